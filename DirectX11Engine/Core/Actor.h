@@ -1,47 +1,48 @@
 #pragma once
 #include "Core/pch.h"
+#include "TransformSystem.h"
+#include <functional>
 
+// Something placed in the world. The transform itself lives in the TransformSystem :
+// the setters only mark it dirty and the world matrix is rebuilt once, by the next TransformSystem::Update or the next read
 class Actor
 {
 public:
+	Actor();
+	~Actor();
+
+	Actor(const Actor&) = delete;
+	Actor& operator=(const Actor&) = delete;
+
 	// World Matrix
-	DirectX::XMMATRIX GetWorldMatrix() const { return WorldMatrix; }
-	void SetWorldMatrix(DirectX::XMMATRIX Val) { WorldMatrix = Val; }
+	DirectX::XMMATRIX GetWorldMatrix() const { return TransformSystem::Get().GetWorldMatrix(Transform); }
 
 	// Transform setters and Getters
-	DirectX::XMFLOAT3 GetPosition() const { return Position; }
-	void SetPosition(DirectX::XMFLOAT3 Val)
-	{
-		Position = Val;
-		UpdateWorldMatrix();
-	}
+	DirectX::XMFLOAT3 GetPosition() const { return TransformSystem::Get().GetPosition(Transform); }
+	void SetPosition(DirectX::XMFLOAT3 Val) { TransformSystem::Get().SetPosition(Transform, Val); }
 
+	// Euler angles in degrees, as they were set. The transform keeps the matching quaternion
 	DirectX::XMFLOAT3 GetRotation() const { return Rotation; }
-	void SetRotation(DirectX::XMFLOAT3 Val)
-	{
-		Rotation = Val;
-		UpdateWorldMatrix();
-	}
-
-	DirectX::XMFLOAT3 GetScale() const { return Scale; }
-	void SetScale(DirectX::XMFLOAT3 Val)
-	{
-		Scale = Val;
-		UpdateWorldMatrix();
-	}
-
-	void UpdateWorldMatrix();
-
-	// Direction vectors from transform
-	DirectX::XMFLOAT3 GetForwardVector() const;
-	DirectX::XMFLOAT3 GetRightVector() const;
-	DirectX::XMFLOAT3 GetUpVector() const;
+	void SetRotation(DirectX::XMFLOAT3 Val);
+
+	DirectX::XMFLOAT3 GetScale() const { return TransformSystem::Get().GetScale(Transform); }
+	void SetScale(DirectX::XMFLOAT3 Val) { TransformSystem::Get().SetScale(Transform, Val); }
+
+	// The actor follows Parent, its transform becomes relative to the one of Parent. Null detaches it
+	void SetParent(const Actor* Parent);
+
+	TransformSystem::Id GetTransformId() const { return Transform; }
+
+	// Called by TransformSystem::Update after the world matrix changed, lets the scene refit the bounds of the actor
+	std::function<void()> OnTransformChanged;
+
+	// Direction vectors from transform, cached with the world matrix
+	DirectX::XMFLOAT3 GetForwardVector() const { return TransformSystem::Get().GetForwardVector(Transform); }
+	DirectX::XMFLOAT3 GetRightVector() const { return TransformSystem::Get().GetRightVector(Transform); }
+	DirectX::XMFLOAT3 GetUpVector() const { return TransformSystem::Get().GetUpVector(Transform); }
 
 protected:
-	DirectX::XMMATRIX WorldMatrix;
+	TransformSystem::Id Transform = TransformSystem::InvalidId;
 
-	// Mesh Transform
-	DirectX::XMFLOAT3 Position = { 0,0,0 };
 	DirectX::XMFLOAT3 Rotation = { 0,0,0 };
-	DirectX::XMFLOAT3 Scale = { 1,1,1 };
 };
@@ -0,0 +1,81 @@
+#include "Core/pch.h"
+#include "ConstantBufferRing.h"
+#include <stdexcept>
+
+using Microsoft::WRL::ComPtr;
+
+ConstantBufferRing::ConstantBufferRing(ComPtr<ID3D11Device1> Device, size_t Capacity)
+	: Device(Device)
+{
+	// Binding with offsets and mapping constant buffers with NO_OVERWRITE need the D3D11.1 runtime and driver support
+	D3D11_FEATURE_DATA_D3D11_OPTIONS Options = {};
+	DX::ThrowIfFailed(Device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &Options, sizeof(Options)));
+	DX::ThrowIfFailed(Options.ConstantBufferOffsetting && Options.MapNoOverwriteOnDynamicConstantBuffer ? S_OK : E_NOTIMPL);
+
+	CreateBuffer(GetAlignedSize(Capacity));
+}
+
+void ConstantBufferRing::CreateBuffer(size_t NewCapacity)
+{
+	CD3D11_BUFFER_DESC BufferDesc(static_cast<UINT>(NewCapacity), D3D11_BIND_CONSTANT_BUFFER, D3D11_USAGE_DYNAMIC, D3D11_CPU_ACCESS_WRITE);
+
+	Buffer.Reset();
+	DX::ThrowIfFailed(Device->CreateBuffer(&BufferDesc, nullptr, Buffer.GetAddressOf()));
+	Capacity = NewCapacity;
+	Offset = Capacity;
+}
+
+void ConstantBufferRing::Begin(ID3D11DeviceContext1* DeviceContext, size_t Bytes)
+{
+	Bytes = GetAlignedSize(std::max<size_t>(Bytes, Alignment));
+	if (Bytes > Capacity)
+	{
+		CreateBuffer(std::max(Bytes, Capacity * 2));
+	}
+
+	// The GPU may still read what was written before Offset, only a wrap needs a new buffer
+	D3D11_MAP MapType = D3D11_MAP_WRITE_NO_OVERWRITE;
+	if (Offset + Bytes > Capacity)
+	{
+		MapType = D3D11_MAP_WRITE_DISCARD;
+		Offset = 0;
+	}
+
+	D3D11_MAPPED_SUBRESOURCE Mapped;
+	DX::ThrowIfFailed(DeviceContext->Map(Buffer.Get(), 0, MapType, 0, &Mapped));
+	MappedData = static_cast<uint8_t*>(Mapped.pData);
+	MappedEnd = Offset + Bytes;
+	++FrameMaps;
+}
+
+ConstantBufferRing::Allocation ConstantBufferRing::Write(const void* Data, size_t Size)
+{
+	const size_t SliceSize = GetAlignedSize(Size);
+	if (!MappedData || Offset + SliceSize > MappedEnd)
+	{
+		throw std::runtime_error("ConstantBufferRing: write outside of the range reserved by Begin");
+	}
+
+	memcpy(MappedData + Offset, Data, Size);
+
+	Allocation Slice;
+	Slice.FirstConstant = static_cast<UINT>(Offset / 16);
+	Slice.NumConstants = static_cast<UINT>(SliceSize / 16);
+
+	Offset += SliceSize;
+	FrameBytes += Size;
+	return Slice;
+}
+
+void ConstantBufferRing::End(ID3D11DeviceContext1* DeviceContext)
+{
+	DeviceContext->Unmap(Buffer.Get(), 0);
+	MappedData = nullptr;
+	MappedEnd = 0;
+}
+
+void ConstantBufferRing::ResetFrameStats()
+{
+	FrameBytes = 0;
+	FrameMaps = 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "Core/pch.h"
+
+// A large dynamic constant buffer that per-draw constants are written to, one after the other.
+// Each frame maps it once with NO_OVERWRITE past the data of the previous frames, or with DISCARD when it wraps,
+// and the draws bind their slice with the D3D11.1 *SetConstantBuffers1 offsets.
+class ConstantBufferRing
+{
+public:
+
+	// Slice of the ring, in 16 bytes constants as expected by *SetConstantBuffers1
+	struct Allocation
+	{
+		UINT FirstConstant = 0;
+		UINT NumConstants = 0;
+	};
+
+	// Offsets must be multiples of 16 constants
+	static constexpr size_t Alignment = 256;
+
+	ConstantBufferRing(Microsoft::WRL::ComPtr<ID3D11Device1> Device, size_t Capacity = 4 * 1024 * 1024);
+
+	ConstantBufferRing(const ConstantBufferRing&) = delete;
+	ConstantBufferRing& operator=(const ConstantBufferRing&) = delete;
+
+	// Map room for Bytes of constants, the buffer grows if it can't hold them
+	void Begin(ID3D11DeviceContext1* DeviceContext, size_t Bytes);
+	// Copy constants to the next slice, must be within the bytes asked for by Begin
+	Allocation Write(const void* Data, size_t Size);
+	void End(ID3D11DeviceContext1* DeviceContext);
+
+	ID3D11Buffer* GetBuffer() const { return Buffer.Get(); }
+
+	// Size of a slice holding Size bytes
+	static size_t GetAlignedSize(size_t Size) { return (Size + Alignment - 1) & ~(Alignment - 1); }
+
+	// Bytes written and maps since the last call to ResetFrameStats
+	size_t GetFrameBytes() const { return FrameBytes; }
+	unsigned int GetFrameMaps() const { return FrameMaps; }
+	void ResetFrameStats();
+
+private:
+
+	void CreateBuffer(size_t NewCapacity);
+
+	Microsoft::WRL::ComPtr<ID3D11Device1> Device;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> Buffer;
+	size_t Capacity = 0;
+
+	// Next free byte, and the mapping of the current Begin/End
+	size_t Offset = 0;
+	size_t MappedEnd = 0;
+	uint8_t* MappedData = nullptr;
+
+	size_t FrameBytes = 0;
+	unsigned int FrameMaps = 0;
+};
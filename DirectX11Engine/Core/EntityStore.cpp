@@ -0,0 +1,440 @@
+#include "Core/pch.h"
+#include "EntityStore.h"
+#include "FrustumCulling.h"
+#include "Memory.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <new>
+#include <random>
+#include <stdexcept>
+
+using namespace DirectX;
+
+namespace
+{
+	// Size and default value of each component type, in the order of their index
+	struct ComponentInfo
+	{
+		size_t Size;
+		void (*Construct)(void* Component);
+	};
+
+	template<typename T>
+	ComponentInfo MakeInfo()
+	{
+		return { sizeof(T), [](void* Component) { ::new (Component) T(); } };
+	}
+
+	const ComponentInfo ComponentInfos[EntityStore::ComponentCount] =
+	{
+		MakeInfo<TransformComponent>(),
+		MakeInfo<RenderMeshComponent>(),
+		MakeInfo<BoundsComponent>(),
+		MakeInfo<LightComponent>(),
+		MakeInfo<MaterialComponent>(),
+	};
+
+	// Arrays of a chunk start on a cache line
+	const size_t ArrayAlignment = 64;
+
+	size_t AlignUp(size_t Value, size_t Alignment)
+	{
+		return (Value + Alignment - 1) & ~(Alignment - 1);
+	}
+
+	bool IsInFrustum(const BoundingSphere& Sphere, const XMVECTOR Planes[6])
+	{
+		const XMVECTOR Center = XMLoadFloat3(&Sphere.Center);
+		for (int i = 0; i < 6; ++i)
+		{
+			if (XMVectorGetX(XMPlaneDotCoord(Planes[i], Center)) < -Sphere.Radius)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Work of the benchmark on one entity : world bounds from the local box, then frustum test
+	bool UpdateBounds(const TransformComponent& Transform, const BoundingBox& LocalBox, BoundsComponent& OutBounds, const XMVECTOR Planes[6])
+	{
+		LocalBox.Transform(OutBounds.Box, XMLoadFloat4x4(&Transform.World));
+		OutBounds.Sphere = BoundingSphere(OutBounds.Box.Center, XMVectorGetX(XMVector3Length(XMLoadFloat3(&OutBounds.Box.Extents))));
+		return IsInFrustum(OutBounds.Sphere, Planes);
+	}
+
+	// An entity as separate heap objects, the way the renderer held its meshes before the entity store
+	struct ObjectEntity
+	{
+		TransformComponent* Transform = nullptr;
+		BoundsComponent* Bounds = nullptr;
+		MaterialComponent* Material = nullptr;
+	};
+}
+
+EntityStore::Entity EntityStore::Create(Signature Components)
+{
+	uint32_t Index;
+	if (!FreeSlots.empty())
+	{
+		Index = FreeSlots.back();
+		FreeSlots.pop_back();
+	}
+	else
+	{
+		if (Locations.size() > Entity::MaxIndex)
+		{
+			throw std::length_error("Too many entities for the handles");
+		}
+		Index = static_cast<uint32_t>(Locations.size());
+		Locations.emplace_back();
+		Generations.push_back(1);
+	}
+
+	const Entity NewEntity(Index, Generations[Index]);
+	Locations[Index] = Insert(FindOrCreateArchetype(Components), NewEntity);
+	++EntityCount;
+	return NewEntity;
+}
+
+void EntityStore::Destroy(Entity Target)
+{
+	if (!IsAlive(Target))
+	{
+		return;
+	}
+
+	RemoveRow(Locations[Target.GetIndex()]);
+	FreeSlot(Target.GetIndex());
+}
+
+void EntityStore::Clear()
+{
+	// The slots are kept so that the entities of the cleared scene don't resolve to the next one's
+	for (uint32_t Index = 0; Index < Locations.size(); ++Index)
+	{
+		if (Locations[Index].Archetype != InvalidIndex)
+		{
+			FreeSlot(Index);
+		}
+	}
+	Archetypes.clear();
+}
+
+void EntityStore::FreeSlot(uint32_t Index)
+{
+	Locations[Index] = Location();
+	// Generations wrap from MaxGeneration back to 1
+	Generations[Index] = Generations[Index] % Entity::MaxGeneration + 1;
+	FreeSlots.push_back(Index);
+	--EntityCount;
+}
+
+EntityStore::Signature EntityStore::GetSignature(Entity Target) const
+{
+	return IsAlive(Target) ? Archetypes[Locations[Target.GetIndex()].Archetype].Components : 0;
+}
+
+void EntityStore::ForEachChunk(Signature Required, const std::function<void(Chunk&)>& Visit) const
+{
+	for (const Archetype& Type : Archetypes)
+	{
+		if ((Type.Components & Required) != Required)
+		{
+			continue;
+		}
+		for (const std::unique_ptr<Chunk>& TypeChunk : Type.Chunks)
+		{
+			if (TypeChunk->Count > 0)
+			{
+				Visit(*TypeChunk);
+			}
+		}
+	}
+}
+
+void EntityStore::ParallelForEachChunk(Signature Required, const std::function<void(Chunk&)>& Visit) const
+{
+	// The list of chunks only lives for the call
+	ScratchScope Scratch;
+	ArenaVector<Chunk*> Chunks = Scratch.MakeVector<Chunk*>();
+	GatherChunks(Required, Chunks);
+
+	ThreadPool::Get().ParallelFor(Chunks.size(), 1, [&Chunks, &Visit](size_t Begin, size_t End)
+	{
+		for (size_t i = Begin; i < End; ++i)
+		{
+			Visit(*Chunks[i]);
+		}
+	});
+}
+
+EntityStore::Stats EntityStore::GetStats() const
+{
+	Stats Result;
+	Result.Entities = EntityCount;
+	Result.Archetypes = Archetypes.size();
+	for (const Archetype& Type : Archetypes)
+	{
+		Result.Chunks += Type.Chunks.size();
+		Result.ChunkBytes += Type.Chunks.size() * Type.Bytes;
+	}
+	return Result;
+}
+
+uint32_t EntityStore::FindOrCreateArchetype(Signature Components)
+{
+	for (size_t i = 0; i < Archetypes.size(); ++i)
+	{
+		if (Archetypes[i].Components == Components)
+		{
+			return static_cast<uint32_t>(i);
+		}
+	}
+
+	Archetype NewType;
+	NewType.Components = Components;
+
+	// As many entities as fit the chunk size, every array padded to a cache line
+	size_t RowBytes = sizeof(Entity);
+	for (uint32_t i = 0; i < ComponentCount; ++i)
+	{
+		if (Components & (1u << i))
+		{
+			RowBytes += ComponentInfos[i].Size;
+		}
+	}
+	NewType.Capacity = static_cast<uint32_t>(std::max<size_t>(ChunkBytes / RowBytes, 16));
+
+	size_t Offset = 0;
+	NewType.EntitiesOffset = Offset;
+	Offset = AlignUp(Offset + NewType.Capacity * sizeof(Entity), ArrayAlignment);
+	for (uint32_t i = 0; i < ComponentCount; ++i)
+	{
+		if (Components & (1u << i))
+		{
+			NewType.Offsets[i] = Offset;
+			Offset = AlignUp(Offset + NewType.Capacity * ComponentInfos[i].Size, ArrayAlignment);
+		}
+	}
+	NewType.Bytes = Offset;
+
+	Archetypes.push_back(std::move(NewType));
+	return static_cast<uint32_t>(Archetypes.size() - 1);
+}
+
+EntityStore::Location EntityStore::Insert(uint32_t ArchetypeIndex, Entity Target)
+{
+	Archetype& Type = Archetypes[ArchetypeIndex];
+	if (Type.Chunks.empty() || Type.Chunks.back()->Count == Type.Capacity)
+	{
+		std::unique_ptr<Chunk> NewChunk(new Chunk());
+		NewChunk->Components = Type.Components;
+		NewChunk->Capacity = Type.Capacity;
+		// Over allocated by an alignment so the arrays can start on a cache line
+		NewChunk->Memory.reset(new uint8_t[Type.Bytes + ArrayAlignment]);
+		uint8_t* Base = reinterpret_cast<uint8_t*>(AlignUp(reinterpret_cast<size_t>(NewChunk->Memory.get()), ArrayAlignment));
+		NewChunk->Entities = reinterpret_cast<Entity*>(Base + Type.EntitiesOffset);
+		for (uint32_t i = 0; i < ComponentCount; ++i)
+		{
+			NewChunk->Arrays[i] = (Type.Components & (1u << i)) ? Base + Type.Offsets[i] : nullptr;
+		}
+		Type.Chunks.push_back(std::move(NewChunk));
+	}
+
+	Chunk& Last = *Type.Chunks.back();
+	Location Row;
+	Row.Archetype = ArchetypeIndex;
+	Row.Chunk = static_cast<uint32_t>(Type.Chunks.size() - 1);
+	Row.Row = Last.Count++;
+
+	Last.Entities[Row.Row] = Target;
+	for (uint32_t i = 0; i < ComponentCount; ++i)
+	{
+		if (Last.Arrays[i])
+		{
+			ComponentInfos[i].Construct(static_cast<uint8_t*>(Last.Arrays[i]) + Row.Row * ComponentInfos[i].Size);
+		}
+	}
+	return Row;
+}
+
+void EntityStore::RemoveRow(const Location& Row)
+{
+	Archetype& Type = Archetypes[Row.Archetype];
+	Chunk& Last = *Type.Chunks.back();
+	const uint32_t LastRow = Last.Count - 1;
+	const Location LastLocation = { Row.Archetype, static_cast<uint32_t>(Type.Chunks.size() - 1), LastRow };
+
+	// The last entity of the archetype takes the row, so the chunks stay packed
+	if (LastLocation.Chunk != Row.Chunk || LastLocation.Row != Row.Row)
+	{
+		Chunk& Target = *Type.Chunks[Row.Chunk];
+		const Entity Moved = Last.Entities[LastRow];
+		Target.Entities[Row.Row] = Moved;
+		for (uint32_t i = 0; i < ComponentCount; ++i)
+		{
+			if (Target.Arrays[i])
+			{
+				memcpy(GetComponent(Row, i), GetComponent(LastLocation, i), ComponentInfos[i].Size);
+			}
+		}
+		Locations[Moved.GetIndex()] = Row;
+	}
+
+	if (--Last.Count == 0)
+	{
+		Type.Chunks.pop_back();
+	}
+}
+
+void EntityStore::ChangeSignature(Entity Target, Signature NewComponents)
+{
+	if (!IsAlive(Target) || GetSignature(Target) == NewComponents)
+	{
+		return;
+	}
+
+	// The shared components are copied to the new row, the added ones keep their default value
+	const Location OldRow = Locations[Target.GetIndex()];
+	const Location NewRow = Insert(FindOrCreateArchetype(NewComponents), Target);
+	for (uint32_t i = 0; i < ComponentCount; ++i)
+	{
+		void* Source = GetComponent(OldRow, i);
+		void* Destination = GetComponent(NewRow, i);
+		if (Source && Destination)
+		{
+			memcpy(Destination, Source, ComponentInfos[i].Size);
+		}
+	}
+
+	RemoveRow(OldRow);
+	Locations[Target.GetIndex()] = NewRow;
+}
+
+void* EntityStore::GetComponent(Entity Target, uint32_t Component) const
+{
+	return IsAlive(Target) ? GetComponent(Locations[Target.GetIndex()], Component) : nullptr;
+}
+
+void* EntityStore::GetComponent(const Location& Row, uint32_t Component) const
+{
+	const Chunk& RowChunk = *Archetypes[Row.Archetype].Chunks[Row.Chunk];
+	return RowChunk.Arrays[Component] ? static_cast<uint8_t*>(RowChunk.Arrays[Component]) + Row.Row * ComponentInfos[Component].Size : nullptr;
+}
+
+void EntityStore::GatherChunks(Signature Required, ArenaVector<Chunk*>& OutChunks) const
+{
+	size_t Count = 0;
+	ForEachChunk(Required, [&Count](Chunk&) { ++Count; });
+	OutChunks.reserve(Count);
+	ForEachChunk(Required, [&OutChunks](Chunk& Visited) { OutChunks.push_back(&Visited); });
+}
+
+EntityStore::Benchmark EntityStore::RunBenchmark(size_t EntityCount, unsigned int Frames)
+{
+	Frames = std::max(Frames, 1u);
+
+	// Entities spread in a 2 km cube, seen by a camera at the center looking down +z
+	std::mt19937 Random(1234);
+	std::uniform_real_distribution<float> Position(-1000.0f, 1000.0f);
+	std::vector<XMFLOAT4X4> Worlds(EntityCount);
+	for (XMFLOAT4X4& World : Worlds)
+	{
+		XMStoreFloat4x4(&World, XMMatrixTranslation(Position(Random), Position(Random), Position(Random)));
+	}
+
+	const XMMATRIX ViewProj = XMMatrixPerspectiveFovLH(XM_PIDIV4, 16.0f / 9.0f, 0.1f, 2000.0f);
+	const Frustum View = Frustum::FromViewProjection(ViewProj);
+	XMVECTOR Planes[6];
+	for (int i = 0; i < 6; ++i)
+	{
+		Planes[i] = XMLoadFloat4(&View.Planes[i]);
+	}
+	const BoundingBox LocalBox(XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(1.0f, 1.0f, 1.0f));
+
+	auto Milliseconds = [](std::chrono::steady_clock::time_point From)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - From).count();
+	};
+
+	Benchmark Result;
+	Result.Entities = EntityCount;
+	Result.Frames = Frames;
+
+	// Each component is its own allocation, interleaved with the other entities ones as a loading would do
+	std::vector<ObjectEntity> Objects(EntityCount);
+	for (size_t i = 0; i < EntityCount; ++i)
+	{
+		Objects[i].Transform = new TransformComponent();
+		Objects[i].Transform->World = Worlds[i];
+		Objects[i].Bounds = new BoundsComponent();
+		Objects[i].Material = new MaterialComponent();
+	}
+	std::shuffle(Objects.begin(), Objects.end(), Random);
+
+	size_t ObjectsVisible = 0;
+	auto Start = std::chrono::steady_clock::now();
+	for (unsigned int Frame = 0; Frame < Frames; ++Frame)
+	{
+		ObjectsVisible = 0;
+		for (const ObjectEntity& Object : Objects)
+		{
+			ObjectsVisible += UpdateBounds(*Object.Transform, LocalBox, *Object.Bounds, Planes) ? 1 : 0;
+		}
+	}
+	Result.ObjectsMs = Milliseconds(Start) / Frames;
+
+	for (ObjectEntity& Object : Objects)
+	{
+		delete Object.Transform;
+		delete Object.Bounds;
+		delete Object.Material;
+	}
+
+	EntityStore Store;
+	for (size_t i = 0; i < EntityCount; ++i)
+	{
+		TransformComponent Transform;
+		Transform.World = Worlds[i];
+		Store.Create(Transform, BoundsComponent(), MaterialComponent());
+	}
+
+	const Signature Required = MakeSignature<TransformComponent, BoundsComponent>();
+	auto UpdateChunk = [&LocalBox, &Planes](Chunk& Visited) -> size_t
+	{
+		const TransformComponent* Transforms = Visited.Get<TransformComponent>();
+		BoundsComponent* Bounds = Visited.Get<BoundsComponent>();
+		size_t Visible = 0;
+		for (uint32_t i = 0; i < Visited.GetCount(); ++i)
+		{
+			Visible += UpdateBounds(Transforms[i], LocalBox, Bounds[i], Planes) ? 1 : 0;
+		}
+		return Visible;
+	};
+
+	size_t ChunksVisible = 0;
+	Start = std::chrono::steady_clock::now();
+	for (unsigned int Frame = 0; Frame < Frames; ++Frame)
+	{
+		ChunksVisible = 0;
+		Store.ForEachChunk(Required, [&](Chunk& Visited) { ChunksVisible += UpdateChunk(Visited); });
+	}
+	Result.ChunksMs = Milliseconds(Start) / Frames;
+
+	std::atomic<size_t> ParallelVisible(0);
+	Start = std::chrono::steady_clock::now();
+	for (unsigned int Frame = 0; Frame < Frames; ++Frame)
+	{
+		ParallelVisible = 0;
+		Store.ParallelForEachChunk(Required, [&](Chunk& Visited) { ParallelVisible += UpdateChunk(Visited); });
+	}
+	Result.ParallelChunksMs = Milliseconds(Start) / Frames;
+
+	// The three paths see the same entities
+	assert(ObjectsVisible == ChunksVisible && ChunksVisible == ParallelVisible);
+	Result.Visible = ParallelVisible;
+	return Result;
+}
@@ -0,0 +1,235 @@
+#pragma once
+#include "Core/pch.h"
+#include "TransformSystem.h"
+#include "Memory.h"
+#include "ResourcePool.h"
+#include "Lights/Light.h"
+#include "Mesh/Material.h"
+#include "Mesh/VertexPacking.h"
+#include <DirectXCollision.h>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Components of the scene entities. They are plain data, moved with memcpy when an entity changes of archetype
+
+struct TransformComponent
+{
+	TransformSystem::Id Transform = TransformSystem::InvalidId;
+	// Copy of the world matrix of the transform, refreshed when it moves
+	DirectX::XMFLOAT4X4 World = DirectX::XMFLOAT4X4(1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f);
+	// Largest scale of the axes of World, to project local errors on screen
+	float MaxScale = 1.0f;
+};
+
+struct RenderMeshComponent
+{
+	// Geometry and textures of the draw, in the mesh pool of the renderer
+	MeshHandle Source;
+	// Slot of the mesh in the scene queries : the bounds table, the hierarchy, the visibility and the light masks
+	uint32_t QueryIndex = 0;
+	// Dequantization of the packed positions
+	VertexPacking::Quantization Quantization;
+};
+
+struct BoundsComponent
+{
+	DirectX::BoundingBox Box;
+	DirectX::BoundingSphere Sphere;
+};
+
+struct LightComponent
+{
+	PointLightData Data = PointLightData();
+};
+
+struct MaterialComponent
+{
+	MaterialData Material;
+	bool bNormalMap = false;
+	bool bSpecularMap = false;
+};
+
+// Index of each component type in the signatures
+template<typename T> struct ComponentType;
+template<> struct ComponentType<TransformComponent> { static constexpr uint32_t Index = 0; };
+template<> struct ComponentType<RenderMeshComponent> { static constexpr uint32_t Index = 1; };
+template<> struct ComponentType<BoundsComponent> { static constexpr uint32_t Index = 2; };
+template<> struct ComponentType<LightComponent> { static constexpr uint32_t Index = 3; };
+template<> struct ComponentType<MaterialComponent> { static constexpr uint32_t Index = 4; };
+
+// Entities of the scene, stored by archetype : the entities having the same set of components share chunks of about 16 KB,
+// where each component has its own contiguous array. Systems walk the chunks of the archetypes having the components they read,
+// touching only those arrays, and the chunks can be split across the thread pool.
+// Creating, destroying or changing the components of entities is not thread safe, the components of a chunk can be written in parallel.
+class EntityStore
+{
+public:
+
+	// Same scheme as the resource handles : the index of the entity slot and its generation, which changes when the entity is
+	// destroyed or the store cleared, so the id of a destroyed entity doesn't resolve to the one reusing its slot
+	using Entity = Handle<EntityStore>;
+	static constexpr Entity InvalidEntity = Entity();
+
+	// Bit ComponentType<T>::Index is set for each component T
+	using Signature = uint32_t;
+	static constexpr uint32_t ComponentCount = 5;
+
+	template<typename... T>
+	static constexpr Signature MakeSignature() { return (0u | ... | (1u << ComponentType<T>::Index)); }
+
+	// Entities of one archetype, the arrays of the components outside of the archetype are null
+	class Chunk
+	{
+	public:
+		uint32_t GetCount() const { return Count; }
+		Signature GetSignature() const { return Components; }
+		const Entity* GetEntities() const { return Entities; }
+
+		template<typename T>
+		T* Get() const { return static_cast<T*>(Arrays[ComponentType<T>::Index]); }
+
+	private:
+		friend class EntityStore;
+
+		Signature Components = 0;
+		uint32_t Count = 0;
+		uint32_t Capacity = 0;
+		Entity* Entities = nullptr;
+		void* Arrays[ComponentCount] = {};
+		std::unique_ptr<uint8_t[]> Memory;
+	};
+
+	struct Stats
+	{
+		size_t Entities = 0;
+		size_t Archetypes = 0;
+		size_t Chunks = 0;
+		size_t ChunkBytes = 0;
+	};
+
+	// 100k entities with a transform and bounds : their world boxes are rebuilt and tested against a frustum,
+	// through heap allocated objects, then through the chunks on one thread and across the thread pool
+	struct Benchmark
+	{
+		size_t Entities = 0;
+		unsigned int Frames = 0;
+		// Per frame
+		double ObjectsMs = 0.0;
+		double ChunksMs = 0.0;
+		double ParallelChunksMs = 0.0;
+		size_t Visible = 0;
+	};
+
+	EntityStore() = default;
+	~EntityStore() = default;
+
+	EntityStore(const EntityStore&) = delete;
+	EntityStore& operator=(const EntityStore&) = delete;
+
+	// New entity with default components
+	Entity Create(Signature Components);
+
+	template<typename... T>
+	Entity Create(const T&... Components)
+	{
+		const Entity NewEntity = Create(MakeSignature<T...>());
+		(Set(NewEntity, Components), ...);
+		return NewEntity;
+	}
+
+	void Destroy(Entity Target);
+
+	// Destroy every entity and release the chunks
+	void Clear();
+
+	bool IsAlive(Entity Target) const
+	{
+		const uint32_t Index = Target.GetIndex();
+		return Index < Locations.size() && Generations[Index] == Target.GetGeneration() && Locations[Index].Archetype != InvalidIndex;
+	}
+
+	// Add or remove a component, the entity moves to the chunks of its new archetype
+	template<typename T>
+	void Add(Entity Target, const T& Component)
+	{
+		ChangeSignature(Target, GetSignature(Target) | MakeSignature<T>());
+		Set(Target, Component);
+	}
+
+	template<typename T>
+	void Remove(Entity Target) { ChangeSignature(Target, GetSignature(Target) & ~MakeSignature<T>()); }
+
+	// The component of the entity, null if it doesn't have one. Invalidated when entities are created, destroyed or change archetype
+	template<typename T>
+	T* Get(Entity Target) const { return static_cast<T*>(GetComponent(Target, ComponentType<T>::Index)); }
+
+	template<typename T>
+	void Set(Entity Target, const T& Component) { *Get<T>(Target) = Component; }
+
+	Signature GetSignature(Entity Target) const;
+
+	// Every chunk whose archetype has at least the Required components
+	void ForEachChunk(Signature Required, const std::function<void(Chunk&)>& Visit) const;
+
+	// Same, one chunk per job on the thread pool. The calling thread takes part and the call returns once every chunk is done
+	void ParallelForEachChunk(Signature Required, const std::function<void(Chunk&)>& Visit) const;
+
+	Stats GetStats() const;
+
+	static Benchmark RunBenchmark(size_t EntityCount, unsigned int Frames);
+
+private:
+
+	static constexpr uint32_t InvalidIndex = ~0u;
+	static constexpr size_t ChunkBytes = 16 * 1024;
+
+	struct Archetype
+	{
+		Signature Components = 0;
+		// Entities per chunk and offset of each array in the chunk memory
+		uint32_t Capacity = 0;
+		size_t EntitiesOffset = 0;
+		size_t Offsets[ComponentCount] = {};
+		size_t Bytes = 0;
+		// Every chunk is full except the last one
+		std::vector<std::unique_ptr<Chunk>> Chunks;
+	};
+
+	struct Location
+	{
+		uint32_t Archetype = InvalidIndex;
+		uint32_t Chunk = 0;
+		uint32_t Row = 0;
+	};
+
+	uint32_t FindOrCreateArchetype(Signature Components);
+
+	// Append the entity to the archetype, its components are default constructed
+	Location Insert(uint32_t ArchetypeIndex, Entity Target);
+
+	// Fill the row with the last entity of the archetype
+	void RemoveRow(const Location& Row);
+
+	void ChangeSignature(Entity Target, Signature Components);
+
+	void* GetComponent(Entity Target, uint32_t Component) const;
+	void* GetComponent(const Location& Row, uint32_t Component) const;
+
+	void GatherChunks(Signature Required, ArenaVector<Chunk*>& OutChunks) const;
+
+	// Release the slot of a destroyed entity, its generation moves on
+	void FreeSlot(uint32_t Index);
+
+	std::vector<Archetype> Archetypes;
+	// By entity slot. Generations start at 1 so that the zero entity never matches
+	std::vector<Location> Locations;
+	std::vector<uint32_t> Generations;
+	std::vector<uint32_t> FreeSlots;
+	size_t EntityCount = 0;
+};
+
+static_assert(std::is_trivially_copyable<TransformComponent>::value && std::is_trivially_copyable<RenderMeshComponent>::value &&
+	std::is_trivially_copyable<BoundsComponent>::value && std::is_trivially_copyable<LightComponent>::value &&
+	std::is_trivially_copyable<MaterialComponent>::value, "Components are moved between chunks with memcpy");
@@ -0,0 +1,218 @@
+#include "Core/pch.h"
+#include "FrustumCulling.h"
+#include "SceneBVH.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <xmmintrin.h>
+
+using namespace DirectX;
+
+Frustum Frustum::FromViewProjection(FXMMATRIX ViewProj)
+{
+	// Row vectors are multiplied on the left, the planes are combinations of the columns
+	const XMMATRIX Columns = XMMatrixTranspose(ViewProj);
+
+	const XMVECTOR Planes[6] =
+	{
+		XMVectorAdd(Columns.r[3], Columns.r[0]),		// Left
+		XMVectorSubtract(Columns.r[3], Columns.r[0]),	// Right
+		XMVectorAdd(Columns.r[3], Columns.r[1]),		// Bottom
+		XMVectorSubtract(Columns.r[3], Columns.r[1]),	// Top
+		Columns.r[2],									// Near
+		XMVectorSubtract(Columns.r[3], Columns.r[2]),	// Far
+	};
+
+	Frustum Result;
+	for (int i = 0; i < 6; ++i)
+	{
+		XMStoreFloat4(&Result.Planes[i], XMPlaneNormalize(Planes[i]));
+	}
+	return Result;
+}
+
+void BoundsTable::Resize(size_t NewCount)
+{
+	Count = NewCount;
+
+	// Padded to a multiple of four so the last group can be loaded as a whole
+	const size_t Padded = (NewCount + 3) & ~size_t(3);
+	for (std::vector<float>* Column : { &CenterX, &CenterY, &CenterZ, &ExtentX, &ExtentY, &ExtentZ, &Radius })
+	{
+		Column->assign(Padded, 0.0f);
+	}
+}
+
+void BoundsTable::Set(size_t Index, const BoundingBox& Box, const BoundingSphere& Sphere)
+{
+	CenterX[Index] = Box.Center.x;
+	CenterY[Index] = Box.Center.y;
+	CenterZ[Index] = Box.Center.z;
+	ExtentX[Index] = Box.Extents.x;
+	ExtentY[Index] = Box.Extents.y;
+	ExtentZ[Index] = Box.Extents.z;
+
+	// Smallest of the box diagonal and the sphere grown to be centered on the box
+	const float BoxRadius = XMVectorGetX(XMVector3Length(XMLoadFloat3(&Box.Extents)));
+	const float SphereRadius = XMVectorGetX(XMVector3Length(XMLoadFloat3(&Box.Center) - XMLoadFloat3(&Sphere.Center))) + Sphere.Radius;
+	Radius[Index] = std::min(BoxRadius, SphereRadius);
+}
+
+void FrustumCuller::CullScalar(const Frustum& View, const BoundsTable& Bounds, size_t Begin, size_t End, uint8_t* OutVisible)
+{
+	for (size_t i = Begin; i < End; ++i)
+	{
+		bool bInside = true;
+		for (const XMFLOAT4& Plane : View.Planes)
+		{
+			const float Distance = Plane.x * Bounds.CenterX[i] + Plane.y * Bounds.CenterY[i] + Plane.z * Bounds.CenterZ[i] + Plane.w;
+			const float BoxRadius = fabsf(Plane.x) * Bounds.ExtentX[i] + fabsf(Plane.y) * Bounds.ExtentY[i] + fabsf(Plane.z) * Bounds.ExtentZ[i];
+			if (Distance + std::min(BoxRadius, Bounds.Radius[i]) < 0.0f)
+			{
+				bInside = false;
+				break;
+			}
+		}
+		OutVisible[i] = bInside ? 1 : 0;
+	}
+}
+
+void FrustumCuller::CullSimd(const Frustum& View, const BoundsTable& Bounds, size_t Begin, size_t End, uint8_t* OutVisible)
+{
+	// Groups of four objects, a scalar tail takes what is left before End
+	const size_t SimdEnd = Begin + ((End - Begin) & ~size_t(3));
+
+	__m128 PlaneX[6], PlaneY[6], PlaneZ[6], PlaneW[6], AbsX[6], AbsY[6], AbsZ[6];
+	for (int p = 0; p < 6; ++p)
+	{
+		PlaneX[p] = _mm_set1_ps(View.Planes[p].x);
+		PlaneY[p] = _mm_set1_ps(View.Planes[p].y);
+		PlaneZ[p] = _mm_set1_ps(View.Planes[p].z);
+		PlaneW[p] = _mm_set1_ps(View.Planes[p].w);
+		AbsX[p] = _mm_set1_ps(fabsf(View.Planes[p].x));
+		AbsY[p] = _mm_set1_ps(fabsf(View.Planes[p].y));
+		AbsZ[p] = _mm_set1_ps(fabsf(View.Planes[p].z));
+	}
+
+	const __m128 Zero = _mm_setzero_ps();
+	for (size_t i = Begin; i < SimdEnd; i += 4)
+	{
+		const __m128 CenterX = _mm_loadu_ps(&Bounds.CenterX[i]);
+		const __m128 CenterY = _mm_loadu_ps(&Bounds.CenterY[i]);
+		const __m128 CenterZ = _mm_loadu_ps(&Bounds.CenterZ[i]);
+		const __m128 ExtentX = _mm_loadu_ps(&Bounds.ExtentX[i]);
+		const __m128 ExtentY = _mm_loadu_ps(&Bounds.ExtentY[i]);
+		const __m128 ExtentZ = _mm_loadu_ps(&Bounds.ExtentZ[i]);
+		const __m128 Radius = _mm_loadu_ps(&Bounds.Radius[i]);
+
+		__m128 Outside = _mm_setzero_ps();
+		for (int p = 0; p < 6; ++p)
+		{
+			__m128 Distance = _mm_add_ps(_mm_mul_ps(PlaneX[p], CenterX), PlaneW[p]);
+			Distance = _mm_add_ps(Distance, _mm_mul_ps(PlaneY[p], CenterY));
+			Distance = _mm_add_ps(Distance, _mm_mul_ps(PlaneZ[p], CenterZ));
+
+			__m128 BoxRadius = _mm_mul_ps(AbsX[p], ExtentX);
+			BoxRadius = _mm_add_ps(BoxRadius, _mm_mul_ps(AbsY[p], ExtentY));
+			BoxRadius = _mm_add_ps(BoxRadius, _mm_mul_ps(AbsZ[p], ExtentZ));
+
+			Outside = _mm_or_ps(Outside, _mm_cmplt_ps(_mm_add_ps(Distance, _mm_min_ps(BoxRadius, Radius)), Zero));
+		}
+
+		const int OutsideMask = _mm_movemask_ps(Outside);
+		OutVisible[i + 0] = (OutsideMask & 1) ? 0 : 1;
+		OutVisible[i + 1] = (OutsideMask & 2) ? 0 : 1;
+		OutVisible[i + 2] = (OutsideMask & 4) ? 0 : 1;
+		OutVisible[i + 3] = (OutsideMask & 8) ? 0 : 1;
+	}
+
+	CullScalar(View, Bounds, SimdEnd, End, OutVisible);
+}
+
+void FrustumCuller::CullParallel(const Frustum& View, const BoundsTable& Bounds, uint8_t* OutVisible) const
+{
+	const size_t Count = Bounds.GetCount();
+	if (Count <= ParallelGrain)
+	{
+		CullSimd(View, Bounds, 0, Count, OutVisible);
+		return;
+	}
+
+	// Grains are kept a multiple of four so that only the last range has a scalar tail
+	const size_t Grain = (ParallelGrain + 3) & ~size_t(3);
+	ThreadPool::Get().ParallelFor(Count, Grain, [&](size_t Begin, size_t End)
+	{
+		CullSimd(View, Bounds, Begin, End, OutVisible);
+	});
+}
+
+void FrustumCuller::Cull(const Frustum& View, const BoundsTable& Bounds, std::vector<uint8_t>& OutVisible, const SceneBVH* Hierarchy)
+{
+	auto CullStart = std::chrono::steady_clock::now();
+
+	const size_t Count = Bounds.GetCount();
+	OutVisible.resize(Count);
+
+	if (bCullFrustum && bUseHierarchy && Hierarchy && Hierarchy->GetObjectCount() == Count)
+	{
+		Hierarchy->CullFrustum(View, OutVisible);
+	}
+	else if (bCullFrustum)
+	{
+		CullParallel(View, Bounds, OutVisible.data());
+	}
+	else
+	{
+		std::fill(OutVisible.begin(), OutVisible.end(), uint8_t(1));
+	}
+
+	Counters.Visible = static_cast<size_t>(std::count(OutVisible.begin(), OutVisible.end(), uint8_t(1)));
+	Counters.Culled = Count - Counters.Visible;
+	Counters.CullMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - CullStart).count();
+}
+
+FrustumCuller::Benchmark FrustumCuller::RunBenchmark(const Frustum& View, size_t ObjectCount, unsigned int Iterations) const
+{
+	Iterations = std::max(Iterations, 1u);
+
+	// Objects spread in a 2 km cube, from pebbles to buildings, the same set on every run
+	std::mt19937 Random(1234);
+	std::uniform_real_distribution<float> Position(-1000.0f, 1000.0f);
+	std::uniform_real_distribution<float> Size(0.1f, 20.0f);
+
+	BoundsTable Bounds;
+	Bounds.Resize(ObjectCount);
+	std::vector<BoundingBox> Boxes(ObjectCount);
+	for (size_t i = 0; i < ObjectCount; ++i)
+	{
+		Boxes[i] = BoundingBox(XMFLOAT3(Position(Random), Position(Random), Position(Random)), XMFLOAT3(Size(Random), Size(Random), Size(Random)));
+		BoundingSphere Sphere;
+		BoundingSphere::CreateFromBoundingBox(Sphere, Boxes[i]);
+		Bounds.Set(i, Boxes[i], Sphere);
+	}
+
+	SceneBVH Hierarchy;
+	Hierarchy.Build(Boxes);
+
+	std::vector<uint8_t> Visible(ObjectCount);
+	auto Time = [&](auto&& Cull)
+	{
+		auto Start = std::chrono::steady_clock::now();
+		for (unsigned int i = 0; i < Iterations; ++i)
+		{
+			Cull();
+		}
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count() / Iterations;
+	};
+
+	Benchmark Result;
+	Result.Objects = ObjectCount;
+	Result.ScalarMs = Time([&] { CullScalar(View, Bounds, 0, ObjectCount, Visible.data()); });
+	Result.SimdMs = Time([&] { CullSimd(View, Bounds, 0, ObjectCount, Visible.data()); });
+	Result.ParallelMs = Time([&] { CullParallel(View, Bounds, Visible.data()); });
+	Result.HierarchyMs = Time([&] { Hierarchy.CullFrustum(View, Visible); });
+	Result.HierarchyBuildMs = Hierarchy.GetStats().BuildMs;
+	Result.Visible = static_cast<size_t>(std::count(Visible.begin(), Visible.end(), uint8_t(1)));
+	return Result;
+}
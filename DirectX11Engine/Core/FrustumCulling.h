@@ -0,0 +1,86 @@
+#pragma once
+#include "Core/pch.h"
+#include <DirectXCollision.h>
+#include <vector>
+
+class SceneBVH;
+
+// The six planes of a view frustum, normals point inside
+struct Frustum
+{
+	DirectX::XMFLOAT4 Planes[6];
+
+	// Extracted from the rows of a view projection matrix, with the D3D [0, 1] depth range
+	static Frustum FromViewProjection(DirectX::FXMMATRIX ViewProj);
+};
+
+// World bounds of the objects of a scene, in structure of arrays so four objects are loaded per SSE register.
+// Each object has both an axis aligned box and a sphere, the tighter of the two is used against each plane.
+class BoundsTable
+{
+public:
+
+	void Resize(size_t Count);
+	void Set(size_t Index, const DirectX::BoundingBox& Box, const DirectX::BoundingSphere& Sphere);
+
+	size_t GetCount() const { return Count; }
+
+	// Box centers and extents, then sphere radii. The sphere is centered on the box
+	std::vector<float> CenterX, CenterY, CenterZ;
+	std::vector<float> ExtentX, ExtentY, ExtentZ;
+	std::vector<float> Radius;
+
+private:
+
+	size_t Count = 0;
+};
+
+// Tests a BoundsTable against a Frustum, four objects per instruction with SSE.
+// Large tables are split across the thread pool, or skipped in whole subtrees when a SceneBVH over them is given.
+class FrustumCuller
+{
+public:
+
+	struct Stats
+	{
+		size_t Visible = 0;
+		size_t Culled = 0;
+		double CullMs = 0.0;
+	};
+
+	struct Benchmark
+	{
+		size_t Objects = 0;
+		// Average time of a cull, one object at a time, with SSE, and with SSE on the thread pool
+		double ScalarMs = 0.0;
+		double SimdMs = 0.0;
+		double ParallelMs = 0.0;
+		// Average time of a walk of a SceneBVH over the same objects, and of its build
+		double HierarchyMs = 0.0;
+		double HierarchyBuildMs = 0.0;
+		size_t Visible = 0;
+	};
+
+	// Objects per job when the table is split across workers, smaller tables are culled on the calling thread
+	size_t ParallelGrain = 4096;
+	bool bCullFrustum = true;
+	bool bUseHierarchy = true;
+
+	// OutVisible gets 1 for the objects at least partly inside the frustum.
+	// Hierarchy, when given and enabled, must hold the same objects as Bounds in the same order.
+	void Cull(const Frustum& View, const BoundsTable& Bounds, std::vector<uint8_t>& OutVisible, const SceneBVH* Hierarchy = nullptr);
+
+	const Stats& GetStats() const { return Counters; }
+
+	// Cull ObjectCount random objects spread around the origin, Iterations times
+	Benchmark RunBenchmark(const Frustum& View, size_t ObjectCount, unsigned int Iterations) const;
+
+	static void CullScalar(const Frustum& View, const BoundsTable& Bounds, size_t Begin, size_t End, uint8_t* OutVisible);
+	static void CullSimd(const Frustum& View, const BoundsTable& Bounds, size_t Begin, size_t End, uint8_t* OutVisible);
+
+private:
+
+	void CullParallel(const Frustum& View, const BoundsTable& Bounds, uint8_t* OutVisible) const;
+
+	Stats Counters;
+};
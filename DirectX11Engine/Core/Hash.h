@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Fast non-cryptographic hashing used to key on-disk caches
+namespace Hash
+{
+	constexpr uint64_t Seed = 0xcbf29ce484222325ull;
+	constexpr uint64_t Prime = 0x100000001b3ull;
+
+	inline uint64_t Mix(uint64_t Value)
+	{
+		Value ^= Value >> 33;
+		Value *= 0xff51afd7ed558ccdull;
+		Value ^= Value >> 33;
+		Value *= 0xc4ceb9fe1a85ec53ull;
+		Value ^= Value >> 33;
+		return Value;
+	}
+
+	inline uint64_t Combine(uint64_t A, uint64_t B)
+	{
+		return Mix(A ^ (B + 0x9e3779b97f4a7c15ull + (A << 6) + (A >> 2)));
+	}
+
+	// Hash a block of memory, 32 bytes per iteration over four independent lanes
+	inline uint64_t HashBytes(const void* Data, size_t Size, uint64_t InSeed = Seed)
+	{
+		const uint8_t* Bytes = static_cast<const uint8_t*>(Data);
+		uint64_t Lanes[4] = { InSeed, InSeed ^ Prime, InSeed + Prime, InSeed - Prime };
+
+		size_t Offset = 0;
+		for (; Offset + 32 <= Size; Offset += 32)
+		{
+			for (int iLane = 0; iLane < 4; ++iLane)
+			{
+				uint64_t Word;
+				memcpy(&Word, Bytes + Offset + iLane * 8, sizeof(Word));
+				Lanes[iLane] = (Lanes[iLane] ^ Word) * Prime;
+				Lanes[iLane] = (Lanes[iLane] << 31) | (Lanes[iLane] >> 33);
+			}
+		}
+
+		uint64_t Result = Combine(Combine(Lanes[0], Lanes[1]), Combine(Lanes[2], Lanes[3]));
+		for (; Offset < Size; ++Offset)
+		{
+			Result = (Result ^ Bytes[Offset]) * Prime;
+		}
+
+		return Mix(Result ^ Size);
+	}
+
+	inline uint64_t HashString(const std::wstring& String, uint64_t InSeed = Seed)
+	{
+		return HashBytes(String.data(), String.size() * sizeof(wchar_t), InSeed);
+	}
+}
@@ -43,7 +43,9 @@ extern "C"
 int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPWSTR lpCmdLine, _In_ int nCmdShow)
 {
     UNREFERENCED_PARAMETER(hPrevInstance);
-    UNREFERENCED_PARAMETER(lpCmdLine);
+
+    // -allocationcheck : tick the startup scene in a hidden window and exit with 1 if the ticks after the warmup allocated
+    const bool bAllocationCheck = wcsstr(lpCmdLine, L"-allocationcheck") != nullptr;
 
     if (!XMVerifyCPUSupport())
         return 1;
@@ -93,7 +95,7 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         if (!hwnd)
             return 1;
 
-        ShowWindow(hwnd, nCmdShow);
+        ShowWindow(hwnd, bAllocationCheck ? SW_HIDE : nCmdShow);
         // TODO: Change nCmdShow to SW_SHOWMAXIMIZED to default to fullscreen.
 
         SetWindowLongPtr(hwnd, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(g_game.get()) );
@@ -103,6 +105,14 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         g_game->Initialize(hwnd, rc.right - rc.left, rc.bottom - rc.top);
     }
 
+    if (bAllocationCheck)
+    {
+        const int Result = g_game->RunAllocationCheck() == 0 ? 0 : 1;
+        g_game.reset();
+        CoUninitialize();
+        return Result;
+    }
+
     // Main message loop
     MSG msg = {};
     while (WM_QUIT != msg.message)
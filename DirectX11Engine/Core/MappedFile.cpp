@@ -0,0 +1,62 @@
+#include "Core/pch.h"
+#include "MappedFile.h"
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const std::wstring& Path)
+{
+	Close();
+
+	File = CreateFileW(Path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (File == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER FileSize;
+	if (!GetFileSizeEx(File, &FileSize) || FileSize.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+
+	Mapping = CreateFileMappingW(File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!Mapping)
+	{
+		Close();
+		return false;
+	}
+
+	Data = static_cast<const uint8_t*>(MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!Data)
+	{
+		Close();
+		return false;
+	}
+
+	Size = static_cast<size_t>(FileSize.QuadPart);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (Data)
+	{
+		UnmapViewOfFile(Data);
+		Data = nullptr;
+	}
+	if (Mapping)
+	{
+		CloseHandle(Mapping);
+		Mapping = nullptr;
+	}
+	if (File != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(File);
+		File = INVALID_HANDLE_VALUE;
+	}
+	Size = 0;
+}
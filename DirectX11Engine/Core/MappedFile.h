@@ -0,0 +1,27 @@
+#pragma once
+#include "Core/pch.h"
+
+// Read-only view of a whole file mapped into memory
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Map the file at Path, returns false if it does not exist or is empty
+	bool Open(const std::wstring& Path);
+	void Close();
+
+	bool IsOpen() const { return Data != nullptr; }
+	const uint8_t* GetData() const { return Data; }
+	size_t GetSize() const { return Size; }
+
+private:
+	HANDLE File = INVALID_HANDLE_VALUE;
+	HANDLE Mapping = nullptr;
+	const uint8_t* Data = nullptr;
+	size_t Size = 0;
+};
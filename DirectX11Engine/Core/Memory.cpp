@@ -0,0 +1,411 @@
+#include "Core/pch.h"
+#include "Memory.h"
+#include <algorithm>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+namespace
+{
+	// Constant initialized, operator new can run before the dynamic initialization of the statics
+	std::atomic<uint64_t> HeapAllocations{ 0 };
+
+	const size_t FrameArenaBytes = 1024 * 1024;
+	const size_t ScratchArenaBytes = 256 * 1024;
+
+	uintptr_t AlignUp(uintptr_t Value, size_t Alignment)
+	{
+		return (Value + Alignment - 1) & ~uintptr_t(Alignment - 1);
+	}
+
+	// Scratch arena of a thread. Its usage is published when the thread leaves its outermost scope, for the stats read by the others
+	struct ThreadScratch
+	{
+		ThreadScratch();
+		~ThreadScratch();
+
+		void Publish();
+
+		LinearArena Arena;
+		std::atomic<size_t> PublishedCapacity{ 0 };
+		std::atomic<size_t> PublishedPeak{ 0 };
+		std::atomic<size_t> PublishedGrows{ 0 };
+	};
+
+	// Every scratch arena and pool alive, for the stats. Never destroyed, the worker threads leave after the statics are gone
+	struct AllocatorRegistry
+	{
+		std::mutex Mutex;
+		std::vector<ThreadScratch*> Scratches;
+		std::vector<const FixedSizePool*> Pools;
+	};
+
+	AllocatorRegistry& GetRegistry()
+	{
+		static AllocatorRegistry* Registry = new AllocatorRegistry();
+		return *Registry;
+	}
+
+	ThreadScratch::ThreadScratch()
+		: Arena("Scratch", ScratchArenaBytes)
+	{
+		Publish();
+		std::lock_guard<std::mutex> Lock(GetRegistry().Mutex);
+		GetRegistry().Scratches.push_back(this);
+	}
+
+	ThreadScratch::~ThreadScratch()
+	{
+		AllocatorRegistry& Registry = GetRegistry();
+		std::lock_guard<std::mutex> Lock(Registry.Mutex);
+		Registry.Scratches.erase(std::remove(Registry.Scratches.begin(), Registry.Scratches.end(), this), Registry.Scratches.end());
+	}
+
+	void ThreadScratch::Publish()
+	{
+		const AllocatorStats Stats = Arena.GetStats();
+		PublishedCapacity = Stats.Capacity;
+		PublishedPeak = Stats.Peak;
+		PublishedGrows = Stats.Grows;
+	}
+
+	ThreadScratch& GetThreadScratch()
+	{
+		thread_local ThreadScratch Scratch;
+		return Scratch;
+	}
+}
+
+// Every allocation of the program is counted, to check that the frames don't allocate once the engine runs steadily.
+// All the forms are replaced, over-aligned types such as the ones holding an XMMATRIX go through the aligned ones
+
+void* operator new(size_t Size)
+{
+	HeapAllocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* Pointer = malloc(Size > 0 ? Size : 1))
+	{
+		return Pointer;
+	}
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t Size)
+{
+	return operator new(Size);
+}
+
+void* operator new(size_t Size, const std::nothrow_t&) noexcept
+{
+	HeapAllocations.fetch_add(1, std::memory_order_relaxed);
+	return malloc(Size > 0 ? Size : 1);
+}
+
+void* operator new[](size_t Size, const std::nothrow_t& Tag) noexcept
+{
+	return operator new(Size, Tag);
+}
+
+void* operator new(size_t Size, std::align_val_t Alignment)
+{
+	HeapAllocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* Pointer = _aligned_malloc(Size > 0 ? Size : 1, static_cast<size_t>(Alignment)))
+	{
+		return Pointer;
+	}
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t Size, std::align_val_t Alignment)
+{
+	return operator new(Size, Alignment);
+}
+
+void* operator new(size_t Size, std::align_val_t Alignment, const std::nothrow_t&) noexcept
+{
+	HeapAllocations.fetch_add(1, std::memory_order_relaxed);
+	return _aligned_malloc(Size > 0 ? Size : 1, static_cast<size_t>(Alignment));
+}
+
+void* operator new[](size_t Size, std::align_val_t Alignment, const std::nothrow_t& Tag) noexcept
+{
+	return operator new(Size, Alignment, Tag);
+}
+
+void operator delete(void* Pointer) noexcept
+{
+	free(Pointer);
+}
+
+void operator delete[](void* Pointer) noexcept
+{
+	free(Pointer);
+}
+
+void operator delete(void* Pointer, size_t) noexcept
+{
+	free(Pointer);
+}
+
+void operator delete[](void* Pointer, size_t) noexcept
+{
+	free(Pointer);
+}
+
+void operator delete(void* Pointer, const std::nothrow_t&) noexcept
+{
+	free(Pointer);
+}
+
+void operator delete[](void* Pointer, const std::nothrow_t&) noexcept
+{
+	free(Pointer);
+}
+
+void operator delete(void* Pointer, std::align_val_t) noexcept
+{
+	_aligned_free(Pointer);
+}
+
+void operator delete[](void* Pointer, std::align_val_t) noexcept
+{
+	_aligned_free(Pointer);
+}
+
+void operator delete(void* Pointer, size_t, std::align_val_t) noexcept
+{
+	_aligned_free(Pointer);
+}
+
+void operator delete[](void* Pointer, size_t, std::align_val_t) noexcept
+{
+	_aligned_free(Pointer);
+}
+
+void operator delete(void* Pointer, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	_aligned_free(Pointer);
+}
+
+void operator delete[](void* Pointer, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	_aligned_free(Pointer);
+}
+
+LinearArena::LinearArena(const char* Name, size_t Capacity)
+	: Name(Name)
+	, Block(new uint8_t[Capacity])
+	, Capacity(Capacity)
+{
+}
+
+LinearArena::~LinearArena() = default;
+
+void* LinearArena::Allocate(size_t Bytes, size_t Alignment)
+{
+	++Allocations;
+
+	const uintptr_t Base = reinterpret_cast<uintptr_t>(Block.get());
+	const size_t Aligned = static_cast<size_t>(AlignUp(Base + Offset, Alignment) - Base);
+	if (Aligned + Bytes <= Capacity)
+	{
+		Offset = Aligned + Bytes;
+		Peak = std::max(Peak, Offset + OverflowBytes);
+		return Block.get() + Aligned;
+	}
+
+	// Its own block until the arena is empty again
+	Overflows.push_back({ std::unique_ptr<uint8_t[]>(new uint8_t[Bytes + Alignment]), Bytes });
+	OverflowBytes += Bytes;
+	OverflowPeak = std::max(OverflowPeak, OverflowBytes);
+	Peak = std::max(Peak, Offset + OverflowBytes);
+	return reinterpret_cast<void*>(AlignUp(reinterpret_cast<uintptr_t>(Overflows.back().Memory.get()), Alignment));
+}
+
+void LinearArena::Rewind(const Mark& To)
+{
+	Offset = To.Offset;
+	while (Overflows.size() > To.Overflows)
+	{
+		OverflowBytes -= Overflows.back().Bytes;
+		Overflows.pop_back();
+	}
+
+	if (Offset > 0 || !Overflows.empty())
+	{
+		return;
+	}
+
+	// Empty : the block grows to hold the most that overflowed at once since it was last empty
+	Allocations = 0;
+	if (OverflowPeak > 0)
+	{
+		Capacity += OverflowPeak;
+		Block.reset(new uint8_t[Capacity]);
+		OverflowPeak = 0;
+		++Grows;
+	}
+}
+
+AllocatorStats LinearArena::GetStats() const
+{
+	AllocatorStats Stats;
+	Stats.Name = Name;
+	Stats.Capacity = Capacity;
+	Stats.Used = Offset + OverflowBytes;
+	Stats.Peak = Peak;
+	Stats.Allocations = Allocations;
+	Stats.Grows = Grows;
+	return Stats;
+}
+
+FrameMemory::FrameMemory()
+	: Arenas{ { "Frame", FrameArenaBytes }, { "Frame", FrameArenaBytes } }
+{
+}
+
+FrameMemory& FrameMemory::Get()
+{
+	static FrameMemory Frames;
+	return Frames;
+}
+
+void FrameMemory::BeginFrame()
+{
+	const AllocatorStats Finished = Arenas[Current].GetStats();
+	LastFrameBytes = Finished.Used;
+	LastFrameAllocations = Finished.Allocations;
+
+	// The other arena holds the previous frame, which isn't read anymore
+	Current ^= 1;
+	Arenas[Current].Reset();
+}
+
+AllocatorStats FrameMemory::GetStats() const
+{
+	const AllocatorStats First = Arenas[0].GetStats();
+	const AllocatorStats Second = Arenas[1].GetStats();
+
+	AllocatorStats Stats;
+	Stats.Name = "Frame";
+	Stats.Capacity = First.Capacity + Second.Capacity;
+	Stats.Used = First.Used + Second.Used;
+	Stats.Peak = std::max(First.Peak, Second.Peak);
+	Stats.FrameBytes = LastFrameBytes;
+	Stats.Allocations = LastFrameAllocations;
+	Stats.Grows = First.Grows + Second.Grows;
+	return Stats;
+}
+
+ScratchScope::ScratchScope()
+	: Arena(GetThreadScratch().Arena)
+	, Start(Arena.GetMark())
+{
+}
+
+ScratchScope::~ScratchScope()
+{
+	Arena.Rewind(Start);
+	if (Start.Offset == 0 && Start.Overflows == 0)
+	{
+		GetThreadScratch().Publish();
+	}
+}
+
+FixedSizePool::FixedSizePool(const char* Name, size_t SlotSize, size_t SlotsPerBlock, size_t Alignment)
+	: Name(Name)
+	, Alignment(std::max<size_t>({ Alignment, 16, alignof(std::max_align_t) }))
+	, SlotSize(AlignUp(std::max(SlotSize, sizeof(FreeSlot)), this->Alignment))
+	, SlotsPerBlock(std::max<size_t>(SlotsPerBlock, 1))
+{
+	std::lock_guard<std::mutex> Lock(GetRegistry().Mutex);
+	GetRegistry().Pools.push_back(this);
+}
+
+FixedSizePool::~FixedSizePool()
+{
+	AllocatorRegistry& Registry = GetRegistry();
+	std::lock_guard<std::mutex> Lock(Registry.Mutex);
+	Registry.Pools.erase(std::remove(Registry.Pools.begin(), Registry.Pools.end(), this), Registry.Pools.end());
+}
+
+void* FixedSizePool::Allocate()
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+
+	if (!FreeSlots)
+	{
+		// The slots of a new block are chained in address order, from the first aligned address of the block
+		Blocks.emplace_back(new uint8_t[SlotSize * SlotsPerBlock + Alignment]);
+		uint8_t* First = reinterpret_cast<uint8_t*>(AlignUp(reinterpret_cast<uintptr_t>(Blocks.back().get()), Alignment));
+		for (size_t i = SlotsPerBlock; i-- > 0;)
+		{
+			FreeSlot* Slot = reinterpret_cast<FreeSlot*>(First + i * SlotSize);
+			Slot->Next = FreeSlots;
+			FreeSlots = Slot;
+		}
+	}
+
+	FreeSlot* Slot = FreeSlots;
+	FreeSlots = Slot->Next;
+	++Allocations;
+	PeakSlots = std::max(PeakSlots, ++LiveSlots);
+	return Slot;
+}
+
+void FixedSizePool::Free(void* Slot)
+{
+	if (!Slot)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> Lock(Mutex);
+	FreeSlot* Freed = static_cast<FreeSlot*>(Slot);
+	Freed->Next = FreeSlots;
+	FreeSlots = Freed;
+	--LiveSlots;
+}
+
+AllocatorStats FixedSizePool::GetStats() const
+{
+	std::lock_guard<std::mutex> Lock(Mutex);
+
+	AllocatorStats Stats;
+	Stats.Name = Name;
+	Stats.Capacity = Blocks.size() * SlotsPerBlock * SlotSize;
+	Stats.Used = LiveSlots * SlotSize;
+	Stats.Peak = PeakSlots * SlotSize;
+	Stats.Allocations = Allocations;
+	Stats.Grows = Blocks.size() > 0 ? Blocks.size() - 1 : 0;
+	return Stats;
+}
+
+uint64_t Memory::GetHeapAllocationCount()
+{
+	return HeapAllocations.load(std::memory_order_relaxed);
+}
+
+void Memory::GetAllocatorStats(std::vector<AllocatorStats>& OutStats)
+{
+	OutStats.clear();
+	OutStats.push_back(FrameMemory::Get().GetStats());
+
+	AllocatorRegistry& Registry = GetRegistry();
+	std::lock_guard<std::mutex> Lock(Registry.Mutex);
+
+	// The scratch arenas of every thread as one
+	AllocatorStats Scratch;
+	Scratch.Name = "Scratch";
+	for (const ThreadScratch* Thread : Registry.Scratches)
+	{
+		Scratch.Capacity += Thread->PublishedCapacity;
+		Scratch.Peak = std::max<size_t>(Scratch.Peak, Thread->PublishedPeak);
+		Scratch.Grows += Thread->PublishedGrows;
+	}
+	OutStats.push_back(Scratch);
+
+	for (const FixedSizePool* Pool : Registry.Pools)
+	{
+		OutStats.push_back(Pool->GetStats());
+	}
+}
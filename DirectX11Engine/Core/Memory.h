@@ -0,0 +1,222 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Usage of an allocator, in bytes
+struct AllocatorStats
+{
+	const char* Name = "";
+	size_t Capacity = 0;
+	size_t Used = 0;
+	size_t Peak = 0;
+	// Bytes and allocations of the last frame for the frame arenas, since the last reset for the others
+	size_t FrameBytes = 0;
+	size_t Allocations = 0;
+	// Memory taken from the heap after the first block
+	size_t Grows = 0;
+};
+
+// Bump allocator over one block, everything is freed at once by Reset or by rewinding to a mark.
+// Allocations that don't fit get their own heap block until the arena is back to empty, then the block is grown
+// to hold them too, so a steady workload stops touching the heap after its first frames.
+// Not thread safe, each thread has its own scratch arena.
+class LinearArena
+{
+public:
+
+	// Position to rewind to, the allocations made after it are freed
+	struct Mark
+	{
+		size_t Offset = 0;
+		size_t Overflows = 0;
+	};
+
+	LinearArena(const char* Name, size_t Capacity);
+	~LinearArena();
+
+	LinearArena(const LinearArena&) = delete;
+	LinearArena& operator=(const LinearArena&) = delete;
+
+	void* Allocate(size_t Bytes, size_t Alignment = 16);
+
+	// Default constructed array, the type can't need a destructor since the arena never calls one
+	template<typename T>
+	T* AllocateArray(size_t Count)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "Arena memory is released without destructors");
+		T* Array = static_cast<T*>(Allocate(sizeof(T) * Count, alignof(T)));
+		for (size_t i = 0; i < Count; ++i)
+		{
+			::new (Array + i) T();
+		}
+		return Array;
+	}
+
+	Mark GetMark() const { return { Offset, Overflows.size() }; }
+	void Rewind(const Mark& To);
+	void Reset() { Rewind(Mark()); }
+
+	AllocatorStats GetStats() const;
+
+private:
+
+	const char* Name;
+	std::unique_ptr<uint8_t[]> Block;
+	size_t Capacity = 0;
+	size_t Offset = 0;
+
+	// Allocations that didn't fit in Block, the bytes they hold now and the most they held at once since the arena was last empty
+	struct Overflow
+	{
+		std::unique_ptr<uint8_t[]> Memory;
+		size_t Bytes = 0;
+	};
+	std::vector<Overflow> Overflows;
+	size_t OverflowBytes = 0;
+	size_t OverflowPeak = 0;
+
+	size_t Peak = 0;
+	size_t Allocations = 0;
+	size_t Grows = 0;
+};
+
+// Minimal allocator for the standard containers over a LinearArena. Deallocation does nothing, the memory goes back with the arena
+template<typename T>
+class ArenaAllocator
+{
+public:
+
+	using value_type = T;
+
+	explicit ArenaAllocator(LinearArena& Arena) noexcept : Arena(&Arena) {}
+
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& Other) noexcept : Arena(Other.GetArena()) {}
+
+	T* allocate(size_t Count) { return static_cast<T*>(Arena->Allocate(sizeof(T) * Count, alignof(T))); }
+	void deallocate(T*, size_t) noexcept {}
+
+	LinearArena* GetArena() const { return Arena; }
+
+	template<typename U>
+	bool operator==(const ArenaAllocator<U>& Other) const { return Arena == Other.GetArena(); }
+	template<typename U>
+	bool operator!=(const ArenaAllocator<U>& Other) const { return Arena != Other.GetArena(); }
+
+private:
+
+	LinearArena* Arena;
+};
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Memory for the transient data of a frame, in two arenas used in turn : what is allocated during a frame stays valid
+// during the next one, BeginFrame resets the arena of the frame before. Only for the thread running the frame
+class FrameMemory
+{
+public:
+
+	static FrameMemory& Get();
+
+	void BeginFrame();
+
+	LinearArena& GetArena() { return Arenas[Current]; }
+	void* Allocate(size_t Bytes, size_t Alignment = 16) { return Arenas[Current].Allocate(Bytes, Alignment); }
+
+	template<typename T>
+	T* AllocateArray(size_t Count) { return Arenas[Current].AllocateArray<T>(Count); }
+
+	// FrameBytes and Allocations are the ones of the last finished frame
+	AllocatorStats GetStats() const;
+
+private:
+
+	FrameMemory();
+
+	LinearArena Arenas[2];
+	unsigned int Current = 0;
+	size_t LastFrameBytes = 0;
+	size_t LastFrameAllocations = 0;
+};
+
+// Temporary memory of the calling thread, released when the scope ends. Scopes nest, each thread has its own arena
+class ScratchScope
+{
+public:
+
+	ScratchScope();
+	~ScratchScope();
+
+	ScratchScope(const ScratchScope&) = delete;
+	ScratchScope& operator=(const ScratchScope&) = delete;
+
+	LinearArena& GetArena() { return Arena; }
+
+	template<typename T>
+	T* AllocateArray(size_t Count) { return Arena.AllocateArray<T>(Count); }
+
+	// Empty vector in the scratch arena, to reserve before filling it
+	template<typename T>
+	ArenaVector<T> MakeVector() { return ArenaVector<T>(ArenaAllocator<T>(Arena)); }
+
+private:
+
+	LinearArena& Arena;
+	LinearArena::Mark Start;
+};
+
+// Slots of a fixed size, taken from blocks of SlotsPerBlock and reused once freed. Thread safe.
+// Backs the operator new of the small engine objects that come and go with the scenes
+class FixedSizePool
+{
+public:
+
+	// Slots are aligned to at least 16 bytes, enough for the DirectXMath vectors and matrices of the pooled objects
+	FixedSizePool(const char* Name, size_t SlotSize, size_t SlotsPerBlock = 64, size_t Alignment = 16);
+	~FixedSizePool();
+
+	FixedSizePool(const FixedSizePool&) = delete;
+	FixedSizePool& operator=(const FixedSizePool&) = delete;
+
+	size_t GetSlotSize() const { return SlotSize; }
+
+	void* Allocate();
+	void Free(void* Slot);
+
+	AllocatorStats GetStats() const;
+
+private:
+
+	struct FreeSlot
+	{
+		FreeSlot* Next;
+	};
+
+	const char* Name;
+	size_t Alignment;
+	size_t SlotSize;
+	size_t SlotsPerBlock;
+
+	mutable std::mutex Mutex;
+	std::vector<std::unique_ptr<uint8_t[]>> Blocks;
+	FreeSlot* FreeSlots = nullptr;
+	size_t LiveSlots = 0;
+	size_t PeakSlots = 0;
+	size_t Allocations = 0;
+};
+
+namespace Memory
+{
+	// Calls of the global operator new since the start, every standard container and engine object goes through it
+	uint64_t GetHeapAllocationCount();
+
+	// The frame arenas, the scratch arenas of the threads, then the pools
+	void GetAllocatorStats(std::vector<AllocatorStats>& OutStats);
+}
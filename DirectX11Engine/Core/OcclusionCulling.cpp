@@ -0,0 +1,404 @@
+#include "Core/pch.h"
+#include "OcclusionCulling.h"
+#include "Memory.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <xmmintrin.h>
+
+using namespace DirectX;
+
+namespace
+{
+	// Vertices closer than this to the camera plane are not projected, their triangles are dropped
+	constexpr float MinClipW = 1e-3f;
+
+	int PyramidWidth(size_t Level) { return std::max(OcclusionCuller::Width >> Level, 1); }
+	int PyramidHeight(size_t Level) { return std::max(OcclusionCuller::Height >> Level, 1); }
+}
+
+float OcclusionCuller::GetScreenSize(const BoundingSphere& Sphere, FXMVECTOR CameraPosition, float ProjectionScaleY)
+{
+	const float Distance = XMVectorGetX(XMVector3Length(XMLoadFloat3(&Sphere.Center) - CameraPosition));
+	if (Distance <= Sphere.Radius)
+	{
+		return FLT_MAX;
+	}
+	// The viewport is 2 units high in clip space
+	return Sphere.Radius * ProjectionScaleY / Distance;
+}
+
+void OcclusionCuller::BeginFrame(FXMMATRIX ViewProj)
+{
+	XMStoreFloat4x4(&ViewProjection, ViewProj);
+	Occluders.clear();
+	Counters = Stats();
+}
+
+void OcclusionCuller::AddOccluder(const Occluder& NewOccluder)
+{
+	if (NewOccluder.ScreenSize >= MinOccluderSize && NewOccluder.IndexCount >= 3)
+	{
+		Occluders.push_back(NewOccluder);
+	}
+}
+
+void OcclusionCuller::SetupOccluder(const Occluder& Source, ScreenTriangle* OutTriangles) const
+{
+	const XMMATRIX WorldViewProj = XMLoadFloat4x4(&Source.World) * XMLoadFloat4x4(&ViewProjection);
+	const uint8_t* Positions = reinterpret_cast<const uint8_t*>(Source.Positions);
+
+	for (uint32_t Triangle = 0; Triangle < Source.IndexCount / 3; ++Triangle)
+	{
+		ScreenTriangle& Out = OutTriangles[Triangle];
+		Out.MinX = Out.MinY = 0;
+		Out.MaxX = Out.MaxY = -1;
+
+		bool bBehind = false;
+		for (int Corner = 0; Corner < 3 && !bBehind; ++Corner)
+		{
+			const XMFLOAT3* Position = reinterpret_cast<const XMFLOAT3*>(Positions + size_t(Source.Indices[Triangle * 3 + Corner]) * Source.PositionStride);
+			XMFLOAT4 Clip;
+			XMStoreFloat4(&Clip, XMVector3Transform(XMLoadFloat3(Position), WorldViewProj));
+
+			bBehind = Clip.w < MinClipW;
+			const float InvW = 1.0f / Clip.w;
+			Out.X[Corner] = (Clip.x * InvW * 0.5f + 0.5f) * Width;
+			Out.Y[Corner] = (0.5f - Clip.y * InvW * 0.5f) * Height;
+			Out.Z[Corner] = Clip.z * InvW;
+		}
+
+		// Triangles crossing the camera plane are not clipped, dropping them only loses some occlusion
+		if (bBehind)
+		{
+			continue;
+		}
+
+		// Pixels whose center lies in the bounds of the triangle
+		const float MinX = std::min({ Out.X[0], Out.X[1], Out.X[2] });
+		const float MaxX = std::max({ Out.X[0], Out.X[1], Out.X[2] });
+		const float MinY = std::min({ Out.Y[0], Out.Y[1], Out.Y[2] });
+		const float MaxY = std::max({ Out.Y[0], Out.Y[1], Out.Y[2] });
+		if (MaxX < 0.0f || MaxY < 0.0f || MinX > Width || MinY > Height)
+		{
+			continue;
+		}
+		Out.MinX = std::max(0, static_cast<int>(ceilf(MinX - 0.5f)));
+		Out.MinY = std::max(0, static_cast<int>(ceilf(MinY - 0.5f)));
+		Out.MaxX = std::min(Width - 1, static_cast<int>(floorf(MaxX - 0.5f)));
+		Out.MaxY = std::min(Height - 1, static_cast<int>(floorf(MaxY - 0.5f)));
+	}
+}
+
+void OcclusionCuller::Rasterize()
+{
+	auto SetupStart = std::chrono::steady_clock::now();
+
+	// Biggest occluders first, until one of the budgets runs out
+	std::sort(Occluders.begin(), Occluders.end(), [](const Occluder& A, const Occluder& B) { return A.ScreenSize > B.ScreenSize; });
+
+	ScratchScope Scratch;
+	size_t* FirstTriangles = Scratch.AllocateArray<size_t>(Occluders.size());
+	size_t OccluderCount = 0;
+	size_t TriangleCount = 0;
+	for (const Occluder& Current : Occluders)
+	{
+		const size_t Count = Current.IndexCount / 3;
+		if (OccluderCount >= MaxOccluders || (TriangleCount > 0 && TriangleCount + Count > MaxOccluderTriangles))
+		{
+			break;
+		}
+		FirstTriangles[OccluderCount++] = TriangleCount;
+		TriangleCount += Count;
+	}
+	Occluders.resize(OccluderCount);
+	Triangles.resize(TriangleCount);
+
+	ThreadPool::Get().ParallelFor(Occluders.size(), 1, [this, FirstTriangles](size_t Begin, size_t End)
+	{
+		for (size_t i = Begin; i < End; ++i)
+		{
+			SetupOccluder(Occluders[i], &Triangles[FirstTriangles[i]]);
+		}
+	});
+
+	// Each tile gets the triangles overlapping it
+	TileBins.resize(TilesX * TilesY);
+	for (std::vector<uint32_t>& Bin : TileBins)
+	{
+		Bin.clear();
+	}
+	for (uint32_t i = 0; i < Triangles.size(); ++i)
+	{
+		const ScreenTriangle& Triangle = Triangles[i];
+		if (Triangle.MaxX < Triangle.MinX || Triangle.MaxY < Triangle.MinY)
+		{
+			continue;
+		}
+		++Counters.RasterizedTriangles;
+		for (int TileY = Triangle.MinY / TileSize; TileY <= Triangle.MaxY / TileSize; ++TileY)
+		{
+			for (int TileX = Triangle.MinX / TileSize; TileX <= Triangle.MaxX / TileSize; ++TileX)
+			{
+				TileBins[TileY * TilesX + TileX].push_back(i);
+			}
+		}
+	}
+
+	Counters.Occluders = static_cast<unsigned int>(Occluders.size());
+	Counters.OccluderTriangles = static_cast<unsigned int>(TriangleCount);
+
+	auto RasterStart = std::chrono::steady_clock::now();
+	Counters.SetupMs = std::chrono::duration<double, std::milli>(RasterStart - SetupStart).count();
+
+	TiledDepth.resize(Width * Height);
+	ThreadPool::Get().ParallelFor(TilesX * TilesY, 1, [this](size_t Begin, size_t End)
+	{
+		for (size_t Tile = Begin; Tile < End; ++Tile)
+		{
+			RasterizeTile(static_cast<int>(Tile));
+		}
+	});
+	BuildDepthPyramid();
+
+	Counters.RasterMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - RasterStart).count();
+}
+
+void OcclusionCuller::RasterizeTile(int TileIndex)
+{
+	float* Tile = &TiledDepth[size_t(TileIndex) * TileSize * TileSize];
+	std::fill(Tile, Tile + TileSize * TileSize, 1.0f);
+
+	const int TileLeft = (TileIndex % TilesX) * TileSize;
+	const int TileTop = (TileIndex / TilesX) * TileSize;
+	const __m128 PixelOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128 Zero = _mm_setzero_ps();
+
+	for (uint32_t TriangleIndex : TileBins[TileIndex])
+	{
+		const ScreenTriangle& Triangle = Triangles[TriangleIndex];
+		const float* X = Triangle.X;
+		const float* Y = Triangle.Y;
+
+		const float Area = (X[1] - X[0]) * (Y[2] - Y[0]) - (X[2] - X[0]) * (Y[1] - Y[0]);
+		if (fabsf(Area) < 1e-8f)
+		{
+			continue;
+		}
+
+		// Edge functions are positive inside, whatever the winding, so both faces are rasterized
+		const float Sign = Area > 0.0f ? 1.0f : -1.0f;
+		__m128 EdgeA[3], EdgeB[3], EdgeC[3];
+		for (int Edge = 0; Edge < 3; ++Edge)
+		{
+			const int From = (Edge + 1) % 3;
+			const int To = (Edge + 2) % 3;
+			EdgeA[Edge] = _mm_set1_ps(Sign * (Y[From] - Y[To]));
+			EdgeB[Edge] = _mm_set1_ps(Sign * (X[To] - X[From]));
+			EdgeC[Edge] = _mm_set1_ps(Sign * (X[From] * Y[To] - X[To] * Y[From]));
+		}
+
+		// Depth is linear in screen space after the perspective divide
+		const float DepthX = ((Triangle.Z[1] - Triangle.Z[0]) * (Y[2] - Y[0]) - (Triangle.Z[2] - Triangle.Z[0]) * (Y[1] - Y[0])) / Area;
+		const float DepthY = ((Triangle.Z[2] - Triangle.Z[0]) * (X[1] - X[0]) - (Triangle.Z[1] - Triangle.Z[0]) * (X[2] - X[0])) / Area;
+		const __m128 DepthStepX = _mm_set1_ps(DepthX);
+
+		// Columns are walked four at a time from a multiple of four, the tile is a multiple of four wide
+		const int MinX = std::max(Triangle.MinX, TileLeft) & ~3;
+		const int MaxX = std::min(Triangle.MaxX, TileLeft + TileSize - 1);
+		const int MinY = std::max(Triangle.MinY, TileTop);
+		const int MaxY = std::min(Triangle.MaxY, TileTop + TileSize - 1);
+
+		for (int PixelY = MinY; PixelY <= MaxY; ++PixelY)
+		{
+			const float CenterY = PixelY + 0.5f;
+			const __m128 RowY = _mm_set1_ps(CenterY);
+			const __m128 RowDepth = _mm_set1_ps(Triangle.Z[0] + DepthY * (CenterY - Y[0]) - DepthX * X[0]);
+			float* Row = Tile + (PixelY - TileTop) * TileSize - TileLeft;
+
+			for (int PixelX = MinX; PixelX <= MaxX; PixelX += 4)
+			{
+				const __m128 CenterX = _mm_add_ps(_mm_set1_ps(float(PixelX)), PixelOffsets);
+
+				__m128 Inside = _mm_cmpge_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(EdgeA[0], CenterX), _mm_mul_ps(EdgeB[0], RowY)), EdgeC[0]), Zero);
+				Inside = _mm_and_ps(Inside, _mm_cmpge_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(EdgeA[1], CenterX), _mm_mul_ps(EdgeB[1], RowY)), EdgeC[1]), Zero));
+				Inside = _mm_and_ps(Inside, _mm_cmpge_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(EdgeA[2], CenterX), _mm_mul_ps(EdgeB[2], RowY)), EdgeC[2]), Zero));
+				if (_mm_movemask_ps(Inside) == 0)
+				{
+					continue;
+				}
+
+				const __m128 Depth = _mm_max_ps(_mm_add_ps(RowDepth, _mm_mul_ps(DepthStepX, CenterX)), Zero);
+				const __m128 Current = _mm_loadu_ps(Row + PixelX);
+				const __m128 Nearest = _mm_min_ps(Current, Depth);
+				_mm_storeu_ps(Row + PixelX, _mm_or_ps(_mm_and_ps(Inside, Nearest), _mm_andnot_ps(Inside, Current)));
+			}
+		}
+	}
+}
+
+void OcclusionCuller::BuildDepthPyramid()
+{
+	size_t LevelCount = 1;
+	while (PyramidWidth(LevelCount - 1) > 1 && PyramidHeight(LevelCount - 1) > 1)
+	{
+		++LevelCount;
+	}
+	DepthPyramid.resize(LevelCount);
+
+	// Level 0 puts the tiles back in rows
+	DepthPyramid[0].resize(Width * Height);
+	for (int Tile = 0; Tile < TilesX * TilesY; ++Tile)
+	{
+		const float* Source = &TiledDepth[size_t(Tile) * TileSize * TileSize];
+		const int Left = (Tile % TilesX) * TileSize;
+		const int Top = (Tile / TilesX) * TileSize;
+		for (int Row = 0; Row < TileSize; ++Row)
+		{
+			std::copy(Source + Row * TileSize, Source + (Row + 1) * TileSize, &DepthPyramid[0][(Top + Row) * Width + Left]);
+		}
+	}
+
+	for (size_t Level = 1; Level < LevelCount; ++Level)
+	{
+		const std::vector<float>& Parent = DepthPyramid[Level - 1];
+		const int ParentWidth = PyramidWidth(Level - 1);
+		const int LevelWidth = PyramidWidth(Level);
+		const int LevelHeight = PyramidHeight(Level);
+
+		std::vector<float>& Current = DepthPyramid[Level];
+		Current.resize(size_t(LevelWidth) * LevelHeight);
+		for (int TexelY = 0; TexelY < LevelHeight; ++TexelY)
+		{
+			const float* Top = &Parent[size_t(TexelY * 2) * ParentWidth];
+			const float* Bottom = Top + ParentWidth;
+			for (int TexelX = 0; TexelX < LevelWidth; ++TexelX)
+			{
+				Current[TexelY * LevelWidth + TexelX] = std::max(std::max(Top[TexelX * 2], Top[TexelX * 2 + 1]), std::max(Bottom[TexelX * 2], Bottom[TexelX * 2 + 1]));
+			}
+		}
+	}
+}
+
+bool OcclusionCuller::IsOccluded(const BoundingBox& Box) const
+{
+	if (DepthPyramid.empty())
+	{
+		return false;
+	}
+
+	XMFLOAT3 Corners[BoundingBox::CORNER_COUNT];
+	Box.GetCorners(Corners);
+
+	const XMMATRIX ViewProj = XMLoadFloat4x4(&ViewProjection);
+	float MinX = FLT_MAX, MinY = FLT_MAX, MaxX = -FLT_MAX, MaxY = -FLT_MAX, MinZ = FLT_MAX;
+	for (const XMFLOAT3& Corner : Corners)
+	{
+		XMFLOAT4 Clip;
+		XMStoreFloat4(&Clip, XMVector3Transform(XMLoadFloat3(&Corner), ViewProj));
+
+		// A box reaching behind the camera covers the near plane
+		if (Clip.w < MinClipW)
+		{
+			return false;
+		}
+		const float InvW = 1.0f / Clip.w;
+		const float ScreenX = (Clip.x * InvW * 0.5f + 0.5f) * Width;
+		const float ScreenY = (0.5f - Clip.y * InvW * 0.5f) * Height;
+		MinX = std::min(MinX, ScreenX);
+		MaxX = std::max(MaxX, ScreenX);
+		MinY = std::min(MinY, ScreenY);
+		MaxY = std::max(MaxY, ScreenY);
+		MinZ = std::min(MinZ, Clip.z * InvW);
+	}
+
+	// Every pixel the box touches, not only the covered centers
+	const int Left = std::max(0, static_cast<int>(floorf(MinX)));
+	const int Top = std::max(0, static_cast<int>(floorf(MinY)));
+	const int Right = std::min(Width - 1, static_cast<int>(floorf(MaxX)));
+	const int Bottom = std::min(Height - 1, static_cast<int>(floorf(MaxY)));
+	if (Right < Left || Bottom < Top)
+	{
+		return false;
+	}
+
+	// Coarsest level where the rectangle spans at most 4x4 texels
+	size_t Level = 0;
+	while (Level + 1 < DepthPyramid.size() && std::max(Right - Left, Bottom - Top) >> Level > 3)
+	{
+		++Level;
+	}
+
+	const std::vector<float>& Depth = DepthPyramid[Level];
+	const int LevelWidth = PyramidWidth(Level);
+	for (int TexelY = Top >> Level; TexelY <= Bottom >> Level; ++TexelY)
+	{
+		for (int TexelX = Left >> Level; TexelX <= Right >> Level; ++TexelX)
+		{
+			if (Depth[TexelY * LevelWidth + TexelX] >= MinZ)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void OcclusionCuller::Cull(const BoundsTable& Bounds, std::vector<uint8_t>& InOutVisible)
+{
+	auto TestStart = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < Bounds.GetCount(); ++i)
+	{
+		if (!InOutVisible[i])
+		{
+			continue;
+		}
+		++Counters.Tested;
+
+		const BoundingBox Box(XMFLOAT3(Bounds.CenterX[i], Bounds.CenterY[i], Bounds.CenterZ[i]), XMFLOAT3(Bounds.ExtentX[i], Bounds.ExtentY[i], Bounds.ExtentZ[i]));
+		if (IsOccluded(Box))
+		{
+			InOutVisible[i] = 0;
+			++Counters.Occluded;
+		}
+	}
+
+	Counters.TestMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - TestStart).count();
+}
+
+ID3D11ShaderResourceView* OcclusionCuller::UpdateDebugView(ID3D11Device1* Device, ID3D11DeviceContext1* DeviceContext)
+{
+	if (DepthPyramid.empty())
+	{
+		return DebugView.Get();
+	}
+
+	if (!DebugTexture)
+	{
+		CD3D11_TEXTURE2D_DESC TextureDesc(DXGI_FORMAT_R8G8B8A8_UNORM, Width, Height, 1, 1);
+		DX::ThrowIfFailed(Device->CreateTexture2D(&TextureDesc, nullptr, DebugTexture.GetAddressOf()));
+		DX::ThrowIfFailed(Device->CreateShaderResourceView(DebugTexture.Get(), nullptr, DebugView.GetAddressOf()));
+	}
+
+	// Depth is stretched between the nearest pixel and the far plane, perspective depth is mostly close to 1
+	const std::vector<float>& Depth = DepthPyramid[0];
+	const float Nearest = *std::min_element(Depth.begin(), Depth.end());
+	const float Scale = Nearest < 1.0f ? 1.0f / (1.0f - Nearest) : 0.0f;
+
+	std::vector<uint32_t> Pixels(Depth.size());
+	for (size_t i = 0; i < Depth.size(); ++i)
+	{
+		const uint32_t Grey = static_cast<uint32_t>(std::min(std::max((1.0f - Depth[i]) * Scale, 0.0f), 1.0f) * 255.0f);
+		Pixels[i] = 0xff000000 | (Grey << 16) | (Grey << 8) | Grey;
+	}
+	DeviceContext->UpdateSubresource(DebugTexture.Get(), 0, nullptr, Pixels.data(), Width * sizeof(uint32_t), 0);
+
+	return DebugView.Get();
+}
+
+void OcclusionCuller::ReleaseDebugView()
+{
+	DebugView.Reset();
+	DebugTexture.Reset();
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include "Core/pch.h"
+#include "FrustumCulling.h"
+#include <DirectXCollision.h>
+#include <vector>
+
+// Software occlusion culling : a few large occluders are rasterized on the CPU into a low resolution depth buffer,
+// split in tiles rasterized in parallel with SSE, four pixels at a time.
+// The buffer is then reduced to a max depth pyramid, and the boxes of the candidates are tested against it.
+class OcclusionCuller
+{
+public:
+
+	static constexpr int Width = 256;
+	static constexpr int Height = 128;
+	static constexpr int TileSize = 32;
+	static constexpr int TilesX = Width / TileSize;
+	static constexpr int TilesY = Height / TileSize;
+
+	// Triangles of an occluder, Positions is read every PositionStride bytes
+	struct Occluder
+	{
+		const DirectX::XMFLOAT3* Positions = nullptr;
+		uint32_t PositionStride = sizeof(DirectX::XMFLOAT3);
+		const uint32_t* Indices = nullptr;
+		uint32_t IndexCount = 0;
+		DirectX::XMFLOAT4X4 World;
+		// Height of the bounding sphere on screen, as a fraction of the viewport
+		float ScreenSize = 0.0f;
+	};
+
+	struct Stats
+	{
+		unsigned int Occluders = 0;
+		unsigned int OccluderTriangles = 0;
+		// Triangles in front of the camera and on screen, after binning
+		unsigned int RasterizedTriangles = 0;
+		unsigned int Tested = 0;
+		unsigned int Occluded = 0;
+		double SetupMs = 0.0;
+		double RasterMs = 0.0;
+		double TestMs = 0.0;
+	};
+
+	bool bOcclusionCulling = true;
+	// Smallest screen size of an occluder, and budgets of the occluders rasterized each frame, biggest first
+	float MinOccluderSize = 0.2f;
+	unsigned int MaxOccluders = 32;
+	unsigned int MaxOccluderTriangles = 200000;
+
+	// Screen size of a sphere for the Occluder::ScreenSize, ProjectionScaleY is the [1][1] term of the projection
+	static float GetScreenSize(const DirectX::BoundingSphere& Sphere, DirectX::FXMVECTOR CameraPosition, float ProjectionScaleY);
+
+	void BeginFrame(DirectX::FXMMATRIX ViewProj);
+	void AddOccluder(const Occluder& NewOccluder);
+
+	// Rasterize the biggest occluders within the budgets and build the depth pyramid
+	void Rasterize();
+
+	// Set InOutVisible to 0 for the visible objects of Bounds hidden behind the occluders
+	void Cull(const BoundsTable& Bounds, std::vector<uint8_t>& InOutVisible);
+
+	bool IsOccluded(const DirectX::BoundingBox& Box) const;
+
+	const Stats& GetStats() const { return Counters; }
+
+	// Grey scale copy of the depth buffer, near is white and empty pixels are black
+	ID3D11ShaderResourceView* UpdateDebugView(ID3D11Device1* Device, ID3D11DeviceContext1* DeviceContext);
+	void ReleaseDebugView();
+
+private:
+
+	// Triangle in pixels, an empty pixel range when it was clipped
+	struct ScreenTriangle
+	{
+		float X[3], Y[3], Z[3];
+		int MinX, MinY, MaxX, MaxY;
+	};
+
+	void SetupOccluder(const Occluder& Source, ScreenTriangle* OutTriangles) const;
+	void RasterizeTile(int TileIndex);
+	void BuildDepthPyramid();
+
+	DirectX::XMFLOAT4X4 ViewProjection;
+	std::vector<Occluder> Occluders;
+	std::vector<ScreenTriangle> Triangles;
+	std::vector<std::vector<uint32_t>> TileBins;
+
+	// Depth of each tile, TileSize * TileSize pixels at a time
+	std::vector<float> TiledDepth;
+	// Level 0 is the depth buffer in rows, each next level keeps the farthest of 2x2 texels
+	std::vector<std::vector<float>> DepthPyramid;
+
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> DebugTexture;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> DebugView;
+
+	Stats Counters;
+};
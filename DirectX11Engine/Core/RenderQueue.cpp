@@ -0,0 +1,210 @@
+#include "Core/pch.h"
+#include "RenderQueue.h"
+#include "StateTracker.h"
+#include "Hash.h"
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+	bool SameSlice(const ConstantBufferRing::Allocation& A, const ConstantBufferRing::Allocation& B)
+	{
+		return A.FirstConstant == B.FirstConstant && A.NumConstants == B.NumConstants;
+	}
+
+	// Bind what differs from Previous, or count it only when State is null. Returns the bindings made and adds the skipped ones to OutAvoided
+	unsigned int BindChanges(const DrawBindings* Previous, const DrawBindings& Next, StateTracker* State, ID3D11Buffer* ConstantBuffer, unsigned int& OutAvoided)
+	{
+		unsigned int Changes = 0;
+		auto Bind = [&](bool bChanged, auto&& Issue)
+		{
+			if (!bChanged)
+			{
+				++OutAvoided;
+				return;
+			}
+			++Changes;
+			if (State)
+			{
+				Issue();
+			}
+		};
+
+		Bind(!Previous || Previous->PixelShader != Next.PixelShader, [&] { State->SetPixelShader(Next.PixelShader); });
+		Bind(!Previous || Previous->VertexBuffer != Next.VertexBuffer || Previous->VertexStride != Next.VertexStride,
+			[&] { State->SetVertexBuffer(0, Next.VertexBuffer, Next.VertexStride, 0); });
+		Bind(!Previous || Previous->IndexBuffer != Next.IndexBuffer || Previous->IndexFormat != Next.IndexFormat,
+			[&] { State->SetIndexBuffer(Next.IndexBuffer, Next.IndexFormat, 0); });
+
+		for (UINT Slot = 0; Slot < 3; ++Slot)
+		{
+			if (Next.Views[Slot])
+			{
+				Bind(!Previous || Previous->Views[Slot] != Next.Views[Slot], [&] { State->SetPSShaderResource(Slot, Next.Views[Slot]); });
+			}
+		}
+		if (Next.Sampler)
+		{
+			Bind(!Previous || Previous->Sampler != Next.Sampler, [&] { State->SetPSSampler(0, Next.Sampler); });
+		}
+
+		Bind(!Previous || !SameSlice(Previous->VSConstants, Next.VSConstants),
+			[&] { State->SetVSConstantBuffer(0, ConstantBuffer, Next.VSConstants.FirstConstant, Next.VSConstants.NumConstants); });
+		Bind(!Previous || !SameSlice(Previous->PSConstants, Next.PSConstants),
+			[&] { State->SetPSConstantBuffer(1, ConstantBuffer, Next.PSConstants.FirstConstant, Next.PSConstants.NumConstants); });
+
+		return Changes;
+	}
+}
+
+uint64_t RenderQueue::MakeKey(unsigned int Pass, unsigned int ShaderId, unsigned int MaterialId, float Depth)
+{
+	uint32_t DepthBits = 0;
+	if (Depth > 0.0f)
+	{
+		memcpy(&DepthBits, &Depth, sizeof(DepthBits));
+	}
+
+	uint64_t Key = uint64_t(Pass & ((1u << PassBits) - 1)) << (64 - PassBits);
+	Key |= uint64_t(ShaderId & ((1u << ShaderBits) - 1)) << (64 - PassBits - ShaderBits);
+	Key |= uint64_t(MaterialId & ((1u << MaterialBits) - 1)) << 32;
+	Key |= DepthBits;
+	return Key;
+}
+
+unsigned int RenderQueue::MakeMaterialId(const DrawBindings& Bindings)
+{
+	uint64_t MaterialHash = Hash::Seed;
+	for (ID3D11ShaderResourceView* View : Bindings.Views)
+	{
+		MaterialHash = Hash::Combine(MaterialHash, reinterpret_cast<uintptr_t>(View));
+	}
+	return static_cast<unsigned int>(MaterialHash & ((1u << MaterialBits) - 1));
+}
+
+void RenderQueue::Clear()
+{
+	Items.clear();
+	Order.clear();
+}
+
+void RenderQueue::Add(uint64_t SortKey, const DrawBindings& Bindings)
+{
+	Order.push_back({ SortKey, static_cast<uint32_t>(Items.size()) });
+	Items.push_back(Bindings);
+}
+
+void RenderQueue::Sort(bool bSort)
+{
+	auto SortStart = std::chrono::steady_clock::now();
+
+	if (bSort)
+	{
+		RadixSort(Order, Scratch);
+	}
+
+	Counters.SortMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - SortStart).count();
+}
+
+void RenderQueue::RadixSort(std::vector<SortEntry>& Entries, std::vector<SortEntry>& Scratch)
+{
+	// Least significant byte first, each pass is stable so the order of the bytes before is kept
+	Scratch.resize(Entries.size());
+
+	for (unsigned int Shift = 0; Shift < 64; Shift += 8)
+	{
+		size_t Offsets[256] = {};
+		for (const SortEntry& Entry : Entries)
+		{
+			++Offsets[(Entry.Key >> Shift) & 0xff];
+		}
+
+		// Every key shares this byte, the pass would not move anything
+		if (Offsets[(Entries.empty() ? 0 : Entries[0].Key >> Shift) & 0xff] == Entries.size())
+		{
+			continue;
+		}
+
+		size_t Total = 0;
+		for (size_t& Offset : Offsets)
+		{
+			const size_t Count = Offset;
+			Offset = Total;
+			Total += Count;
+		}
+
+		for (const SortEntry& Entry : Entries)
+		{
+			Scratch[Offsets[(Entry.Key >> Shift) & 0xff]++] = Entry;
+		}
+		Entries.swap(Scratch);
+	}
+}
+
+void RenderQueue::Submit(StateTracker& State, ID3D11Buffer* ConstantBuffer)
+{
+	Counters.Draws = 0;
+	Counters.Bindings = 0;
+	Counters.BindingsAvoided = 0;
+
+	const DrawBindings* Previous = nullptr;
+	for (const SortEntry& Entry : Order)
+	{
+		const DrawBindings& Draw = Items[Entry.Index];
+		Counters.Bindings += BindChanges(Previous, Draw, &State, ConstantBuffer, Counters.BindingsAvoided);
+
+		State.GetContext()->DrawIndexed(Draw.IndexCount, Draw.StartIndex, Draw.BaseVertex);
+		++Counters.Draws;
+		Previous = &Draw;
+	}
+
+	LastCounters = Counters;
+}
+
+unsigned int RenderQueue::CountBindings(const std::vector<SortEntry>& Entries) const
+{
+	unsigned int Bindings = 0;
+	unsigned int Avoided = 0;
+
+	const DrawBindings* Previous = nullptr;
+	for (const SortEntry& Entry : Entries)
+	{
+		Bindings += BindChanges(Previous, Items[Entry.Index], nullptr, nullptr, Avoided);
+		Previous = &Items[Entry.Index];
+	}
+	return Bindings;
+}
+
+RenderQueue::Benchmark RenderQueue::RunBenchmark(unsigned int Iterations) const
+{
+	Iterations = std::max(Iterations, 1u);
+
+	std::vector<SortEntry> Unsorted = Order;
+	std::sort(Unsorted.begin(), Unsorted.end(), [](const SortEntry& A, const SortEntry& B) { return A.Index < B.Index; });
+
+	Benchmark Result;
+	Result.Draws = Unsorted.size();
+	Result.UnsortedBindings = CountBindings(Unsorted);
+
+	std::vector<SortEntry> Entries;
+	std::vector<SortEntry> BenchmarkScratch;
+
+	auto RadixStart = std::chrono::steady_clock::now();
+	for (unsigned int i = 0; i < Iterations; ++i)
+	{
+		Entries = Unsorted;
+		RadixSort(Entries, BenchmarkScratch);
+	}
+	Result.RadixMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - RadixStart).count() / Iterations;
+	Result.SortedBindings = CountBindings(Entries);
+
+	auto StdSortStart = std::chrono::steady_clock::now();
+	for (unsigned int i = 0; i < Iterations; ++i)
+	{
+		Entries = Unsorted;
+		std::sort(Entries.begin(), Entries.end(), [](const SortEntry& A, const SortEntry& B) { return A.Key < B.Key; });
+	}
+	Result.StdSortMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - StdSortStart).count() / Iterations;
+
+	return Result;
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include "Core/pch.h"
+#include "ConstantBufferRing.h"
+#include <vector>
+
+class StateTracker;
+
+// Everything a draw binds, compared with the draw before it at submission
+struct DrawBindings
+{
+	ID3D11PixelShader* PixelShader = nullptr;
+	ID3D11Buffer* VertexBuffer = nullptr;
+	UINT VertexStride = 0;
+	ID3D11Buffer* IndexBuffer = nullptr;
+	DXGI_FORMAT IndexFormat = DXGI_FORMAT_R32_UINT;
+	// Albedo, normal map and specular map, null slots are left as they are
+	ID3D11ShaderResourceView* Views[3] = {};
+	ID3D11SamplerState* Sampler = nullptr;
+	ConstantBufferRing::Allocation VSConstants;
+	ConstantBufferRing::Allocation PSConstants;
+	UINT IndexCount = 0;
+	UINT StartIndex = 0;
+	INT BaseVertex = 0;
+};
+
+// The draws of a frame, sorted by a 64 bits key before they are submitted.
+// From the most significant bits : pass, shader, material and textures, then depth front to back,
+// so that draws sharing state end up next to each other and occluders are drawn first.
+class RenderQueue
+{
+public:
+
+	struct Stats
+	{
+		unsigned int Draws = 0;
+		// Set calls made, and skipped because the previous draw already bound the same thing
+		unsigned int Bindings = 0;
+		unsigned int BindingsAvoided = 0;
+		double SortMs = 0.0;
+	};
+
+	static constexpr unsigned int PassBits = 4;
+	static constexpr unsigned int ShaderBits = 8;
+	static constexpr unsigned int MaterialBits = 20;
+
+	// Depth is the distance to the camera, positive floats keep their order when compared as integers
+	static uint64_t MakeKey(unsigned int Pass, unsigned int ShaderId, unsigned int MaterialId, float Depth);
+
+	// Material id of a texture set, views are hashed by address
+	static unsigned int MakeMaterialId(const DrawBindings& Bindings);
+
+	void Clear();
+	void Add(uint64_t SortKey, const DrawBindings& Bindings);
+
+	// Radix sort of the keys, in submission order when bSort is false
+	void Sort(bool bSort = true);
+
+	// Issue the draws in sorted order, the constants are bound on ConstantBuffer
+	void Submit(StateTracker& State, ID3D11Buffer* ConstantBuffer);
+
+	size_t GetDrawCount() const { return Items.size(); }
+	const Stats& GetLastStats() const { return LastCounters; }
+
+	struct Benchmark
+	{
+		size_t Draws = 0;
+		// Bindings made in submission order and once sorted
+		unsigned int UnsortedBindings = 0;
+		unsigned int SortedBindings = 0;
+		// Average time of a radix sort and of a std::sort of the same keys
+		double RadixMs = 0.0;
+		double StdSortMs = 0.0;
+	};
+
+	// Sort copies of the current draws Iterations times, the queue itself is left as it is
+	Benchmark RunBenchmark(unsigned int Iterations) const;
+
+private:
+
+	struct SortEntry
+	{
+		uint64_t Key;
+		uint32_t Index;
+	};
+
+	static void RadixSort(std::vector<SortEntry>& Entries, std::vector<SortEntry>& Scratch);
+
+	// Bindings the draws would make in this order, without drawing
+	unsigned int CountBindings(const std::vector<SortEntry>& Entries) const;
+
+	std::vector<DrawBindings> Items;
+	std::vector<SortEntry> Order;
+	std::vector<SortEntry> Scratch;
+
+	Stats Counters;
+	Stats LastCounters;
+};
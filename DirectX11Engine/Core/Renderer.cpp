@@ -5,6 +5,13 @@
 #include "Core/pch.h"
 #include "Mesh/Mesh.h"
 #include "Mesh/Cube.h"
+#include "Mesh/InstanceBatch.h"
+#include "Mesh/MeshCache.h"
+#include "Mesh/MaterialRegistry.h"
+#include "Mesh/TextureRegistry.h"
+#include "StateCache.h"
+#include "StateTracker.h"
+#include "ObjLoader.h"
 #include "Camera.h"
 #include "GameInputManager.h"
 #include "Renderer.h"
@@ -14,6 +21,10 @@
 #include <assimp/postprocess.h>
 #include "assimp/material.h"
 #include "Shaders/Shader.h"
+#include "Shaders/ShaderCache.h"
+#include "Shaders/ShaderVariants.h"
+#include "ThreadPool.h"
+#include "Memory.h"
 
 // GUI
 #include "ImGui/imgui.h"
@@ -21,6 +32,9 @@
 #include "ImGui/imgui_impl_dx11.h"
 #include "Math.h"
 #include <ShObjIdl_core.h>
+#include <cassert>
+#include <chrono>
+#include <functional>
 
 extern void ExitGame() noexcept;
 
@@ -29,6 +43,26 @@ using namespace DirectX::SimpleMath;
 
 using Microsoft::WRL::ComPtr;
 
+namespace
+{
+    // Post processing of every imported model, part of the mesh cache key
+    // Tangent frames are generated by the meshes, see TangentSpace
+    const unsigned int ModelImportFlags = aiProcess_Triangulate |
+        aiProcess_FlipUVs |
+        aiProcess_JoinIdenticalVertices |
+        aiProcess_SortByPType;
+
+    // Colors and variant flags of a mesh for the entity store, the lit variant is picked from the flags every frame
+    MaterialComponent MakeMaterialComponent(const Mesh& Source)
+    {
+        MaterialComponent Material;
+        Material.Material = Source.Material;
+        Material.bNormalMap = Source.HasNormalMap();
+        Material.bSpecularMap = Source.HasSpecularMap();
+        return Material;
+    }
+}
+
 Renderer::Renderer() noexcept :
     Window(nullptr),
     OutputWidth(800),
@@ -75,6 +109,9 @@ void Renderer::Initialize(HWND window, int width, int height)
 // Executes the basic game loop.
 void Renderer::Tick()
 {
+    const uint64_t AllocationsBefore = Memory::GetHeapAllocationCount();
+    FrameMemory::Get().BeginFrame();
+
     Timer.Tick([&]()
     {
         InputManager->Update();       
@@ -83,6 +120,44 @@ void Renderer::Tick()
     Update(Timer);
 
     Render();
+
+    // Once the scene is loaded and the containers have grown, a tick shouldn't reach the heap anymore
+    TickAllocations = Memory::GetHeapAllocationCount() - AllocationsBefore;
+    AllocationFreeTicks = TickAllocations == 0 ? AllocationFreeTicks + 1 : 0;
+
+#ifndef NDEBUG
+    // Self-test of a loaded scene : the warmup starts once its textures are streamed in, then the checked ticks must not allocate.
+    // Using the GUI may allocate, it starts the warmup over
+    if (Textures->GetStreamingCount() > 0 || ImGui::IsAnyItemActive())
+    {
+        AllocationCheckTicks = 0;
+    }
+    else if (AllocationCheckTicks < AllocationWarmupTicks + AllocationCheckedTicks)
+    {
+        ++AllocationCheckTicks;
+        assert(AllocationCheckTicks <= AllocationWarmupTicks || TickAllocations == 0);
+    }
+#endif
+}
+
+uint64_t Renderer::RunAllocationCheck()
+{
+    while (Textures->GetStreamingCount() > 0)
+    {
+        Tick();
+    }
+    for (unsigned int iTick = 0; iTick < AllocationWarmupTicks; ++iTick)
+    {
+        Tick();
+    }
+
+    uint64_t Allocations = 0;
+    for (unsigned int iTick = 0; iTick < AllocationCheckedTicks; ++iTick)
+    {
+        Tick();
+        Allocations += TickAllocations;
+    }
+    return Allocations;
 }
 
 // Updates the world.
@@ -104,114 +179,255 @@ void Renderer::Render()
         return;
     }
 
+    // ImGui draws behind the tracker at the end of the frame
+    Tracker->BeginFrame();
+
     DrawGui();
 
+    // Upload the textures decoded since the last frame
+    Textures->Update();
 
     Clear();
 
-	// Clear the views
-	D3dContext->ClearRenderTargetView(RenderTargetView.Get(), Colors::Aqua);
-
-    // GBUffer Pass
-	D3dContext->ClearDepthStencilView(DepthStencilView.Get(), D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
-
-	D3dContext->OMSetRenderTargets(1, RenderTargetView.GetAddressOf(), DepthStencilView.Get());
-
     // Blending
 	float BlendFactor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
 	UINT SampleMask = 0xffffffff;
-    D3dContext->OMSetBlendState(BlendState.Get(), BlendFactor, SampleMask);
-
-	// Set the viewport
-	CD3D11_VIEWPORT viewport(0.0f, 0.0f, static_cast<float>(OutputWidth), static_cast<float>(OutputHeight));
-	D3dContext->RSSetViewports(1, &viewport);
+    Tracker->SetBlendState(BlendState, BlendFactor, SampleMask);
 
-	D3dContext->RSSetState(SolidState);
-	D3dContext->OMSetDepthStencilState(DepthStencilState.Get(), 0);
+	Tracker->SetRasterizerState(SolidState);
+	Tracker->SetDepthStencilState(DepthStencilState, 0);
 
 	// Set Input layout
-    D3dContext->IASetInputLayout(InputLayout.Get());
-    D3dContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    Tracker->SetInputLayout(InputLayout.Get());
+    Tracker->SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-	// Set shaders
-	Microsoft::WRL::ComPtr<ID3D11VertexShader> VSRef = VertexShader->GetVertexShaderRef();
-	Microsoft::WRL::ComPtr<ID3D11PixelShader> PSRef = CurrentPixelShader->GetPixelShaderRef();
+	// Set shaders, the pixel shader is picked per mesh
+    Tracker->SetVertexShader(VertexShader->GetVertexShaderRef().Get());
 
-    D3dContext->VSSetShader(VSRef.Get(), 0, 0);
-    D3dContext->PSSetShader(PSRef.Get(), 0, 0);
-
-    // LightingPass
-
-    // Draw each mesh of the scene
-    for (Mesh* Mesh : Meshes)
+    // Per frame constants
+	PerFrameBuffStruct_PS.Sun = Sun->GetLightData();
+	if (!bToggleDirectional)
 	{
-		WorldViewProj = Mesh->GetWorldMatrix() * SceneCamera->GetViewMatrix() * SceneCamera->GetProjectionMatrix();
-
-		PerObjectBuffStruct_VS.WorldViewProj = XMMatrixTranspose(WorldViewProj);
-        PerObjectBuffStruct_VS.World = XMMatrixTranspose(Mesh->GetWorldMatrix());
+		PerFrameBuffStruct_PS.Sun.AmbientColor = DirectX::XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+		PerFrameBuffStruct_PS.Sun.DiffuseColor = DirectX::XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+		PerFrameBuffStruct_PS.Sun.SpecularColor = DirectX::XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+	}
 
-		PerFrameBuffStruct_PS.Sun = Sun->GetLightData();
-		if (!bToggleDirectional)
+	// The first MAX_LIGHTS point lights are uploaded
+	unsigned int PointLightCount = 0;
+	Entities.ForEachChunk(EntityStore::MakeSignature<LightComponent>(), [this, &PointLightCount](EntityStore::Chunk& LightChunk)
+	{
+		const LightComponent* Lights = LightChunk.Get<LightComponent>();
+		for (uint32_t i = 0; i < LightChunk.GetCount() && PointLightCount < MAX_LIGHTS; ++i)
 		{
-			PerFrameBuffStruct_PS.Sun.AmbientColor = DirectX::XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
-			PerFrameBuffStruct_PS.Sun.DiffuseColor = DirectX::XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
-			PerFrameBuffStruct_PS.Sun.SpecularColor = DirectX::XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+			PerFrameBuffStruct_PS.PointLights[PointLightCount++] = Lights[i].Data;
 		}
+	});
 
-		for (int i = 0; i < MAX_LIGHTS && i < Lights.size(); ++i)
-		{
-			   PerFrameBuffStruct_PS.PointLights[i] = Lights[i].Light->GetLightData();
-		}
-        PerObjectBuffStruct_PS.Mat = Mesh->Material;
+	XMFLOAT3 CamPos{};
+	XMStoreFloat3(&CamPos, SceneCamera->GetPosition());
+	PerFrameBuffStruct_PS.CameraPosition = CamPos;
+    PerFrameBuffStruct_PS.LightsCount = static_cast<float>(PointLightCount);
 
-		XMFLOAT3 CamPos{};
-		XMStoreFloat3(&CamPos, SceneCamera->GetPosition());
-		PerFrameBuffStruct_PS.CameraPosition = CamPos;
-        PerFrameBuffStruct_PS.LightsCount = Lights.size();
+    const XMMATRIX ViewProj = SceneCamera->GetViewMatrix() * SceneCamera->GetProjectionMatrix();
 
-		D3dContext->UpdateSubresource(PerFrameBuffer_PS.Get(), 0, nullptr, &PerFrameBuffStruct_PS, 0, 0);
-		D3dContext->PSSetConstantBuffers(0, 1, PerFrameBuffer_PS.GetAddressOf());
+    // Transforms moved by the game and the GUI are rebuilt once, the moved meshes are refit in the scene queries
+    TransformSystem::Get().Update();
 
-		D3dContext->UpdateSubresource(PerObjectBuffer_PS.Get(), 0, nullptr, &PerObjectBuffStruct_PS, 0, 0);
-		D3dContext->PSSetConstantBuffers(1, 1, PerObjectBuffer_PS.GetAddressOf());
+    // Only the meshes in the view frustum are drawn
+    UpdateSceneQueries();
+    Culler.Cull(Frustum::FromViewProjection(ViewProj), SceneBounds, MeshVisibility, &SceneHierarchy);
 
-		D3dContext->UpdateSubresource(PerObjectBuffer_VS.Get(), 0, nullptr, &PerObjectBuffStruct_VS, 0, 0);
-		D3dContext->VSSetConstantBuffers(0, 1, PerObjectBuffer_VS.GetAddressOf());
-		
-		Mesh->Draw(D3dContext);
+    // The meshes of the frustum big enough on screen are the occluders of the others
+    const float ProjectionScaleY = XMVectorGetY(SceneCamera->GetProjectionMatrix().r[1]);
+    Occlusion.BeginFrame(ViewProj);
+    if (Occlusion.bOcclusionCulling)
+    {
+        // Size in occlusion buffer texels of one world unit at a distance of one
+        const float OcclusionTexelsPerUnit = ProjectionScaleY * OcclusionCuller::Height * 0.5f;
+        const XMVECTOR OcclusionEye = SceneCamera->GetPosition();
+        Entities.ForEachChunk(EntityStore::MakeSignature<RenderMeshComponent, TransformComponent, BoundsComponent>(), [&](EntityStore::Chunk& MeshChunk)
+        {
+            const RenderMeshComponent* RenderMeshes = MeshChunk.Get<RenderMeshComponent>();
+            const TransformComponent* Transforms = MeshChunk.Get<TransformComponent>();
+            const BoundsComponent* Bounds = MeshChunk.Get<BoundsComponent>();
+            for (uint32_t i = 0; i < MeshChunk.GetCount(); ++i)
+            {
+                const Mesh* Candidate = MeshPool->Get(RenderMeshes[i].Source);
+                const Mesh::GeometryView CandidateGeometry = Candidate->GetGeometry();
+                if (!MeshVisibility[RenderMeshes[i].QueryIndex] || CandidateGeometry.VertexCount == 0)
+                {
+                    continue;
+                }
+
+                OcclusionCuller::Occluder NewOccluder;
+                NewOccluder.Positions = &CandidateGeometry.Vertices[0].Position;
+                NewOccluder.PositionStride = sizeof(VertexType);
+                // A simplified level can stick out of the real silhouette and hide meshes that are visible,
+                // so the coarsest one used stays within a texel of the occlusion buffer, like the draws with LodPixelError
+                const BoundingSphere& WorldSphere = Bounds[i].Sphere;
+                const float NearestDistance = XMVectorGetX(XMVector3Length(XMLoadFloat3(&WorldSphere.Center) - OcclusionEye)) - WorldSphere.Radius;
+                const unsigned int Lod = NearestDistance > 0.0f ? Candidate->SelectLod(Transforms[i].MaxScale * OcclusionTexelsPerUnit / NearestDistance, 1.0f) : 0;
+                NewOccluder.Indices = reinterpret_cast<const uint32_t*>(Lod == 0 ? CandidateGeometry.Indices : CandidateGeometry.LodIndices + Candidate->Lods[Lod - 1].FirstIndex);
+                NewOccluder.IndexCount = Candidate->GetLodIndexCount(Lod);
+                NewOccluder.World = Transforms[i].World;
+                NewOccluder.ScreenSize = OcclusionCuller::GetScreenSize(Bounds[i].Sphere, SceneCamera->GetPosition(), ProjectionScaleY);
+                Occlusion.AddOccluder(NewOccluder);
+            }
+        });
+
+        Occlusion.Rasterize();
+        Occlusion.Cull(SceneBounds, MeshVisibility);
+
+        if (bShowOcclusionBuffer)
+        {
+            OcclusionDebugView = Occlusion.UpdateDebugView(D3dDevice.Get(), D3dContext.Get());
+        }
     }
-    if (bDrawLightEmitters)
+    const size_t VisibleCount = static_cast<size_t>(std::count(MeshVisibility.begin(), MeshVisibility.end(), uint8_t(1)));
+
+    // Every constant of the frame is written to the ring in a single mapping, before the draws
+    const XMMATRIX TransposedViewProj = XMMatrixTranspose(ViewProj);
+    const size_t FrameBytes = ConstantBufferRing::GetAlignedSize(sizeof(ConstantBufferPerFrame_PS)) + ConstantBufferRing::GetAlignedSize(sizeof(XMMATRIX));
+    const size_t ObjectBytes = ConstantBufferRing::GetAlignedSize(sizeof(ConstantBufferPerObject_VS)) + ConstantBufferRing::GetAlignedSize(sizeof(ConstantBufferPerObject_PS));
+
+    ConstantRing->ResetFrameStats();
+    ConstantRing->Begin(D3dContext.Get(), FrameBytes + VisibleCount * ObjectBytes);
+    const ConstantBufferRing::Allocation FrameConstants = ConstantRing->Write(&PerFrameBuffStruct_PS, sizeof(PerFrameBuffStruct_PS));
+    const ConstantBufferRing::Allocation ViewProjConstants = ConstantRing->Write(&TransposedViewProj, sizeof(TransposedViewProj));
+
+    bool bVariantUsed[ShaderVariantSet::VariantCount] = {};
+    DrawQueue.Clear();
+
+    // Shaders are keyed by variant, the others come after the lit variants
+    auto GetShaderId = [this](const Shader* DrawShader) -> unsigned int
     {
-		// Draw meshes for the lights
-		for (LightAndMesh CurrentLight : Lights)
-		{
-			D3dContext->PSSetShader(UnlitPixelShader->GetPixelShaderRef().Get(), 0, 0);
+        return DrawShader == UnlitPixelShader ? ShaderVariantSet::VariantCount : ShaderVariantSet::VariantCount + 1;
+    };
 
-            CurrentLight.LightMesh->InitMesh(D3dDevice, D3dContext);
-			WorldViewProj = CurrentLight.LightMesh->GetWorldMatrix() * SceneCamera->GetViewMatrix() * SceneCamera->GetProjectionMatrix();
+    // Size in pixels of one world unit at a distance of one
+    const float PixelsPerUnit = ProjectionScaleY * OutputHeight * 0.5f;
+    FullTriangles = 0;
+    DrawnTriangles = 0;
+    std::fill(std::begin(LodDraws), std::end(LodDraws), 0u);
+
+    // Draws are prepared in parallel, one chunk of mesh entities per job, reading only the components they need
+    const XMVECTOR CameraPosition = SceneCamera->GetPosition();
+    PreparedDraw* PreparedDraws = FrameMemory::Get().AllocateArray<PreparedDraw>(MeshEntities.size());
+    // Passed by reference, the std::function would copy this many captures to the heap every frame
+    auto PrepareChunkDraws = [&](EntityStore::Chunk& MeshChunk)
+    {
+        const RenderMeshComponent* RenderMeshes = MeshChunk.Get<RenderMeshComponent>();
+        const TransformComponent* Transforms = MeshChunk.Get<TransformComponent>();
+        const BoundsComponent* Bounds = MeshChunk.Get<BoundsComponent>();
+        const MaterialComponent* MeshMaterials = MeshChunk.Get<MaterialComponent>();
+        for (uint32_t i = 0; i < MeshChunk.GetCount(); ++i)
+        {
+            const uint32_t iMesh = RenderMeshes[i].QueryIndex;
+            if (!MeshVisibility[iMesh])
+            {
+                continue;
+            }
+            PreparedDraw& Draw = PreparedDraws[iMesh];
+
+            // Only the lights reaching the mesh are applied, by the cheapest variant for its textures
+            unsigned int LightIndices[MAX_LIGHTS];
+            const unsigned int LightCount = GatherLights(iMesh, LightIndices);
+            for (unsigned int iLight = 0; iLight < MAX_LIGHTS; ++iLight)
+            {
+                (&Draw.PSConstants.LightIndices[iLight / 4].x)[iLight % 4] = iLight < LightCount ? LightIndices[iLight] : 0;
+            }
 
-			PerObjectBuffStruct_VS.WorldViewProj = XMMatrixTranspose(WorldViewProj);
-			PerObjectBuffStruct_VS.World = XMMatrixTranspose(CurrentLight.LightMesh->GetWorldMatrix());
+            Shader* MeshPixelShader = CurrentPixelShader;
+            Draw.ShaderId = GetShaderId(CurrentPixelShader);
+            if (CurrentPixelShader == PixelShader)
+            {
+                const ShaderVariantKey Variant = ShaderVariantSet::Select(MeshMaterials[i].bNormalMap, MeshMaterials[i].bSpecularMap, LightCount);
+                Draw.ShaderId = ShaderVariantSet::GetIndex(Variant);
+                MeshPixelShader = LitPixelShaders->Get(Variant);
+            }
+
+            const XMMATRIX World = XMLoadFloat4x4(&Transforms[i].World);
+            Draw.VSConstants.WorldViewProj = XMMatrixTranspose(World * ViewProj);
+            Draw.VSConstants.World = XMMatrixTranspose(World);
+            Draw.VSConstants.PositionScale = RenderMeshes[i].Quantization.Scale;
+            Draw.VSConstants.PositionOffset = RenderMeshes[i].Quantization.Offset;
+            Draw.PSConstants.Mat = MeshMaterials[i].Material;
+
+            // The error of a level is measured at the nearest point of the bounds, a camera inside them gets the full mesh
+            const Mesh* Source = MeshPool->Get(RenderMeshes[i].Source);
+            Draw.Lod = 0;
+            if (bUseLods)
+            {
+                const BoundingSphere& WorldSphere = Bounds[i].Sphere;
+                const float NearestDistance = XMVectorGetX(XMVector3Length(XMLoadFloat3(&WorldSphere.Center) - CameraPosition)) - WorldSphere.Radius;
+                Draw.Lod = NearestDistance > 0.0f ? Source->SelectLod(Transforms[i].MaxScale * PixelsPerUnit / NearestDistance, LodPixelError) : 0;
+            }
+
+            Draw.Bindings = Source->GetDrawBindings(Draw.Lod);
+            Draw.Bindings.PixelShader = MeshPixelShader->GetPixelShaderRef().Get();
+            Draw.FullTriangles = Source->GetLodIndexCount(0) / 3;
+            Draw.Depth = XMVectorGetX(XMVector3Length(XMLoadFloat3(&Bounds[i].Box.Center) - CameraPosition));
+        }
+    };
+    Entities.ParallelForEachChunk(EntityStore::MakeSignature<RenderMeshComponent, TransformComponent, BoundsComponent, MaterialComponent>(), std::ref(PrepareChunkDraws));
+
+    // The constants are written and the draws queued in mesh order, so the frame doesn't depend on the scheduling
+    for (size_t iMesh = 0; iMesh < MeshEntities.size(); ++iMesh)
+    {
+        if (!MeshVisibility[iMesh])
+        {
+            continue;
+        }
+
+        PreparedDraw& Draw = PreparedDraws[iMesh];
+        if (Draw.ShaderId < ShaderVariantSet::VariantCount)
+        {
+            bVariantUsed[Draw.ShaderId] = true;
+        }
+        FullTriangles += Draw.FullTriangles;
+        DrawnTriangles += Draw.Bindings.IndexCount / 3;
+        ++LodDraws[std::min(Draw.Lod, 3u)];
 
-			PerFrameBuffStruct_PS.Sun = Sun->GetLightData();
+        Draw.Bindings.VSConstants = ConstantRing->Write(&Draw.VSConstants, sizeof(Draw.VSConstants));
+        Draw.Bindings.PSConstants = ConstantRing->Write(&Draw.PSConstants, sizeof(Draw.PSConstants));
+        DrawQueue.Add(RenderQueue::MakeKey(0, Draw.ShaderId, RenderQueue::MakeMaterialId(Draw.Bindings), Draw.Depth), Draw.Bindings);
+    }
 
-			XMFLOAT3 CamPos{};
-			XMStoreFloat3(&CamPos, SceneCamera->GetPosition());
-			PerFrameBuffStruct_PS.CameraPosition = CamPos;
-			PerFrameBuffStruct_PS.LightsCount = Lights.size();
+    ConstantRing->End(D3dContext.Get());
 
-			D3dContext->UpdateSubresource(PerFrameBuffer_PS.Get(), 0, nullptr, &PerFrameBuffStruct_PS, 0, 0);
-			D3dContext->PSSetConstantBuffers(0, 1, PerFrameBuffer_PS.GetAddressOf());
+    // LightingPass
+    Tracker->SetPSConstantBuffer(0, ConstantRing->GetBuffer(), FrameConstants.FirstConstant, FrameConstants.NumConstants);
 
-			D3dContext->UpdateSubresource(PerObjectBuffer_PS.Get(), 0, nullptr, &PerObjectBuffStruct_PS, 0, 0);
-			D3dContext->PSSetConstantBuffers(1, 1, PerObjectBuffer_PS.GetAddressOf());
+    DrawQueue.Sort(bSortDraws);
+    DrawQueue.Submit(*Tracker, ConstantRing->GetBuffer());
 
-			D3dContext->UpdateSubresource(PerObjectBuffer_VS.Get(), 0, nullptr, &PerObjectBuffStruct_VS, 0, 0);
-			D3dContext->VSSetConstantBuffers(0, 1, PerObjectBuffer_VS.GetAddressOf());
+    // Meshes for the lights, every proxy in one instanced draw
+    if (bDrawLightEmitters && PointLightCount > 0)
+    {
+        std::vector<InstanceData>& Proxies = LightProxies->BeginInstances();
+        Entities.ForEachChunk(EntityStore::MakeSignature<LightComponent>(), [&Proxies](EntityStore::Chunk& LightChunk)
+        {
+            const LightComponent* Lights = LightChunk.Get<LightComponent>();
+            for (uint32_t i = 0; i < LightChunk.GetCount(); ++i)
+            {
+                const XMFLOAT3& Position = Lights[i].Data.Position;
+                InstanceData Proxy;
+                XMStoreFloat4x4(&Proxy.World, XMMatrixScaling(5.0f, 5.0f, 5.0f) * XMMatrixTranslation(Position.x, Position.y, Position.z));
+                Proxy.Color = Lights[i].Data.DiffuseColor;
+                Proxies.push_back(Proxy);
+            }
+        });
+        LightProxies->EndInstances(D3dContext.Get());
+
+        Tracker->SetInputLayout(InstancedInputLayout.Get());
+        Tracker->SetVertexShader(InstancedVertexShader->GetVertexShaderRef().Get());
+        Tracker->SetPixelShader(EmitterPixelShader->GetPixelShaderRef().Get());
+        Tracker->SetVSConstantBuffer(0, ConstantRing->GetBuffer(), ViewProjConstants.FirstConstant, ViewProjConstants.NumConstants);
+        LightProxies->Draw(*Tracker);
+    }
 
-            CurrentLight.LightMesh->Draw(D3dContext);
-		}
-    }   
+    VariantsUsed = static_cast<unsigned int>(std::count(std::begin(bVariantUsed), std::end(bVariantUsed), true));
 
 	ImGui::Render();
 	ImGui_ImplDX11_RenderDrawData(ImGui::GetDrawData());
@@ -230,6 +446,248 @@ void Renderer::DrawGui()
 
 	if (ImGui::Button("Open"))
 		OpenModel();
+    ImGui::SameLine();
+    if (ImGui::Button("Reload"))
+        LoadNewModel(CurrentModelPath);
+    ImGui::SameLine();
+    ImGui::Checkbox("Use mesh cache", &bUseMeshCache);
+
+    ImGui::Text("Model geometry %.1f ms (%s), GPU init %.1f ms", LoadStats.GeometryMs, LoadStats.bFromCache ? "cache" : "assimp", LoadStats.InitMs);
+    ImGui::Text("Last geometry load : cache %.1f ms, assimp %.1f ms", LoadStats.LastCachedMs, LoadStats.LastImportMs);
+    if (ImGui::TreeNode("Load phases"))
+    {
+        ImGui::Text("Assimp import  %.1f ms", LoadStats.ImportMs);
+        ImGui::Text("Mesh convert   %.1f ms (%u workers + main)", LoadStats.ConvertMs, ThreadPool::Get().GetThreadCount());
+        ImGui::Text("Cache %s %.1f ms", LoadStats.bFromCache ? "read " : "write", LoadStats.CacheMs);
+        ImGui::Text("GPU init       %.1f ms", LoadStats.InitMs);
+        ImGui::TreePop();
+    }
+    if (ImGui::TreeNode("Textures"))
+    {
+        const TextureRegistry::Stats& TextureStats = Textures->GetStats();
+        ImGui::Text("Hits %u (by content %u), misses %u (cooked %u), failures %u", TextureStats.Hits, TextureStats.ContentHits, TextureStats.Misses, TextureStats.CookedLoads, TextureStats.Failures);
+        ImGui::Text("Uploaded %.1f MB, saved %.1f MB", TextureStats.BytesUploaded / (1024.0 * 1024.0), TextureStats.BytesSaved / (1024.0 * 1024.0));
+        const TextureRegistry::Residency TextureCounts = Textures->GetResidency();
+        ImGui::Text("Resident %zu textures, %.1f MB, %zu sharing an image, %zu pending", TextureCounts.Resident, Textures->GetResidentBytes() / (1024.0 * 1024.0), TextureCounts.Shared, TextureCounts.Pending);
+        if (TextureCounts.Failed > 0)
+            ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "%zu textures failed to stream, they keep their placeholder", TextureCounts.Failed);
+
+        ImGui::Checkbox("Stream textures", &Textures->bStreamTextures);
+        int UploadBudgetMB = int(Textures->UploadBudgetBytes / (1024 * 1024));
+        if (ImGui::SliderInt("Upload budget (MB/frame)", &UploadBudgetMB, 1, 64))
+            Textures->UploadBudgetBytes = size_t(UploadBudgetMB) * 1024 * 1024;
+        ImGui::Text("Streaming %zu, last frame %.1f MB in %.2f ms, worst frame %.2f ms", Textures->GetStreamingCount(),
+            TextureStats.LastFrameUploadBytes / (1024.0 * 1024.0), TextureStats.LastFrameUploadMs, TextureStats.MaxFrameUploadMs);
+        ImGui::Text("Last texture resident %.1f ms after the load", TextureStats.StreamingDoneMs);
+        ImGui::TreePop();
+    }
+    if (ImGui::TreeNode("Culling"))
+    {
+        const FrustumCuller::Stats& CullStats = Culler.GetStats();
+        ImGui::Checkbox("Frustum culling", &Culler.bCullFrustum);
+        ImGui::SameLine();
+        ImGui::Checkbox("Through the BVH", &Culler.bUseHierarchy);
+        ImGui::Text("Visible %zu, culled %zu in %.3f ms", CullStats.Visible, CullStats.Culled, CullStats.CullMs);
+        if (ImGui::Button("Benchmark culling"))
+        {
+            const Frustum View = Frustum::FromViewProjection(SceneCamera->GetViewMatrix() * SceneCamera->GetProjectionMatrix());
+            CullBenchmarks.clear();
+            CullBenchmarks.push_back(Culler.RunBenchmark(View, 10000, 100));
+            CullBenchmarks.push_back(Culler.RunBenchmark(View, 50000, 50));
+            CullBenchmarks.push_back(Culler.RunBenchmark(View, 100000, 20));
+        }
+        for (const FrustumCuller::Benchmark& Result : CullBenchmarks)
+        {
+            ImGui::Text("%zu objects : scalar %.3f ms, SSE %.3f ms, SSE on %u workers + main %.3f ms (%zu visible)",
+                Result.Objects, Result.ScalarMs, Result.SimdMs, ThreadPool::Get().GetThreadCount(), Result.ParallelMs, Result.Visible);
+            ImGui::Text("    BVH %.3f ms, built in %.1f ms", Result.HierarchyMs, Result.HierarchyBuildMs);
+        }
+        ImGui::TreePop();
+    }
+    if (ImGui::TreeNode("Occlusion"))
+    {
+        const OcclusionCuller::Stats& OcclusionStats = Occlusion.GetStats();
+        ImGui::Checkbox("Occlusion culling", &Occlusion.bOcclusionCulling);
+        ImGui::SliderFloat("Min occluder size", &Occlusion.MinOccluderSize, 0.05f, 1.0f);
+        int MaxOccluders = int(Occlusion.MaxOccluders);
+        if (ImGui::SliderInt("Max occluders", &MaxOccluders, 1, 128))
+            Occlusion.MaxOccluders = unsigned(MaxOccluders);
+        ImGui::Text("Occluded %u of %u tested in %.3f ms", OcclusionStats.Occluded, OcclusionStats.Tested, OcclusionStats.TestMs);
+        ImGui::Text("%u occluders, %u triangles, %u on screen", OcclusionStats.Occluders, OcclusionStats.OccluderTriangles, OcclusionStats.RasterizedTriangles);
+        ImGui::Text("Setup %.3f ms, raster %.3f ms : %dx%d in %d tiles on %u workers + main", OcclusionStats.SetupMs, OcclusionStats.RasterMs,
+            OcclusionCuller::Width, OcclusionCuller::Height, OcclusionCuller::TilesX * OcclusionCuller::TilesY, ThreadPool::Get().GetThreadCount());
+        ImGui::Checkbox("Show occlusion buffer", &bShowOcclusionBuffer);
+        if (bShowOcclusionBuffer && OcclusionDebugView)
+            ImGui::Image(OcclusionDebugView, ImVec2(OcclusionCuller::Width * 2.0f, OcclusionCuller::Height * 2.0f));
+        ImGui::TreePop();
+    }
+    if (ImGui::TreeNode("Scene BVH"))
+    {
+        const SceneBVH::Stats& HierarchyStats = SceneHierarchy.GetStats();
+        ImGui::Text("%zu objects, %zu nodes, depth %u, built in %.2f ms, %u refits", SceneHierarchy.GetObjectCount(), HierarchyStats.Nodes, HierarchyStats.Depth, HierarchyStats.BuildMs, HierarchyStats.Refits);
+        ImGui::Text("Nodes visited last query : frustum %u, ray %u, sphere %u", HierarchyStats.LastFrustumNodes, HierarchyStats.LastRayNodes, HierarchyStats.LastSphereNodes);
+
+        // Moving the picked mesh goes through Actor::SetPosition, which refits the hierarchy on the next frame
+        if (SelectedMesh >= 0 && SelectedMesh < static_cast<int>(MeshEntities.size()))
+        {
+            XMFLOAT3 Position = GetMesh(SelectedMesh)->GetPosition();
+            ImGui::Text("Selected mesh %d (left click to pick)", SelectedMesh);
+            if (ImGui::DragFloat3("Position", &Position.x, 0.1f))
+                GetMesh(SelectedMesh)->SetPosition(Position);
+        }
+        else
+        {
+            ImGui::Text("No mesh selected (left click to pick)");
+        }
+        ImGui::TreePop();
+    }
+    if (ImGui::TreeNode("Transforms"))
+    {
+        const TransformSystem::Stats& TransformStats = TransformSystem::Get().GetStats();
+        ImGui::Text("%zu transforms on %zu levels, %zu moved last frame, updated in %.3f ms", TransformStats.Transforms, TransformStats.Levels,
+            TransformStats.Moved, TransformStats.UpdateMs);
+
+        if (ImGui::Button("Benchmark transforms"))
+            TransformBenchmark = TransformSystem::RunBenchmark(100000, 10);
+        if (TransformBenchmark.Transforms > 0)
+        {
+            ImGui::Text("%zu moving transforms, per frame :", TransformBenchmark.Transforms);
+            ImGui::Text("    Rebuilt in every setter %.3f ms", TransformBenchmark.ImmediateMs);
+            ImGui::Text("    Transform system %.3f ms : set %.3f ms, update %.3f ms, read %.3f ms",
+                TransformBenchmark.SetMs + TransformBenchmark.UpdateMs + TransformBenchmark.ReadMs, TransformBenchmark.SetMs, TransformBenchmark.UpdateMs, TransformBenchmark.ReadMs);
+        }
+        ImGui::TreePop();
+    }
+    if (ImGui::TreeNode("Entities"))
+    {
+        const EntityStore::Stats EntityStats = Entities.GetStats();
+        ImGui::Text("%zu entities in %zu archetypes, %zu chunks (%.2f MB)", EntityStats.Entities, EntityStats.Archetypes, EntityStats.Chunks,
+            EntityStats.ChunkBytes / (1024.0 * 1024.0));
+
+        if (ImGui::Button("Benchmark iteration"))
+            EntityBenchmark = EntityStore::RunBenchmark(100000, 10);
+        if (EntityBenchmark.Entities > 0)
+        {
+            ImGui::Text("%zu entities, bounds update and frustum test per frame (%zu visible) :", EntityBenchmark.Entities, EntityBenchmark.Visible);
+            ImGui::Text("    Heap objects %.3f ms, chunks %.3f ms, chunks on the thread pool %.3f ms", EntityBenchmark.ObjectsMs, EntityBenchmark.ChunksMs, EntityBenchmark.ParallelChunksMs);
+        }
+        ImGui::TreePop();
+    }
+    if (ImGui::TreeNode("Memory"))
+    {
+        ImGui::Text("Heap allocations last tick : %llu, %u ticks in a row without any", static_cast<unsigned long long>(TickAllocations), AllocationFreeTicks);
+
+        Memory::GetAllocatorStats(AllocatorReport);
+        for (const AllocatorStats& Stats : AllocatorReport)
+        {
+            ImGui::Text("%s : %.1f / %.1f KB, peak %.1f KB, %zu allocations, grown %zu times", Stats.Name, Stats.Used / 1024.0, Stats.Capacity / 1024.0,
+                Stats.Peak / 1024.0, Stats.Allocations, Stats.Grows);
+            if (Stats.FrameBytes > 0)
+            {
+                ImGui::SameLine();
+                ImGui::Text("(%.1f KB last frame)", Stats.FrameBytes / 1024.0);
+            }
+        }
+
+        // Resident resources by type, the ones of the scene are released together when it is unloaded
+        ImGui::Separator();
+        ResourceReport = { MeshPool->GetStats(), Materials->GetResourceStats(), Textures->GetResourceStats(), Geometry->GetResourceStats() };
+        for (const ResourceStats& Stats : ResourceReport)
+        {
+            ImGui::Text("%s : %zu resident (%zu with the scene), %.2f MB, %zu slots", Stats.Name, Stats.Count, Stats.SceneCount,
+                Stats.ResidentBytes / (1024.0 * 1024.0), Stats.Slots);
+        }
+        ImGui::Text("Last unload : %zu meshes, %zu materials, %zu textures, %zu buffers in %.2f ms", LastUnload.Meshes, LastUnload.Materials,
+            LastUnload.Textures, LastUnload.Buffers, LastUnload.UnloadMs);
+        if (ImGui::Button("Unload scene"))
+            UnloadScene();
+        ImGui::TreePop();
+    }
+    if (ImGui::TreeNode("Geometry"))
+    {
+        ImGui::Checkbox("Levels of detail", &bUseLods);
+        ImGui::SameLine();
+        ImGui::SliderFloat("Max pixel error", &LodPixelError, 0.25f, 8.0f);
+        ImGui::Text("Triangles last frame : %u at full detail, %u drawn (%.1f%%)", FullTriangles, DrawnTriangles, 100.0f * DrawnTriangles / std::max(FullTriangles, 1u));
+        ImGui::Text("Draws per level : %u, %u, %u, %u", LodDraws[0], LodDraws[1], LodDraws[2], LodDraws[3]);
+        const GeometryArena::Stats GeometryStats = Geometry->GetStats();
+        ImGui::Text("%u meshes in the arena, grown %u times", GeometryStats.Allocations, GeometryStats.Grows);
+        ImGui::Text("Vertices %u / %u (%.1f%%), %zu free ranges, %.1f%% fragmented", GeometryStats.VerticesUsed, GeometryStats.VertexCapacity,
+            100.0f * GeometryStats.VerticesUsed / std::max(GeometryStats.VertexCapacity, 1u), GeometryStats.VertexFreeRanges, 100.0f * GeometryStats.VertexFragmentation);
+        ImGui::Text("32 bits indices %u / %u (%.1f%%), %zu free ranges, %.1f%% fragmented", GeometryStats.IndicesUsed, GeometryStats.IndexCapacity,
+            100.0f * GeometryStats.IndicesUsed / std::max(GeometryStats.IndexCapacity, 1u), GeometryStats.IndexFreeRanges, 100.0f * GeometryStats.IndexFragmentation);
+        ImGui::Text("16 bits indices %u / %u (%.1f%%), %zu free ranges, %.1f%% fragmented", GeometryStats.ShortIndicesUsed, GeometryStats.ShortIndexCapacity,
+            100.0f * GeometryStats.ShortIndicesUsed / std::max(GeometryStats.ShortIndexCapacity, 1u), GeometryStats.ShortIndexFreeRanges, 100.0f * GeometryStats.ShortIndexFragmentation);
+
+        // Quantization report over the meshes of the scene, against their full precision vertices
+        VertexPacking::ErrorStats PackingError;
+        for (size_t iMesh = 0; iMesh < MeshEntities.size(); ++iMesh)
+        {
+            PackingError.Add(GetMesh(iMesh)->PackingError);
+        }
+        ImGui::Text("Vertex memory : %.2f MB packed, %.2f MB as floats (%.1fx smaller)", PackingError.Vertices * sizeof(PackedVertex) / (1024.0 * 1024.0),
+            PackingError.Vertices * sizeof(VertexType) / (1024.0 * 1024.0), float(sizeof(VertexType)) / sizeof(PackedVertex));
+        ImGui::Text("Quantization error : position %.5f%% of the bounds, UV %.5f", 100.0f * PackingError.MaxPosition, PackingError.MaxTextureCoordinate);
+        ImGui::Text("    normal %.2f deg, tangent %.2f deg, binormal %.2f deg", PackingError.MaxNormalDegrees, PackingError.MaxTangentDegrees, PackingError.MaxBinormalDegrees);
+        ImGui::TreePop();
+    }
+    if (ImGui::TreeNode("Pipeline state"))
+    {
+        const StateTracker::Stats& TrackerStats = Tracker->GetLastFrameStats();
+        const StateCache::Stats& CacheStats = States->GetStats();
+        ImGui::Text("Set calls last frame : %u issued, %u filtered", TrackerStats.Issued, TrackerStats.Filtered);
+        ImGui::Text("State objects : %zu, created %u, reused %u", States->GetStateCount(), CacheStats.Created, CacheStats.Reused);
+        ImGui::Text("Constants : %.1f KB uploaded last frame in %u maps", ConstantRing->GetFrameBytes() / 1024.0f, ConstantRing->GetFrameMaps());
+
+        const RenderQueue::Stats& QueueStats = DrawQueue.GetLastStats();
+        ImGui::Checkbox("Sort draws", &bSortDraws);
+        ImGui::Text("Draws %u : %u bindings, %u avoided, sorted in %.3f ms", QueueStats.Draws, QueueStats.Bindings, QueueStats.BindingsAvoided, QueueStats.SortMs);
+        ImGui::Text("Light proxies : %zu instances in 1 draw, uploaded %u times", LightProxies->GetInstanceCount(), LightProxies->GetUploadCount());
+        if (ImGui::Button("Benchmark draw queue"))
+            QueueBenchmark = DrawQueue.RunBenchmark(100);
+        if (QueueBenchmark.Draws > 0)
+        {
+            ImGui::Text("%zu draws : %u bindings in scene order, %u sorted", QueueBenchmark.Draws, QueueBenchmark.UnsortedBindings, QueueBenchmark.SortedBindings);
+            ImGui::Text("Radix sort %.4f ms, std::sort %.4f ms", QueueBenchmark.RadixMs, QueueBenchmark.StdSortMs);
+        }
+
+        const ShaderCache::Stats ShaderStats = ShaderCache::GetStats();
+        ImGui::Text("Shader cache : %u hits, %u misses", ShaderStats.Hits, ShaderStats.Misses);
+        ImGui::Text("Shaders compiled in %.1f ms, loaded in %.1f ms, %.1f ms of compiling saved", ShaderStats.CompileMs, ShaderStats.LoadMs, ShaderStats.SavedMs);
+        ImGui::Text("Lit variants : %u built in %.1f ms, %u used last frame", ShaderVariantSet::VariantCount, LitPixelShaders->GetBuildMs(), VariantsUsed);
+        ImGui::Text("Variant selection test : %s", bVariantSelectionPassed ? "passed" : "FAILED");
+        ImGui::TreePop();
+    }
+    if (ImGui::TreeNode("Texture cooking"))
+    {
+        ImGui::Checkbox("BC7 albedo", &CookSettings.bAlbedoBC7);
+        ImGui::SameLine();
+        if (ImGui::Button("Cook scene textures"))
+            CookSceneTextures();
+
+        size_t TotalUncompressed = 0;
+        size_t TotalCooked = 0;
+        double TotalMs = 0.0;
+        for (const TextureCooker::Report& Report : CookReports)
+        {
+            const std::string Name = DX::WStringToString(Report.SourcePath.substr(Report.SourcePath.find_last_of(L"\\/") + 1));
+            if (!Report.bSuccess)
+            {
+                ImGui::Text("%s : failed", Name.c_str());
+                continue;
+            }
+
+            ImGui::Text("%s : %s %ux%u, %u mips, %.2f -> %.2f MB (%.1f:1), PSNR %.1f dB, %.0f ms", Name.c_str(), TextureCooker::GetFormatName(Report.Format),
+                Report.Width, Report.Height, Report.MipCount, Report.UncompressedBytes / (1024.0 * 1024.0), Report.CookedBytes / (1024.0 * 1024.0),
+                double(Report.UncompressedBytes) / double(std::max<size_t>(1, Report.CookedBytes)), Report.PSNR, Report.Milliseconds);
+            TotalUncompressed += Report.UncompressedBytes;
+            TotalCooked += Report.CookedBytes;
+            TotalMs += Report.Milliseconds;
+        }
+        if (TotalCooked > 0)
+            ImGui::Text("Total : %.1f -> %.1f MB, %.0f ms of encoding", TotalUncompressed / (1024.0 * 1024.0), TotalCooked / (1024.0 * 1024.0), TotalMs);
+        ImGui::TreePop();
+    }
 
     ImGui::SliderFloat("Camera Speed", &SceneCamera->Speed, 0.1f, 50.0f);
 	static float SunDiffuseColor[3] = { Sun->DiffuseColor.x, Sun->DiffuseColor.y, Sun->DiffuseColor.z };
@@ -267,6 +725,60 @@ void Renderer::DrawGui()
 
 	if (ImGui::Button("Toggle Light Emitters"))
 		bDrawLightEmitters = !bDrawLightEmitters;
+
+    if (ImGui::CollapsingHeader("Benchmarks"))
+    {
+        if (ImGui::Button("OBJ parser"))
+            RunObjBenchmark();
+
+        if (ImGui::TreeNode("OBJ parser results"))
+        {
+            if (ObjBenchmarkResults.empty())
+                ImGui::Text("No results, no .obj found in Assets/Models or not run yet");
+
+            for (const ObjBenchmarkResult& Result : ObjBenchmarkResults)
+            {
+                if (Result.bLoaded)
+                    ImGui::Text("%s : %.1f MB, %.1f MB/s, %.2f M lines/s, %u chunks", Result.Name.c_str(), Result.MegaBytes, Result.MegaBytesPerSecond, Result.LinesPerSecond / 1000000.0, Result.Chunks);
+                else
+                    ImGui::Text("%s : failed to load", Result.Name.c_str());
+            }
+            ImGui::TreePop();
+        }
+
+        // About 2 million vertices
+        if (ImGui::Button("Mesh ingestion"))
+            IngestionBenchmark = Mesh::RunIngestionBenchmark(1448, 5);
+        if (IngestionBenchmark.Vertices > 0)
+        {
+            ImGui::Text("%zu vertices, %zu indices, per run :", IngestionBenchmark.Vertices, IngestionBenchmark.Indices);
+            ImGui::Text("    One by one %.2f ms, %llu allocations", IngestionBenchmark.OneByOneMs, static_cast<unsigned long long>(IngestionBenchmark.OneByOneAllocations));
+            ImGui::Text("    Bulk %.2f ms, %llu allocations", IngestionBenchmark.BulkMs, static_cast<unsigned long long>(IngestionBenchmark.BulkAllocations));
+        }
+
+        if (ImGui::Button("Mesh optimizer"))
+            RunMeshAnalysis();
+
+        if (ImGui::TreeNode("Mesh optimizer results"))
+        {
+            if (MeshAnalysisResults.empty())
+                ImGui::Text("No results, no .obj found in Assets/Models or not run yet");
+
+            for (const MeshAnalysisResult& Result : MeshAnalysisResults)
+            {
+                if (!Result.bLoaded)
+                {
+                    ImGui::Text("%s : failed to load", Result.Name.c_str());
+                    continue;
+                }
+                ImGui::Text("%s : %u meshes, %zu triangles, optimized in %.1f ms", Result.Name.c_str(), Result.Meshes, Result.CacheBefore.Triangles, Result.OptimizeMs);
+                ImGui::Text("    ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, overdraw %.3f -> %.3f",
+                    Result.CacheBefore.GetACMR(), Result.CacheAfter.GetACMR(), Result.CacheBefore.GetATVR(), Result.CacheAfter.GetATVR(),
+                    Result.OverdrawBefore.GetOverdraw(), Result.OverdrawAfter.GetOverdraw());
+            }
+            ImGui::TreePop();
+        }
+    }
         
     //ImGui::ShowDemoWindow();
 
@@ -282,14 +794,11 @@ void Renderer::Clear()
     D3dContext->ClearRenderTargetView(RenderTargetView.Get(), Colors::Aqua);
     D3dContext->ClearDepthStencilView(DepthStencilView.Get(), D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
 
-    D3dContext->OMSetRenderTargets(1, RenderTargetView.GetAddressOf(), DepthStencilView.Get());
+    Tracker->SetRenderTarget(RenderTargetView.Get(), DepthStencilView.Get());
 
     // Set the viewport.
     CD3D11_VIEWPORT viewport(0.0f, 0.0f, static_cast<float>(OutputWidth), static_cast<float>(OutputHeight));
-    D3dContext->RSSetViewports(1, &viewport);
-
-    D3dContext->RSSetState(SolidState);
-    D3dContext->OMSetDepthStencilState(DepthStencilState.Get(), 0);
+    Tracker->SetViewport(viewport);
 }
 
 // Presents the back buffer contents to the screen.
@@ -352,37 +861,359 @@ void Renderer::GetDefaultSize(int& width, int& height) const noexcept
     height = 1080;
 }
 
-void Renderer::LoadNewModel(std::wstring Path)
+void Renderer::ForEachAssetModel(const std::function<void(const std::wstring&, const std::string&)>& Visit)
 {
-    SceneCamera->SetPosition(XMVectorSet(0.0f, 5.0f, -7.0f, 0.0f));
+    // Every model lives in its own folder of Assets/Models
+    WIN32_FIND_DATAW FolderData;
+    HANDLE FolderHandle = FindFirstFileW(L"Assets/Models/*", &FolderData);
+    if (FolderHandle == INVALID_HANDLE_VALUE)
+        return;
+
+    do
+    {
+        if (!(FolderData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || FolderData.cFileName[0] == L'.')
+            continue;
+
+        const std::wstring Folder = std::wstring(L"Assets/Models/") + FolderData.cFileName + L"/";
+
+        WIN32_FIND_DATAW FileData;
+        HANDLE FileHandle = FindFirstFileW((Folder + L"*.obj").c_str(), &FileData);
+        if (FileHandle == INVALID_HANDLE_VALUE)
+            continue;
+
+        do
+        {
+            Visit(Folder + FileData.cFileName, DX::WStringToString(FileData.cFileName));
+        } while (FindNextFileW(FileHandle, &FileData));
+
+        FindClose(FileHandle);
+    } while (FindNextFileW(FolderHandle, &FolderData));
+
+    FindClose(FolderHandle);
+}
+
+void Renderer::RunObjBenchmark()
+{
+    ObjBenchmarkResults.clear();
+
+    ForEachAssetModel([this](const std::wstring& Path, const std::string& Name)
+    {
+        objl::Loader Loader;
+
+        ObjBenchmarkResult Result;
+        Result.Name = Name;
+        Result.bLoaded = Loader.LoadFile(Path);
+        Result.MegaBytes = Loader.Stats.Bytes / (1024.0 * 1024.0);
+        Result.MegaBytesPerSecond = Loader.Stats.GetMegaBytesPerSecond();
+        Result.LinesPerSecond = Loader.Stats.GetLinesPerSecond();
+        Result.Chunks = Loader.Stats.Chunks;
+        ObjBenchmarkResults.push_back(Result);
+    });
+}
+
+void Renderer::RunMeshAnalysis()
+{
+    MeshAnalysisResults.clear();
+
+    ForEachAssetModel([this](const std::wstring& Path, const std::string& Name)
+    {
+        MeshAnalysisResult Result;
+        Result.Name = Name;
+
+        // Same import as LoadNewModel, without the cache, which only holds optimized meshes
+        Assimp::Importer Importer;
+        const aiScene* Scene = Importer.ReadFile(DX::WStringToString(Path), ModelImportFlags);
+        Result.bLoaded = Scene != nullptr;
+        if (!Scene)
+        {
+            MeshAnalysisResults.push_back(Result);
+            return;
+        }
+
+        struct MeshResult
+        {
+            MeshOptimizer::VertexCacheStats CacheBefore, CacheAfter;
+            MeshOptimizer::OverdrawStats OverdrawBefore, OverdrawAfter;
+            double OptimizeMs = 0.0;
+        };
+        std::vector<MeshResult> MeshResults(Scene->mNumMeshes);
+
+        ThreadPool::Get().ParallelFor(Scene->mNumMeshes, 1, [&](size_t Begin, size_t End)
+        {
+            for (size_t iMesh = Begin; iMesh < End; ++iMesh)
+            {
+                const aiMesh* AssimpMesh = Scene->mMeshes[iMesh];
+                std::vector<XMFLOAT3> Positions(AssimpMesh->mNumVertices);
+                memcpy(Positions.data(), AssimpMesh->mVertices, Positions.size() * sizeof(XMFLOAT3));
+
+                std::vector<uint32_t> Indices;
+                Indices.reserve(size_t(AssimpMesh->mNumFaces) * 3);
+                for (unsigned int iFace = 0; iFace < AssimpMesh->mNumFaces; ++iFace)
+                {
+                    const aiFace& Face = AssimpMesh->mFaces[iFace];
+                    if (Face.mNumIndices == 3)
+                        Indices.insert(Indices.end(), Face.mIndices, Face.mIndices + 3);
+                }
+
+                MeshResult& Measure = MeshResults[iMesh];
+                Measure.CacheBefore = MeshOptimizer::AnalyzeVertexCache(Indices.data(), Indices.size(), Positions.size());
+                Measure.OverdrawBefore = MeshOptimizer::AnalyzeOverdraw(Indices.data(), Indices.size(), Positions.data(), sizeof(XMFLOAT3), Positions.size());
+
+                // The steps of Mesh::OptimizeGeometry
+                auto OptimizeStart = std::chrono::steady_clock::now();
+                MeshOptimizer::OptimizeVertexCache(Indices.data(), Indices.size(), Positions.size());
+                MeshOptimizer::OptimizeOverdraw(Indices.data(), Indices.size(), Positions.data(), sizeof(XMFLOAT3), Positions.size());
+                Positions.resize(MeshOptimizer::OptimizeVertexFetch(Positions.data(), sizeof(XMFLOAT3), Positions.size(), Indices.data(), Indices.size()));
+                Measure.OptimizeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - OptimizeStart).count();
+
+                Measure.CacheAfter = MeshOptimizer::AnalyzeVertexCache(Indices.data(), Indices.size(), Positions.size());
+                Measure.OverdrawAfter = MeshOptimizer::AnalyzeOverdraw(Indices.data(), Indices.size(), Positions.data(), sizeof(XMFLOAT3), Positions.size());
+            }
+        });
+
+        Result.Meshes = Scene->mNumMeshes;
+        for (const MeshResult& Measure : MeshResults)
+        {
+            Result.CacheBefore.Add(Measure.CacheBefore);
+            Result.CacheAfter.Add(Measure.CacheAfter);
+            Result.OverdrawBefore.Add(Measure.OverdrawBefore);
+            Result.OverdrawAfter.Add(Measure.OverdrawAfter);
+            Result.OptimizeMs += Measure.OptimizeMs;
+        }
+        MeshAnalysisResults.push_back(Result);
+    });
+}
+
+void Renderer::UpdateSceneQueries()
+{
+    // The hierarchy keeps its shape, only the nodes above the moved meshes are refit
+    for (uint32_t iMesh : MovedMeshes)
+    {
+        RefreshMeshEntity(iMesh);
+        const BoundsComponent* Bounds = Entities.Get<BoundsComponent>(MeshEntities[iMesh]);
+        SceneBounds.Set(iMesh, Bounds->Box, Bounds->Sphere);
+        SceneHierarchy.UpdateObject(iMesh, Bounds->Box);
+    }
+    MovedMeshes.clear();
+    SceneHierarchy.Refit();
+
+    // Only the first MAX_LIGHTS lights are uploaded, they are already in the per frame constants
+    MeshLightMasks.assign(MeshEntities.size(), 0);
+    for (unsigned int i = 0; i < static_cast<unsigned int>(PerFrameBuffStruct_PS.LightsCount); ++i)
+    {
+        const PointLightData& LightData = PerFrameBuffStruct_PS.PointLights[i];
+        ReachedMeshes.clear();
+        SceneHierarchy.QuerySphere(BoundingSphere(LightData.Position, LightData.Range), ReachedMeshes);
+        for (uint32_t iMesh : ReachedMeshes)
+        {
+            MeshLightMasks[iMesh] |= uint8_t(1 << i);
+        }
+    }
+}
+
+unsigned int Renderer::GatherLights(size_t MeshIndex, unsigned int OutIndices[MAX_LIGHTS]) const
+{
+    unsigned int Count = 0;
+    const uint8_t Mask = MeshIndex < MeshLightMasks.size() ? MeshLightMasks[MeshIndex] : 0;
+    for (unsigned int i = 0; i < MAX_LIGHTS; ++i)
+    {
+        if (Mask & (1 << i))
+        {
+            OutIndices[Count++] = i;
+        }
+    }
+    return Count;
+}
+
+Mesh* Renderer::GetMesh(size_t MeshIndex) const
+{
+    return MeshPool->Get(Entities.Get<RenderMeshComponent>(MeshEntities[MeshIndex])->Source);
+}
+
+void Renderer::RefreshMeshEntity(size_t MeshIndex)
+{
+    const Mesh* Source = GetMesh(MeshIndex);
+    const EntityStore::Entity MeshEntity = MeshEntities[MeshIndex];
+
+    TransformComponent* Transform = Entities.Get<TransformComponent>(MeshEntity);
+    XMStoreFloat4x4(&Transform->World, Source->GetWorldMatrix());
+    const XMFLOAT3 Scale = Source->GetScale();
+    Transform->MaxScale = std::max({ fabsf(Scale.x), fabsf(Scale.y), fabsf(Scale.z) });
+
+    BoundsComponent* Bounds = Entities.Get<BoundsComponent>(MeshEntity);
+    Bounds->Box = Source->GetWorldBounds();
+    Bounds->Sphere = Source->GetWorldSphere();
+}
+
+void Renderer::UnloadScene()
+{
+    auto UnloadStart = std::chrono::steady_clock::now();
+
+    Entities.Clear();
+    MeshEntities.clear();
+    SceneBounds.Resize(0);
+    SceneHierarchy.Clear();
+    MovedMeshes.clear();
+    SelectedMesh = -1;
+
+    // The ranges go back to the arena in one pass first, so the meshes released after them have nothing left to free
+    LastUnload.Buffers = Geometry->ReleaseLifetime(EResourceLifetime::Scene);
+    LastUnload.Meshes = MeshPool->ReleaseLifetime(EResourceLifetime::Scene);
+    LastUnload.Materials = Materials->ReleaseLifetime(EResourceLifetime::Scene);
+    LastUnload.Textures = Textures->ReleaseLifetime(EResourceLifetime::Scene);
+    LastUnload.UnloadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - UnloadStart).count();
+}
+
+bool Renderer::RunVariantSelectionTest()
+{
+    struct Case
+    {
+        const wchar_t* NormalMapPath;
+        const wchar_t* SpecularMapPath;
+        bool bNormalMap;
+        bool bSpecularMap;
+    };
+    // Default textures and maps that failed to load, which InitMaterial clears, count as missing
+    const Case Cases[] =
+    {
+        { Mesh::DefaultNormalMapPath, Mesh::DefaultTexturePath, false, false },
+        { L"", L"", false, false },
+        { L"Assets/Models/Test/Bump.png", Mesh::DefaultTexturePath, true, false },
+        { Mesh::DefaultNormalMapPath, L"Assets/Models/Test/Specular.png", false, true },
+        { L"Assets/Models/Test/Bump.png", L"Assets/Models/Test/Specular.png", true, true },
+    };
+
+    Mesh Source;
+    for (unsigned int Lights : { 0u, 1u, unsigned(MAX_LIGHTS), unsigned(MAX_LIGHTS) + 3 })
+    {
+        // Each combination of maps must end up in its own variant
+        bool bIndexUsed[ShaderVariantSet::VariantCount] = {};
+        unsigned int Distinct = 0;
+        for (const Case& Current : Cases)
+        {
+            Source.NormalMapPath = Current.NormalMapPath;
+            Source.SpecularMapPath = Current.SpecularMapPath;
+
+            // Same path as the draws : the component built at load, then Select with the lights reaching the mesh
+            const MaterialComponent Material = MakeMaterialComponent(Source);
+            const ShaderVariantKey Variant = ShaderVariantSet::Select(Material.bNormalMap, Material.bSpecularMap, Lights);
+            if (Variant.bNormalMap != Current.bNormalMap || Variant.bSpecularMap != Current.bSpecularMap
+                || Variant.PointLightCount != std::min<unsigned int>(Lights, MAX_LIGHTS))
+            {
+                return false;
+            }
+
+            const unsigned int Index = ShaderVariantSet::GetIndex(Variant);
+            Distinct += bIndexUsed[Index] ? 0 : 1;
+            bIndexUsed[Index] = true;
+        }
+        if (Distinct != 4)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Renderer::PickAt(int X, int Y)
+{
+    // Ray from the near plane to the far plane through the pixel
+    const XMMATRIX View = SceneCamera->GetViewMatrix();
+    const XMMATRIX Projection = SceneCamera->GetProjectionMatrix();
+    const float Width = static_cast<float>(OutputWidth);
+    const float Height = static_cast<float>(OutputHeight);
+    const XMVECTOR Near = XMVector3Unproject(XMVectorSet(float(X), float(Y), 0.0f, 0.0f), 0.0f, 0.0f, Width, Height, 0.0f, 1.0f, Projection, View, XMMatrixIdentity());
+    const XMVECTOR Far = XMVector3Unproject(XMVectorSet(float(X), float(Y), 1.0f, 0.0f), 0.0f, 0.0f, Width, Height, 0.0f, 1.0f, Projection, View, XMMatrixIdentity());
+
+    float Distance = 0.0f;
+    const uint32_t Hit = SceneHierarchy.Raycast(Near, XMVector3Normalize(XMVectorSubtract(Far, Near)), Distance);
+    SelectedMesh = Hit == SceneBVH::InvalidObject ? -1 : static_cast<int>(Hit);
+}
+
+void Renderer::CookSceneTextures()
+{
+    // Each image once per use
+    std::vector<std::pair<std::wstring, ETextureKind>> Sources;
+    auto AddSource = [&Sources](const std::wstring& Path, ETextureKind Kind)
+    {
+        if (!Path.empty() && std::find(Sources.begin(), Sources.end(), std::make_pair(Path, Kind)) == Sources.end())
+            Sources.emplace_back(Path, Kind);
+    };
+
+    for (size_t iMesh = 0; iMesh < MeshEntities.size(); ++iMesh)
+    {
+        const Mesh* SceneMesh = GetMesh(iMesh);
+        AddSource(SceneMesh->TexturePath, ETextureKind::Albedo);
+        AddSource(SceneMesh->NormalMapPath, ETextureKind::NormalMap);
+        AddSource(SceneMesh->SpecularMapPath, ETextureKind::SpecularMap);
+    }
+
+    // Images are cooked in parallel, and their blocks too
+    CookReports.clear();
+    CookReports.resize(Sources.size());
+    ThreadPool::Get().ParallelFor(Sources.size(), 1, [this, &Sources](size_t Begin, size_t End)
+    {
+        for (size_t iSource = Begin; iSource < End; ++iSource)
+            CookReports[iSource] = TextureCooker::Cook(Sources[iSource].first, Sources[iSource].second, CookSettings);
+    });
+
+    // The registry still knows the source images, reload through the cooked files
+    Textures->Invalidate();
+    LoadNewModel(CurrentModelPath);
+}
 
+void Renderer::LoadNewModel(std::wstring Path)
+{
     // load a mesh  
     wchar_t Dir[_MAX_DIR];
     wchar_t Dump[_MAX_PATH];
 
     _wsplitpath_s(Path.c_str(), Dump, Dir, Dump, Dump);
-    Meshes.clear();
 
-	Assimp::Importer Importer;
+    auto LoadStart = std::chrono::steady_clock::now();
 
-	const aiScene* Scene = Importer.ReadFile(DX::WStringToString(Path), aiProcess_CalcTangentSpace |
-		aiProcess_Triangulate |
-        aiProcess_FlipUVs |
-		aiProcess_JoinIdenticalVertices |
-		aiProcess_SortByPType);
+    // Try the cooked version of the model first
+    const uint64_t CacheKey = bUseMeshCache ? MeshCache::ComputeKey(Path, ModelImportFlags) : 0;
+    std::vector<Mesh*> Meshes;
+    std::vector<MeshCache::CookedLight> SceneLights;
 
-    if (Scene)
+    LoadStats.bFromCache = CacheKey != 0 && MeshCache::Load(MeshCache::GetCachePath(CacheKey), CacheKey, Meshes, SceneLights);
+    LoadStats.ImportMs = 0.0;
+    LoadStats.ConvertMs = 0.0;
+    LoadStats.CacheMs = LoadStats.bFromCache ? std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - LoadStart).count() : 0.0;
+
+    if (!LoadStats.bFromCache)
     {
-        // Extract the models
-        aiNode* Node = Scene->mRootNode;
-        ParseAssimpNode(Node, Scene, Dir);
+        Assimp::Importer Importer;
 
-        if (Sun)
+        // A model that doesn't import leaves the current scene as it is
+        const aiScene* Scene = Importer.ReadFile(DX::WStringToString(Path), ModelImportFlags);
+        if (!Scene)
         {
-            delete Sun;
-            Sun = nullptr;
+            return;
         }
-        Lights.clear();
+
+        auto ImportEnd = std::chrono::steady_clock::now();
+        LoadStats.ImportMs = std::chrono::duration<double, std::milli>(ImportEnd - LoadStart).count();
+
+        // Extract the models : the node tree is flattened first so the meshes keep the order of a depth first walk,
+        // then every aiMesh is converted on the thread pool
+        std::vector<AssimpMeshRef> SceneMeshes;
+        ParseAssimpNode(Scene->mRootNode, Scene, SceneMeshes);
+
+        const std::wstring ContainingFolder(Dir);
+        const size_t FirstMesh = Meshes.size();
+        Meshes.resize(FirstMesh + SceneMeshes.size());
+
+        ThreadPool::Get().ParallelFor(SceneMeshes.size(), 1, [&](size_t Begin, size_t End)
+        {
+            for (size_t i = Begin; i < End; ++i)
+            {
+                Meshes[FirstMesh + i] = new Mesh(SceneMeshes[i].AssimpMesh, SceneMeshes[i].Node, Scene, ContainingFolder);
+            }
+        });
+
+        LoadStats.ConvertMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - ImportEnd).count();
 
         // Extract the lights
         for (unsigned int i = 0; i < Scene->mNumLights; ++i)
@@ -391,74 +1222,135 @@ void Renderer::LoadNewModel(std::wstring Path)
 
             if (CurrentLight)
             {
-				XMFLOAT3 Position = XMFLOAT3(CurrentLight->mPosition.x, CurrentLight->mPosition.y, CurrentLight->mPosition.z);
-				XMFLOAT4 Ambient = XMFLOAT4(CurrentLight->mColorAmbient.r, CurrentLight->mColorAmbient.g, CurrentLight->mColorAmbient.b, 1.0f);
-				XMFLOAT4 Diffuse = XMFLOAT4(CurrentLight->mColorDiffuse.r, CurrentLight->mColorDiffuse.g, CurrentLight->mColorDiffuse.b, 1.0f);
-				XMFLOAT4 Specular = XMFLOAT4(CurrentLight->mColorSpecular.r, CurrentLight->mColorSpecular.g, CurrentLight->mColorSpecular.b, 1.0f);
-
-				if (CurrentLight->mType == aiLightSource_DIRECTIONAL)
-				{
-					XMFLOAT3 Direction = XMFLOAT3(CurrentLight->mDirection.x, CurrentLight->mDirection.y, CurrentLight->mDirection.z);
+                if (CurrentLight->mType == aiLightSource_DIRECTIONAL)
+                {
+                    MeshCache::CookedLight Directional;
+                    Directional.Position = XMFLOAT3(CurrentLight->mPosition.x, CurrentLight->mPosition.y, CurrentLight->mPosition.z);
+                    Directional.AmbientColor = XMFLOAT4(CurrentLight->mColorAmbient.r, CurrentLight->mColorAmbient.g, CurrentLight->mColorAmbient.b, 1.0f);
+                    Directional.DiffuseColor = XMFLOAT4(CurrentLight->mColorDiffuse.r, CurrentLight->mColorDiffuse.g, CurrentLight->mColorDiffuse.b, 1.0f);
+                    Directional.SpecularColor = XMFLOAT4(CurrentLight->mColorSpecular.r, CurrentLight->mColorSpecular.g, CurrentLight->mColorSpecular.b, 1.0f);
+                    Directional.Direction = XMFLOAT3(CurrentLight->mDirection.x, CurrentLight->mDirection.y, CurrentLight->mDirection.z);
 
-					DirectionalLight* Directional = new DirectionalLight(Position, Ambient, Diffuse, Specular, Direction);
                     // We add some ambient as we do not have GI for now
-                    if (Directional->AmbientColor.x == 0.0f && Directional->AmbientColor.y == 0.0f && Directional->AmbientColor.z == 0.0f);
+                    if (Directional.AmbientColor.x == 0.0f && Directional.AmbientColor.y == 0.0f && Directional.AmbientColor.z == 0.0f)
                     {
-                        Directional->AmbientColor = XMFLOAT4(.1f, .1f, .1f, 1.0f);
+                        Directional.AmbientColor = XMFLOAT4(.1f, .1f, .1f, 1.0f);
                     }
 
-					Sun = Directional;
-				}
+                    SceneLights.push_back(Directional);
+                }
 
-				if (CurrentLight->mType == aiLightSource_POINT)
-				{
-					//XMFLOAT3 Attenuation = XMFLOAT3(CurrentLight->mAttenuationConstant, CurrentLight->mAttenuationLinear, CurrentLight->mAttenuationQuadratic);
+                if (CurrentLight->mType == aiLightSource_POINT)
+                {
+                    //XMFLOAT3 Attenuation = XMFLOAT3(CurrentLight->mAttenuationConstant, CurrentLight->mAttenuationLinear, CurrentLight->mAttenuationQuadratic);
 
-					//PointLight* Point = new PointLight(Position, Ambient, Diffuse, Specular, Attenuation);
-					//Lights.push_back(Point);
-				}
-            }		
+                    //PointLight* Point = new PointLight(Position, Ambient, Diffuse, Specular, Attenuation);
+                    //Lights.push_back(Point);
+                }
+            }
         }
 
-		if (!Sun)
-		{
-			Sun = new DirectionalLight(XMFLOAT3(0.8, -0.1, -0.6), XMFLOAT4(.1f, .1f, .1f, 1.0f), XMFLOAT4(1.f, 1.f, 1.f, 1.0f), XMFLOAT4(1.f, 1.f, 1.f, 1.0f), XMFLOAT3(0.8, -0.1, -0.6));
-		}
+        if (CacheKey != 0)
+        {
+            auto CacheStart = std::chrono::steady_clock::now();
+            MeshCache::Save(MeshCache::GetCachePath(CacheKey), CacheKey, Meshes, SceneLights);
+            LoadStats.CacheMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - CacheStart).count();
+        }
+    }
+
+    auto GeometryEnd = std::chrono::steady_clock::now();
+
+    // The new scene is ready, the resources of the previous one are released before the GPU resources of the new one are created
+    UnloadScene();
+    CurrentModelPath = Path;
+    AllocationCheckTicks = 0;
+    SceneCamera->SetPosition(XMVectorSet(0.0f, 5.0f, -7.0f, 0.0f));
+
+    Textures->ResetStats();
+    for (Mesh* NewMesh : Meshes)
+    {
+        NewMesh->InitMesh(D3dContext, *Materials, *Geometry);
+    }
+
+    // World bounds are computed once, then again for the meshes that report a move.
+    // The transforms set by the loading are flushed first so they aren't reported as moves
+    TransformSystem::Get().Update();
+    // Each mesh becomes an entity, its index in the scene queries is its load order
+    std::vector<BoundingBox> WorldBounds(Meshes.size());
+    SceneBounds.Resize(Meshes.size());
+    MeshEntities.resize(Meshes.size());
+    for (size_t i = 0; i < Meshes.size(); ++i)
+    {
+        RenderMeshComponent RenderMesh;
+        RenderMesh.Source = MeshPool->Add(Meshes[i], EResourceLifetime::Scene, Meshes[i]->GetCpuBytes());
+        RenderMesh.QueryIndex = static_cast<uint32_t>(i);
+        RenderMesh.Quantization = Meshes[i]->PositionQuantization;
+
+        TransformComponent Transform;
+        Transform.Transform = Meshes[i]->GetTransformId();
+
+        const MaterialComponent Material = MakeMaterialComponent(*Meshes[i]);
+
+        MeshEntities[i] = Entities.Create(RenderMesh, Transform, BoundsComponent(), Material);
+        RefreshMeshEntity(i);
+
+        const BoundsComponent* Bounds = Entities.Get<BoundsComponent>(MeshEntities[i]);
+        WorldBounds[i] = Bounds->Box;
+        SceneBounds.Set(i, Bounds->Box, Bounds->Sphere);
+        Meshes[i]->OnTransformChanged = [this, i] { MovedMeshes.push_back(static_cast<uint32_t>(i)); };
+    }
+    SceneHierarchy.Build(WorldBounds);
+
+    auto LoadEnd = std::chrono::steady_clock::now();
 
-        AddPointLight(XMFLOAT3(-10.0, 10.0, -10.0), XMFLOAT4(1.f, 0.f, 0.f, 1.0f), XMFLOAT4(1.f, 0.f, 0.f, 1.0f));
+    LoadStats.GeometryMs = std::chrono::duration<double, std::milli>(GeometryEnd - LoadStart).count();
+    LoadStats.InitMs = std::chrono::duration<double, std::milli>(LoadEnd - GeometryEnd).count();
+    (LoadStats.bFromCache ? LoadStats.LastCachedMs : LoadStats.LastImportMs) = LoadStats.GeometryMs;
 
-        AddPointLight(XMFLOAT3(5.0, 10.0, 50.0), XMFLOAT4(0.f, 0.f, 1.f, 1.0f), XMFLOAT4(0.f, 0.f, 1.f, 1.0f));		
+    if (Sun)
+    {
+        delete Sun;
+        Sun = nullptr;
+    }
 
+    for (const MeshCache::CookedLight& Directional : SceneLights)
+    {
+        Sun = new DirectionalLight(Directional.Position, Directional.AmbientColor, Directional.DiffuseColor, Directional.SpecularColor, Directional.Direction);
     }
+
+    if (!Sun)
+    {
+        Sun = new DirectionalLight(XMFLOAT3(0.8, -0.1, -0.6), XMFLOAT4(.1f, .1f, .1f, 1.0f), XMFLOAT4(1.f, 1.f, 1.f, 1.0f), XMFLOAT4(1.f, 1.f, 1.f, 1.0f), XMFLOAT3(0.8, -0.1, -0.6));
+    }
+
+    AddPointLight(XMFLOAT3(-10.0, 10.0, -10.0), XMFLOAT4(1.f, 0.f, 0.f, 1.0f), XMFLOAT4(1.f, 0.f, 0.f, 1.0f));
+
+    AddPointLight(XMFLOAT3(5.0, 10.0, 50.0), XMFLOAT4(0.f, 0.f, 1.f, 1.0f), XMFLOAT4(0.f, 0.f, 1.f, 1.0f));
 }
 
 void Renderer::AddPointLight(XMFLOAT3 Position, XMFLOAT4 DiffuseColor, XMFLOAT4 SpecularColor)
 {
-    LightAndMesh NewLightStruct;
-	PointLight* NewLight = new PointLight(Position, XMFLOAT4(0.f, 0.f, 0.f, 1.0f), DiffuseColor, SpecularColor, XMFLOAT3(1.0, 0.0014, 0.000007));
-    Mesh* LightMesh = new Cube(NewLight->GetPosition(), XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(5.0f, 5.0f, 5.0f));
-
-    NewLightStruct.Light = NewLight;
-    NewLightStruct.LightMesh = LightMesh;
+	PointLight NewLight(Position, XMFLOAT4(0.f, 0.f, 0.f, 1.0f), DiffuseColor, SpecularColor, XMFLOAT3(1.0, 0.0014, 0.000007));
 
-	Lights.push_back(NewLightStruct);
+	// The light is an entity with its shader data, drawn by the LightProxies batch
+	LightComponent Light;
+	Light.Data = NewLight.GetLightData();
+	Entities.Create(Light);
 }
 
-void Renderer::ParseAssimpNode(aiNode* Node, const aiScene* Scene, wchar_t* Dir)
+void Renderer::ParseAssimpNode(aiNode* Node, const aiScene* Scene, std::vector<AssimpMeshRef>& OutMeshes)
 {
 	for (unsigned int i = 0; i < Node->mNumMeshes; ++i)
 	{
-		aiMesh* CurrentMesh = Scene->mMeshes[Node->mMeshes[i]];
-
-		Mesh* NewMesh = new Mesh(CurrentMesh, Node, Scene, std::wstring(Dir));
-
-		NewMesh->InitMesh(D3dDevice, D3dContext);
-		Meshes.push_back(NewMesh);
+		AssimpMeshRef MeshRef;
+		MeshRef.AssimpMesh = Scene->mMeshes[Node->mMeshes[i]];
+		MeshRef.Node = Node;
+		OutMeshes.push_back(MeshRef);
 	}
 
     for (unsigned int i = 0; i < Node->mNumChildren; ++i)
     {
-        ParseAssimpNode(Node->mChildren[i], Scene, Dir);
+        ParseAssimpNode(Node->mChildren[i], Scene, OutMeshes);
     }
 }
 
@@ -535,28 +1427,48 @@ void Renderer::CreateDevice()
     // Initialize the camera
     SceneCamera = new Camera();
 
+    // Pipeline states are shared by everything that asks for the same descriptor
+    States = new StateCache(D3dDevice);
+    Tracker = new StateTracker(D3dContext);
+    ConstantRing = new ConstantBufferRing(D3dDevice);
+
+    // Materials, textures and geometry are shared by every mesh of the scene
+    MeshPool = new ResourcePool<Mesh>("Meshes");
+    Textures = new TextureRegistry(D3dDevice, D3dContext, *States);
+    Materials = new MaterialRegistry(*Textures);
+    Geometry = new GeometryArena(D3dDevice, sizeof(PackedVertex));
+
+    // Every light proxy is an instance of the same cube, kept with its resources when scenes are unloaded
+    Mesh* ProxyCube = new Cube();
+    ProxyCube->Lifetime = EResourceLifetime::Engine;
+    ProxyCube->InitMesh(D3dContext, *Materials, *Geometry);
+    MeshPool->Add(ProxyCube, EResourceLifetime::Engine, ProxyCube->GetCpuBytes());
+    LightProxies = new InstanceBatch(D3dDevice, ProxyCube);
+
     // load a mesh
     LoadNewModel(L"Assets/Models/Shapes/TestScene.obj");
 
     // Compile the shaders
 	VertexShader = new Shader(L"Shaders/SimpleVertexShader.hlsl", EShaderType::VertexShader, device);
-	PixelShader = new Shader(L"Shaders/SimplePixelShader.hlsl", EShaderType::PixelShader, device);
+	LitPixelShaders = new ShaderVariantSet(L"Shaders/SimplePixelShader.hlsl", device);
+	PixelShader = LitPixelShaders->Get(ShaderVariantSet::Select(true, true, MAX_LIGHTS));
+	bVariantSelectionPassed = ShaderVariantSet::RunSelfTest() && RunVariantSelectionTest();
+	assert(bVariantSelectionPassed);
     UnlitPixelShader = new Shader(L"Shaders/UnlitPixelShader.hlsl", EShaderType::PixelShader, device);
     NormalPixelShader = new Shader(L"Shaders/NormalPixelShader.hlsl", EShaderType::PixelShader, device);
+    InstancedVertexShader = new Shader(L"Shaders/InstancedVertexShader.hlsl", EShaderType::VertexShader, device);
+    EmitterPixelShader = new Shader(L"Shaders/EmitterPixelShader.hlsl", EShaderType::PixelShader, device);
 
     CurrentPixelShader = PixelShader;
 
-	// Create and set the InputLayout
-	D3D11_INPUT_ELEMENT_DESC Layout[] =
-	{
-		{ "POSITION",	0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0,	D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "NORMAL",		0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12,	D3D11_INPUT_PER_VERTEX_DATA, 0 },
-        { "TANGENT",	0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 24,	D3D11_INPUT_PER_VERTEX_DATA, 0 },
-        { "BINORMAL",	0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 36,	D3D11_INPUT_PER_VERTEX_DATA, 0 },
-		{ "TEXCOORD",	0, DXGI_FORMAT_R32G32_FLOAT,	0, 48,	D3D11_INPUT_PER_VERTEX_DATA, 0 },
-	};
-	UINT LayoutNum = ARRAYSIZE(Layout);
-	DX::ThrowIfFailed(device->CreateInputLayout(Layout, LayoutNum, VertexShader->ShaderBuffer->GetBufferPointer(), VertexShader->ShaderBuffer->GetBufferSize(), InputLayout.GetAddressOf()));
+	// Create and set the InputLayout, the arena holds packed vertices
+	DX::ThrowIfFailed(device->CreateInputLayout(PackedVertex::InputElements, PackedVertex::InputElementCount, VertexShader->ShaderBuffer->GetBufferPointer(), VertexShader->ShaderBuffer->GetBufferSize(), InputLayout.GetAddressOf()));
+
+	// Instanced meshes read their position from slot 0 and the instances from slot 1
+	D3D11_INPUT_ELEMENT_DESC InstancedLayout[1 + InstanceData::InputElementCount];
+	InstancedLayout[0] = PackedVertex::InputElements[0];
+	std::copy(std::begin(InstanceData::InputElements), std::end(InstanceData::InputElements), InstancedLayout + 1);
+	DX::ThrowIfFailed(device->CreateInputLayout(InstancedLayout, ARRAYSIZE(InstancedLayout), InstancedVertexShader->ShaderBuffer->GetBufferPointer(), InstancedVertexShader->ShaderBuffer->GetBufferSize(), InstancedInputLayout.GetAddressOf()));
 
     // Create the lights
     //Lights.push_back(Light);
@@ -569,9 +1481,9 @@ void Renderer::CreateResources()
     // Clear the previous window size specific context.
     ID3D11RenderTargetView* nullViews [] = { nullptr };
     D3dContext->OMSetRenderTargets(_countof(nullViews), nullViews, nullptr);
+    Tracker->Invalidate();
     RenderTargetView.Reset();
     DepthStencilView.Reset();
-    BlendState.Reset();
 
     D3dContext->Flush();
 
@@ -670,33 +1582,7 @@ void Renderer::CreateResources()
     ZeroMemory(&BlendStateDesc, sizeof(D3D11_BLEND_DESC1));
     BlendStateDesc.RenderTarget[0].BlendEnable = FALSE;
     BlendStateDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
-    DX::ThrowIfFailed(D3dDevice->CreateBlendState1(&BlendStateDesc, BlendState.GetAddressOf()));
-
-    // Constant buffer
-    D3D11_BUFFER_DESC ConstantBufferDescriptor;
-    ZeroMemory(&ConstantBufferDescriptor, sizeof(D3D11_BUFFER_DESC));
-    ConstantBufferDescriptor.Usage = D3D11_USAGE_DEFAULT;
-    ConstantBufferDescriptor.ByteWidth = sizeof(PerObjectBuffStruct_VS);
-    ConstantBufferDescriptor.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-    ConstantBufferDescriptor.CPUAccessFlags = 0;
-    ConstantBufferDescriptor.MiscFlags = 0;
-    DX::ThrowIfFailed(D3dDevice->CreateBuffer(&ConstantBufferDescriptor, nullptr, PerObjectBuffer_VS.GetAddressOf()));
-
-	ZeroMemory(&ConstantBufferDescriptor, sizeof(D3D11_BUFFER_DESC));
-	ConstantBufferDescriptor.Usage = D3D11_USAGE_DEFAULT;
-	ConstantBufferDescriptor.ByteWidth = sizeof(PerFrameBuffStruct_PS);
-	ConstantBufferDescriptor.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-	ConstantBufferDescriptor.CPUAccessFlags = 0;
-	ConstantBufferDescriptor.MiscFlags = 0;
-    DX::ThrowIfFailed(D3dDevice->CreateBuffer(&ConstantBufferDescriptor, nullptr, PerFrameBuffer_PS.GetAddressOf()));
-
-	ZeroMemory(&ConstantBufferDescriptor, sizeof(D3D11_BUFFER_DESC));
-	ConstantBufferDescriptor.Usage = D3D11_USAGE_DEFAULT;
-	ConstantBufferDescriptor.ByteWidth = sizeof(PerObjectBuffStruct_PS);
-	ConstantBufferDescriptor.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-	ConstantBufferDescriptor.CPUAccessFlags = 0;
-	ConstantBufferDescriptor.MiscFlags = 0;
-	DX::ThrowIfFailed(D3dDevice->CreateBuffer(&ConstantBufferDescriptor, nullptr, PerObjectBuffer_PS.GetAddressOf()));
+    BlendState = States->GetBlendState(BlendStateDesc);
 
     FontPos.x = backBufferWidth / 2.0f;
     FontPos.y = backBufferHeight / 2.0f;
@@ -708,12 +1594,12 @@ void Renderer::CreateResources()
     RasterizerDesc.FillMode = D3D11_FILL_SOLID;
     RasterizerDesc.CullMode = D3D11_CULL_NONE;
     RasterizerDesc.MultisampleEnable = true;
-    DX::ThrowIfFailed(D3dDevice->CreateRasterizerState(&RasterizerDesc, &SolidState));
+    SolidState = States->GetRasterizerState(RasterizerDesc);
 
 	ZeroMemory(&RasterizerDesc, sizeof(D3D11_RASTERIZER_DESC));
 	RasterizerDesc.FillMode = D3D11_FILL_WIREFRAME;
 	RasterizerDesc.CullMode = D3D11_CULL_NONE;
-	DX::ThrowIfFailed(D3dDevice->CreateRasterizerState(&RasterizerDesc, &WireFrameState));
+	WireFrameState = States->GetRasterizerState(RasterizerDesc);
 
     D3D11_DEPTH_STENCIL_DESC DepthStencilDesc;
     ZeroMemory(&DepthStencilDesc, sizeof(D3D11_DEPTH_STENCIL_DESC));
@@ -738,35 +1624,59 @@ void Renderer::CreateResources()
 	DepthStencilDesc.BackFace.StencilDepthFailOp = D3D11_STENCIL_OP_DECR;
 	DepthStencilDesc.BackFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
 	DepthStencilDesc.BackFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
-    DX::ThrowIfFailed(D3dDevice->CreateDepthStencilState(&DepthStencilDesc, DepthStencilState.GetAddressOf()));
+    DepthStencilState = States->GetDepthStencilState(DepthStencilDesc);
 }
 
 void Renderer::OnDeviceLost()
 {
     // TODO: Add Direct3D resource cleanup here.
 
-    for (auto Mesh : Meshes)
-    {
-        delete Mesh;
-    }
+    UnloadScene();
     delete Sun;
-    Lights.clear();
+    Sun = nullptr;
+
+    delete LightProxies;
+    LightProxies = nullptr;
+    Occlusion.ReleaseDebugView();
+    OcclusionDebugView = nullptr;
+
+    // The engine meshes give their ranges back to the arena, so they go before it
+    delete MeshPool;
+    MeshPool = nullptr;
+    delete Materials;
+    Materials = nullptr;
+    delete Geometry;
+    Geometry = nullptr;
+
+    delete Textures;
+    Textures = nullptr;
+
+    // The states are released with the cache
+    delete ConstantRing;
+    ConstantRing = nullptr;
+    delete Tracker;
+    Tracker = nullptr;
+    delete States;
+    States = nullptr;
+    BlendState = nullptr;
+    SolidState = nullptr;
+    WireFrameState = nullptr;
+    DepthStencilState = nullptr;
 
 	delete VertexShader;
-	delete PixelShader;
+	delete LitPixelShaders;
+	LitPixelShaders = nullptr;
+	PixelShader = nullptr;
 	delete UnlitPixelShader;
 	delete NormalPixelShader;
+	delete InstancedVertexShader;
+	delete EmitterPixelShader;
 
-    InputLayout->Release();
+    InputLayout.Reset();
+    InstancedInputLayout.Reset();
     DepthStencilView.Reset();
     RenderTargetView.Reset();
-    BlendState->Release();
 
-    PerObjectBuffer_VS->Release();
-    PerFrameBuffer_PS->Release();
-    SolidState->Release();
-    DepthStencilState->Release();
-    WireFrameState->Release();
     SwapChain.Reset();
     D3dContext.Reset();
     D3dDevice.Reset();
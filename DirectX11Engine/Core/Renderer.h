@@ -7,9 +7,29 @@
 #include "StepTimer.h"
 #include "Lights/Light.h"
 #include "Mesh/Material.h"
+#include "Mesh/Mesh.h"
+#include "Mesh/TextureCooker.h"
+#include "Mesh/MeshOptimizer.h"
+#include "RenderQueue.h"
+#include "FrustumCulling.h"
+#include "SceneBVH.h"
+#include "OcclusionCulling.h"
+#include "TransformSystem.h"
+#include "EntityStore.h"
+#include "Memory.h"
+#include "ResourcePool.h"
+#include <DirectXCollision.h>
+#include <functional>
 
 class Shader;
+class ShaderVariantSet;
 class Mesh;
+class TextureRegistry;
+class MaterialRegistry;
+class GeometryArena;
+class InstanceBatch;
+class StateCache;
+class StateTracker;
 
 struct ConstantBufferPerFrame_PS
 {
@@ -23,18 +43,76 @@ struct ConstantBufferPerFrame_PS
 struct ConstantBufferPerObject_PS
 {
 	MaterialData Mat = MaterialData();
+    // Indices of the point lights reaching the object, 4 per element
+    DirectX::XMUINT4 LightIndices[2] = {};
 };
+static_assert(MAX_LIGHTS <= 8, "ConstantBufferPerObject_PS::LightIndices holds 8 lights");
 
 struct ConstantBufferPerObject_VS
 {
     DirectX::XMMATRIX WorldViewProj;
     DirectX::XMMATRIX World;
+    // Dequantization of the packed positions of the mesh
+    DirectX::XMFLOAT4 PositionScale;
+    DirectX::XMFLOAT4 PositionOffset;
 };
 
-struct LightAndMesh
+// A mesh of the Assimp scene and the node it is attached to
+struct AssimpMeshRef
 {
-    PointLight* Light = nullptr;
-    Mesh* LightMesh = nullptr;
+    aiMesh* AssimpMesh = nullptr;
+    const aiNode* Node = nullptr;
+};
+
+// Timings of the last LoadNewModel calls, in ms
+struct ModelLoadStats
+{
+    bool bFromCache = false;
+    double GeometryMs = 0.0;
+    double InitMs = 0.0;
+
+    // Phases of the geometry load
+    double ImportMs = 0.0;
+    double ConvertMs = 0.0;
+    double CacheMs = 0.0;
+
+    // Last geometry load through the mesh cache and through Assimp, to compare both paths
+    double LastCachedMs = 0.0;
+    double LastImportMs = 0.0;
+};
+
+// Resources released by the last scene unload, and the time taken by the sweeps
+struct SceneUnloadStats
+{
+    size_t Meshes = 0;
+    size_t Materials = 0;
+    size_t Textures = 0;
+    size_t Buffers = 0;
+    double UnloadMs = 0.0;
+};
+
+// Throughput of the OBJ parser on one model of Assets/Models
+struct ObjBenchmarkResult
+{
+    std::string Name;
+    double MegaBytes = 0.0;
+    double MegaBytesPerSecond = 0.0;
+    double LinesPerSecond = 0.0;
+    unsigned int Chunks = 0;
+    bool bLoaded = false;
+};
+
+// Vertex cache and overdraw of the meshes of a model of Assets/Models, as imported and after the import optimizations
+struct MeshAnalysisResult
+{
+    std::string Name;
+    unsigned int Meshes = 0;
+    MeshOptimizer::VertexCacheStats CacheBefore;
+    MeshOptimizer::VertexCacheStats CacheAfter;
+    MeshOptimizer::OverdrawStats OverdrawBefore;
+    MeshOptimizer::OverdrawStats OverdrawAfter;
+    double OptimizeMs = 0.0;
+    bool bLoaded = false;
 };
 
 // A basic game implementation that creates a D3D11 device and
@@ -58,6 +136,10 @@ public:
     // Basic game loop
     void Tick();
 
+    // Headless check of the loaded scene : tick until its textures are streamed in, warm up, then return the heap allocations
+    // counted over the checked ticks, which should be none
+    uint64_t RunAllocationCheck();
+
     // Messages
     void OnActivated();
     void OnDeactivated();
@@ -72,26 +154,88 @@ public:
 
     void AddPointLight(DirectX::XMFLOAT3 Position, DirectX::XMFLOAT4 DiffuseColor, DirectX::XMFLOAT4 SpecularColor);
 
-    void ParseAssimpNode(aiNode* Node, const aiScene* Scene, wchar_t* Dir);
+    // Gather the meshes of the node tree, depth first
+    void ParseAssimpNode(aiNode* Node, const aiScene* Scene, std::vector<AssimpMeshRef>& OutMeshes);
+
+    // Select the mesh under a pixel of the window, or nothing
+    void PickAt(int X, int Y);
 
     Shader* VertexShader = nullptr;
     Shader* PixelShader = nullptr;
     Shader* UnlitPixelShader = nullptr;
     Shader* NormalPixelShader = nullptr;
+    Shader* InstancedVertexShader = nullptr;
+    Shader* EmitterPixelShader = nullptr;
 
     Shader* CurrentPixelShader = nullptr;
 
-	// ***  TODO : SCENE CLASS ***
-	std::vector<Mesh*> Meshes;
+    // Variants of the lit pixel shader, PixelShader is the one with every feature
+    ShaderVariantSet* LitPixelShaders = nullptr;
+
+    // Entities of the scene : the meshes, with a transform, bounds and a material, and the point lights.
+    // The meshes are owned by the MeshPool, the entities reference them by handle
+    EntityStore Entities;
+    // Entity of each mesh, by index in the scene queries
+    std::vector<EntityStore::Entity> MeshEntities;
 
     // A scene can contain one directional light and MAX_LIGHTS PointLights
 	DirectionalLight* Sun = nullptr;
-    std::vector<LightAndMesh> Lights;
 	class Camera* SceneCamera = nullptr;
-	// ***  SCENE CLASS ***
+
+    // Resources referenced by handles, the ones of the scene are released together by UnloadScene
+    ResourcePool<Mesh>* MeshPool = nullptr;
+    MaterialRegistry* Materials = nullptr;
+    TextureRegistry* Textures = nullptr;
+    GeometryArena* Geometry = nullptr;
+
+    // Proxies of the point lights, drawn when bDrawLightEmitters is set
+    InstanceBatch* LightProxies = nullptr;
+
+    // Pipeline state objects, deduplicated, and the context state, filtered from redundant calls
+    StateCache* States = nullptr;
+    StateTracker* Tracker = nullptr;
+
+    // Every constant of a frame, written with a single map and bound by offset
+    ConstantBufferRing* ConstantRing = nullptr;
+
+    // World bounds of Meshes, in the same order, and which of them were in the frustum this frame
+    BoundsTable SceneBounds;
+    FrustumCuller Culler;
+    std::vector<uint8_t> MeshVisibility;
+    std::vector<FrustumCuller::Benchmark> CullBenchmarks;
+
+    // Meshes of the frustum hidden by the biggest ones on screen, from a depth buffer rasterized on the CPU
+    OcclusionCuller Occlusion;
+    bool bShowOcclusionBuffer = false;
+    ID3D11ShaderResourceView* OcclusionDebugView = nullptr;
+
+    // Hierarchy over SceneBounds, refit for the meshes moved since the last frame
+    SceneBVH SceneHierarchy;
+    std::vector<uint32_t> MovedMeshes;
+
+    // Bit i is set for the meshes reached by the point light i, found with a sphere query per light
+    std::vector<uint8_t> MeshLightMasks;
+    std::vector<uint32_t> ReachedMeshes;
+
+    // Index in Meshes of the picked mesh, -1 when nothing is selected
+    int SelectedMesh = -1;
+
+    // Draws of the frame, sorted to share state with their neighbours
+    RenderQueue DrawQueue;
+    bool bSortDraws = true;
+    RenderQueue::Benchmark QueueBenchmark;
+    TransformSystem::Benchmark TransformBenchmark;
+    EntityStore::Benchmark EntityBenchmark;
 
     bool bDrawLightEmitters = false;
 
+    // Levels of detail are picked so that their error covers at most LodPixelError pixels on screen
+    bool bUseLods = true;
+    float LodPixelError = 1.0f;
+
+    // Load models from their cooked version when it is up to date
+    bool bUseMeshCache = true;
+
 private:
 
     void Update(DX::StepTimer const& timer);
@@ -109,6 +253,37 @@ private:
 
     void OpenModel();
 
+    // Call Visit with the path and the file name of every .obj of Assets/Models
+    static void ForEachAssetModel(const std::function<void(const std::wstring&, const std::string&)>& Visit);
+
+    // Parse every .obj of Assets/Models and record the parser throughput
+    void RunObjBenchmark();
+
+    // Import every .obj of Assets/Models and measure the vertex cache and overdraw before and after the mesh optimizations
+    void RunMeshAnalysis();
+
+    // Check that the lit variant of a mesh follows the maps its material really has, from the flags set at load to Select.
+    // Run at startup in every build, the result shows in the settings
+    static bool RunVariantSelectionTest();
+
+    // Cook the textures used by the scene to block compressed DDS files, then reload it to use them
+    void CookSceneTextures();
+
+    // Update the bounds of the moved meshes, then fill MeshLightMasks
+    void UpdateSceneQueries();
+
+    // Point lights whose range reaches the mesh, returns their count
+    unsigned int GatherLights(size_t MeshIndex, unsigned int OutIndices[MAX_LIGHTS]) const;
+
+    // Mesh of the entity at an index of the scene queries
+    Mesh* GetMesh(size_t MeshIndex) const;
+
+    // Copy the world matrix and bounds of a mesh to the components of its entity
+    void RefreshMeshEntity(size_t MeshIndex);
+
+    // Destroy every entity and clear the scene queries, then release the resources of the scene with one sweep per pool
+    void UnloadScene();
+
     // Device resources.
     HWND                                            Window;
     int                                             OutputWidth;
@@ -124,15 +299,13 @@ private:
 
 	// Input layout
 	Microsoft::WRL::ComPtr<ID3D11InputLayout> InputLayout;
+	Microsoft::WRL::ComPtr<ID3D11InputLayout> InstancedInputLayout;
 
-    // BlendState
-    Microsoft::WRL::ComPtr<ID3D11BlendState1> BlendState;
-
-    // RasterizerStates
-    ID3D11RasterizerState* SolidState;
-    ID3D11RasterizerState* WireFrameState;
-
-    Microsoft::WRL::ComPtr<ID3D11DepthStencilState> DepthStencilState;
+    // Pipeline states, owned by the StateCache
+    ID3D11BlendState1* BlendState = nullptr;
+    ID3D11RasterizerState* SolidState = nullptr;
+    ID3D11RasterizerState* WireFrameState = nullptr;
+    ID3D11DepthStencilState* DepthStencilState = nullptr;
 
     // Rendering loop timer.
     DX::StepTimer                                   Timer;
@@ -144,21 +317,51 @@ private:
     float Pitch = 0;
     float Yaw = 0;
 
-    // ***** TODO : Where to put that ? *****
+    std::wstring CurrentModelPath;
+    ModelLoadStats LoadStats;
+    std::vector<ObjBenchmarkResult> ObjBenchmarkResults;
+    Mesh::IngestionBenchmark IngestionBenchmark;
+    std::vector<MeshAnalysisResult> MeshAnalysisResults;
+    TextureCooker::Settings CookSettings;
+    std::vector<TextureCooker::Report> CookReports;
+    // Number of lit variants drawn with during the last frame
+    unsigned int VariantsUsed = 0;
+    bool bVariantSelectionPassed = false;
+    // Triangles of the meshes drawn during the last frame, at full resolution and at their level of detail
+    unsigned int FullTriangles = 0;
+    unsigned int DrawnTriangles = 0;
+    unsigned int LodDraws[4] = {};
+    // Heap allocations of the last Tick, and how many ticks in a row didn't allocate
+    uint64_t TickAllocations = 0;
+    unsigned int AllocationFreeTicks = 0;
+    // Debug builds assert that the ticks after the warmup of a newly loaded scene don't allocate, RunAllocationCheck counts them in any build
+    static constexpr unsigned int AllocationWarmupTicks = 120;
+    static constexpr unsigned int AllocationCheckedTicks = 60;
+    unsigned int AllocationCheckTicks = 0;
+    std::vector<AllocatorStats> AllocatorReport;
+    std::vector<ResourceStats> ResourceReport;
+    SceneUnloadStats LastUnload;
+
+    // Draw of a visible mesh, prepared in parallel over the entity chunks then added to the DrawQueue in mesh order.
+    // They are allocated from the frame memory, by index in the scene queries
+    struct PreparedDraw
+    {
+        ConstantBufferPerObject_VS VSConstants;
+        ConstantBufferPerObject_PS PSConstants;
+        DrawBindings Bindings;
+        unsigned int ShaderId = 0;
+        unsigned int Lod = 0;
+        unsigned int FullTriangles = 0;
+        float Depth = 0.0f;
+    };
 
-    // Constant buffers for vertex and pixel shader
-    Microsoft::WRL::ComPtr<ID3D11Buffer> PerObjectBuffer_VS;
-    Microsoft::WRL::ComPtr<ID3D11Buffer> PerFrameBuffer_PS;
-    Microsoft::WRL::ComPtr<ID3D11Buffer> PerObjectBuffer_PS;
+    // ***** TODO : Where to put that ? *****
 
-    ConstantBufferPerObject_VS PerObjectBuffStruct_VS;
+    // Constants for the pixel shader, copied to the ConstantRing. The per object ones are in PreparedDraws
     ConstantBufferPerFrame_PS PerFrameBuffStruct_PS;
-    ConstantBufferPerObject_PS PerObjectBuffStruct_PS;
 
     // ***** TODO : Where to put that ? *****
 
-    DirectX::XMMATRIX WorldViewProj;
-
     // RenderText
     DirectX::SimpleMath::Vector2 FontPos;
     std::unique_ptr<DirectX::SpriteFont> Font;
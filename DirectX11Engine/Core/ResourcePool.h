@@ -0,0 +1,245 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+// How long a resource stays : engine resources until the shutdown, scene resources until the scene that loaded them is unloaded
+enum class EResourceLifetime : uint8_t
+{
+	Engine,
+	Scene
+};
+
+// Resources alive in a pool, for the memory report
+struct ResourceStats
+{
+	const char* Name = "";
+	size_t Count = 0;
+	size_t SceneCount = 0;
+	size_t Slots = 0;
+	// Memory held by the resources, as reported when they were added
+	size_t ResidentBytes = 0;
+};
+
+// 32 bits reference to a resource of a ResourcePool : the index of its slot and the generation of the slot when the resource was added.
+// The generation changes when the slot is released, so a handle of a released resource doesn't resolve anymore, even once the slot is reused.
+// The zero handle never resolves
+template<typename T>
+class Handle
+{
+public:
+
+	static constexpr uint32_t IndexBits = 20;
+	static constexpr uint32_t MaxIndex = (1u << IndexBits) - 1;
+	static constexpr uint32_t MaxGeneration = (1u << (32 - IndexBits)) - 1;
+
+	Handle() = default;
+	Handle(uint32_t Index, uint32_t Generation) : Value((Generation << IndexBits) | Index) {}
+
+	uint32_t GetIndex() const { return Value & MaxIndex; }
+	uint32_t GetGeneration() const { return Value >> IndexBits; }
+	bool IsValid() const { return Value != 0; }
+
+	bool operator==(const Handle& Other) const { return Value == Other.Value; }
+	bool operator!=(const Handle& Other) const { return Value != Other.Value; }
+
+	uint32_t Value = 0;
+};
+
+// Handles of the engine resources
+class Mesh;
+struct Texture;
+struct Material;
+struct GeometryRange;
+
+using MeshHandle = Handle<Mesh>;
+using TextureHandle = Handle<Texture>;
+using MaterialHandle = Handle<Material>;
+using BufferHandle = Handle<GeometryRange>;
+
+// Owns the resources of a type and hands out handles to them. Each resource is added with a lifetime, ReleaseLifetime
+// frees every resource of a lifetime in a single pass over the slots, so unloading a scene doesn't depend on who still points to what.
+// Not thread safe : resources are added and released by the render thread, Get can be called from the jobs of a frame
+template<typename T>
+class ResourcePool
+{
+public:
+
+	using HandleType = Handle<T>;
+
+	explicit ResourcePool(const char* Name) : Name(Name) {}
+
+	~ResourcePool()
+	{
+		for (Slot& Current : Slots)
+		{
+			delete Current.Resource;
+		}
+	}
+
+	ResourcePool(const ResourcePool&) = delete;
+	ResourcePool& operator=(const ResourcePool&) = delete;
+
+	// Take ownership of a resource allocated with new
+	HandleType Add(T* Resource, EResourceLifetime Lifetime, size_t Bytes = 0)
+	{
+		uint32_t Index;
+		if (!FreeSlots.empty())
+		{
+			Index = FreeSlots.back();
+			FreeSlots.pop_back();
+		}
+		else
+		{
+			if (Slots.size() > HandleType::MaxIndex)
+			{
+				throw std::length_error("Too many resources for the handles");
+			}
+			Index = static_cast<uint32_t>(Slots.size());
+			Slots.emplace_back();
+		}
+
+		Slot& NewSlot = Slots[Index];
+		NewSlot.Resource = Resource;
+		NewSlot.Bytes = Bytes;
+		NewSlot.Lifetime = Lifetime;
+		++Count;
+		ResidentBytes += Bytes;
+		return HandleType(Index, NewSlot.Generation);
+	}
+
+	// The resource, or nullptr once it was released
+	T* Get(HandleType Resource) const
+	{
+		const Slot* Found = Find(Resource);
+		return Found ? Found->Resource : nullptr;
+	}
+
+	bool Release(HandleType Resource)
+	{
+		if (!Find(Resource))
+		{
+			return false;
+		}
+		FreeSlot(Resource.GetIndex());
+		return true;
+	}
+
+	void SetBytes(HandleType Resource, size_t Bytes)
+	{
+		if (Slot* Found = Find(Resource))
+		{
+			ResidentBytes = ResidentBytes - Found->Bytes + Bytes;
+			Found->Bytes = Bytes;
+		}
+	}
+
+	// A scene resource reused by the engine stays until the shutdown
+	void ExtendLifetime(HandleType Resource, EResourceLifetime Lifetime)
+	{
+		Slot* Found = Find(Resource);
+		if (Found && Lifetime == EResourceLifetime::Engine)
+		{
+			Found->Lifetime = Lifetime;
+		}
+	}
+
+	// Release every resource of a lifetime, OnRelease sees each of them before it is deleted. Returns how many were released
+	template<typename Visitor>
+	size_t ReleaseLifetime(EResourceLifetime Lifetime, Visitor&& OnRelease)
+	{
+		size_t Released = 0;
+		for (uint32_t Index = 0; Index < Slots.size(); ++Index)
+		{
+			if (Slots[Index].Resource && Slots[Index].Lifetime == Lifetime)
+			{
+				OnRelease(*Slots[Index].Resource);
+				FreeSlot(Index);
+				++Released;
+			}
+		}
+		return Released;
+	}
+
+	size_t ReleaseLifetime(EResourceLifetime Lifetime)
+	{
+		return ReleaseLifetime(Lifetime, [](T&) {});
+	}
+
+	// Visit(Handle, Resource) for every resource alive
+	template<typename Visitor>
+	void ForEach(Visitor&& Visit) const
+	{
+		for (uint32_t Index = 0; Index < Slots.size(); ++Index)
+		{
+			if (Slots[Index].Resource)
+			{
+				Visit(HandleType(Index, Slots[Index].Generation), *Slots[Index].Resource);
+			}
+		}
+	}
+
+	size_t GetCount() const { return Count; }
+
+	ResourceStats GetStats() const
+	{
+		ResourceStats Stats;
+		Stats.Name = Name;
+		Stats.Count = Count;
+		Stats.Slots = Slots.size();
+		Stats.ResidentBytes = ResidentBytes;
+		for (const Slot& Current : Slots)
+		{
+			Stats.SceneCount += Current.Resource && Current.Lifetime == EResourceLifetime::Scene ? 1 : 0;
+		}
+		return Stats;
+	}
+
+private:
+
+	struct Slot
+	{
+		T* Resource = nullptr;
+		size_t Bytes = 0;
+		// Starts at 1 so that the zero handle never matches
+		uint32_t Generation = 1;
+		EResourceLifetime Lifetime = EResourceLifetime::Scene;
+	};
+
+	Slot* Find(HandleType Resource)
+	{
+		return const_cast<Slot*>(static_cast<const ResourcePool*>(this)->Find(Resource));
+	}
+
+	const Slot* Find(HandleType Resource) const
+	{
+		const uint32_t Index = Resource.GetIndex();
+		if (Index >= Slots.size() || Slots[Index].Generation != Resource.GetGeneration() || !Slots[Index].Resource)
+		{
+			return nullptr;
+		}
+		return &Slots[Index];
+	}
+
+	void FreeSlot(uint32_t Index)
+	{
+		// The slot is free before the destructor runs, in case it releases other resources
+		Slot& Freed = Slots[Index];
+		T* Resource = Freed.Resource;
+		ResidentBytes -= Freed.Bytes;
+		Freed.Resource = nullptr;
+		Freed.Bytes = 0;
+		// Generations wrap from MaxGeneration back to 1
+		Freed.Generation = Freed.Generation % HandleType::MaxGeneration + 1;
+		FreeSlots.push_back(Index);
+		--Count;
+		delete Resource;
+	}
+
+	const char* Name;
+	std::vector<Slot> Slots;
+	std::vector<uint32_t> FreeSlots;
+	size_t Count = 0;
+	size_t ResidentBytes = 0;
+};
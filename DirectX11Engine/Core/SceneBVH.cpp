@@ -0,0 +1,502 @@
+#include "Core/pch.h"
+#include "SceneBVH.h"
+#include "Memory.h"
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
+using namespace DirectX;
+
+namespace
+{
+	constexpr unsigned int BinCount = 12;
+	constexpr uint32_t MaxLeafObjects = 2;
+	constexpr uint32_t NoParent = ~0u;
+
+	float Component(const XMFLOAT3& Vector, int Axis)
+	{
+		return (&Vector.x)[Axis];
+	}
+
+	void Grow(XMFLOAT3& Min, XMFLOAT3& Max, const XMFLOAT3& OtherMin, const XMFLOAT3& OtherMax)
+	{
+		Min = XMFLOAT3(std::min(Min.x, OtherMin.x), std::min(Min.y, OtherMin.y), std::min(Min.z, OtherMin.z));
+		Max = XMFLOAT3(std::max(Max.x, OtherMax.x), std::max(Max.y, OtherMax.y), std::max(Max.z, OtherMax.z));
+	}
+
+	// Half the surface area, the factor of two does not change the heuristic
+	float HalfArea(const XMFLOAT3& Min, const XMFLOAT3& Max)
+	{
+		const float X = Max.x - Min.x, Y = Max.y - Min.y, Z = Max.z - Min.z;
+		return X < 0.0f ? 0.0f : X * Y + Y * Z + Z * X;
+	}
+
+	const XMFLOAT3 EmptyMin(FLT_MAX, FLT_MAX, FLT_MAX);
+	const XMFLOAT3 EmptyMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+	enum class EPlaneSide { Outside, Inside, Straddling };
+
+	EPlaneSide Classify(const XMFLOAT4& Plane, const XMFLOAT3& Min, const XMFLOAT3& Max)
+	{
+		const float CenterX = (Min.x + Max.x) * 0.5f, CenterY = (Min.y + Max.y) * 0.5f, CenterZ = (Min.z + Max.z) * 0.5f;
+		const float Distance = Plane.x * CenterX + Plane.y * CenterY + Plane.z * CenterZ + Plane.w;
+		const float Radius = fabsf(Plane.x) * (Max.x - CenterX) + fabsf(Plane.y) * (Max.y - CenterY) + fabsf(Plane.z) * (Max.z - CenterZ);
+		if (Distance + Radius < 0.0f)
+		{
+			return EPlaneSide::Outside;
+		}
+		return Distance - Radius >= 0.0f ? EPlaneSide::Inside : EPlaneSide::Straddling;
+	}
+
+	// Slab test, returns the distance at which the ray enters the box or FLT_MAX
+	float IntersectRay(const XMFLOAT3& Origin, const XMFLOAT3& InverseDirection, const XMFLOAT3& Min, const XMFLOAT3& Max)
+	{
+		float Enter = 0.0f;
+		float Exit = FLT_MAX;
+		for (int Axis = 0; Axis < 3; ++Axis)
+		{
+			float Near = (Component(Min, Axis) - Component(Origin, Axis)) * Component(InverseDirection, Axis);
+			float Far = (Component(Max, Axis) - Component(Origin, Axis)) * Component(InverseDirection, Axis);
+			if (Near > Far)
+			{
+				std::swap(Near, Far);
+			}
+			Enter = std::max(Enter, Near);
+			Exit = std::min(Exit, Far);
+		}
+		return Enter <= Exit ? Enter : FLT_MAX;
+	}
+}
+
+void SceneBVH::Clear()
+{
+	Nodes.clear();
+	Parents.clear();
+	ObjectIndices.clear();
+	ObjectLeaves.clear();
+	ObjectMin.clear();
+	ObjectMax.clear();
+	DirtyLeaves.clear();
+	Counters = Stats();
+}
+
+void SceneBVH::Build(const std::vector<BoundingBox>& ObjectBounds)
+{
+	auto BuildStart = std::chrono::steady_clock::now();
+	Clear();
+
+	const uint32_t Count = static_cast<uint32_t>(ObjectBounds.size());
+	ObjectMin.resize(Count);
+	ObjectMax.resize(Count);
+	for (uint32_t i = 0; i < Count; ++i)
+	{
+		const BoundingBox& Box = ObjectBounds[i];
+		ObjectMin[i] = XMFLOAT3(Box.Center.x - Box.Extents.x, Box.Center.y - Box.Extents.y, Box.Center.z - Box.Extents.z);
+		ObjectMax[i] = XMFLOAT3(Box.Center.x + Box.Extents.x, Box.Center.y + Box.Extents.y, Box.Center.z + Box.Extents.z);
+	}
+
+	ObjectIndices.resize(Count);
+	std::iota(ObjectIndices.begin(), ObjectIndices.end(), 0);
+	ObjectLeaves.resize(Count);
+
+	if (Count == 0)
+	{
+		return;
+	}
+
+	// A binary tree with one object or more per leaf has less than 2 * Count nodes, the references stay valid while subdividing
+	Nodes.reserve(size_t(Count) * 2);
+	Parents.reserve(size_t(Count) * 2);
+
+	Node Root;
+	Root.FirstOrLeft = 0;
+	Root.Count = Count;
+	Nodes.push_back(Root);
+	Parents.push_back(NoParent);
+	UpdateNodeBounds(0);
+	Subdivide(0, 1);
+
+	for (uint32_t NodeIndex = 0; NodeIndex < Nodes.size(); ++NodeIndex)
+	{
+		const Node& Leaf = Nodes[NodeIndex];
+		for (uint32_t i = 0; Leaf.IsLeaf() && i < Leaf.Count; ++i)
+		{
+			ObjectLeaves[ObjectIndices[Leaf.FirstOrLeft + i]] = NodeIndex;
+		}
+	}
+
+	Counters.Nodes = Nodes.size();
+	Counters.BuildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - BuildStart).count();
+}
+
+void SceneBVH::UpdateNodeBounds(uint32_t NodeIndex)
+{
+	Node& Current = Nodes[NodeIndex];
+	Current.Min = EmptyMin;
+	Current.Max = EmptyMax;
+
+	if (Current.IsLeaf())
+	{
+		for (uint32_t i = 0; i < Current.Count; ++i)
+		{
+			const uint32_t Object = ObjectIndices[Current.FirstOrLeft + i];
+			Grow(Current.Min, Current.Max, ObjectMin[Object], ObjectMax[Object]);
+		}
+	}
+	else
+	{
+		for (uint32_t Child = Current.FirstOrLeft; Child < Current.FirstOrLeft + 2; ++Child)
+		{
+			Grow(Current.Min, Current.Max, Nodes[Child].Min, Nodes[Child].Max);
+		}
+	}
+}
+
+void SceneBVH::Subdivide(uint32_t NodeIndex, unsigned int Depth)
+{
+	Counters.Depth = std::max(Counters.Depth, Depth);
+
+	const uint32_t First = Nodes[NodeIndex].FirstOrLeft;
+	const uint32_t Count = Nodes[NodeIndex].Count;
+	if (Count <= MaxLeafObjects)
+	{
+		return;
+	}
+
+	// Objects are binned by the center of their box
+	auto GetCenter = [this](uint32_t Object, int Axis)
+	{
+		return (Component(ObjectMin[Object], Axis) + Component(ObjectMax[Object], Axis)) * 0.5f;
+	};
+
+	XMFLOAT3 CenterMin = EmptyMin;
+	XMFLOAT3 CenterMax = EmptyMax;
+	for (uint32_t i = First; i < First + Count; ++i)
+	{
+		const XMFLOAT3 Center(GetCenter(ObjectIndices[i], 0), GetCenter(ObjectIndices[i], 1), GetCenter(ObjectIndices[i], 2));
+		Grow(CenterMin, CenterMax, Center, Center);
+	}
+
+	int BestAxis = -1;
+	unsigned int BestSplit = 0;
+	float BestCost = FLT_MAX;
+
+	for (int Axis = 0; Axis < 3; ++Axis)
+	{
+		const float AxisMin = Component(CenterMin, Axis);
+		const float Extent = Component(CenterMax, Axis) - AxisMin;
+		if (Extent <= 0.0f)
+		{
+			continue;
+		}
+
+		struct Bin
+		{
+			XMFLOAT3 Min = EmptyMin;
+			XMFLOAT3 Max = EmptyMax;
+			uint32_t Count = 0;
+		};
+		Bin Bins[BinCount];
+
+		const float Scale = BinCount / Extent;
+		for (uint32_t i = First; i < First + Count; ++i)
+		{
+			const uint32_t Object = ObjectIndices[i];
+			const unsigned int BinIndex = std::min(BinCount - 1, static_cast<unsigned int>((GetCenter(Object, Axis) - AxisMin) * Scale));
+			Grow(Bins[BinIndex].Min, Bins[BinIndex].Max, ObjectMin[Object], ObjectMax[Object]);
+			++Bins[BinIndex].Count;
+		}
+
+		// Sweep from both ends to get the cost of every split plane between two bins
+		float LeftArea[BinCount - 1], RightArea[BinCount - 1];
+		uint32_t LeftCount[BinCount - 1], RightCount[BinCount - 1];
+		XMFLOAT3 LeftMin = EmptyMin, LeftMax = EmptyMax, RightMin = EmptyMin, RightMax = EmptyMax;
+		uint32_t LeftSum = 0, RightSum = 0;
+		for (unsigned int i = 0; i < BinCount - 1; ++i)
+		{
+			LeftSum += Bins[i].Count;
+			Grow(LeftMin, LeftMax, Bins[i].Min, Bins[i].Max);
+			LeftCount[i] = LeftSum;
+			LeftArea[i] = HalfArea(LeftMin, LeftMax);
+
+			RightSum += Bins[BinCount - 1 - i].Count;
+			Grow(RightMin, RightMax, Bins[BinCount - 1 - i].Min, Bins[BinCount - 1 - i].Max);
+			RightCount[BinCount - 2 - i] = RightSum;
+			RightArea[BinCount - 2 - i] = HalfArea(RightMin, RightMax);
+		}
+
+		for (unsigned int i = 0; i < BinCount - 1; ++i)
+		{
+			const float Cost = LeftCount[i] * LeftArea[i] + RightCount[i] * RightArea[i];
+			if (LeftCount[i] > 0 && RightCount[i] > 0 && Cost < BestCost)
+			{
+				BestCost = Cost;
+				BestAxis = Axis;
+				BestSplit = i + 1;
+			}
+		}
+	}
+
+	// Keep the leaf when no split is cheaper than testing every object
+	const float LeafCost = Count * HalfArea(Nodes[NodeIndex].Min, Nodes[NodeIndex].Max);
+	if (BestAxis < 0 || BestCost >= LeafCost)
+	{
+		return;
+	}
+
+	const float AxisMin = Component(CenterMin, BestAxis);
+	const float Scale = BinCount / (Component(CenterMax, BestAxis) - AxisMin);
+	auto Middle = std::partition(ObjectIndices.begin() + First, ObjectIndices.begin() + First + Count, [&](uint32_t Object)
+	{
+		return std::min(BinCount - 1, static_cast<unsigned int>((GetCenter(Object, BestAxis) - AxisMin) * Scale)) < BestSplit;
+	});
+
+	const uint32_t LeftObjects = static_cast<uint32_t>(Middle - ObjectIndices.begin()) - First;
+	if (LeftObjects == 0 || LeftObjects == Count)
+	{
+		return;
+	}
+
+	const uint32_t Left = static_cast<uint32_t>(Nodes.size());
+	Node LeftNode;
+	LeftNode.FirstOrLeft = First;
+	LeftNode.Count = LeftObjects;
+	Node RightNode;
+	RightNode.FirstOrLeft = First + LeftObjects;
+	RightNode.Count = Count - LeftObjects;
+	Nodes.push_back(LeftNode);
+	Nodes.push_back(RightNode);
+	Parents.push_back(NodeIndex);
+	Parents.push_back(NodeIndex);
+
+	Nodes[NodeIndex].FirstOrLeft = Left;
+	Nodes[NodeIndex].Count = 0;
+
+	UpdateNodeBounds(Left);
+	UpdateNodeBounds(Left + 1);
+	Subdivide(Left, Depth + 1);
+	Subdivide(Left + 1, Depth + 1);
+}
+
+void SceneBVH::UpdateObject(uint32_t Object, const BoundingBox& Bounds)
+{
+	if (Object >= ObjectMin.size())
+	{
+		return;
+	}
+
+	ObjectMin[Object] = XMFLOAT3(Bounds.Center.x - Bounds.Extents.x, Bounds.Center.y - Bounds.Extents.y, Bounds.Center.z - Bounds.Extents.z);
+	ObjectMax[Object] = XMFLOAT3(Bounds.Center.x + Bounds.Extents.x, Bounds.Center.y + Bounds.Extents.y, Bounds.Center.z + Bounds.Extents.z);
+	DirtyLeaves.push_back(ObjectLeaves[Object]);
+	++Counters.Refits;
+}
+
+void SceneBVH::Refit()
+{
+	for (uint32_t Leaf : DirtyLeaves)
+	{
+		// Walk up until a node keeps its bounds, the ones above it can't change either
+		for (uint32_t NodeIndex = Leaf; NodeIndex != NoParent; NodeIndex = Parents[NodeIndex])
+		{
+			const XMFLOAT3 OldMin = Nodes[NodeIndex].Min;
+			const XMFLOAT3 OldMax = Nodes[NodeIndex].Max;
+			UpdateNodeBounds(NodeIndex);
+
+			const bool bUnchanged = memcmp(&OldMin, &Nodes[NodeIndex].Min, sizeof(XMFLOAT3)) == 0 && memcmp(&OldMax, &Nodes[NodeIndex].Max, sizeof(XMFLOAT3)) == 0;
+			if (bUnchanged && NodeIndex != Leaf)
+			{
+				break;
+			}
+		}
+	}
+	DirtyLeaves.clear();
+}
+
+void SceneBVH::CullFrustum(const Frustum& View, std::vector<uint8_t>& OutVisible) const
+{
+	OutVisible.assign(ObjectMin.size(), 0);
+	Counters.LastFrustumNodes = 0;
+	if (Nodes.empty())
+	{
+		return;
+	}
+
+	// Each node carries the planes its parent straddled, the others are already known to pass
+	constexpr uint32_t AllPlanes = (1 << 6) - 1;
+	ScratchScope Scratch;
+	ArenaVector<std::pair<uint32_t, uint32_t>> Stack = Scratch.MakeVector<std::pair<uint32_t, uint32_t>>();
+	Stack.reserve(64);
+	Stack.emplace_back(0, AllPlanes);
+
+	while (!Stack.empty())
+	{
+		const uint32_t NodeIndex = Stack.back().first;
+		uint32_t PlaneMask = Stack.back().second;
+		Stack.pop_back();
+		++Counters.LastFrustumNodes;
+
+		const Node& Current = Nodes[NodeIndex];
+		bool bOutside = false;
+		for (int Plane = 0; Plane < 6 && !bOutside; ++Plane)
+		{
+			if (PlaneMask & (1 << Plane))
+			{
+				const EPlaneSide Side = Classify(View.Planes[Plane], Current.Min, Current.Max);
+				bOutside = Side == EPlaneSide::Outside;
+				if (Side == EPlaneSide::Inside)
+				{
+					PlaneMask &= ~(1 << Plane);
+				}
+			}
+		}
+		if (bOutside)
+		{
+			continue;
+		}
+
+		if (!Current.IsLeaf())
+		{
+			Stack.emplace_back(Current.FirstOrLeft, PlaneMask);
+			Stack.emplace_back(Current.FirstOrLeft + 1, PlaneMask);
+			continue;
+		}
+
+		for (uint32_t i = 0; i < Current.Count; ++i)
+		{
+			const uint32_t Object = ObjectIndices[Current.FirstOrLeft + i];
+			bool bVisible = true;
+			for (int Plane = 0; Plane < 6 && bVisible; ++Plane)
+			{
+				bVisible = !(PlaneMask & (1 << Plane)) || Classify(View.Planes[Plane], ObjectMin[Object], ObjectMax[Object]) != EPlaneSide::Outside;
+			}
+			OutVisible[Object] = bVisible ? 1 : 0;
+		}
+	}
+}
+
+uint32_t SceneBVH::Raycast(FXMVECTOR Origin, FXMVECTOR Direction, float& OutDistance) const
+{
+	Counters.LastRayNodes = 0;
+	OutDistance = FLT_MAX;
+	uint32_t Closest = InvalidObject;
+	if (Nodes.empty())
+	{
+		return Closest;
+	}
+
+	XMFLOAT3 RayOrigin, InverseDirection;
+	XMStoreFloat3(&RayOrigin, Origin);
+	XMStoreFloat3(&InverseDirection, XMVectorReciprocal(Direction));
+
+	// Nearest child first, nodes entered further than the closest hit are skipped
+	ScratchScope Scratch;
+	ArenaVector<std::pair<uint32_t, float>> Stack = Scratch.MakeVector<std::pair<uint32_t, float>>();
+	Stack.reserve(64);
+	const float RootDistance = IntersectRay(RayOrigin, InverseDirection, Nodes[0].Min, Nodes[0].Max);
+	if (RootDistance != FLT_MAX)
+	{
+		Stack.emplace_back(0, RootDistance);
+	}
+
+	while (!Stack.empty())
+	{
+		const uint32_t NodeIndex = Stack.back().first;
+		const float EnterDistance = Stack.back().second;
+		Stack.pop_back();
+		if (EnterDistance >= OutDistance)
+		{
+			continue;
+		}
+		++Counters.LastRayNodes;
+
+		const Node& Current = Nodes[NodeIndex];
+		if (Current.IsLeaf())
+		{
+			for (uint32_t i = 0; i < Current.Count; ++i)
+			{
+				const uint32_t Object = ObjectIndices[Current.FirstOrLeft + i];
+				const float Distance = IntersectRay(RayOrigin, InverseDirection, ObjectMin[Object], ObjectMax[Object]);
+				if (Distance < OutDistance)
+				{
+					OutDistance = Distance;
+					Closest = Object;
+				}
+			}
+			continue;
+		}
+
+		const uint32_t Left = Current.FirstOrLeft;
+		const float LeftDistance = IntersectRay(RayOrigin, InverseDirection, Nodes[Left].Min, Nodes[Left].Max);
+		const float RightDistance = IntersectRay(RayOrigin, InverseDirection, Nodes[Left + 1].Min, Nodes[Left + 1].Max);
+
+		// The nearer child is pushed last so it is visited first
+		const bool bLeftFirst = LeftDistance <= RightDistance;
+		const std::pair<uint32_t, float> Near(bLeftFirst ? Left : Left + 1, bLeftFirst ? LeftDistance : RightDistance);
+		const std::pair<uint32_t, float> Far(bLeftFirst ? Left + 1 : Left, bLeftFirst ? RightDistance : LeftDistance);
+		if (Far.second != FLT_MAX)
+		{
+			Stack.push_back(Far);
+		}
+		if (Near.second != FLT_MAX)
+		{
+			Stack.push_back(Near);
+		}
+	}
+
+	return Closest;
+}
+
+void SceneBVH::QuerySphere(const BoundingSphere& Sphere, std::vector<uint32_t>& OutObjects) const
+{
+	Counters.LastSphereNodes = 0;
+	if (Nodes.empty())
+	{
+		return;
+	}
+
+	const float RadiusSquared = Sphere.Radius * Sphere.Radius;
+	auto Touches = [&](const XMFLOAT3& Min, const XMFLOAT3& Max)
+	{
+		float DistanceSquared = 0.0f;
+		for (int Axis = 0; Axis < 3; ++Axis)
+		{
+			const float Center = Component(Sphere.Center, Axis);
+			const float Closest = std::max(Component(Min, Axis), std::min(Center, Component(Max, Axis)));
+			DistanceSquared += (Center - Closest) * (Center - Closest);
+		}
+		return DistanceSquared <= RadiusSquared;
+	};
+
+	ScratchScope Scratch;
+	ArenaVector<uint32_t> Stack = Scratch.MakeVector<uint32_t>();
+	Stack.reserve(64);
+	Stack.push_back(0);
+
+	while (!Stack.empty())
+	{
+		const Node& Current = Nodes[Stack.back()];
+		Stack.pop_back();
+		++Counters.LastSphereNodes;
+
+		if (!Touches(Current.Min, Current.Max))
+		{
+			continue;
+		}
+
+		if (!Current.IsLeaf())
+		{
+			Stack.push_back(Current.FirstOrLeft);
+			Stack.push_back(Current.FirstOrLeft + 1);
+			continue;
+		}
+
+		for (uint32_t i = 0; i < Current.Count; ++i)
+		{
+			const uint32_t Object = ObjectIndices[Current.FirstOrLeft + i];
+			if (Touches(ObjectMin[Object], ObjectMax[Object]))
+			{
+				OutObjects.push_back(Object);
+			}
+		}
+	}
+}
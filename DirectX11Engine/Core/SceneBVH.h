@@ -0,0 +1,75 @@
+#pragma once
+#include "Core/pch.h"
+#include "FrustumCulling.h"
+#include <DirectXCollision.h>
+#include <vector>
+
+// Bounding volume hierarchy over the world boxes of the objects of a scene.
+// Built top down with a binned surface area heuristic, and refit bottom up when objects move :
+// the tree keeps its topology, so it loosens if objects travel far until it is built again.
+class SceneBVH
+{
+public:
+
+	struct Stats
+	{
+		size_t Nodes = 0;
+		unsigned int Depth = 0;
+		double BuildMs = 0.0;
+		// Objects refit since the last build
+		unsigned int Refits = 0;
+		// Nodes visited by the last query of each kind
+		unsigned int LastFrustumNodes = 0;
+		unsigned int LastRayNodes = 0;
+		unsigned int LastSphereNodes = 0;
+	};
+
+	static constexpr uint32_t InvalidObject = ~0u;
+
+	void Build(const std::vector<DirectX::BoundingBox>& ObjectBounds);
+	void Clear();
+
+	// Store the new bounds of an object, the nodes above it are refit by Refit
+	void UpdateObject(uint32_t Object, const DirectX::BoundingBox& Bounds);
+	void Refit();
+
+	// OutVisible is sized to the object count, with 1 for the objects in the frustum.
+	// Subtrees fully inside the frustum are accepted without testing their objects.
+	void CullFrustum(const Frustum& View, std::vector<uint8_t>& OutVisible) const;
+
+	// Closest object whose box the ray enters, InvalidObject if none
+	uint32_t Raycast(DirectX::FXMVECTOR Origin, DirectX::FXMVECTOR Direction, float& OutDistance) const;
+
+	// Every object whose box touches the sphere
+	void QuerySphere(const DirectX::BoundingSphere& Sphere, std::vector<uint32_t>& OutObjects) const;
+
+	size_t GetObjectCount() const { return ObjectMin.size(); }
+	const Stats& GetStats() const { return Counters; }
+
+private:
+
+	// Leaves have Count objects from ObjectIndices[FirstOrLeft], inner nodes have their children at FirstOrLeft and FirstOrLeft + 1
+	struct Node
+	{
+		DirectX::XMFLOAT3 Min;
+		uint32_t FirstOrLeft = 0;
+		DirectX::XMFLOAT3 Max;
+		uint32_t Count = 0;
+
+		bool IsLeaf() const { return Count > 0; }
+	};
+
+	void Subdivide(uint32_t NodeIndex, unsigned int Depth);
+	void UpdateNodeBounds(uint32_t NodeIndex);
+
+	std::vector<Node> Nodes;
+	std::vector<uint32_t> Parents;
+	std::vector<uint32_t> ObjectIndices;
+	std::vector<uint32_t> ObjectLeaves;
+	std::vector<DirectX::XMFLOAT3> ObjectMin;
+	std::vector<DirectX::XMFLOAT3> ObjectMax;
+	std::vector<uint32_t> DirtyLeaves;
+
+	// Queries are const, their counters are not part of the tree
+	mutable Stats Counters;
+};
@@ -0,0 +1,91 @@
+#include "Core/pch.h"
+#include "StateCache.h"
+#include "Core/Hash.h"
+
+using Microsoft::WRL::ComPtr;
+
+StateCache::StateCache(ComPtr<ID3D11Device1> Device)
+	: Device(Device)
+{
+}
+
+template<typename DescType, typename StateType>
+StateType* StateCache::Find(const StateMap<DescType, StateType>& Map, uint64_t Key, const DescType& Desc)
+{
+	// Hash collisions are told apart by the descriptor itself
+	auto Range = Map.equal_range(Key);
+	for (auto It = Range.first; It != Range.second; ++It)
+	{
+		if (memcmp(&It->second.Desc, &Desc, sizeof(DescType)) == 0)
+		{
+			++Counters.Reused;
+			return It->second.State.Get();
+		}
+	}
+	return nullptr;
+}
+
+ID3D11BlendState1* StateCache::GetBlendState(const D3D11_BLEND_DESC1& Desc)
+{
+	const uint64_t Key = Hash::HashBytes(&Desc, sizeof(Desc));
+	if (ID3D11BlendState1* Existing = Find(BlendStates, Key, Desc))
+	{
+		return Existing;
+	}
+
+	ComPtr<ID3D11BlendState1> NewState;
+	DX::ThrowIfFailed(Device->CreateBlendState1(&Desc, NewState.GetAddressOf()));
+	++Counters.Created;
+	BlendStates.emplace(Key, Entry<D3D11_BLEND_DESC1, ID3D11BlendState1>{ Desc, NewState });
+	return NewState.Get();
+}
+
+ID3D11RasterizerState* StateCache::GetRasterizerState(const D3D11_RASTERIZER_DESC& Desc)
+{
+	const uint64_t Key = Hash::HashBytes(&Desc, sizeof(Desc));
+	if (ID3D11RasterizerState* Existing = Find(RasterizerStates, Key, Desc))
+	{
+		return Existing;
+	}
+
+	ComPtr<ID3D11RasterizerState> NewState;
+	DX::ThrowIfFailed(Device->CreateRasterizerState(&Desc, NewState.GetAddressOf()));
+	++Counters.Created;
+	RasterizerStates.emplace(Key, Entry<D3D11_RASTERIZER_DESC, ID3D11RasterizerState>{ Desc, NewState });
+	return NewState.Get();
+}
+
+ID3D11DepthStencilState* StateCache::GetDepthStencilState(const D3D11_DEPTH_STENCIL_DESC& Desc)
+{
+	const uint64_t Key = Hash::HashBytes(&Desc, sizeof(Desc));
+	if (ID3D11DepthStencilState* Existing = Find(DepthStencilStates, Key, Desc))
+	{
+		return Existing;
+	}
+
+	ComPtr<ID3D11DepthStencilState> NewState;
+	DX::ThrowIfFailed(Device->CreateDepthStencilState(&Desc, NewState.GetAddressOf()));
+	++Counters.Created;
+	DepthStencilStates.emplace(Key, Entry<D3D11_DEPTH_STENCIL_DESC, ID3D11DepthStencilState>{ Desc, NewState });
+	return NewState.Get();
+}
+
+ID3D11SamplerState* StateCache::GetSamplerState(const D3D11_SAMPLER_DESC& Desc)
+{
+	const uint64_t Key = Hash::HashBytes(&Desc, sizeof(Desc));
+	if (ID3D11SamplerState* Existing = Find(SamplerStates, Key, Desc))
+	{
+		return Existing;
+	}
+
+	ComPtr<ID3D11SamplerState> NewState;
+	DX::ThrowIfFailed(Device->CreateSamplerState(&Desc, NewState.GetAddressOf()));
+	++Counters.Created;
+	SamplerStates.emplace(Key, Entry<D3D11_SAMPLER_DESC, ID3D11SamplerState>{ Desc, NewState });
+	return NewState.Get();
+}
+
+size_t StateCache::GetStateCount() const
+{
+	return BlendStates.size() + RasterizerStates.size() + DepthStencilStates.size() + SamplerStates.size();
+}
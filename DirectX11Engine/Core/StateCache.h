@@ -0,0 +1,57 @@
+#pragma once
+#include <unordered_map>
+#include "Core/pch.h"
+
+// Owns the blend, rasterizer, depth-stencil and sampler states of the engine.
+// States are deduplicated by the hash of their descriptor, asking twice for the same descriptor
+// returns the same object. Descriptors are compared byte per byte, so they must be zeroed before being filled.
+// The returned pointers are owned by the cache and live as long as it does.
+class StateCache
+{
+public:
+
+	struct Stats
+	{
+		// State objects created, and requests served by an existing one
+		unsigned int Created = 0;
+		unsigned int Reused = 0;
+	};
+
+	explicit StateCache(Microsoft::WRL::ComPtr<ID3D11Device1> Device);
+
+	StateCache(const StateCache&) = delete;
+	StateCache& operator=(const StateCache&) = delete;
+
+	ID3D11BlendState1* GetBlendState(const D3D11_BLEND_DESC1& Desc);
+	ID3D11RasterizerState* GetRasterizerState(const D3D11_RASTERIZER_DESC& Desc);
+	ID3D11DepthStencilState* GetDepthStencilState(const D3D11_DEPTH_STENCIL_DESC& Desc);
+	ID3D11SamplerState* GetSamplerState(const D3D11_SAMPLER_DESC& Desc);
+
+	const Stats& GetStats() const { return Counters; }
+	size_t GetStateCount() const;
+
+private:
+
+	template<typename DescType, typename StateType>
+	struct Entry
+	{
+		DescType Desc;
+		Microsoft::WRL::ComPtr<StateType> State;
+	};
+
+	template<typename DescType, typename StateType>
+	using StateMap = std::unordered_multimap<uint64_t, Entry<DescType, StateType>>;
+
+	// Existing state with the same descriptor, or nullptr
+	template<typename DescType, typename StateType>
+	StateType* Find(const StateMap<DescType, StateType>& Map, uint64_t Key, const DescType& Desc);
+
+	Microsoft::WRL::ComPtr<ID3D11Device1> Device;
+
+	StateMap<D3D11_BLEND_DESC1, ID3D11BlendState1> BlendStates;
+	StateMap<D3D11_RASTERIZER_DESC, ID3D11RasterizerState> RasterizerStates;
+	StateMap<D3D11_DEPTH_STENCIL_DESC, ID3D11DepthStencilState> DepthStencilStates;
+	StateMap<D3D11_SAMPLER_DESC, ID3D11SamplerState> SamplerStates;
+
+	Stats Counters;
+};
@@ -0,0 +1,220 @@
+#include "Core/pch.h"
+#include "StateTracker.h"
+
+using Microsoft::WRL::ComPtr;
+
+StateTracker::StateTracker(ComPtr<ID3D11DeviceContext1> DeviceContext)
+	: DeviceContext(DeviceContext)
+{
+}
+
+void StateTracker::BeginFrame()
+{
+	LastFrameCounters = FrameCounters;
+	FrameCounters = Stats();
+	Invalidate();
+}
+
+void StateTracker::Invalidate()
+{
+	RenderTarget.reset();
+	Viewport.reset();
+	RasterizerState.reset();
+	Blend.reset();
+	DepthStencil.reset();
+
+	InputLayout.reset();
+	Topology.reset();
+	for (auto& VertexBuffer : VertexBuffers)
+	{
+		VertexBuffer.reset();
+	}
+	IndexBuffer.reset();
+
+	VertexShader.reset();
+	PixelShader.reset();
+	for (auto& ConstantBuffer : VSConstantBuffers)
+	{
+		ConstantBuffer.reset();
+	}
+	for (auto& ConstantBuffer : PSConstantBuffers)
+	{
+		ConstantBuffer.reset();
+	}
+	for (auto& ShaderResource : PSShaderResources)
+	{
+		ShaderResource.reset();
+	}
+	for (auto& Sampler : PSSamplers)
+	{
+		Sampler.reset();
+	}
+}
+
+template<typename T>
+bool StateTracker::Track(std::optional<T>& Shadow, const T& Value)
+{
+	if (Shadow && *Shadow == Value)
+	{
+		++FrameCounters.Filtered;
+		return false;
+	}
+
+	Shadow = Value;
+	++FrameCounters.Issued;
+	return true;
+}
+
+template<typename T, size_t Count>
+bool StateTracker::TrackSlot(std::optional<T> (&Shadows)[Count], UINT Slot, const T& Value)
+{
+	if (Slot >= Count)
+	{
+		++FrameCounters.Issued;
+		return true;
+	}
+	return Track(Shadows[Slot], Value);
+}
+
+void StateTracker::SetRenderTarget(ID3D11RenderTargetView* NewRenderTarget, ID3D11DepthStencilView* NewDepthStencil)
+{
+	if (Track(RenderTarget, RenderTargetBinding{ NewRenderTarget, NewDepthStencil }))
+	{
+		DeviceContext->OMSetRenderTargets(1, &NewRenderTarget, NewDepthStencil);
+	}
+}
+
+void StateTracker::SetViewport(const D3D11_VIEWPORT& NewViewport)
+{
+	const bool bSame = Viewport && memcmp(&*Viewport, &NewViewport, sizeof(D3D11_VIEWPORT)) == 0;
+	if (bSame)
+	{
+		++FrameCounters.Filtered;
+		return;
+	}
+
+	Viewport = NewViewport;
+	++FrameCounters.Issued;
+	DeviceContext->RSSetViewports(1, &NewViewport);
+}
+
+void StateTracker::SetRasterizerState(ID3D11RasterizerState* State)
+{
+	if (Track(RasterizerState, State))
+	{
+		DeviceContext->RSSetState(State);
+	}
+}
+
+void StateTracker::SetBlendState(ID3D11BlendState* State, const float BlendFactor[4], UINT SampleMask)
+{
+	BlendBinding NewBlend = { State, { BlendFactor[0], BlendFactor[1], BlendFactor[2], BlendFactor[3] }, SampleMask };
+	if (Track(Blend, NewBlend))
+	{
+		DeviceContext->OMSetBlendState(State, BlendFactor, SampleMask);
+	}
+}
+
+void StateTracker::SetDepthStencilState(ID3D11DepthStencilState* State, UINT StencilRef)
+{
+	if (Track(DepthStencil, DepthStencilBinding{ State, StencilRef }))
+	{
+		DeviceContext->OMSetDepthStencilState(State, StencilRef);
+	}
+}
+
+void StateTracker::SetInputLayout(ID3D11InputLayout* Layout)
+{
+	if (Track(InputLayout, Layout))
+	{
+		DeviceContext->IASetInputLayout(Layout);
+	}
+}
+
+void StateTracker::SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY NewTopology)
+{
+	if (Track(Topology, NewTopology))
+	{
+		DeviceContext->IASetPrimitiveTopology(NewTopology);
+	}
+}
+
+void StateTracker::SetVertexBuffer(UINT Slot, ID3D11Buffer* Buffer, UINT Stride, UINT Offset)
+{
+	if (TrackSlot(VertexBuffers, Slot, BufferBinding{ Buffer, Stride, Offset }))
+	{
+		DeviceContext->IASetVertexBuffers(Slot, 1, &Buffer, &Stride, &Offset);
+	}
+}
+
+void StateTracker::SetIndexBuffer(ID3D11Buffer* Buffer, DXGI_FORMAT Format, UINT Offset)
+{
+	if (Track(IndexBuffer, BufferBinding{ Buffer, UINT(Format), Offset }))
+	{
+		DeviceContext->IASetIndexBuffer(Buffer, Format, Offset);
+	}
+}
+
+void StateTracker::SetVertexShader(ID3D11VertexShader* Shader)
+{
+	if (Track(VertexShader, Shader))
+	{
+		DeviceContext->VSSetShader(Shader, nullptr, 0);
+	}
+}
+
+void StateTracker::SetPixelShader(ID3D11PixelShader* Shader)
+{
+	if (Track(PixelShader, Shader))
+	{
+		DeviceContext->PSSetShader(Shader, nullptr, 0);
+	}
+}
+
+void StateTracker::SetVSConstantBuffer(UINT Slot, ID3D11Buffer* Buffer)
+{
+	if (TrackSlot(VSConstantBuffers, Slot, BufferBinding{ Buffer, 0, 0 }))
+	{
+		DeviceContext->VSSetConstantBuffers(Slot, 1, &Buffer);
+	}
+}
+
+void StateTracker::SetPSConstantBuffer(UINT Slot, ID3D11Buffer* Buffer)
+{
+	if (TrackSlot(PSConstantBuffers, Slot, BufferBinding{ Buffer, 0, 0 }))
+	{
+		DeviceContext->PSSetConstantBuffers(Slot, 1, &Buffer);
+	}
+}
+
+void StateTracker::SetVSConstantBuffer(UINT Slot, ID3D11Buffer* Buffer, UINT FirstConstant, UINT NumConstants)
+{
+	if (TrackSlot(VSConstantBuffers, Slot, BufferBinding{ Buffer, NumConstants, FirstConstant }))
+	{
+		DeviceContext->VSSetConstantBuffers1(Slot, 1, &Buffer, &FirstConstant, &NumConstants);
+	}
+}
+
+void StateTracker::SetPSConstantBuffer(UINT Slot, ID3D11Buffer* Buffer, UINT FirstConstant, UINT NumConstants)
+{
+	if (TrackSlot(PSConstantBuffers, Slot, BufferBinding{ Buffer, NumConstants, FirstConstant }))
+	{
+		DeviceContext->PSSetConstantBuffers1(Slot, 1, &Buffer, &FirstConstant, &NumConstants);
+	}
+}
+
+void StateTracker::SetPSShaderResource(UINT Slot, ID3D11ShaderResourceView* View)
+{
+	if (TrackSlot(PSShaderResources, Slot, View))
+	{
+		DeviceContext->PSSetShaderResources(Slot, 1, &View);
+	}
+}
+
+void StateTracker::SetPSSampler(UINT Slot, ID3D11SamplerState* Sampler)
+{
+	if (TrackSlot(PSSamplers, Slot, Sampler))
+	{
+		DeviceContext->PSSetSamplers(Slot, 1, &Sampler);
+	}
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <optional>
+#include "Core/pch.h"
+
+// Sits in front of the device context and drops the Set calls that would not change its state.
+// The bound objects are only compared by address, the tracker does not keep them alive :
+// Invalidate must be called whenever state may have been changed behind its back, or objects released.
+// BeginFrame does it once per frame and keeps the counters of the frame before.
+class StateTracker
+{
+public:
+
+	struct Stats
+	{
+		// Set calls forwarded to the context, and dropped because redundant
+		unsigned int Issued = 0;
+		unsigned int Filtered = 0;
+	};
+
+	static constexpr UINT MaxVertexBuffers = 4;
+	static constexpr UINT MaxShaderResources = 16;
+
+	explicit StateTracker(Microsoft::WRL::ComPtr<ID3D11DeviceContext1> DeviceContext);
+
+	StateTracker(const StateTracker&) = delete;
+	StateTracker& operator=(const StateTracker&) = delete;
+
+	// For everything that is not state, like draws and buffer updates
+	ID3D11DeviceContext1* GetContext() const { return DeviceContext.Get(); }
+
+	void BeginFrame();
+	// Forget the known state, the next Set calls are all issued
+	void Invalidate();
+
+	void SetRenderTarget(ID3D11RenderTargetView* RenderTarget, ID3D11DepthStencilView* DepthStencil);
+	void SetViewport(const D3D11_VIEWPORT& Viewport);
+	void SetRasterizerState(ID3D11RasterizerState* State);
+	void SetBlendState(ID3D11BlendState* State, const float BlendFactor[4], UINT SampleMask);
+	void SetDepthStencilState(ID3D11DepthStencilState* State, UINT StencilRef);
+
+	void SetInputLayout(ID3D11InputLayout* Layout);
+	void SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY Topology);
+	void SetVertexBuffer(UINT Slot, ID3D11Buffer* Buffer, UINT Stride, UINT Offset);
+	void SetIndexBuffer(ID3D11Buffer* Buffer, DXGI_FORMAT Format, UINT Offset);
+
+	void SetVertexShader(ID3D11VertexShader* Shader);
+	void SetPixelShader(ID3D11PixelShader* Shader);
+	void SetVSConstantBuffer(UINT Slot, ID3D11Buffer* Buffer);
+	void SetPSConstantBuffer(UINT Slot, ID3D11Buffer* Buffer);
+	// Slice of a buffer, in 16 bytes constants, through the D3D11.1 *SetConstantBuffers1
+	void SetVSConstantBuffer(UINT Slot, ID3D11Buffer* Buffer, UINT FirstConstant, UINT NumConstants);
+	void SetPSConstantBuffer(UINT Slot, ID3D11Buffer* Buffer, UINT FirstConstant, UINT NumConstants);
+	void SetPSShaderResource(UINT Slot, ID3D11ShaderResourceView* View);
+	void SetPSSampler(UINT Slot, ID3D11SamplerState* Sampler);
+
+	const Stats& GetFrameStats() const { return FrameCounters; }
+	const Stats& GetLastFrameStats() const { return LastFrameCounters; }
+
+private:
+
+	struct RenderTargetBinding
+	{
+		ID3D11RenderTargetView* RenderTarget;
+		ID3D11DepthStencilView* DepthStencil;
+		bool operator==(const RenderTargetBinding& Other) const { return RenderTarget == Other.RenderTarget && DepthStencil == Other.DepthStencil; }
+	};
+
+	struct BlendBinding
+	{
+		ID3D11BlendState* State;
+		float BlendFactor[4];
+		UINT SampleMask;
+		bool operator==(const BlendBinding& Other) const
+		{
+			return State == Other.State && SampleMask == Other.SampleMask && memcmp(BlendFactor, Other.BlendFactor, sizeof(BlendFactor)) == 0;
+		}
+	};
+
+	struct DepthStencilBinding
+	{
+		ID3D11DepthStencilState* State;
+		UINT StencilRef;
+		bool operator==(const DepthStencilBinding& Other) const { return State == Other.State && StencilRef == Other.StencilRef; }
+	};
+
+	// Stride and offset of vertex buffers, format and offset of index buffers, constant count and first constant of constant buffers
+	struct BufferBinding
+	{
+		ID3D11Buffer* Buffer;
+		UINT StrideOrFormat;
+		UINT Offset;
+		bool operator==(const BufferBinding& Other) const { return Buffer == Other.Buffer && StrideOrFormat == Other.StrideOrFormat && Offset == Other.Offset; }
+	};
+
+	// Record the new value, returns false if the call is redundant
+	template<typename T>
+	bool Track(std::optional<T>& Shadow, const T& Value);
+
+	// Slots past the tracked ones are always issued
+	template<typename T, size_t Count>
+	bool TrackSlot(std::optional<T> (&Shadows)[Count], UINT Slot, const T& Value);
+
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext1> DeviceContext;
+
+	std::optional<RenderTargetBinding> RenderTarget;
+	std::optional<D3D11_VIEWPORT> Viewport;
+	std::optional<ID3D11RasterizerState*> RasterizerState;
+	std::optional<BlendBinding> Blend;
+	std::optional<DepthStencilBinding> DepthStencil;
+
+	std::optional<ID3D11InputLayout*> InputLayout;
+	std::optional<D3D11_PRIMITIVE_TOPOLOGY> Topology;
+	std::optional<BufferBinding> VertexBuffers[MaxVertexBuffers];
+	std::optional<BufferBinding> IndexBuffer;
+
+	std::optional<ID3D11VertexShader*> VertexShader;
+	std::optional<ID3D11PixelShader*> PixelShader;
+	// NumConstants is 0 for a whole buffer
+	std::optional<BufferBinding> VSConstantBuffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+	std::optional<BufferBinding> PSConstantBuffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+	std::optional<ID3D11ShaderResourceView*> PSShaderResources[MaxShaderResources];
+	std::optional<ID3D11SamplerState*> PSSamplers[D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT];
+
+	Stats FrameCounters;
+	Stats LastFrameCounters;
+};
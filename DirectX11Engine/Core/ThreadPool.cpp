@@ -0,0 +1,176 @@
+#include "ThreadPool.h"
+#include "Memory.h"
+#include <algorithm>
+
+namespace
+{
+	FixedSizePool& GetStatePool();
+
+	struct ParallelForState
+	{
+		// The job of the caller, which waits for every range before returning
+		const std::function<void(size_t, size_t)>* Job = nullptr;
+		size_t Count = 0;
+		size_t Grain = 1;
+		size_t RangeCount = 0;
+
+		std::atomic<size_t> NextRange{ 0 };
+		std::atomic<size_t> DoneRanges{ 0 };
+		std::mutex DoneMutex;
+		std::condition_variable DoneCondition;
+
+		// The caller and the queued helpers, which may run after the caller returned. The last one gives the state back to the pool
+		std::atomic<size_t> References{ 0 };
+
+		void Release()
+		{
+			if (References.fetch_sub(1) == 1)
+			{
+				this->~ParallelForState();
+				GetStatePool().Free(this);
+			}
+		}
+
+		// Grab ranges until there are none left
+		void Run()
+		{
+			size_t Range;
+			while ((Range = NextRange.fetch_add(1)) < RangeCount)
+			{
+				const size_t Begin = Range * Grain;
+				(*Job)(Begin, std::min(Begin + Grain, Count));
+
+				if (DoneRanges.fetch_add(1) + 1 == RangeCount)
+				{
+					std::lock_guard<std::mutex> Lock(DoneMutex);
+					DoneCondition.notify_all();
+				}
+			}
+		}
+	};
+
+	FixedSizePool& GetStatePool()
+	{
+		static FixedSizePool Pool("Parallel for", sizeof(ParallelForState), 16, alignof(ParallelForState));
+		return Pool;
+	}
+}
+
+ThreadPool::ThreadPool(unsigned int ThreadCount)
+{
+	if (ThreadCount == 0)
+	{
+		const unsigned int HardwareThreads = std::thread::hardware_concurrency();
+		ThreadCount = HardwareThreads > 1 ? HardwareThreads - 1 : 1;
+	}
+
+	Workers.reserve(ThreadCount);
+	for (unsigned int i = 0; i < ThreadCount; ++i)
+	{
+		Workers.emplace_back([this]() { WorkerLoop(); });
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> Lock(JobsMutex);
+		bStopping = true;
+	}
+	JobsCondition.notify_all();
+
+	for (std::thread& Worker : Workers)
+	{
+		Worker.join();
+	}
+}
+
+ThreadPool& ThreadPool::Get()
+{
+	static ThreadPool EnginePool;
+	return EnginePool;
+}
+
+void ThreadPool::Enqueue(std::function<void()> Job)
+{
+	{
+		std::lock_guard<std::mutex> Lock(JobsMutex);
+		if (JobCount == Jobs.size())
+		{
+			// Unrolled in a ring twice as big
+			std::vector<std::function<void()>> Grown(std::max<size_t>(Jobs.size() * 2, 64));
+			for (size_t i = 0; i < JobCount; ++i)
+			{
+				Grown[i] = std::move(Jobs[(FirstJob + i) % Jobs.size()]);
+			}
+			Jobs.swap(Grown);
+			FirstJob = 0;
+		}
+		Jobs[(FirstJob + JobCount) % Jobs.size()] = std::move(Job);
+		++JobCount;
+	}
+	JobsCondition.notify_one();
+}
+
+void ThreadPool::ParallelFor(size_t Count, size_t Grain, const std::function<void(size_t, size_t)>& Job)
+{
+	if (Count == 0)
+	{
+		return;
+	}
+
+	Grain = std::max<size_t>(Grain, 1);
+	const size_t RangeCount = (Count + Grain - 1) / Grain;
+	if (RangeCount == 1 || Workers.empty())
+	{
+		Job(0, Count);
+		return;
+	}
+
+	// Helpers may still be queued after the last range is done, so they share ownership of the state.
+	// States come from a pool and the helpers only capture a pointer, so a parallel for doesn't allocate
+	const size_t HelperCount = std::min<size_t>(Workers.size(), RangeCount - 1);
+	ParallelForState* State = new (GetStatePool().Allocate()) ParallelForState();
+	State->Job = &Job;
+	State->Count = Count;
+	State->Grain = Grain;
+	State->RangeCount = RangeCount;
+	State->References = HelperCount + 1;
+
+	for (size_t i = 0; i < HelperCount; ++i)
+	{
+		Enqueue([State]() { State->Run(); State->Release(); });
+	}
+
+	State->Run();
+
+	{
+		std::unique_lock<std::mutex> Lock(State->DoneMutex);
+		State->DoneCondition.wait(Lock, [State]() { return State->DoneRanges.load() == State->RangeCount; });
+	}
+	State->Release();
+}
+
+void ThreadPool::WorkerLoop()
+{
+	while (true)
+	{
+		std::function<void()> Job;
+		{
+			std::unique_lock<std::mutex> Lock(JobsMutex);
+			JobsCondition.wait(Lock, [this]() { return bStopping || JobCount > 0; });
+
+			if (bStopping && JobCount == 0)
+			{
+				return;
+			}
+
+			Job = std::move(Jobs[FirstJob]);
+			Jobs[FirstJob] = nullptr;
+			FirstJob = (FirstJob + 1) % Jobs.size();
+			--JobCount;
+		}
+
+		Job();
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads shared by the whole engine
+class ThreadPool
+{
+public:
+	// 0 creates one worker per hardware thread minus the calling one
+	explicit ThreadPool(unsigned int ThreadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// The pool used by the engine systems
+	static ThreadPool& Get();
+
+	unsigned int GetThreadCount() const { return static_cast<unsigned int>(Workers.size()); }
+
+	// Run a job on the first available worker
+	void Enqueue(std::function<void()> Job);
+
+	// Split [0, Count) in ranges of Grain elements and run Job(Begin, End) on each of them.
+	// The calling thread takes part in the work and the call returns once every range is done.
+	void ParallelFor(size_t Count, size_t Grain, const std::function<void(size_t, size_t)>& Job);
+
+private:
+	void WorkerLoop();
+
+	std::vector<std::thread> Workers;
+	// Jobs waiting for a worker, in a ring that only grows, so queuing doesn't allocate once it is big enough
+	std::vector<std::function<void()>> Jobs;
+	size_t FirstJob = 0;
+	size_t JobCount = 0;
+	std::mutex JobsMutex;
+	std::condition_variable JobsCondition;
+	bool bStopping = false;
+};
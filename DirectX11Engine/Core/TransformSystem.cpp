@@ -0,0 +1,420 @@
+#include "Core/pch.h"
+#include "TransformSystem.h"
+#include "Actor.h"
+#include "Math.h"
+#include "ThreadPool.h"
+#include <chrono>
+#include <random>
+#include <stdexcept>
+
+using namespace DirectX;
+
+namespace
+{
+	// Transforms per job of the update, enough to hide the scheduling
+	const size_t UpdateGrain = 1024;
+
+	// The update path of the actors before the transform system : every setter rebuilds the world matrix
+	// and every direction getter rebuilds the rotation matrix
+	struct ImmediateTransform
+	{
+		XMMATRIX WorldMatrix = XMMatrixIdentity();
+		XMFLOAT3 Position = { 0, 0, 0 };
+		XMFLOAT3 Rotation = { 0, 0, 0 };
+		XMFLOAT3 Scale = { 1, 1, 1 };
+		std::function<void()> OnTransformChanged;
+
+		void SetPosition(XMFLOAT3 Val) { Position = Val; UpdateWorldMatrix(); }
+		void SetRotation(XMFLOAT3 Val) { Rotation = Val; UpdateWorldMatrix(); }
+
+		void UpdateWorldMatrix()
+		{
+			const XMMATRIX RotationMatrix = XMMatrixRotationRollPitchYaw(Math::DegreesToRadian(Rotation.x), Math::DegreesToRadian(Rotation.y), Math::DegreesToRadian(Rotation.z));
+			WorldMatrix = XMMatrixScaling(Scale.x, Scale.y, Scale.z) * RotationMatrix * XMMatrixTranslation(Position.x, Position.y, Position.z);
+			if (OnTransformChanged)
+			{
+				OnTransformChanged();
+			}
+		}
+
+		XMFLOAT3 GetDirection(FXMVECTOR Axis) const
+		{
+			const XMMATRIX RotationMatrix = XMMatrixRotationRollPitchYaw(Math::DegreesToRadian(Rotation.x), Math::DegreesToRadian(Rotation.y), Math::DegreesToRadian(Rotation.z));
+			XMFLOAT3 Result;
+			XMStoreFloat3(&Result, XMVector3Transform(Axis, RotationMatrix));
+			return Result;
+		}
+	};
+}
+
+TransformSystem::TransformSystem() = default;
+
+TransformSystem::~TransformSystem() = default;
+
+TransformSystem& TransformSystem::Get()
+{
+	static TransformSystem Instance;
+	return Instance;
+}
+
+TransformSystem::Id TransformSystem::Create(Actor* Owner)
+{
+	std::lock_guard<std::mutex> Lock(CreateMutex);
+
+	Id Transform;
+	if (!FreeIds.empty())
+	{
+		Transform = FreeIds.back();
+		FreeIds.pop_back();
+	}
+	else
+	{
+		if (HighWater == BlockSize * MaxBlocks)
+		{
+			throw std::runtime_error("TransformSystem : too many transforms");
+		}
+		Transform = HighWater++;
+		if (!Blocks[Transform / BlockSize])
+		{
+			Blocks[Transform / BlockSize] = std::make_unique<Block>();
+		}
+	}
+
+	Block& Entry = GetBlock(Transform);
+	const uint32_t Slot = GetSlot(Transform);
+	Entry.Positions[Slot] = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	Entry.Rotations[Slot] = XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
+	Entry.Scales[Slot] = XMFLOAT3(1.0f, 1.0f, 1.0f);
+	Entry.Parents[Slot] = InvalidId;
+	Entry.Versions[Slot] = 0;
+	Entry.ParentVersions[Slot] = 0;
+	XMStoreFloat4x4(&Entry.Worlds[Slot], XMMatrixIdentity());
+	Entry.Forwards[Slot] = XMFLOAT3(0.0f, 0.0f, 1.0f);
+	Entry.Rights[Slot] = XMFLOAT3(1.0f, 0.0f, 0.0f);
+	Entry.Ups[Slot] = XMFLOAT3(0.0f, 1.0f, 0.0f);
+	Entry.Owners[Slot] = Owner;
+	Entry.Flags[Slot] = Alive | Dirty;
+
+	bLevelsDirty = true;
+	return Transform;
+}
+
+void TransformSystem::Destroy(Id Transform)
+{
+	if (Transform == InvalidId)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> Lock(CreateMutex);
+
+	Block& Entry = GetBlock(Transform);
+	Entry.Flags[GetSlot(Transform)] = 0;
+	Entry.Owners[GetSlot(Transform)] = nullptr;
+
+	// The children stay where they are in the world until they are moved
+	if (bHasHierarchy)
+	{
+		for (Id Child = 0; Child < HighWater; ++Child)
+		{
+			Block& ChildEntry = GetBlock(Child);
+			const uint32_t ChildSlot = GetSlot(Child);
+			if ((ChildEntry.Flags[ChildSlot] & Alive) && ChildEntry.Parents[ChildSlot] == Transform)
+			{
+				ChildEntry.Parents[ChildSlot] = InvalidId;
+				ChildEntry.Flags[ChildSlot] |= Dirty;
+			}
+		}
+	}
+
+	FreeIds.push_back(Transform);
+	bLevelsDirty = true;
+}
+
+void TransformSystem::SetParent(Id Transform, Id Parent)
+{
+	for (Id Ancestor = Parent; Ancestor != InvalidId; Ancestor = GetParent(Ancestor))
+	{
+		if (Ancestor == Transform)
+		{
+			return;
+		}
+	}
+
+	Block& Entry = GetBlock(Transform);
+	Entry.Parents[GetSlot(Transform)] = Parent;
+	Entry.Flags[GetSlot(Transform)] |= Dirty;
+	bHasHierarchy |= Parent != InvalidId;
+	bLevelsDirty = true;
+}
+
+void TransformSystem::SetPosition(Id Transform, const XMFLOAT3& Position)
+{
+	Block& Entry = GetBlock(Transform);
+	Entry.Positions[GetSlot(Transform)] = Position;
+	Entry.Flags[GetSlot(Transform)] |= Dirty;
+}
+
+void TransformSystem::SetRotation(Id Transform, FXMVECTOR Quaternion)
+{
+	Block& Entry = GetBlock(Transform);
+	XMStoreFloat4(&Entry.Rotations[GetSlot(Transform)], Quaternion);
+	Entry.Flags[GetSlot(Transform)] |= Dirty;
+}
+
+void TransformSystem::SetScale(Id Transform, const XMFLOAT3& Scale)
+{
+	Block& Entry = GetBlock(Transform);
+	Entry.Scales[GetSlot(Transform)] = Scale;
+	Entry.Flags[GetSlot(Transform)] |= Dirty;
+}
+
+XMMATRIX TransformSystem::GetWorldMatrix(Id Transform)
+{
+	Resolve(Transform);
+	return XMLoadFloat4x4(&GetBlock(Transform).Worlds[GetSlot(Transform)]);
+}
+
+XMFLOAT3 TransformSystem::GetForwardVector(Id Transform)
+{
+	Resolve(Transform);
+	return GetBlock(Transform).Forwards[GetSlot(Transform)];
+}
+
+XMFLOAT3 TransformSystem::GetRightVector(Id Transform)
+{
+	Resolve(Transform);
+	return GetBlock(Transform).Rights[GetSlot(Transform)];
+}
+
+XMFLOAT3 TransformSystem::GetUpVector(Id Transform)
+{
+	Resolve(Transform);
+	return GetBlock(Transform).Ups[GetSlot(Transform)];
+}
+
+bool TransformSystem::NeedsRebuild(Id Transform) const
+{
+	const Block& Entry = GetBlock(Transform);
+	const uint32_t Slot = GetSlot(Transform);
+	if (Entry.Flags[Slot] & Dirty)
+	{
+		return true;
+	}
+
+	const Id Parent = Entry.Parents[Slot];
+	return Parent != InvalidId && Entry.ParentVersions[Slot] != GetBlock(Parent).Versions[GetSlot(Parent)];
+}
+
+void TransformSystem::Rebuild(Id Transform)
+{
+	Block& Entry = GetBlock(Transform);
+	const uint32_t Slot = GetSlot(Transform);
+
+	const XMFLOAT3& Position = Entry.Positions[Slot];
+	const XMFLOAT3& Scale = Entry.Scales[Slot];
+	XMMATRIX World = XMMatrixScaling(Scale.x, Scale.y, Scale.z) * XMMatrixRotationQuaternion(XMLoadFloat4(&Entry.Rotations[Slot]))
+		* XMMatrixTranslation(Position.x, Position.y, Position.z);
+
+	const Id Parent = Entry.Parents[Slot];
+	if (Parent != InvalidId)
+	{
+		const Block& ParentEntry = GetBlock(Parent);
+		World = World * XMLoadFloat4x4(&ParentEntry.Worlds[GetSlot(Parent)]);
+		Entry.ParentVersions[Slot] = ParentEntry.Versions[GetSlot(Parent)];
+	}
+
+	// The directions are the local axes in world space, cached with the matrix
+	XMStoreFloat4x4(&Entry.Worlds[Slot], World);
+	XMStoreFloat3(&Entry.Rights[Slot], XMVector3Normalize(World.r[0]));
+	XMStoreFloat3(&Entry.Ups[Slot], XMVector3Normalize(World.r[1]));
+	XMStoreFloat3(&Entry.Forwards[Slot], XMVector3Normalize(World.r[2]));
+
+	++Entry.Versions[Slot];
+	Entry.Flags[Slot] = (Entry.Flags[Slot] & ~Dirty) | Moved;
+}
+
+void TransformSystem::Resolve(Id Transform)
+{
+	const Id Parent = GetParent(Transform);
+	if (Parent != InvalidId)
+	{
+		Resolve(Parent);
+	}
+	if (NeedsRebuild(Transform))
+	{
+		Rebuild(Transform);
+	}
+}
+
+void TransformSystem::BuildLevels()
+{
+	// Depth of every transform, the chains above a transform are walked once
+	std::vector<int> Depths(HighWater, -1);
+	std::vector<Id> Chain;
+	size_t LevelCount = 0;
+	for (Id Transform = 0; Transform < HighWater; ++Transform)
+	{
+		if (!(GetBlock(Transform).Flags[GetSlot(Transform)] & Alive) || Depths[Transform] >= 0)
+		{
+			continue;
+		}
+
+		Chain.clear();
+		Id Current = Transform;
+		while (Current != InvalidId && Depths[Current] < 0)
+		{
+			Chain.push_back(Current);
+			Current = GetParent(Current);
+		}
+
+		int Depth = Current != InvalidId ? Depths[Current] : -1;
+		for (auto It = Chain.rbegin(); It != Chain.rend(); ++It)
+		{
+			Depths[*It] = ++Depth;
+		}
+		LevelCount = std::max(LevelCount, size_t(Depth) + 1);
+	}
+
+	Levels.resize(LevelCount);
+	for (std::vector<Id>& Level : Levels)
+	{
+		Level.clear();
+	}
+	for (Id Transform = 0; Transform < HighWater; ++Transform)
+	{
+		if (Depths[Transform] >= 0)
+		{
+			Levels[Depths[Transform]].push_back(Transform);
+		}
+	}
+	bLevelsDirty = false;
+}
+
+void TransformSystem::Update()
+{
+	auto Start = std::chrono::steady_clock::now();
+
+	if (bLevelsDirty)
+	{
+		BuildLevels();
+	}
+
+	// The parents of a level are all in the levels before it, so the transforms of a level only read finished matrices
+	for (const std::vector<Id>& Level : Levels)
+	{
+		ThreadPool::Get().ParallelFor(Level.size(), UpdateGrain, [this, &Level](size_t Begin, size_t End)
+		{
+			for (size_t i = Begin; i < End; ++i)
+			{
+				if (NeedsRebuild(Level[i]))
+				{
+					Rebuild(Level[i]);
+				}
+			}
+		});
+	}
+
+	// Owners are notified in id order, including the transforms rebuilt on demand since the last update
+	LastStats.Moved = 0;
+	for (Id Transform = 0; Transform < HighWater; ++Transform)
+	{
+		Block& Entry = GetBlock(Transform);
+		const uint32_t Slot = GetSlot(Transform);
+		if (Entry.Flags[Slot] & Moved)
+		{
+			Entry.Flags[Slot] &= ~Moved;
+			++LastStats.Moved;
+
+			Actor* Owner = Entry.Owners[Slot];
+			if (Owner && Owner->OnTransformChanged)
+			{
+				Owner->OnTransformChanged();
+			}
+		}
+	}
+
+	LastStats.Transforms = HighWater - FreeIds.size();
+	LastStats.Levels = Levels.size();
+	LastStats.UpdateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+}
+
+TransformSystem::Benchmark TransformSystem::RunBenchmark(size_t TransformCount, unsigned int Frames)
+{
+	Frames = std::max(Frames, 1u);
+
+	// Transforms spread in a 2 km cube, each one moving and turning a bit every frame
+	std::mt19937 Random(1234);
+	std::uniform_real_distribution<float> Position(-1000.0f, 1000.0f);
+	std::vector<XMFLOAT3> Starts(TransformCount);
+	for (XMFLOAT3& Start : Starts)
+	{
+		Start = XMFLOAT3(Position(Random), Position(Random), Position(Random));
+	}
+
+	auto Milliseconds = [](std::chrono::steady_clock::time_point From)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - From).count();
+	};
+
+	// Keeps the directions alive so their computation isn't optimized away
+	XMVECTOR Checksum = XMVectorZero();
+	auto Accumulate = [&Checksum](const XMFLOAT3& Forward, const XMFLOAT3& Right, const XMFLOAT3& Up)
+	{
+		Checksum = XMVectorAdd(Checksum, XMVectorAdd(XMLoadFloat3(&Forward), XMVectorAdd(XMLoadFloat3(&Right), XMLoadFloat3(&Up))));
+	};
+
+	Benchmark Result;
+	Result.Transforms = TransformCount;
+	Result.Frames = Frames;
+
+	std::vector<ImmediateTransform> Immediate(TransformCount);
+	auto Start = std::chrono::steady_clock::now();
+	for (unsigned int Frame = 0; Frame < Frames; ++Frame)
+	{
+		for (size_t i = 0; i < TransformCount; ++i)
+		{
+			Immediate[i].SetPosition(XMFLOAT3(Starts[i].x + Frame * 0.1f, Starts[i].y, Starts[i].z));
+			Immediate[i].SetRotation(XMFLOAT3(0.0f, float(Frame), 0.0f));
+			Accumulate(Immediate[i].GetDirection(g_XMIdentityR2), Immediate[i].GetDirection(g_XMIdentityR0), Immediate[i].GetDirection(g_XMIdentityR1));
+		}
+	}
+	Result.ImmediateMs = Milliseconds(Start) / Frames;
+
+	TransformSystem System;
+	std::vector<Id> Ids(TransformCount);
+	for (Id& Transform : Ids)
+	{
+		Transform = System.Create();
+	}
+
+	for (unsigned int Frame = 0; Frame < Frames; ++Frame)
+	{
+		Start = std::chrono::steady_clock::now();
+		const XMVECTOR Rotation = XMQuaternionRotationRollPitchYaw(0.0f, Math::DegreesToRadian(float(Frame)), 0.0f);
+		for (size_t i = 0; i < TransformCount; ++i)
+		{
+			System.SetPosition(Ids[i], XMFLOAT3(Starts[i].x + Frame * 0.1f, Starts[i].y, Starts[i].z));
+			System.SetRotation(Ids[i], Rotation);
+		}
+		Result.SetMs += Milliseconds(Start);
+
+		Start = std::chrono::steady_clock::now();
+		System.Update();
+		Result.UpdateMs += Milliseconds(Start);
+
+		Start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < TransformCount; ++i)
+		{
+			Accumulate(System.GetForwardVector(Ids[i]), System.GetRightVector(Ids[i]), System.GetUpVector(Ids[i]));
+		}
+		Result.ReadMs += Milliseconds(Start);
+	}
+	Result.SetMs /= Frames;
+	Result.UpdateMs /= Frames;
+	Result.ReadMs /= Frames;
+
+	volatile float Sink = XMVectorGetX(Checksum);
+	(void)Sink;
+	return Result;
+}
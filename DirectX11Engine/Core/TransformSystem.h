@@ -0,0 +1,135 @@
+#pragma once
+#include "Core/pch.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class Actor;
+
+// Position, rotation and scale of every actor, stored structure of arrays with a quaternion rotation and an optional parent.
+// Setters only mark a transform dirty : the world matrices and direction vectors of the dirty transforms and of the ones under
+// them are rebuilt once per frame by Update, one level of the hierarchy at a time across the thread pool.
+// Reading a dirty transform before that rebuilds it and its parents on the spot.
+// The arrays live in fixed blocks, so transforms can be created from several threads while the others are being set.
+class TransformSystem
+{
+public:
+
+	using Id = uint32_t;
+	static constexpr Id InvalidId = ~0u;
+
+	struct Stats
+	{
+		size_t Transforms = 0;
+		size_t Levels = 0;
+		// Transforms rebuilt and owners notified by the last Update
+		size_t Moved = 0;
+		double UpdateMs = 0.0;
+	};
+
+	// 100k moving transforms set, updated and read every frame, against an actor rebuilding its matrix in every setter
+	struct Benchmark
+	{
+		size_t Transforms = 0;
+		unsigned int Frames = 0;
+		// Per frame
+		double ImmediateMs = 0.0;
+		double SetMs = 0.0;
+		double UpdateMs = 0.0;
+		double ReadMs = 0.0;
+	};
+
+	TransformSystem();
+	~TransformSystem();
+
+	TransformSystem(const TransformSystem&) = delete;
+	TransformSystem& operator=(const TransformSystem&) = delete;
+
+	// The transforms of the actors
+	static TransformSystem& Get();
+
+	// Owner gets OnTransformChanged called when Update moves the transform
+	Id Create(Actor* Owner = nullptr);
+	void Destroy(Id Transform);
+
+	// The world matrix of a child is its local matrix followed by the world matrix of its parent. Cycles are refused
+	void SetParent(Id Transform, Id Parent);
+	Id GetParent(Id Transform) const { return GetBlock(Transform).Parents[GetSlot(Transform)]; }
+
+	void SetPosition(Id Transform, const DirectX::XMFLOAT3& Position);
+	void SetRotation(Id Transform, DirectX::FXMVECTOR Quaternion);
+	void SetScale(Id Transform, const DirectX::XMFLOAT3& Scale);
+
+	DirectX::XMFLOAT3 GetPosition(Id Transform) const { return GetBlock(Transform).Positions[GetSlot(Transform)]; }
+	DirectX::XMVECTOR GetRotation(Id Transform) const { return DirectX::XMLoadFloat4(&GetBlock(Transform).Rotations[GetSlot(Transform)]); }
+	DirectX::XMFLOAT3 GetScale(Id Transform) const { return GetBlock(Transform).Scales[GetSlot(Transform)]; }
+
+	// Up to date world matrix and world space directions of the local axes
+	DirectX::XMMATRIX GetWorldMatrix(Id Transform);
+	DirectX::XMFLOAT3 GetForwardVector(Id Transform);
+	DirectX::XMFLOAT3 GetRightVector(Id Transform);
+	DirectX::XMFLOAT3 GetUpVector(Id Transform);
+
+	// Rebuild the dirty transforms, then notify the owners of every transform rebuilt since the previous Update
+	void Update();
+
+	const Stats& GetStats() const { return LastStats; }
+
+	static Benchmark RunBenchmark(size_t TransformCount, unsigned int Frames);
+
+private:
+
+	static constexpr uint32_t BlockSize = 1024;
+	static constexpr uint32_t MaxBlocks = 1024;
+
+	enum EFlags : uint8_t
+	{
+		Alive = 1,
+		// The local transform changed since the world matrix was built
+		Dirty = 2,
+		// The world matrix was rebuilt since the last Update
+		Moved = 4,
+	};
+
+	struct Block
+	{
+		DirectX::XMFLOAT3 Positions[BlockSize];
+		DirectX::XMFLOAT4 Rotations[BlockSize];
+		DirectX::XMFLOAT3 Scales[BlockSize];
+		Id Parents[BlockSize];
+
+		// Incremented on every rebuild. A child is stale when the version of its parent differs from the one it was built with
+		uint32_t Versions[BlockSize];
+		uint32_t ParentVersions[BlockSize];
+
+		DirectX::XMFLOAT4X4 Worlds[BlockSize];
+		DirectX::XMFLOAT3 Forwards[BlockSize];
+		DirectX::XMFLOAT3 Rights[BlockSize];
+		DirectX::XMFLOAT3 Ups[BlockSize];
+
+		Actor* Owners[BlockSize];
+		uint8_t Flags[BlockSize];
+	};
+
+	Block& GetBlock(Id Transform) const { return *Blocks[Transform / BlockSize]; }
+	static uint32_t GetSlot(Id Transform) { return Transform % BlockSize; }
+
+	bool NeedsRebuild(Id Transform) const;
+	void Rebuild(Id Transform);
+	// Rebuild the parents then the transform, if they are dirty
+	void Resolve(Id Transform);
+
+	void BuildLevels();
+
+	std::unique_ptr<Block> Blocks[MaxBlocks];
+	uint32_t HighWater = 0;
+	std::vector<Id> FreeIds;
+	std::mutex CreateMutex;
+
+	// Transforms by depth in the hierarchy, rebuilt when transforms are added, removed or reparented
+	std::vector<std::vector<Id>> Levels;
+	bool bLevelsDirty = false;
+	bool bHasHierarchy = false;
+
+	Stats LastStats;
+};
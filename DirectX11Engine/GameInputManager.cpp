@@ -2,6 +2,7 @@
 #include "Core/Renderer.h"
 #include "Camera.h"
 #include "Mesh/Mesh.h"
+#include "ImGui/imgui.h"
 
 #include "GameInputManager.h"
 
@@ -112,6 +113,13 @@ void GameInputManager::HandleMouse()
 		LastY = Mouse->GetState().y;
 	}
 
+	// Pick on the press, unless the click is for the GUI
+	if (MouseState.leftButton && !bLastLeftButton && MouseState.positionMode == Mouse::MODE_ABSOLUTE && !ImGui::GetIO().WantCaptureMouse)
+	{
+		Owner->PickAt(MouseState.x, MouseState.y);
+	}
+	bLastLeftButton = MouseState.leftButton;
+
 	Mouse->SetMode(MouseState.rightButton ? Mouse::MODE_RELATIVE : Mouse::MODE_ABSOLUTE);
 }
 
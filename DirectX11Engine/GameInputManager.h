@@ -24,6 +24,7 @@ private:
 	bool bFirstFrame = true;
 	int LastX, LastY;
 	int LastFrameWheelValue = 0;
+	bool bLastLeftButton = false;
 
 	void Zoom(int ZoomValue);
 
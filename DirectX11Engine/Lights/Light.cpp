@@ -11,13 +11,11 @@ DirectionalLight::DirectionalLight(DirectX::XMFLOAT3 NewPosition, DirectX::XMFLO
 :Light(NewPosition, NewAmbientColor, NewDiffuseColor, NewSpecularColor)
 {
 	SetRotation(NewRotation);
-	UpdateWorldMatrix();
 }
 
 PointLight::PointLight(DirectX::XMFLOAT3 NewPosition, DirectX::XMFLOAT4 NewAmbientColor, DirectX::XMFLOAT4 NewDiffuseColor, DirectX::XMFLOAT4 NewSpecularColor, DirectX::XMFLOAT3 NewAttenuation)
 	:Light(NewPosition, NewAmbientColor, NewDiffuseColor, NewSpecularColor), Attenuation(NewAttenuation)
 {
-	UpdateWorldMatrix();
 }
 
 DirectionalLightData DirectionalLight::GetLightData()
@@ -37,7 +35,7 @@ PointLightData PointLight::GetLightData()
 	LightData.AmbientColor = AmbientColor;
 	LightData.DiffuseColor = DiffuseColor;
 	LightData.SpecularColor = SpecularColor;
-	LightData.Position = Position;
+	LightData.Position = GetPosition();
 	LightData.Attenuation = Attenuation;
 	LightData.Range = Range;
 
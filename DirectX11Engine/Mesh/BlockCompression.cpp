@@ -0,0 +1,641 @@
+#include "BlockCompression.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	const int PixelCount = 16;
+
+	// BC7 interpolation weights of the 4 bit indices
+	const int Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	int Clamp(int Value, int Min, int Max)
+	{
+		return Value < Min ? Min : (Value > Max ? Max : Value);
+	}
+
+	int RoundToInt(float Value)
+	{
+		return static_cast<int>(std::floor(Value + 0.5f));
+	}
+
+	// Principal axis of the first Dimensions components of the pixels, by power iteration on their covariance
+	void PrincipalAxis(const float Points[PixelCount][4], int Dimensions, const float* Mean, float* OutAxis)
+	{
+		float Covariance[4][4] = {};
+		for (int iPixel = 0; iPixel < PixelCount; ++iPixel)
+		{
+			for (int i = 0; i < Dimensions; ++i)
+			{
+				for (int j = 0; j < Dimensions; ++j)
+				{
+					Covariance[i][j] += (Points[iPixel][i] - Mean[i]) * (Points[iPixel][j] - Mean[j]);
+				}
+			}
+		}
+
+		float Axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+		for (int Iteration = 0; Iteration < 8; ++Iteration)
+		{
+			float Next[4] = {};
+			float Largest = 0.0f;
+			for (int i = 0; i < Dimensions; ++i)
+			{
+				for (int j = 0; j < Dimensions; ++j)
+				{
+					Next[i] += Covariance[i][j] * Axis[j];
+				}
+				Largest = std::max(Largest, std::fabs(Next[i]));
+			}
+
+			// Flat block
+			if (Largest < 1e-6f)
+			{
+				break;
+			}
+			for (int i = 0; i < Dimensions; ++i)
+			{
+				Axis[i] = Next[i] / Largest;
+			}
+		}
+
+		float Length = 0.0f;
+		for (int i = 0; i < Dimensions; ++i)
+		{
+			Length += Axis[i] * Axis[i];
+		}
+		Length = std::sqrt(Length);
+		for (int i = 0; i < 4; ++i)
+		{
+			OutAxis[i] = i < Dimensions ? Axis[i] / Length : 0.0f;
+		}
+	}
+
+	// Endpoints at both ends of the projection of the pixels on their principal axis
+	void FitEndpoints(const float Points[PixelCount][4], int Dimensions, float* OutEnd0, float* OutEnd1)
+	{
+		float Mean[4] = {};
+		for (int iPixel = 0; iPixel < PixelCount; ++iPixel)
+		{
+			for (int i = 0; i < Dimensions; ++i)
+			{
+				Mean[i] += Points[iPixel][i] / PixelCount;
+			}
+		}
+
+		float Axis[4];
+		PrincipalAxis(Points, Dimensions, Mean, Axis);
+
+		float MinProjection = FLT_MAX;
+		float MaxProjection = -FLT_MAX;
+		for (int iPixel = 0; iPixel < PixelCount; ++iPixel)
+		{
+			float Projection = 0.0f;
+			for (int i = 0; i < Dimensions; ++i)
+			{
+				Projection += (Points[iPixel][i] - Mean[i]) * Axis[i];
+			}
+			MinProjection = std::min(MinProjection, Projection);
+			MaxProjection = std::max(MaxProjection, Projection);
+		}
+
+		for (int i = 0; i < Dimensions; ++i)
+		{
+			OutEnd0[i] = std::min(255.0f, std::max(0.0f, Mean[i] + Axis[i] * MaxProjection));
+			OutEnd1[i] = std::min(255.0f, std::max(0.0f, Mean[i] + Axis[i] * MinProjection));
+		}
+	}
+
+	// Least squares endpoints for fixed indices, Weights[iPixel] being the weight of the second endpoint.
+	// Returns false if every pixel uses the same weight
+	bool RefitEndpoints(const float Points[PixelCount][4], int Dimensions, const float* Weights, float* OutEnd0, float* OutEnd1)
+	{
+		float A = 0.0f, B = 0.0f, C = 0.0f;
+		float X[4] = {}, Y[4] = {};
+		for (int iPixel = 0; iPixel < PixelCount; ++iPixel)
+		{
+			const float T = Weights[iPixel];
+			A += (1.0f - T) * (1.0f - T);
+			B += (1.0f - T) * T;
+			C += T * T;
+			for (int i = 0; i < Dimensions; ++i)
+			{
+				X[i] += (1.0f - T) * Points[iPixel][i];
+				Y[i] += T * Points[iPixel][i];
+			}
+		}
+
+		const float Determinant = A * C - B * B;
+		if (std::fabs(Determinant) < 1e-6f)
+		{
+			return false;
+		}
+
+		for (int i = 0; i < Dimensions; ++i)
+		{
+			OutEnd0[i] = std::min(255.0f, std::max(0.0f, (X[i] * C - Y[i] * B) / Determinant));
+			OutEnd1[i] = std::min(255.0f, std::max(0.0f, (Y[i] * A - X[i] * B) / Determinant));
+		}
+		return true;
+	}
+
+	void LoadPoints(const uint8_t* Pixels, float OutPoints[PixelCount][4])
+	{
+		for (int iPixel = 0; iPixel < PixelCount; ++iPixel)
+		{
+			for (int i = 0; i < 4; ++i)
+			{
+				OutPoints[iPixel][i] = Pixels[iPixel * 4 + i];
+			}
+		}
+	}
+
+	// Nearest palette entry of every pixel, returns the total squared error
+	template <int EntryCount>
+	int FindIndices(const uint8_t* Pixels, int Dimensions, const int Palette[EntryCount][4], int* OutIndices)
+	{
+		int TotalError = 0;
+		for (int iPixel = 0; iPixel < PixelCount; ++iPixel)
+		{
+			int BestError = INT32_MAX;
+			for (int iEntry = 0; iEntry < EntryCount; ++iEntry)
+			{
+				int Error = 0;
+				for (int i = 0; i < Dimensions; ++i)
+				{
+					const int Delta = Pixels[iPixel * 4 + i] - Palette[iEntry][i];
+					Error += Delta * Delta;
+				}
+				if (Error < BestError)
+				{
+					BestError = Error;
+					OutIndices[iPixel] = iEntry;
+				}
+			}
+			TotalError += BestError;
+		}
+		return TotalError;
+	}
+
+	// ----- BC1 color -----
+
+	uint16_t PackRGB565(const float* Color)
+	{
+		const int R = Clamp(RoundToInt(Color[0] * 31.0f / 255.0f), 0, 31);
+		const int G = Clamp(RoundToInt(Color[1] * 63.0f / 255.0f), 0, 63);
+		const int B = Clamp(RoundToInt(Color[2] * 31.0f / 255.0f), 0, 31);
+		return static_cast<uint16_t>((R << 11) | (G << 5) | B);
+	}
+
+	void UnpackRGB565(uint16_t Color, int* OutColor)
+	{
+		const int R = Color >> 11;
+		const int G = (Color >> 5) & 63;
+		const int B = Color & 31;
+		OutColor[0] = (R << 3) | (R >> 2);
+		OutColor[1] = (G << 2) | (G >> 4);
+		OutColor[2] = (B << 3) | (B >> 2);
+		OutColor[3] = 255;
+	}
+
+	void ColorPalette(uint16_t Color0, uint16_t Color1, bool bFourColors, int OutPalette[4][4])
+	{
+		UnpackRGB565(Color0, OutPalette[0]);
+		UnpackRGB565(Color1, OutPalette[1]);
+		for (int i = 0; i < 3; ++i)
+		{
+			if (bFourColors)
+			{
+				OutPalette[2][i] = (2 * OutPalette[0][i] + OutPalette[1][i]) / 3;
+				OutPalette[3][i] = (OutPalette[0][i] + 2 * OutPalette[1][i]) / 3;
+			}
+			else
+			{
+				OutPalette[2][i] = (OutPalette[0][i] + OutPalette[1][i]) / 2;
+				OutPalette[3][i] = 0;
+			}
+		}
+		OutPalette[2][3] = 255;
+		OutPalette[3][3] = bFourColors ? 255 : 0;
+	}
+
+	// Indices and error of a four color block, the endpoints are ordered so that the decoder picks the four color mode
+	int EvaluateColorBlock(const uint8_t* Pixels, uint16_t& Color0, uint16_t& Color1, int* OutIndices)
+	{
+		if (Color0 < Color1)
+		{
+			std::swap(Color0, Color1);
+		}
+
+		int Palette[4][4];
+		ColorPalette(Color0, Color1, true, Palette);
+		if (Color0 == Color1)
+		{
+			// Three color mode, index 0 is still the endpoint
+			std::fill(OutIndices, OutIndices + PixelCount, 0);
+			int Error = 0;
+			for (int iPixel = 0; iPixel < PixelCount; ++iPixel)
+			{
+				for (int i = 0; i < 3; ++i)
+				{
+					const int Delta = Pixels[iPixel * 4 + i] - Palette[0][i];
+					Error += Delta * Delta;
+				}
+			}
+			return Error;
+		}
+		return FindIndices<4>(Pixels, 3, Palette, OutIndices);
+	}
+
+	void EncodeColorBlock(const uint8_t* Pixels, uint8_t* OutBlock)
+	{
+		float Points[PixelCount][4];
+		LoadPoints(Pixels, Points);
+
+		float End0[4], End1[4];
+		FitEndpoints(Points, 3, End0, End1);
+
+		uint16_t BestColor0 = PackRGB565(End0);
+		uint16_t BestColor1 = PackRGB565(End1);
+		int BestIndices[PixelCount];
+		int BestError = EvaluateColorBlock(Pixels, BestColor0, BestColor1, BestIndices);
+
+		// Least squares refinement of the endpoints
+		const float IndexWeights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+		for (int Iteration = 0; Iteration < 2 && BestError > 0; ++Iteration)
+		{
+			float Weights[PixelCount];
+			for (int iPixel = 0; iPixel < PixelCount; ++iPixel)
+			{
+				Weights[iPixel] = IndexWeights[BestIndices[iPixel]];
+			}
+			if (!RefitEndpoints(Points, 3, Weights, End0, End1))
+			{
+				break;
+			}
+
+			uint16_t Color0 = PackRGB565(End0);
+			uint16_t Color1 = PackRGB565(End1);
+			int Indices[PixelCount];
+			const int Error = EvaluateColorBlock(Pixels, Color0, Color1, Indices);
+			if (Error >= BestError)
+			{
+				break;
+			}
+
+			BestError = Error;
+			BestColor0 = Color0;
+			BestColor1 = Color1;
+			memcpy(BestIndices, Indices, sizeof(Indices));
+		}
+
+		uint32_t IndexBits = 0;
+		for (int iPixel = 0; iPixel < PixelCount; ++iPixel)
+		{
+			IndexBits |= uint32_t(BestIndices[iPixel]) << (iPixel * 2);
+		}
+
+		memcpy(OutBlock, &BestColor0, 2);
+		memcpy(OutBlock + 2, &BestColor1, 2);
+		memcpy(OutBlock + 4, &IndexBits, 4);
+	}
+
+	void DecodeColorBlock(const uint8_t* Block, bool bForceFourColors, uint8_t* OutPixels)
+	{
+		uint16_t Color0, Color1;
+		uint32_t IndexBits;
+		memcpy(&Color0, Block, 2);
+		memcpy(&Color1, Block + 2, 2);
+		memcpy(&IndexBits, Block + 4, 4);
+
+		int Palette[4][4];
+		ColorPalette(Color0, Color1, bForceFourColors || Color0 > Color1, Palette);
+
+		for (int iPixel = 0; iPixel < PixelCount; ++iPixel)
+		{
+			const int Index = (IndexBits >> (iPixel * 2)) & 3;
+			for (int i = 0; i < 4; ++i)
+			{
+				OutPixels[iPixel * 4 + i] = static_cast<uint8_t>(Palette[Index][i]);
+			}
+		}
+	}
+
+	// ----- BC4 single channel -----
+
+	void AlphaPalette(int Alpha0, int Alpha1, int OutPalette[8][4])
+	{
+		OutPalette[0][0] = Alpha0;
+		OutPalette[1][0] = Alpha1;
+		if (Alpha0 > Alpha1)
+		{
+			for (int i = 1; i < 7; ++i)
+			{
+				OutPalette[i + 1][0] = ((7 - i) * Alpha0 + i * Alpha1 + 3) / 7;
+			}
+		}
+		else
+		{
+			for (int i = 1; i < 5; ++i)
+			{
+				OutPalette[i + 1][0] = ((5 - i) * Alpha0 + i * Alpha1 + 2) / 5;
+			}
+			OutPalette[6][0] = 0;
+			OutPalette[7][0] = 255;
+		}
+	}
+
+	// ----- BC7 mode 6 -----
+
+	class BitWriter
+	{
+	public:
+		explicit BitWriter(uint8_t* Bytes) : Bytes(Bytes) { memset(Bytes, 0, 16); }
+
+		void Write(uint32_t Value, int BitCount)
+		{
+			for (int iBit = 0; iBit < BitCount; ++iBit, ++Position)
+			{
+				if ((Value >> iBit) & 1)
+				{
+					Bytes[Position >> 3] |= uint8_t(1 << (Position & 7));
+				}
+			}
+		}
+
+	private:
+		uint8_t* Bytes;
+		int Position = 0;
+	};
+
+	class BitReader
+	{
+	public:
+		explicit BitReader(const uint8_t* Bytes) : Bytes(Bytes) {}
+
+		uint32_t Read(int BitCount)
+		{
+			uint32_t Value = 0;
+			for (int iBit = 0; iBit < BitCount; ++iBit, ++Position)
+			{
+				Value |= uint32_t((Bytes[Position >> 3] >> (Position & 7)) & 1) << iBit;
+			}
+			return Value;
+		}
+
+	private:
+		const uint8_t* Bytes;
+		int Position = 0;
+	};
+
+	// 7 bit endpoint and the shared bit that gets closest to an 8 bit color
+	void QuantizeEndpointBC7(const float* Endpoint, int* OutQuantized, int& OutPBit)
+	{
+		int BestError = INT32_MAX;
+		for (int PBit = 0; PBit < 2; ++PBit)
+		{
+			int Quantized[4];
+			int Error = 0;
+			for (int i = 0; i < 4; ++i)
+			{
+				Quantized[i] = Clamp(RoundToInt((Endpoint[i] - PBit) * 0.5f), 0, 127);
+				const int Delta = ((Quantized[i] << 1) | PBit) - RoundToInt(Endpoint[i]);
+				Error += Delta * Delta;
+			}
+			if (Error < BestError)
+			{
+				BestError = Error;
+				OutPBit = PBit;
+				memcpy(OutQuantized, Quantized, sizeof(Quantized));
+			}
+		}
+	}
+
+	void PaletteBC7(const int* Quantized0, int PBit0, const int* Quantized1, int PBit1, int OutPalette[16][4])
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			const int Value0 = (Quantized0[i] << 1) | PBit0;
+			const int Value1 = (Quantized1[i] << 1) | PBit1;
+			for (int iEntry = 0; iEntry < 16; ++iEntry)
+			{
+				OutPalette[iEntry][i] = ((64 - Weights4[iEntry]) * Value0 + Weights4[iEntry] * Value1 + 32) >> 6;
+			}
+		}
+	}
+}
+
+void BlockCompression::EncodeBC1(const uint8_t* Pixels, uint8_t* OutBlock)
+{
+	EncodeColorBlock(Pixels, OutBlock);
+}
+
+void BlockCompression::DecodeBC1(const uint8_t* Block, uint8_t* OutPixels)
+{
+	DecodeColorBlock(Block, false, OutPixels);
+}
+
+void BlockCompression::EncodeBC3(const uint8_t* Pixels, uint8_t* OutBlock)
+{
+	EncodeBC4(Pixels, 3, OutBlock);
+	EncodeColorBlock(Pixels, OutBlock + 8);
+}
+
+void BlockCompression::DecodeBC3(const uint8_t* Block, uint8_t* OutPixels)
+{
+	DecodeColorBlock(Block + 8, true, OutPixels);
+	DecodeBC4(Block, 3, OutPixels);
+}
+
+void BlockCompression::EncodeBC4(const uint8_t* Pixels, int Channel, uint8_t* OutBlock)
+{
+	uint8_t Values[PixelCount * 4] = {};
+	int Min = 255, Max = 0;
+	for (int iPixel = 0; iPixel < PixelCount; ++iPixel)
+	{
+		Values[iPixel * 4] = Pixels[iPixel * 4 + Channel];
+		Min = std::min<int>(Min, Values[iPixel * 4]);
+		Max = std::max<int>(Max, Values[iPixel * 4]);
+	}
+
+	int BestAlpha0 = Max, BestAlpha1 = Min;
+	int BestIndices[PixelCount] = {};
+
+	if (Max > Min)
+	{
+		// Eight value mode, with the endpoints slightly inset when it lowers the error
+		int BestError = INT32_MAX;
+		for (int Alpha0 = Max; Alpha0 >= std::max(Min + 1, Max - 2); --Alpha0)
+		{
+			for (int Alpha1 = Min; Alpha1 <= std::min(Alpha0 - 1, Min + 2); ++Alpha1)
+			{
+				int Palette[8][4];
+				AlphaPalette(Alpha0, Alpha1, Palette);
+
+				int Indices[PixelCount];
+				const int Error = FindIndices<8>(Values, 1, Palette, Indices);
+				if (Error < BestError)
+				{
+					BestError = Error;
+					BestAlpha0 = Alpha0;
+					BestAlpha1 = Alpha1;
+					memcpy(BestIndices, Indices, sizeof(Indices));
+				}
+			}
+		}
+	}
+
+	uint64_t IndexBits = 0;
+	for (int iPixel = 0; iPixel < PixelCount; ++iPixel)
+	{
+		IndexBits |= uint64_t(BestIndices[iPixel]) << (iPixel * 3);
+	}
+
+	OutBlock[0] = static_cast<uint8_t>(BestAlpha0);
+	OutBlock[1] = static_cast<uint8_t>(BestAlpha1);
+	for (int iByte = 0; iByte < 6; ++iByte)
+	{
+		OutBlock[2 + iByte] = static_cast<uint8_t>(IndexBits >> (iByte * 8));
+	}
+}
+
+void BlockCompression::DecodeBC4(const uint8_t* Block, int Channel, uint8_t* OutPixels)
+{
+	int Palette[8][4];
+	AlphaPalette(Block[0], Block[1], Palette);
+
+	uint64_t IndexBits = 0;
+	for (int iByte = 0; iByte < 6; ++iByte)
+	{
+		IndexBits |= uint64_t(Block[2 + iByte]) << (iByte * 8);
+	}
+
+	for (int iPixel = 0; iPixel < PixelCount; ++iPixel)
+	{
+		OutPixels[iPixel * 4 + Channel] = static_cast<uint8_t>(Palette[(IndexBits >> (iPixel * 3)) & 7][0]);
+	}
+}
+
+void BlockCompression::EncodeBC5(const uint8_t* Pixels, uint8_t* OutBlock)
+{
+	EncodeBC4(Pixels, 0, OutBlock);
+	EncodeBC4(Pixels, 1, OutBlock + 8);
+}
+
+void BlockCompression::DecodeBC5(const uint8_t* Block, uint8_t* OutPixels)
+{
+	for (int iPixel = 0; iPixel < PixelCount; ++iPixel)
+	{
+		OutPixels[iPixel * 4 + 2] = 0;
+		OutPixels[iPixel * 4 + 3] = 255;
+	}
+	DecodeBC4(Block, 0, OutPixels);
+	DecodeBC4(Block + 8, 1, OutPixels);
+}
+
+void BlockCompression::EncodeBC7(const uint8_t* Pixels, uint8_t* OutBlock)
+{
+	float Points[PixelCount][4];
+	LoadPoints(Pixels, Points);
+
+	float End0[4], End1[4];
+	FitEndpoints(Points, 4, End0, End1);
+
+	int BestQuantized0[4] = {}, BestQuantized1[4] = {}, BestPBit0 = 0, BestPBit1 = 0;
+	int BestIndices[PixelCount] = {};
+	int BestError = INT32_MAX;
+
+	for (int Iteration = 0; Iteration < 3; ++Iteration)
+	{
+		int Quantized0[4], Quantized1[4], PBit0, PBit1;
+		QuantizeEndpointBC7(End0, Quantized0, PBit0);
+		QuantizeEndpointBC7(End1, Quantized1, PBit1);
+
+		int Palette[16][4];
+		PaletteBC7(Quantized0, PBit0, Quantized1, PBit1, Palette);
+
+		int Indices[PixelCount];
+		const int Error = FindIndices<16>(Pixels, 4, Palette, Indices);
+		if (Error >= BestError)
+		{
+			break;
+		}
+
+		BestError = Error;
+		memcpy(BestQuantized0, Quantized0, sizeof(Quantized0));
+		memcpy(BestQuantized1, Quantized1, sizeof(Quantized1));
+		BestPBit0 = PBit0;
+		BestPBit1 = PBit1;
+		memcpy(BestIndices, Indices, sizeof(Indices));
+
+		// Least squares refinement of the endpoints for the next iteration
+		float Weights[PixelCount];
+		for (int iPixel = 0; iPixel < PixelCount; ++iPixel)
+		{
+			Weights[iPixel] = Weights4[Indices[iPixel]] / 64.0f;
+		}
+		if (Error == 0 || !RefitEndpoints(Points, 4, Weights, End0, End1))
+		{
+			break;
+		}
+	}
+
+	// The anchor index is stored without its top bit, which must be 0
+	if (BestIndices[0] & 8)
+	{
+		std::swap(BestQuantized0, BestQuantized1);
+		std::swap(BestPBit0, BestPBit1);
+		for (int iPixel = 0; iPixel < PixelCount; ++iPixel)
+		{
+			BestIndices[iPixel] = 15 - BestIndices[iPixel];
+		}
+	}
+
+	BitWriter Writer(OutBlock);
+	Writer.Write(1 << 6, 7);
+	for (int i = 0; i < 4; ++i)
+	{
+		Writer.Write(BestQuantized0[i], 7);
+		Writer.Write(BestQuantized1[i], 7);
+	}
+	Writer.Write(BestPBit0, 1);
+	Writer.Write(BestPBit1, 1);
+	Writer.Write(BestIndices[0], 3);
+	for (int iPixel = 1; iPixel < PixelCount; ++iPixel)
+	{
+		Writer.Write(BestIndices[iPixel], 4);
+	}
+}
+
+bool BlockCompression::DecodeBC7(const uint8_t* Block, uint8_t* OutPixels)
+{
+	BitReader Reader(Block);
+	if (Reader.Read(7) != (1 << 6))
+	{
+		return false;
+	}
+
+	int Quantized0[4], Quantized1[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		Quantized0[i] = Reader.Read(7);
+		Quantized1[i] = Reader.Read(7);
+	}
+	const int PBit0 = Reader.Read(1);
+	const int PBit1 = Reader.Read(1);
+
+	int Palette[16][4];
+	PaletteBC7(Quantized0, PBit0, Quantized1, PBit1, Palette);
+
+	for (int iPixel = 0; iPixel < PixelCount; ++iPixel)
+	{
+		const int Index = Reader.Read(iPixel == 0 ? 3 : 4);
+		for (int i = 0; i < 4; ++i)
+		{
+			OutPixels[iPixel * 4 + i] = static_cast<uint8_t>(Palette[Index][i]);
+		}
+	}
+	return true;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+
+// CPU encoders and decoders of single 4x4 blocks of the BCn formats.
+// Pixels are 16 RGBA8 texels in row order, blocks are written in their GPU layout.
+namespace BlockCompression
+{
+	// 8 bytes, opaque color
+	void EncodeBC1(const uint8_t* Pixels, uint8_t* OutBlock);
+	void DecodeBC1(const uint8_t* Block, uint8_t* OutPixels);
+
+	// 16 bytes, BC4 alpha followed by BC1 color
+	void EncodeBC3(const uint8_t* Pixels, uint8_t* OutBlock);
+	void DecodeBC3(const uint8_t* Block, uint8_t* OutPixels);
+
+	// 8 bytes, a single channel (0 = red ... 3 = alpha) of the pixels. The decoder only writes that channel
+	void EncodeBC4(const uint8_t* Pixels, int Channel, uint8_t* OutBlock);
+	void DecodeBC4(const uint8_t* Block, int Channel, uint8_t* OutPixels);
+
+	// 16 bytes, red and green as two BC4 blocks
+	void EncodeBC5(const uint8_t* Pixels, uint8_t* OutBlock);
+	void DecodeBC5(const uint8_t* Block, uint8_t* OutPixels);
+
+	// 16 bytes, always encoded in mode 6 : one subset, RGBA endpoints and 4 bit indices.
+	// The decoder only handles mode 6 and returns false for the other modes
+	void EncodeBC7(const uint8_t* Pixels, uint8_t* OutBlock);
+	bool DecodeBC7(const uint8_t* Block, uint8_t* OutPixels);
+}
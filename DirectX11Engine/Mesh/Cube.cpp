@@ -7,21 +7,20 @@ Cube::Cube()
 	:Mesh()
 {
 	SetVerticesAndIndices();
-	TexturePath = L"Assets/Textures/DefaultTexture.png";
-	NormalMapPath = L"Assets/Textures/DefaultBump.png";
+	TexturePath = DefaultTexturePath;
+	NormalMapPath = DefaultNormalMapPath;
 }
 
 Cube::Cube(XMFLOAT3 Position, XMFLOAT3 Rotation, XMFLOAT3 Scale)
 {
 	SetVerticesAndIndices();
 
-	this->Position = Position;
-	this->Rotation = Rotation;
-	this->Scale = Scale;
+	SetPosition(Position);
+	SetRotation(Rotation);
+	SetScale(Scale);
 
-	UpdateWorldMatrix();
-	TexturePath = L"Assets/Textures/DefaultTexture.png";
-	NormalMapPath = L"Assets/Textures/DefaultBump.png";
+	TexturePath = DefaultTexturePath;
+	NormalMapPath = DefaultNormalMapPath;
 }
 
 void Cube::SetVerticesAndIndices()
@@ -0,0 +1,259 @@
+#include "Core/pch.h"
+#include "GeometryArena.h"
+#include <algorithm>
+#include <vector>
+
+using Microsoft::WRL::ComPtr;
+
+RangeAllocator::RangeAllocator(uint32_t Capacity)
+	: Capacity(Capacity)
+{
+	if (Capacity > 0)
+	{
+		AddFreeRange(0, Capacity);
+	}
+}
+
+void RangeAllocator::AddFreeRange(uint32_t Offset, uint32_t Size)
+{
+	FreeRanges[Offset] = Size;
+	FreeBySize.emplace(Size, Offset);
+}
+
+uint32_t RangeAllocator::Allocate(uint32_t Size)
+{
+	if (Size == 0)
+	{
+		return 0;
+	}
+
+	auto BestFit = FreeBySize.lower_bound(Size);
+	if (BestFit == FreeBySize.end())
+	{
+		return InvalidOffset;
+	}
+
+	const uint32_t RangeSize = BestFit->first;
+	const uint32_t Offset = BestFit->second;
+	FreeBySize.erase(BestFit);
+	FreeRanges.erase(Offset);
+
+	// The rest of the range stays free
+	if (RangeSize > Size)
+	{
+		AddFreeRange(Offset + Size, RangeSize - Size);
+	}
+
+	Used += Size;
+	return Offset;
+}
+
+void RangeAllocator::Free(uint32_t Offset, uint32_t Size)
+{
+	if (Size == 0 || Offset == InvalidOffset)
+	{
+		return;
+	}
+
+	Used -= Size;
+
+	auto RemoveBySize = [this](uint32_t RangeOffset, uint32_t RangeSize)
+	{
+		auto Range = FreeBySize.equal_range(RangeSize);
+		for (auto It = Range.first; It != Range.second; ++It)
+		{
+			if (It->second == RangeOffset)
+			{
+				FreeBySize.erase(It);
+				return;
+			}
+		}
+	};
+
+	// Merge with the free range right after
+	auto Next = FreeRanges.find(Offset + Size);
+	if (Next != FreeRanges.end())
+	{
+		Size += Next->second;
+		RemoveBySize(Next->first, Next->second);
+		FreeRanges.erase(Next);
+	}
+
+	// And with the one right before
+	auto Previous = FreeRanges.lower_bound(Offset);
+	if (Previous != FreeRanges.begin())
+	{
+		--Previous;
+		if (Previous->first + Previous->second == Offset)
+		{
+			Offset = Previous->first;
+			Size += Previous->second;
+			RemoveBySize(Previous->first, Previous->second);
+			FreeRanges.erase(Previous);
+		}
+	}
+
+	AddFreeRange(Offset, Size);
+}
+
+void RangeAllocator::Grow(uint32_t NewCapacity)
+{
+	if (NewCapacity <= Capacity)
+	{
+		return;
+	}
+
+	// Freeing the new space merges it with a free range at the end
+	const uint32_t OldCapacity = Capacity;
+	Capacity = NewCapacity;
+	Used += NewCapacity - OldCapacity;
+	Free(OldCapacity, NewCapacity - OldCapacity);
+}
+
+uint32_t RangeAllocator::GetLargestFreeRange() const
+{
+	return FreeBySize.empty() ? 0 : FreeBySize.rbegin()->first;
+}
+
+GeometryArena::GeometryArena(ComPtr<ID3D11Device1> Device, UINT VertexStride, uint32_t VertexCapacity, uint32_t IndexCapacity, uint32_t ShortIndexCapacity)
+	: Device(Device)
+	, VertexStride(VertexStride)
+	, Vertices(VertexCapacity)
+	, Indices(IndexCapacity)
+	, ShortIndices(ShortIndexCapacity)
+{
+	VertexBuffer = CreateBuffer(VertexCapacity, VertexStride, D3D11_BIND_VERTEX_BUFFER);
+	IndexBuffer = CreateBuffer(IndexCapacity, sizeof(uint32_t), D3D11_BIND_INDEX_BUFFER);
+	ShortIndexBuffer = CreateBuffer(ShortIndexCapacity, sizeof(uint16_t), D3D11_BIND_INDEX_BUFFER);
+}
+
+ComPtr<ID3D11Buffer> GeometryArena::CreateBuffer(uint32_t Elements, UINT ElementSize, UINT BindFlags) const
+{
+	CD3D11_BUFFER_DESC BufferDesc(Elements * ElementSize, BindFlags);
+
+	ComPtr<ID3D11Buffer> NewBuffer;
+	DX::ThrowIfFailed(Device->CreateBuffer(&BufferDesc, nullptr, NewBuffer.GetAddressOf()));
+	return NewBuffer;
+}
+
+void GeometryArena::GrowBuffer(ID3D11DeviceContext1* DeviceContext, ComPtr<ID3D11Buffer>& Buffer, RangeAllocator& Allocator, UINT ElementSize, UINT BindFlags, uint32_t Needed)
+{
+	const uint32_t OldCapacity = Allocator.GetCapacity();
+	const uint32_t NewCapacity = std::max(OldCapacity * 2, OldCapacity + Needed);
+
+	// The content is copied on the GPU, the ranges handed out keep their offsets
+	ComPtr<ID3D11Buffer> NewBuffer = CreateBuffer(NewCapacity, ElementSize, BindFlags);
+	const D3D11_BOX OldContent = { 0, 0, 0, OldCapacity * ElementSize, 1, 1 };
+	DeviceContext->CopySubresourceRegion(NewBuffer.Get(), 0, 0, 0, 0, Buffer.Get(), 0, &OldContent);
+
+	Buffer = NewBuffer;
+	Allocator.Grow(NewCapacity);
+	++Grows;
+}
+
+void GeometryArena::Upload(ID3D11DeviceContext1* DeviceContext, ID3D11Buffer* Buffer, uint32_t FirstElement, UINT ElementSize, const void* Data, uint32_t Count)
+{
+	if (Count == 0)
+	{
+		return;
+	}
+
+	const D3D11_BOX Destination = { FirstElement * ElementSize, 0, 0, (FirstElement + Count) * ElementSize, 1, 1 };
+	DeviceContext->UpdateSubresource(Buffer, 0, &Destination, Data, 0, 0);
+}
+
+BufferHandle GeometryArena::Allocate(ID3D11DeviceContext1* DeviceContext, const void* VertexData, uint32_t VertexCount, const uint32_t* IndexData, uint32_t IndexCount,
+	EResourceLifetime Lifetime)
+{
+	GeometryRange Range;
+	Range.VertexCount = VertexCount;
+	Range.IndexCount = IndexCount;
+
+	Range.FirstVertex = Vertices.Allocate(VertexCount);
+	if (Range.FirstVertex == RangeAllocator::InvalidOffset)
+	{
+		GrowBuffer(DeviceContext, VertexBuffer, Vertices, VertexStride, D3D11_BIND_VERTEX_BUFFER, VertexCount);
+		Range.FirstVertex = Vertices.Allocate(VertexCount);
+	}
+
+	// Indices are relative to the first vertex, so the vertex count alone decides of their width
+	const bool bShortIndices = VertexCount <= 0x10000;
+	Range.IndexFormat = bShortIndices ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+	ComPtr<ID3D11Buffer>& TargetBuffer = bShortIndices ? ShortIndexBuffer : IndexBuffer;
+	RangeAllocator& TargetIndices = bShortIndices ? ShortIndices : Indices;
+	const UINT IndexSize = bShortIndices ? sizeof(uint16_t) : sizeof(uint32_t);
+
+	Range.FirstIndex = TargetIndices.Allocate(IndexCount);
+	if (Range.FirstIndex == RangeAllocator::InvalidOffset)
+	{
+		GrowBuffer(DeviceContext, TargetBuffer, TargetIndices, IndexSize, D3D11_BIND_INDEX_BUFFER, IndexCount);
+		Range.FirstIndex = TargetIndices.Allocate(IndexCount);
+	}
+
+	Upload(DeviceContext, VertexBuffer.Get(), Range.FirstVertex, VertexStride, VertexData, VertexCount);
+	if (bShortIndices)
+	{
+		const std::vector<uint16_t> ShortIndexData(IndexData, IndexData + IndexCount);
+		Upload(DeviceContext, TargetBuffer.Get(), Range.FirstIndex, IndexSize, ShortIndexData.data(), IndexCount);
+	}
+	else
+	{
+		Upload(DeviceContext, TargetBuffer.Get(), Range.FirstIndex, IndexSize, IndexData, IndexCount);
+	}
+
+	++Allocations;
+	return Ranges.Add(new GeometryRange(Range), Lifetime, size_t(VertexCount) * VertexStride + size_t(IndexCount) * IndexSize);
+}
+
+void GeometryArena::Free(BufferHandle Range)
+{
+	if (const GeometryRange* Found = Ranges.Get(Range))
+	{
+		FreeRange(*Found);
+		Ranges.Release(Range);
+	}
+}
+
+size_t GeometryArena::ReleaseLifetime(EResourceLifetime Lifetime)
+{
+	return Ranges.ReleaseLifetime(Lifetime, [this](const GeometryRange& Range) { FreeRange(Range); });
+}
+
+void GeometryArena::FreeRange(const GeometryRange& Range)
+{
+	if (!Range.IsValid())
+	{
+		return;
+	}
+
+	Vertices.Free(Range.FirstVertex, Range.VertexCount);
+	RangeAllocator& RangeIndices = Range.IndexFormat == DXGI_FORMAT_R16_UINT ? ShortIndices : Indices;
+	RangeIndices.Free(Range.FirstIndex, Range.IndexCount);
+	--Allocations;
+}
+
+GeometryArena::Stats GeometryArena::GetStats() const
+{
+	auto Fragmentation = [](const RangeAllocator& Allocator)
+	{
+		const uint32_t FreeSpace = Allocator.GetCapacity() - Allocator.GetUsed();
+		return FreeSpace > 0 ? 1.0f - float(Allocator.GetLargestFreeRange()) / float(FreeSpace) : 0.0f;
+	};
+
+	Stats Result;
+	Result.VertexCapacity = Vertices.GetCapacity();
+	Result.VerticesUsed = Vertices.GetUsed();
+	Result.IndexCapacity = Indices.GetCapacity();
+	Result.IndicesUsed = Indices.GetUsed();
+	Result.ShortIndexCapacity = ShortIndices.GetCapacity();
+	Result.ShortIndicesUsed = ShortIndices.GetUsed();
+	Result.VertexFreeRanges = Vertices.GetFreeRangeCount();
+	Result.IndexFreeRanges = Indices.GetFreeRangeCount();
+	Result.ShortIndexFreeRanges = ShortIndices.GetFreeRangeCount();
+	Result.VertexFragmentation = Fragmentation(Vertices);
+	Result.IndexFragmentation = Fragmentation(Indices);
+	Result.ShortIndexFragmentation = Fragmentation(ShortIndices);
+	Result.Allocations = Allocations;
+	Result.Grows = Grows;
+	return Result;
+}
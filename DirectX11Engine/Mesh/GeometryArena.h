@@ -0,0 +1,125 @@
+#pragma once
+#include "Core/pch.h"
+#include "Core/ResourcePool.h"
+#include <map>
+
+// Hands out ranges of [0, Capacity) from a free list sorted by offset.
+// Allocations take the smallest free range that fits and freed ranges are merged with their free neighbours.
+class RangeAllocator
+{
+public:
+
+	static constexpr uint32_t InvalidOffset = ~0u;
+
+	explicit RangeAllocator(uint32_t Capacity = 0);
+
+	// Returns InvalidOffset when no free range is large enough
+	uint32_t Allocate(uint32_t Size);
+	void Free(uint32_t Offset, uint32_t Size);
+
+	// Make room at the end, the new space is merged with a free range ending at the old capacity
+	void Grow(uint32_t NewCapacity);
+
+	uint32_t GetCapacity() const { return Capacity; }
+	uint32_t GetUsed() const { return Used; }
+	size_t GetFreeRangeCount() const { return FreeRanges.size(); }
+	uint32_t GetLargestFreeRange() const;
+
+private:
+
+	void AddFreeRange(uint32_t Offset, uint32_t Size);
+
+	// Offset to size of the free ranges, and the same ranges by size for the best fit search
+	std::map<uint32_t, uint32_t> FreeRanges;
+	std::multimap<uint32_t, uint32_t> FreeBySize;
+
+	uint32_t Capacity = 0;
+	uint32_t Used = 0;
+};
+
+// Where the vertices and indices of a mesh live in the arena, indices are relative to FirstVertex.
+// FirstIndex is an offset in the index buffer of IndexFormat
+struct GeometryRange
+{
+	uint32_t FirstVertex = RangeAllocator::InvalidOffset;
+	uint32_t VertexCount = 0;
+	uint32_t FirstIndex = RangeAllocator::InvalidOffset;
+	uint32_t IndexCount = 0;
+	DXGI_FORMAT IndexFormat = DXGI_FORMAT_R32_UINT;
+
+	bool IsValid() const { return FirstVertex != RangeAllocator::InvalidOffset && FirstIndex != RangeAllocator::InvalidOffset; }
+};
+
+// One vertex buffer and two index buffers shared by every mesh, bound once and drawn from with
+// BaseVertexLocation / StartIndexLocation. Meshes of at most 65536 vertices get 16 bits indices, the others 32 bits ones.
+// The buffers grow by copying to a larger buffer when full.
+// The ranges are the buffer resources of the meshes, referenced by handles and released with their lifetime.
+class GeometryArena
+{
+public:
+
+	struct Stats
+	{
+		uint32_t VertexCapacity = 0;
+		uint32_t VerticesUsed = 0;
+		uint32_t IndexCapacity = 0;
+		uint32_t IndicesUsed = 0;
+		uint32_t ShortIndexCapacity = 0;
+		uint32_t ShortIndicesUsed = 0;
+		// Free ranges, and the share of the free space outside of the largest free range
+		size_t VertexFreeRanges = 0;
+		size_t IndexFreeRanges = 0;
+		size_t ShortIndexFreeRanges = 0;
+		float VertexFragmentation = 0.0f;
+		float IndexFragmentation = 0.0f;
+		float ShortIndexFragmentation = 0.0f;
+		unsigned int Allocations = 0;
+		unsigned int Grows = 0;
+	};
+
+	GeometryArena(Microsoft::WRL::ComPtr<ID3D11Device1> Device, UINT VertexStride, uint32_t VertexCapacity = 1 << 20, uint32_t IndexCapacity = 1 << 20, uint32_t ShortIndexCapacity = 3 << 20);
+
+	GeometryArena(const GeometryArena&) = delete;
+	GeometryArena& operator=(const GeometryArena&) = delete;
+
+	// Copy the geometry to free ranges of the buffers, growing them if needed. Indices are narrowed to 16 bits when they fit
+	BufferHandle Allocate(ID3D11DeviceContext1* DeviceContext, const void* Vertices, uint32_t VertexCount, const uint32_t* Indices, uint32_t IndexCount,
+		EResourceLifetime Lifetime = EResourceLifetime::Scene);
+	// Does nothing if the range was already released
+	void Free(BufferHandle Range);
+
+	// Give back every range of a lifetime in one pass, returns how many were released
+	size_t ReleaseLifetime(EResourceLifetime Lifetime);
+
+	// The range, or nullptr once it was released
+	const GeometryRange* GetRange(BufferHandle Range) const { return Ranges.Get(Range); }
+
+	ID3D11Buffer* GetVertexBuffer() const { return VertexBuffer.Get(); }
+	ID3D11Buffer* GetIndexBuffer(DXGI_FORMAT Format) const { return Format == DXGI_FORMAT_R16_UINT ? ShortIndexBuffer.Get() : IndexBuffer.Get(); }
+	UINT GetVertexStride() const { return VertexStride; }
+
+	Stats GetStats() const;
+	ResourceStats GetResourceStats() const { return Ranges.GetStats(); }
+
+private:
+
+	Microsoft::WRL::ComPtr<ID3D11Buffer> CreateBuffer(uint32_t Elements, UINT ElementSize, UINT BindFlags) const;
+	void GrowBuffer(ID3D11DeviceContext1* DeviceContext, Microsoft::WRL::ComPtr<ID3D11Buffer>& Buffer, RangeAllocator& Allocator, UINT ElementSize, UINT BindFlags, uint32_t Needed);
+	static void Upload(ID3D11DeviceContext1* DeviceContext, ID3D11Buffer* Buffer, uint32_t FirstElement, UINT ElementSize, const void* Data, uint32_t Count);
+	void FreeRange(const GeometryRange& Range);
+
+	Microsoft::WRL::ComPtr<ID3D11Device1> Device;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> VertexBuffer;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> IndexBuffer;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> ShortIndexBuffer;
+	UINT VertexStride = 0;
+
+	RangeAllocator Vertices;
+	RangeAllocator Indices;
+	RangeAllocator ShortIndices;
+
+	ResourcePool<GeometryRange> Ranges{ "Buffers" };
+
+	unsigned int Allocations = 0;
+	unsigned int Grows = 0;
+};
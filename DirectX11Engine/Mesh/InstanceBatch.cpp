@@ -0,0 +1,79 @@
+#include "Core/pch.h"
+#include "InstanceBatch.h"
+#include "Mesh.h"
+#include "Core/StateTracker.h"
+
+using namespace DirectX;
+using Microsoft::WRL::ComPtr;
+
+const D3D11_INPUT_ELEMENT_DESC InstanceData::InputElements[InstanceData::InputElementCount] =
+{
+	{ "INSTANCEWORLD",	0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0,	D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+	{ "INSTANCEWORLD",	1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 16,	D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+	{ "INSTANCEWORLD",	2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 32,	D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+	{ "INSTANCEWORLD",	3, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 48,	D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+	{ "INSTANCECOLOR",	0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 64,	D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+};
+
+InstanceBatch::InstanceBatch(ComPtr<ID3D11Device1> Device, Mesh* SharedMesh)
+	: Device(Device)
+	, SharedMesh(SharedMesh)
+{
+}
+
+std::vector<InstanceData>& InstanceBatch::BeginInstances()
+{
+	Instances.clear();
+	return Instances;
+}
+
+void InstanceBatch::EndInstances(ID3D11DeviceContext1* DeviceContext)
+{
+	// The instanced shader only reads the packed position of the mesh, its dequantization goes in front of every world matrix
+	const XMMATRIX Dequantize = SharedMesh->PositionQuantization.GetMatrix();
+	for (InstanceData& Instance : Instances)
+	{
+		XMStoreFloat4x4(&Instance.World, Dequantize * XMLoadFloat4x4(&Instance.World));
+	}
+
+	const bool bUnchanged = Instances.size() == UploadedInstances.size() &&
+		(Instances.empty() || memcmp(Instances.data(), UploadedInstances.data(), Instances.size() * sizeof(InstanceData)) == 0);
+	if (bUnchanged)
+	{
+		return;
+	}
+
+	// The buffer is only recreated when it gets too small
+	if (Instances.size() > Capacity)
+	{
+		Capacity = std::max<size_t>(Instances.size(), Capacity * 2);
+
+		CD3D11_BUFFER_DESC BufferDesc(static_cast<UINT>(Capacity * sizeof(InstanceData)), D3D11_BIND_VERTEX_BUFFER);
+		InstanceBuffer.Reset();
+		DX::ThrowIfFailed(Device->CreateBuffer(&BufferDesc, nullptr, InstanceBuffer.GetAddressOf()));
+	}
+
+	if (!Instances.empty())
+	{
+		const D3D11_BOX Destination = { 0, 0, 0, static_cast<UINT>(Instances.size() * sizeof(InstanceData)), 1, 1 };
+		DeviceContext->UpdateSubresource(InstanceBuffer.Get(), 0, &Destination, Instances.data(), 0, 0);
+		++Uploads;
+	}
+
+	UploadedInstances = Instances;
+}
+
+void InstanceBatch::Draw(StateTracker& State) const
+{
+	if (Instances.empty())
+	{
+		return;
+	}
+
+	const DrawBindings Bindings = SharedMesh->GetDrawBindings();
+	State.SetVertexBuffer(0, Bindings.VertexBuffer, Bindings.VertexStride, 0);
+	State.SetVertexBuffer(1, InstanceBuffer.Get(), sizeof(InstanceData), 0);
+	State.SetIndexBuffer(Bindings.IndexBuffer, Bindings.IndexFormat, 0);
+
+	State.GetContext()->DrawIndexedInstanced(Bindings.IndexCount, static_cast<UINT>(Instances.size()), Bindings.StartIndex, Bindings.BaseVertex, 0);
+}
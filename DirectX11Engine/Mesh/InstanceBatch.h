@@ -0,0 +1,54 @@
+#pragma once
+#include "Core/pch.h"
+#include <vector>
+
+class Mesh;
+class StateTracker;
+
+// Per instance data, read from the second vertex buffer slot by the instanced vertex shader
+struct InstanceData
+{
+	// Row major, like the matrices of the actors
+	DirectX::XMFLOAT4X4 World;
+	DirectX::XMFLOAT4 Color;
+
+	static const int InputElementCount = 5;
+	static const D3D11_INPUT_ELEMENT_DESC InputElements[InputElementCount];
+};
+
+// Draws one mesh at many transforms in a single instanced draw.
+// The instances are only uploaded when they differ from the ones of the previous frame.
+class InstanceBatch
+{
+public:
+
+	// The mesh is owned by the caller and must outlive the batch
+	InstanceBatch(Microsoft::WRL::ComPtr<ID3D11Device1> Device, Mesh* SharedMesh);
+
+	InstanceBatch(const InstanceBatch&) = delete;
+	InstanceBatch& operator=(const InstanceBatch&) = delete;
+
+	// Instances are rebuilt every frame in place, the buffer keeps its capacity
+	std::vector<InstanceData>& BeginInstances();
+	void EndInstances(ID3D11DeviceContext1* DeviceContext);
+
+	// Binds the mesh on slot 0 and the instances on slot 1, shaders and input layout are left to the caller
+	void Draw(StateTracker& State) const;
+
+	Mesh* GetMesh() const { return SharedMesh; }
+	size_t GetInstanceCount() const { return Instances.size(); }
+	unsigned int GetUploadCount() const { return Uploads; }
+
+private:
+
+	Microsoft::WRL::ComPtr<ID3D11Device1> Device;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> InstanceBuffer;
+	size_t Capacity = 0;
+
+	Mesh* SharedMesh = nullptr;
+
+	// Instances of the frame, and the ones in the buffer
+	std::vector<InstanceData> Instances;
+	std::vector<InstanceData> UploadedInstances;
+	unsigned int Uploads = 0;
+};
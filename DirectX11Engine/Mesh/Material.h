@@ -1,5 +1,6 @@
 #pragma once
 #include "Core/pch.h"
+#include "Core/ResourcePool.h"
 
 struct MaterialData
 {
@@ -14,3 +15,14 @@ struct MaterialData
 	// Specular Exponent
 	float SpecExp = 64.0f;
 };
+
+// Colors and textures of a surface, shared by the meshes with the same ones. Textures that don't load stay invalid
+struct Material
+{
+	MaterialData Data;
+	TextureHandle AlbedoTexture;
+	TextureHandle NormalMap;
+	TextureHandle SpecularMap;
+	// Owned by the StateCache
+	ID3D11SamplerState* Sampler = nullptr;
+};
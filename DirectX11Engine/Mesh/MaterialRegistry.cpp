@@ -0,0 +1,89 @@
+#include "Core/pch.h"
+#include "MaterialRegistry.h"
+#include "TextureRegistry.h"
+#include "Core/Hash.h"
+#include "Core/RenderQueue.h"
+
+MaterialRegistry::MaterialRegistry(TextureRegistry& Textures)
+	: Textures(Textures)
+{
+}
+
+MaterialHandle MaterialRegistry::Load(const MaterialData& Data, const std::wstring& AlbedoPath, const std::wstring& NormalMapPath, const std::wstring& SpecularMapPath,
+	EResourceLifetime Lifetime)
+{
+	const uint64_t Key = MakeKey(Data, AlbedoPath, NormalMapPath, SpecularMapPath);
+	auto Entry = MaterialsByKey.find(Key);
+	if (Entry != MaterialsByKey.end())
+	{
+		if (Materials.Get(Entry->second))
+		{
+			// Loading the textures again extends their lifetime with the material's
+			if (Lifetime == EResourceLifetime::Engine)
+			{
+				Materials.ExtendLifetime(Entry->second, Lifetime);
+				Textures.Load(AlbedoPath, ETextureKind::Albedo, Lifetime);
+				Textures.Load(NormalMapPath, ETextureKind::NormalMap, Lifetime);
+				Textures.Load(SpecularMapPath, ETextureKind::SpecularMap, Lifetime);
+			}
+			return Entry->second;
+		}
+	}
+
+	Material* NewMaterial = new Material();
+	NewMaterial->Data = Data;
+	NewMaterial->AlbedoTexture = Textures.Load(AlbedoPath, ETextureKind::Albedo, Lifetime);
+	NewMaterial->NormalMap = Textures.Load(NormalMapPath, ETextureKind::NormalMap, Lifetime);
+	NewMaterial->SpecularMap = Textures.Load(SpecularMapPath, ETextureKind::SpecularMap, Lifetime);
+	NewMaterial->Sampler = Textures.GetSampler();
+
+	const MaterialHandle NewHandle = Materials.Add(NewMaterial, Lifetime, sizeof(Material));
+	MaterialsByKey[Key] = NewHandle;
+	return NewHandle;
+}
+
+void MaterialRegistry::GetBindings(MaterialHandle Handle, DrawBindings& InOutBindings) const
+{
+	const Material* Found = Materials.Get(Handle);
+	if (!Found)
+	{
+		return;
+	}
+
+	// Textures shared between materials have the same view, the render queue doesn't rebind them
+	const TextureHandle Slots[3] = { Found->AlbedoTexture, Found->NormalMap, Found->SpecularMap };
+	for (int iSlot = 0; iSlot < 3; ++iSlot)
+	{
+		if (const Texture* Bound = Textures.Get(Slots[iSlot]))
+		{
+			InOutBindings.Views[iSlot] = Bound->View.Get();
+		}
+	}
+	if (InOutBindings.Views[0])
+	{
+		InOutBindings.Sampler = Found->Sampler;
+	}
+}
+
+size_t MaterialRegistry::ReleaseLifetime(EResourceLifetime Lifetime)
+{
+	const size_t Released = Materials.ReleaseLifetime(Lifetime);
+	for (auto Entry = MaterialsByKey.begin(); Entry != MaterialsByKey.end();)
+	{
+		Entry = Materials.Get(Entry->second) ? std::next(Entry) : MaterialsByKey.erase(Entry);
+	}
+	return Released;
+}
+
+uint64_t MaterialRegistry::MakeKey(const MaterialData& Data, const std::wstring& AlbedoPath, const std::wstring& NormalMapPath, const std::wstring& SpecularMapPath)
+{
+	// The padding of MaterialData is left out, it is never written
+	const float Colors[10] = { Data.AmbientColor.x, Data.AmbientColor.y, Data.AmbientColor.z, Data.DiffuseColor.x, Data.DiffuseColor.y, Data.DiffuseColor.z,
+		Data.SpecularColor.x, Data.SpecularColor.y, Data.SpecularColor.z, Data.SpecExp };
+	uint64_t Key = Hash::HashBytes(Colors, sizeof(Colors));
+	for (const std::wstring* Path : { &AlbedoPath, &NormalMapPath, &SpecularMapPath })
+	{
+		Key = Hash::Combine(Key, Hash::HashBytes(Path->data(), Path->size() * sizeof(wchar_t)));
+	}
+	return Key;
+}
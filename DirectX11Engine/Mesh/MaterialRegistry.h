@@ -0,0 +1,46 @@
+#pragma once
+#include "Core/pch.h"
+#include "Core/ResourcePool.h"
+#include "Material.h"
+#include <string>
+#include <unordered_map>
+
+class TextureRegistry;
+struct DrawBindings;
+
+// Hands out shared materials, so the meshes with the same colors and textures reference one material and load its textures once.
+// Materials are found by the hash of their colors and texture paths, they are released with their lifetime like their textures.
+class MaterialRegistry
+{
+public:
+
+	explicit MaterialRegistry(TextureRegistry& Textures);
+
+	MaterialRegistry(const MaterialRegistry&) = delete;
+	MaterialRegistry& operator=(const MaterialRegistry&) = delete;
+
+	// The material of these colors and textures, the textures are loaded with the same lifetime.
+	// A material already loaded for the scene and asked for by the engine becomes an engine material, its textures too
+	MaterialHandle Load(const MaterialData& Data, const std::wstring& AlbedoPath, const std::wstring& NormalMapPath, const std::wstring& SpecularMapPath,
+		EResourceLifetime Lifetime = EResourceLifetime::Scene);
+
+	// The material, or nullptr once it was released
+	const Material* Get(MaterialHandle Handle) const { return Materials.Get(Handle); }
+
+	// Views and sampler of the textures of a material, the slots of missing textures are left as they are
+	void GetBindings(MaterialHandle Handle, DrawBindings& InOutBindings) const;
+
+	// Release every material of a lifetime in one pass, returns how many were released. Their textures go with the TextureRegistry sweep
+	size_t ReleaseLifetime(EResourceLifetime Lifetime);
+
+	ResourceStats GetResourceStats() const { return Materials.GetStats(); }
+
+private:
+
+	static uint64_t MakeKey(const MaterialData& Data, const std::wstring& AlbedoPath, const std::wstring& NormalMapPath, const std::wstring& SpecularMapPath);
+
+	TextureRegistry& Textures;
+	ResourcePool<Material> Materials{ "Materials" };
+	// Entries of released materials are erased by ReleaseLifetime
+	std::unordered_map<uint64_t, MaterialHandle> MaterialsByKey;
+};
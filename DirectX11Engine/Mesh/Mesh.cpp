@@ -1,24 +1,225 @@
 #include "Core/pch.h"
 #include <d3dcompiler.h>
 #include "Mesh.h"
+#include "Cube.h"
 #include <iostream>
 #include "Shaders/Shader.h"
+#include "MaterialRegistry.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "TangentSpace.h"
 #include <Core/Math.h>
+#include "Core/Memory.h"
+#include "Core/MappedFile.h"
+#include <cassert>
+#include <chrono>
 
 using namespace DirectX;
 
+namespace
+{
+	// Stands in for the attribute streams a mesh doesn't have
+	const XMFLOAT4 ZeroAttribute = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+
+	// An Assimp attribute array, or the zero attribute with a stride of 0 when the mesh doesn't have it
+	struct AttributeStream
+	{
+		AttributeStream(const aiVector3D* Data)
+			: Base(Data ? reinterpret_cast<const uint8_t*>(Data) : reinterpret_cast<const uint8_t*>(&ZeroAttribute)),
+			Stride(Data ? sizeof(aiVector3D) : 0)
+		{ }
+
+		const float* operator[](size_t Index) const { return reinterpret_cast<const float*>(Base + Index * Stride); }
+
+		const uint8_t* Base;
+		size_t Stride;
+	};
+
+	// Stream the separate Assimp arrays into the interleaved VertexType layout.
+	// Each attribute is moved with one 16 bytes load and store : the stores are done in layout order,
+	// so the extra float written past a field is overwritten by the next one, and the last vertex uses
+	// 12 bytes loads so we never read past the end of the Assimp arrays.
+	void InterleaveVertices(const aiMesh* AssimpMesh, VertexType* OutVertices)
+	{
+		static_assert(offsetof(VertexType, Normal) == 12 && offsetof(VertexType, Tangent) == 24 && offsetof(VertexType, Binormal) == 36
+			&& offsetof(VertexType, TextureCoordinate) == 48 && sizeof(VertexType) == 56, "InterleaveVertices relies on the VertexType layout");
+
+		const size_t VertexCount = AssimpMesh->mNumVertices;
+		if (VertexCount == 0)
+		{
+			return;
+		}
+
+		const AttributeStream Positions(AssimpMesh->mVertices);
+		const AttributeStream Normals(AssimpMesh->HasNormals() ? AssimpMesh->mNormals : nullptr);
+		const AttributeStream Tangents(AssimpMesh->HasTangentsAndBitangents() ? AssimpMesh->mTangents : nullptr);
+		const AttributeStream Binormals(AssimpMesh->HasTangentsAndBitangents() ? AssimpMesh->mBitangents : nullptr);
+		const AttributeStream TexCoords(AssimpMesh->mTextureCoords[0]);
+
+		for (size_t iVert = 0; iVert + 1 < VertexCount; ++iVert)
+		{
+			VertexType& Vertex = OutVertices[iVert];
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(&Vertex.Position), XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(Positions[iVert])));
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(&Vertex.Normal), XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(Normals[iVert])));
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(&Vertex.Tangent), XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(Tangents[iVert])));
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(&Vertex.Binormal), XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(Binormals[iVert])));
+			XMStoreFloat2(&Vertex.TextureCoordinate, XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(TexCoords[iVert])));
+		}
+
+		const size_t Last = VertexCount - 1;
+		VertexType& Vertex = OutVertices[Last];
+		XMStoreFloat3(&Vertex.Position, XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(Positions[Last])));
+		XMStoreFloat3(&Vertex.Normal, XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(Normals[Last])));
+		XMStoreFloat3(&Vertex.Tangent, XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(Tangents[Last])));
+		XMStoreFloat3(&Vertex.Binormal, XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(Binormals[Last])));
+		XMStoreFloat2(&Vertex.TextureCoordinate, XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(TexCoords[Last])));
+	}
+
+	// Indices of every face one after the other, the array is sized once
+	void CopyIndices(const aiMesh* AssimpMesh, std::vector<DWORD>& OutIndices)
+	{
+		size_t IndexCount = 0;
+		for (unsigned int iFace = 0; iFace < AssimpMesh->mNumFaces; ++iFace)
+		{
+			IndexCount += AssimpMesh->mFaces[iFace].mNumIndices;
+		}
+
+		OutIndices.resize(IndexCount);
+		DWORD* OutIndex = OutIndices.data();
+		for (unsigned int iFace = 0; iFace < AssimpMesh->mNumFaces; ++iFace)
+		{
+			const aiFace& Face = AssimpMesh->mFaces[iFace];
+			memcpy(OutIndex, Face.mIndices, Face.mNumIndices * sizeof(DWORD));
+			OutIndex += Face.mNumIndices;
+		}
+	}
+
+	// The ingestion of the constructor before the bulk path, the reference of the benchmark :
+	// a push_back per vertex and per index, with the attribute checks inside the loop
+	void AddVerticesOneByOne(const aiMesh* AssimpMesh, Mesh& Target)
+	{
+		for (unsigned int iVert = 0; iVert < AssimpMesh->mNumVertices; ++iVert)
+		{
+			XMFLOAT3 VertPos = { AssimpMesh->mVertices[iVert].x, AssimpMesh->mVertices[iVert].y, AssimpMesh->mVertices[iVert].z };
+			XMFLOAT2 TexCoord = XMFLOAT2(0, 0);
+			XMFLOAT3 Normal = XMFLOAT3(0, 0, 0);
+			XMFLOAT3 Tangent = XMFLOAT3(0, 0, 0);
+			XMFLOAT3 Binormal = XMFLOAT3(0, 0, 0);
+
+			if (AssimpMesh->mTextureCoords[0])
+			{
+				TexCoord = { AssimpMesh->mTextureCoords[0][iVert].x, AssimpMesh->mTextureCoords[0][iVert].y };
+			}
+			if (AssimpMesh->HasNormals())
+			{
+				Normal = { AssimpMesh->mNormals[iVert].x, AssimpMesh->mNormals[iVert].y, AssimpMesh->mNormals[iVert].z };
+			}
+			if (AssimpMesh->HasTangentsAndBitangents())
+			{
+				Tangent = { AssimpMesh->mTangents[iVert].x, AssimpMesh->mTangents[iVert].y, AssimpMesh->mTangents[iVert].z };
+				Binormal = { AssimpMesh->mBitangents[iVert].x, AssimpMesh->mBitangents[iVert].y, AssimpMesh->mBitangents[iVert].z };
+			}
+
+			Target.AddVertex(VertPos, TexCoord, Normal, Tangent, Binormal);
+		}
+
+		for (unsigned int iFace = 0; iFace < AssimpMesh->mNumFaces; ++iFace)
+		{
+			for (unsigned int iIndex = 0; iIndex < AssimpMesh->mFaces[iFace].mNumIndices; ++iIndex)
+			{
+				Target.AddIndex(AssimpMesh->mFaces[iFace].mIndices[iIndex]);
+			}
+		}
+	}
+
+	// Grid of Side x Side vertices with every attribute, two triangles per cell. The faces point into one shared index array
+	// instead of an allocation each, they must be detached before the aiMesh is destroyed
+	void BuildSyntheticMesh(unsigned int Side, aiMesh& OutMesh, std::vector<unsigned int>& OutFaceIndices)
+	{
+		const unsigned int VertexCount = Side * Side;
+		OutMesh.mNumVertices = VertexCount;
+		OutMesh.mVertices = new aiVector3D[VertexCount];
+		OutMesh.mNormals = new aiVector3D[VertexCount];
+		OutMesh.mTangents = new aiVector3D[VertexCount];
+		OutMesh.mBitangents = new aiVector3D[VertexCount];
+		OutMesh.mTextureCoords[0] = new aiVector3D[VertexCount];
+		OutMesh.mNumUVComponents[0] = 2;
+
+		for (unsigned int y = 0; y < Side; ++y)
+		{
+			for (unsigned int x = 0; x < Side; ++x)
+			{
+				const unsigned int iVert = y * Side + x;
+				const float U = static_cast<float>(x) / (Side - 1);
+				const float V = static_cast<float>(y) / (Side - 1);
+				OutMesh.mVertices[iVert] = aiVector3D(U * 100.0f, 0.0f, V * 100.0f);
+				OutMesh.mNormals[iVert] = aiVector3D(0.0f, 1.0f, 0.0f);
+				OutMesh.mTangents[iVert] = aiVector3D(1.0f, 0.0f, 0.0f);
+				OutMesh.mBitangents[iVert] = aiVector3D(0.0f, 0.0f, 1.0f);
+				OutMesh.mTextureCoords[0][iVert] = aiVector3D(U, V, 0.0f);
+			}
+		}
+
+		const unsigned int FaceCount = (Side - 1) * (Side - 1) * 2;
+		OutFaceIndices.resize(FaceCount * 3);
+		OutMesh.mNumFaces = FaceCount;
+		OutMesh.mFaces = new aiFace[FaceCount];
+		unsigned int iFace = 0;
+		for (unsigned int y = 0; y + 1 < Side; ++y)
+		{
+			for (unsigned int x = 0; x + 1 < Side; ++x)
+			{
+				const unsigned int Corner = y * Side + x;
+				const unsigned int Cell[6] = { Corner, Corner + Side, Corner + 1, Corner + 1, Corner + Side, Corner + Side + 1 };
+				for (unsigned int iTriangle = 0; iTriangle < 2; ++iTriangle, ++iFace)
+				{
+					unsigned int* FaceIndices = &OutFaceIndices[iFace * 3];
+					memcpy(FaceIndices, &Cell[iTriangle * 3], 3 * sizeof(unsigned int));
+					OutMesh.mFaces[iFace].mNumIndices = 3;
+					OutMesh.mFaces[iFace].mIndices = FaceIndices;
+				}
+			}
+		}
+	}
+}
+
+namespace
+{
+	FixedSizePool& GetMeshPool()
+	{
+		static FixedSizePool Pool("Meshes", sizeof(Mesh), 64, alignof(Mesh));
+		return Pool;
+	}
+
+	// Derived meshes are allocated from the same slots, adding members to them would make their operator new throw
+	static_assert(sizeof(Cube) == sizeof(Mesh), "Cube must fit in a slot of the mesh pool");
+}
+
+void* Mesh::operator new(size_t Size)
+{
+	// Derived meshes must fit in a slot, only the ones checked above are known to
+	if (Size > GetMeshPool().GetSlotSize())
+	{
+		throw std::bad_alloc();
+	}
+	return GetMeshPool().Allocate();
+}
+
+void Mesh::operator delete(void* Pointer)
+{
+	GetMeshPool().Free(Pointer);
+}
+
 Mesh::Mesh()
 {
-	SetWorldMatrix(XMMatrixIdentity());
 }
 
 Mesh::Mesh(std::vector<VertexType> Vertices, std::vector<DWORD> Indices)
 {
 	this->Vertices = Vertices;
 	this->Indices = Indices;
-	TexturePath = L"Assets/Textures/DefaultTexture.png";
-	NormalMapPath = L"Assets/Textures/DefaultBump.png";
-	SetWorldMatrix(XMMatrixIdentity());
+	TexturePath = DefaultTexturePath;
+	NormalMapPath = DefaultNormalMapPath;
 }
 
 Mesh::Mesh(aiMesh* AssimpMesh, const aiNode* Node, const aiScene* Scene, const std::wstring& ContainingFolder)
@@ -39,42 +240,19 @@ Mesh::Mesh(aiMesh* AssimpMesh, const aiNode* Node, const aiScene* Scene, const s
 	SetRotation(XMFLOAT3(Math::RadianToDegrees(NewRotation.x), Math::RadianToDegrees(NewRotation.y), Math::RadianToDegrees(NewRotation.z)));
 	SetScale(XMFLOAT3(NewScale.x, NewScale.y, NewScale.z));
 
-	UpdateWorldMatrix();
+	// Vertices : the array is sized once and the attribute checks are done per mesh, not per vertex
+	Vertices.resize(AssimpMesh->mNumVertices);
+	InterleaveVertices(AssimpMesh, Vertices.data());
 
-	// Add VertPos, TexCoord and Normal for each Vertex 
-	for (int iVert = 0; iVert < AssimpMesh->mNumVertices; ++iVert)
-	{
-		XMFLOAT3 VertPos = { AssimpMesh->mVertices[iVert].x, AssimpMesh->mVertices[iVert].y, AssimpMesh->mVertices[iVert].z };
-		XMFLOAT2 TexCoord = XMFLOAT2(0, 0);
-		XMFLOAT3 Normal = XMFLOAT3(0, 0, 0);
-		XMFLOAT3 Tangent = XMFLOAT3(0, 0, 0); 
-		XMFLOAT3 Binormal = XMFLOAT3(0, 0, 0);
+	// Indices
+	CopyIndices(AssimpMesh, Indices);
 
-		if (AssimpMesh->mTextureCoords[0])
-		{
-			TexCoord = { AssimpMesh->mTextureCoords[0][iVert].x, AssimpMesh->mTextureCoords[0][iVert].y };
-		}
-		if (AssimpMesh->HasNormals())
-		{
-			Normal = { AssimpMesh->mNormals[iVert].x, AssimpMesh->mNormals[iVert].y, AssimpMesh->mNormals[iVert].z };	
-		}
-		if (AssimpMesh->HasTangentsAndBitangents())
-		{
-			Tangent = { AssimpMesh->mTangents[iVert].x, AssimpMesh->mTangents[iVert].y, AssimpMesh->mTangents[iVert].z };
-			Binormal = { AssimpMesh->mBitangents[iVert].x, AssimpMesh->mBitangents[iVert].y, AssimpMesh->mBitangents[iVert].z };
-		}
-
-		AddVertex(VertPos, TexCoord, Normal, Tangent, Binormal);
-	}
-
-	// Add indices
-	for (int iFaces = 0; iFaces < AssimpMesh->mNumFaces; ++iFaces)
+	// Tangent space : normals only where the source has none, tangent frames always, so they don't depend on the importer
+	if (!AssimpMesh->HasNormals())
 	{
-		for (int iIndex = 0; iIndex < AssimpMesh->mFaces->mNumIndices; ++iIndex)
-		{
-			AddIndex(AssimpMesh->mFaces[iFaces].mIndices[iIndex]);
-		}
+		TangentSpace::GenerateNormals(Vertices, Indices);
 	}
+	TangentSpace::GenerateTangents(Vertices, Indices);
 
 	// Get Materials
 	if (Scene->HasMaterials())
@@ -110,7 +288,7 @@ Mesh::Mesh(aiMesh* AssimpMesh, const aiNode* Node, const aiScene* Scene, const s
 		}
 		else
 		{
-			TexturePath = L"Assets/Textures/DefaultTexture.png";
+			TexturePath = DefaultTexturePath;
 		}
 
 		// Normal Map
@@ -126,7 +304,7 @@ Mesh::Mesh(aiMesh* AssimpMesh, const aiNode* Node, const aiScene* Scene, const s
 		}
 		else
 		{
-			NormalMapPath = L"Assets/Textures/DefaultBump.png";
+			NormalMapPath = DefaultNormalMapPath;
 		}
 
 		// Specular Map
@@ -142,18 +320,23 @@ Mesh::Mesh(aiMesh* AssimpMesh, const aiNode* Node, const aiScene* Scene, const s
 		}
 		else
 		{
-			SpecularMapPath = L"Assets/Textures/DefaultTexture.png";
+			SpecularMapPath = DefaultTexturePath;
 		}
 
 		SetMaterial(Mat);
 	}
 
+	OptimizeGeometry();
+	BuildLods();
 }
 
 Mesh::~Mesh()
 {
-	VertexBuffer->Release();
-	IndexBuffer->Release();
+	// Does nothing if the sweep of the scene released the range first
+	if (Arena)
+	{
+		Arena->Free(Geometry);
+	}
 	Vertices.clear();
 }
 
@@ -174,155 +357,254 @@ void Mesh::AddIndex(DWORD NewIndex)
 	Indices.push_back(NewIndex);
 }
 
-void Mesh::Draw(Microsoft::WRL::ComPtr<ID3D11DeviceContext1> DeviceContext)
+void Mesh::OptimizeGeometry()
 {
-	// Set Vertex/Index Buffer
-	UINT stride = sizeof(VertexType);
-	UINT offset = 0;
-	DeviceContext->IASetVertexBuffers(0, 1, VertexBuffer.GetAddressOf(), &stride, &offset);
-	DeviceContext->IASetIndexBuffer(IndexBuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
-
-	// Set Texture
-	if (!TexturePath.empty())
+	if (Indices.empty() || Vertices.empty())
+	{
+		return;
+	}
+
+	uint32_t* MeshIndices = reinterpret_cast<uint32_t*>(Indices.data());
+	MeshOptimizer::OptimizeVertexCache(MeshIndices, Indices.size(), Vertices.size());
+	MeshOptimizer::OptimizeOverdraw(MeshIndices, Indices.size(), &Vertices[0].Position, sizeof(VertexType), Vertices.size());
+	Vertices.resize(MeshOptimizer::OptimizeVertexFetch(Vertices.data(), sizeof(VertexType), Vertices.size(), MeshIndices, Indices.size()));
+}
+
+void Mesh::BuildLods()
+{
+	Lods.clear();
+	LodIndices.clear();
+
+	// Small meshes cost less to draw than to switch
+	static const size_t MinLodTriangles = 256;
+	if (Indices.size() < MinLodTriangles * 3 || Vertices.empty())
 	{
-		DeviceContext.Get()->PSSetShaderResources(0, 1, &AlbedoTexture);
-		DeviceContext.Get()->PSSetSamplers(0, 1, &TextureSamplerState);
+		return;
 	}
-	if (!NormalMapPath.empty())
+
+	static_assert(sizeof(DWORD) == sizeof(uint32_t), "Indices are simplified as 32 bits");
+	const std::vector<MeshSimplifier::Level> Levels = MeshSimplifier::BuildLevels(&Vertices[0].Position, sizeof(VertexType), Vertices.size(),
+		reinterpret_cast<const uint32_t*>(Indices.data()), Indices.size(), { 0.5f, 0.25f, 0.125f });
+
+	for (const MeshSimplifier::Level& Level : Levels)
 	{
-		DeviceContext.Get()->PSSetShaderResources(1, 1, &NormalMap);
+		MeshLod Lod;
+		Lod.FirstIndex = static_cast<uint32_t>(LodIndices.size());
+		Lod.IndexCount = static_cast<uint32_t>(Level.Indices.size());
+		Lod.Error = Level.Error;
+		Lods.push_back(Lod);
+		LodIndices.insert(LodIndices.end(), Level.Indices.begin(), Level.Indices.end());
+
+		// Collapses leave the triangles in the order of the full mesh, with holes in the cache reuse
+		MeshOptimizer::OptimizeVertexCache(reinterpret_cast<uint32_t*>(&LodIndices[Lod.FirstIndex]), Lod.IndexCount, Vertices.size());
 	}
-	if (!SpecularMapPath.empty())
+}
+
+Mesh::GeometryView Mesh::GetGeometry() const
+{
+	if (MappedSource)
 	{
-		DeviceContext.Get()->PSSetShaderResources(2, 1, &SpecularMap);
+		return MappedGeometry;
 	}
 
-	// Draw
-	DeviceContext->DrawIndexed(Indices.size(), 0, 0);
+	GeometryView View;
+	View.Vertices = Vertices.data();
+	View.VertexCount = Vertices.size();
+	View.Indices = Indices.data();
+	View.IndexCount = Indices.size();
+	View.LodIndices = LodIndices.data();
+	View.LodIndexCount = LodIndices.size();
+	return View;
 }
 
-void Mesh::SetMaterial(MaterialData MatData)
+void Mesh::SetMappedGeometry(std::shared_ptr<const MappedFile> File, const GeometryView& View)
 {
-	Material = MatData;
+	Vertices.clear();
+	Indices.clear();
+	LodIndices.clear();
+	MappedSource = std::move(File);
+	MappedGeometry = View;
 }
 
-void Mesh::InitMesh(Microsoft::WRL::ComPtr<ID3D11Device1> Device, Microsoft::WRL::ComPtr<ID3D11DeviceContext1> DeviceContext)
+uint32_t Mesh::GetLodIndexCount(unsigned int Lod) const
 {
-	InitTextures(Device, DeviceContext);
+	return Lod == 0 || Lod > Lods.size() ? static_cast<uint32_t>(GetGeometry().IndexCount) : Lods[Lod - 1].IndexCount;
+}
 
-	InitVertexBuffer(Device, DeviceContext);
+unsigned int Mesh::SelectLod(float PixelsPerUnit, float MaxPixelError) const
+{
+	// Errors grow with the level, the first one over the threshold ends the search
+	unsigned int Lod = 0;
+	while (Lod < Lods.size() && Lods[Lod].Error * PixelsPerUnit <= MaxPixelError)
+	{
+		++Lod;
+	}
+	return Lod;
+}
+
+BoundingBox Mesh::GetWorldBounds() const
+{
+	BoundingBox WorldBounds;
+	LocalBounds.Transform(WorldBounds, GetWorldMatrix());
+	return WorldBounds;
 }
 
-void Mesh::InitTextures(Microsoft::WRL::ComPtr<ID3D11Device1>& Device, Microsoft::WRL::ComPtr<ID3D11DeviceContext1> DeviceContext)
+BoundingSphere Mesh::GetWorldSphere() const
 {
-	if (TexturePath != L"")
+	BoundingSphere WorldSphere;
+	LocalSphere.Transform(WorldSphere, GetWorldMatrix());
+	return WorldSphere;
+}
+
+DrawBindings Mesh::GetDrawBindings(unsigned int Lod) const
+{
+	// Nothing to draw once the geometry was released
+	DrawBindings Bindings;
+	const GeometryRange* Range = Arena ? Arena->GetRange(Geometry) : nullptr;
+	if (!Range)
 	{
-		// Init textures
-		HRESULT Hr = CreateWICTextureFromFile(Device.Get(), DeviceContext.Get(), TexturePath.c_str(), nullptr, &AlbedoTexture);	
-		if (Hr != E_FAIL)
-		{
-			
-			D3D11_SAMPLER_DESC SamplerDesc;
-			ZeroMemory(&SamplerDesc, sizeof(SamplerDesc));
-			SamplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
-			SamplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
-			SamplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
-			SamplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
-			SamplerDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
-			SamplerDesc.MinLOD = 0;
-			SamplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
-
-			DX::ThrowIfFailed(Device.Get()->CreateSamplerState(&SamplerDesc, &TextureSamplerState));
-		}
-		else
-		{
-			TexturePath = L"";
-		}
+		return Bindings;
 	}
 
-	if (NormalMapPath != L"")
+	Bindings.VertexBuffer = Arena->GetVertexBuffer();
+	Bindings.VertexStride = Arena->GetVertexStride();
+	Bindings.IndexBuffer = Arena->GetIndexBuffer(Range->IndexFormat);
+	Bindings.IndexFormat = Range->IndexFormat;
+	Bindings.IndexCount = GetLodIndexCount(Lod);
+	Bindings.StartIndex = Range->FirstIndex + (Lod == 0 || Lod > Lods.size() ? 0 : static_cast<uint32_t>(GetGeometry().IndexCount) + Lods[Lod - 1].FirstIndex);
+	Bindings.BaseVertex = static_cast<INT>(Range->FirstVertex);
+
+	if (Materials)
 	{
-		// Init textures
-		HRESULT Hr = CreateWICTextureFromFile(Device.Get(), DeviceContext.Get(), NormalMapPath.c_str(), nullptr, &NormalMap);	
-		if (Hr != E_FAIL)
-		{
-			
-			D3D11_SAMPLER_DESC SamplerDesc;
-			ZeroMemory(&SamplerDesc, sizeof(SamplerDesc));
-			SamplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
-			SamplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
-			SamplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
-			SamplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
-			SamplerDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
-			SamplerDesc.MinLOD = 0;
-			SamplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
-
-			DX::ThrowIfFailed(Device.Get()->CreateSamplerState(&SamplerDesc, &TextureSamplerState));
-		}
-		else
-		{
-			NormalMapPath = L"";
-		}
+		Materials->GetBindings(MaterialId, Bindings);
 	}
+	return Bindings;
+}
+
+Mesh::IngestionBenchmark Mesh::RunIngestionBenchmark(unsigned int Side, unsigned int Runs)
+{
+	Runs = std::max(Runs, 1u);
+
+	aiMesh Synthetic;
+	std::vector<unsigned int> FaceIndices;
+	BuildSyntheticMesh(std::max(Side, 2u), Synthetic, FaceIndices);
 
-	if (SpecularMapPath != L"")
+	auto Milliseconds = [](std::chrono::steady_clock::time_point From)
 	{
-		// Init textures
-		HRESULT Hr = CreateWICTextureFromFile(Device.Get(), DeviceContext.Get(), SpecularMapPath.c_str(), nullptr, &SpecularMap);
-		if (Hr != E_FAIL)
-		{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - From).count();
+	};
 
-			D3D11_SAMPLER_DESC SamplerDesc;
-			ZeroMemory(&SamplerDesc, sizeof(SamplerDesc));
-			SamplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
-			SamplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
-			SamplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
-			SamplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
-			SamplerDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
-			SamplerDesc.MinLOD = 0;
-			SamplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
-
-			DX::ThrowIfFailed(Device.Get()->CreateSamplerState(&SamplerDesc, &TextureSamplerState));
-		}
-		else
-		{
-			SpecularMapPath = L"";
-		}
+	IngestionBenchmark Result;
+	Result.Vertices = Synthetic.mNumVertices;
+	Result.Indices = FaceIndices.size();
+	Result.Runs = Runs;
+
+	// Every run starts from empty arrays, as a new mesh would
+	for (unsigned int Run = 0; Run < Runs; ++Run)
+	{
+		Mesh OneByOne;
+		const uint64_t AllocationsBefore = Memory::GetHeapAllocationCount();
+		const auto Start = std::chrono::steady_clock::now();
+		AddVerticesOneByOne(&Synthetic, OneByOne);
+		Result.OneByOneMs += Milliseconds(Start);
+		Result.OneByOneAllocations = Memory::GetHeapAllocationCount() - AllocationsBefore;
+
+		Mesh Bulk;
+		const uint64_t BulkAllocationsBefore = Memory::GetHeapAllocationCount();
+		const auto BulkStart = std::chrono::steady_clock::now();
+		Bulk.Vertices.resize(Synthetic.mNumVertices);
+		InterleaveVertices(&Synthetic, Bulk.Vertices.data());
+		CopyIndices(&Synthetic, Bulk.Indices);
+		Result.BulkMs += Milliseconds(BulkStart);
+		Result.BulkAllocations = Memory::GetHeapAllocationCount() - BulkAllocationsBefore;
+
+		// Both paths build the same arrays, VertexType has no padding
+		assert(OneByOne.Vertices.size() == Bulk.Vertices.size() && OneByOne.Indices == Bulk.Indices
+			&& memcmp(OneByOne.Vertices.data(), Bulk.Vertices.data(), Bulk.Vertices.size() * sizeof(VertexType)) == 0);
+	}
+	Result.OneByOneMs /= Runs;
+	Result.BulkMs /= Runs;
+
+	// The faces point into FaceIndices, the aiMesh must not delete them
+	for (unsigned int iFace = 0; iFace < Synthetic.mNumFaces; ++iFace)
+	{
+		Synthetic.mFaces[iFace].mIndices = nullptr;
 	}
+	return Result;
 }
 
-void Mesh::InitVertexBuffer(Microsoft::WRL::ComPtr<ID3D11Device1> Device, Microsoft::WRL::ComPtr<ID3D11DeviceContext1> DeviceContext)
+size_t Mesh::GetCpuBytes() const
+{
+	return sizeof(Mesh) + Vertices.capacity() * sizeof(VertexType) + (Indices.capacity() + LodIndices.capacity()) * sizeof(DWORD) + Lods.capacity() * sizeof(MeshLod);
+}
+
+void Mesh::SetMaterial(MaterialData MatData)
 {
-	// Create the VertexBuffer
-	D3D11_BUFFER_DESC VertexBufferDesc;
-	ZeroMemory(&VertexBufferDesc, sizeof(VertexBufferDesc));
-
-	VertexBufferDesc.Usage = D3D11_USAGE_DEFAULT;
-	VertexBufferDesc.ByteWidth = sizeof(VertexType) * Vertices.size();
-	VertexBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-	VertexBufferDesc.CPUAccessFlags = 0;
-	VertexBufferDesc.MiscFlags = 0;
-
-	D3D11_SUBRESOURCE_DATA VertexBufferData;
-	ZeroMemory(&VertexBufferData, sizeof(VertexBufferData));
-	VertexBufferData.pSysMem = &Vertices[0]; // needs the address of the array, not the vector
-
-	HRESULT hr = Device->CreateBuffer(&VertexBufferDesc, &VertexBufferData, VertexBuffer.GetAddressOf());
-	DX::ThrowIfFailed(hr);	
-
-	// Create the IndexBuffer
-	D3D11_BUFFER_DESC IndexBufferDesc;
-	ZeroMemory(&IndexBufferDesc, sizeof(IndexBufferDesc));
-
-	IndexBufferDesc.Usage = D3D11_USAGE_DEFAULT;
-	IndexBufferDesc.ByteWidth = sizeof(DWORD) * Indices.size();
-	IndexBufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
-	IndexBufferDesc.CPUAccessFlags = 0;
-	IndexBufferDesc.MiscFlags = 0;
-
-	D3D11_SUBRESOURCE_DATA IndexBufferData;
-	ZeroMemory(&IndexBufferData, sizeof(IndexBufferData));
-	IndexBufferData.pSysMem = &Indices[0];
-
-	DX::ThrowIfFailed(Device->CreateBuffer(&IndexBufferDesc, &IndexBufferData, IndexBuffer.GetAddressOf()));
+	Material = MatData;
+}
+
+void Mesh::InitMesh(Microsoft::WRL::ComPtr<ID3D11DeviceContext1> DeviceContext, MaterialRegistry& SharedMaterials, GeometryArena& SharedGeometry)
+{
+	InitMaterial(SharedMaterials);
+
+	InitVertexBuffer(DeviceContext, SharedGeometry);
+}
+
+void Mesh::InitMaterial(MaterialRegistry& SharedMaterials)
+{
+	Materials = &SharedMaterials;
+	MaterialId = SharedMaterials.Load(Material, TexturePath, NormalMapPath, SpecularMapPath, Lifetime);
+
+	// A texture that is known not to load is not bound, the others show a placeholder until they are streamed in
+	const ::Material* Loaded = SharedMaterials.Get(MaterialId);
+	if (!Loaded->AlbedoTexture.IsValid())
+	{
+		TexturePath = L"";
+	}
+	if (!Loaded->NormalMap.IsValid())
+	{
+		NormalMapPath = L"";
+	}
+	if (!Loaded->SpecularMap.IsValid())
+	{
+		SpecularMapPath = L"";
+	}
+}
+
+void Mesh::InitVertexBuffer(Microsoft::WRL::ComPtr<ID3D11DeviceContext1> DeviceContext, GeometryArena& SharedGeometry)
+{
+	// Straight from the mapped pages for a cached mesh
+	const GeometryView Source = GetGeometry();
+	if (Source.VertexCount > 0)
+	{
+		BoundingBox::CreateFromPoints(LocalBounds, Source.VertexCount, &Source.Vertices[0].Position, sizeof(VertexType));
+		BoundingSphere::CreateFromPoints(LocalSphere, Source.VertexCount, &Source.Vertices[0].Position, sizeof(VertexType));
+	}
+
+	// The arena holds packed vertices, the error is measured once here for the quantization report
+	PositionQuantization = VertexPacking::ComputeQuantization(LocalBounds);
+	std::vector<PackedVertex> PackedVertices(Source.VertexCount);
+	VertexPacking::Pack(Source.Vertices, Source.VertexCount, PositionQuantization, PackedVertices.data());
+	PackingError = VertexPacking::MeasureError(Source.Vertices, PackedVertices.data(), Source.VertexCount, PositionQuantization);
+
+	static_assert(sizeof(DWORD) == sizeof(uint32_t), "Indices are uploaded as 32 bits");
+
+	// Suballocate from the shared buffers, a previous range is given back first
+	if (Arena)
+	{
+		Arena->Free(Geometry);
+	}
+	Arena = &SharedGeometry;
+	// The levels of detail follow the full resolution indices in the same range, they already do in a cache file
+	const DWORD* UploadIndices = Source.Indices;
+	std::vector<DWORD> AllIndices;
+	if (Source.LodIndexCount > 0 && Source.LodIndices != Source.Indices + Source.IndexCount)
+	{
+		AllIndices.reserve(Source.IndexCount + Source.LodIndexCount);
+		AllIndices.insert(AllIndices.end(), Source.Indices, Source.Indices + Source.IndexCount);
+		AllIndices.insert(AllIndices.end(), Source.LodIndices, Source.LodIndices + Source.LodIndexCount);
+		UploadIndices = AllIndices.data();
+	}
+	Geometry = SharedGeometry.Allocate(DeviceContext.Get(), PackedVertices.data(), static_cast<uint32_t>(PackedVertices.size()),
+		reinterpret_cast<const uint32_t*>(UploadIndices), static_cast<uint32_t>(Source.IndexCount + Source.LodIndexCount), Lifetime);
 }
\ No newline at end of file
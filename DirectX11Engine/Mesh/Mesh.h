@@ -3,7 +3,12 @@
 #include <vector>
 #include "Material.h"
 #include "Core/Actor.h"
+#include "Core/RenderQueue.h"
+#include "GeometryArena.h"
+#include "VertexPacking.h"
 #include "Core/pch.h"
+#include <memory>
+#include <DirectXCollision.h>
 
 using namespace DirectX::SimpleMath;
 
@@ -30,8 +35,8 @@ struct VertexType
 	{
 		XMStoreFloat3(&this->Position, iPosition);
 		XMStoreFloat3(&this->Normal, iNormal);
-		XMStoreFloat3(&this->Tangent, iNormal);
-		XMStoreFloat3(&this->Binormal, iNormal);
+		XMStoreFloat3(&this->Tangent, iTangent);
+		XMStoreFloat3(&this->Binormal, iBinormal);
 		XMStoreFloat2(&this->TextureCoordinate, iTextureCoordinate);
 	}
 
@@ -46,6 +51,18 @@ struct VertexType
 };
 
 class Shader;
+class MaterialRegistry;
+class MappedFile;
+
+// A simplified version of a mesh, over the same vertices
+struct MeshLod
+{
+	// Range of Mesh::LodIndices
+	uint32_t FirstIndex = 0;
+	uint32_t IndexCount = 0;
+	// Largest distance to the full resolution surface, in local units
+	float Error = 0.0f;
+};
 
 class Mesh : public Actor
 {
@@ -59,26 +76,56 @@ public:
 
 	~Mesh();
 
+	// Meshes come and go with the scenes, they are taken from a pool of fixed size slots
+	static void* operator new(size_t Size);
+	static void operator delete(void* Pointer);
+
 	// Vertices coordinates
 	std::vector<VertexType> Vertices;
 
 	// Indices
 	std::vector<DWORD> Indices;
 
-	// Texture and material
-	ID3D11ShaderResourceView* AlbedoTexture;
-	ID3D11ShaderResourceView* NormalMap;
-	ID3D11ShaderResourceView* SpecularMap;
+	// Coarser levels of detail, from the finest. Their indices follow each other in LodIndices and are uploaded after Indices
+	std::vector<MeshLod> Lods;
+	std::vector<DWORD> LodIndices;
 
+	// Colors and texture paths as imported, the material made of them is shared with the other meshes through the MaterialRegistry
 	MaterialData Material;
-	ID3D11SamplerState* TextureSamplerState;
 	std::wstring TexturePath;
 	std::wstring NormalMapPath;
 	std::wstring SpecularMapPath;
 
-	// Buffers
-	Microsoft::WRL::ComPtr<ID3D11Buffer> VertexBuffer;
-	Microsoft::WRL::ComPtr<ID3D11Buffer> IndexBuffer;
+	// Textures bound when the imported material has none of its own
+	static constexpr const wchar_t* DefaultTexturePath = L"Assets/Textures/DefaultTexture.png";
+	static constexpr const wchar_t* DefaultNormalMapPath = L"Assets/Textures/DefaultBump.png";
+
+	// The material has a map of its own that loaded, not a default texture. The shader variant skips the maps it doesn't have
+	bool HasNormalMap() const { return !NormalMapPath.empty() && NormalMapPath != DefaultNormalMapPath; }
+	bool HasSpecularMap() const { return !SpecularMapPath.empty() && SpecularMapPath != DefaultTexturePath; }
+
+	// Bounds of the vertices in local space, computed when the vertex buffer is created
+	DirectX::BoundingBox LocalBounds;
+	DirectX::BoundingSphere LocalSphere;
+
+	MaterialRegistry* Materials = nullptr;
+	MaterialHandle MaterialId;
+
+	// Set for a mesh loaded from the mesh cache, see SetMappedGeometry
+	std::shared_ptr<const MappedFile> MappedSource;
+	GeometryView MappedGeometry;
+
+	// Range of the shared vertex and index buffers holding the geometry, released with the mesh or by the sweep of its lifetime
+	GeometryArena* Arena = nullptr;
+	BufferHandle Geometry;
+
+	// Lifetime of the material, textures and geometry created by InitMesh
+	EResourceLifetime Lifetime = EResourceLifetime::Scene;
+
+	// The vertices are packed when they are uploaded, positions are quantized inside LocalBounds.
+	// GetGeometry keeps the full precision copy for the CPU side
+	VertexPacking::Quantization PositionQuantization;
+	VertexPacking::ErrorStats PackingError;
 
 	void AddVertex(DirectX::XMFLOAT3 Vertex, DirectX::XMFLOAT2 TextureCoord, DirectX::XMFLOAT3 Normal, DirectX::XMFLOAT3 Tangent, DirectX::XMFLOAT3 Binormal);
 
@@ -86,14 +133,64 @@ public:
 
 	void SetMaterial(MaterialData MatData);
 
-	// Initialise shaders and buffers for this mesh
-	void InitMesh(Microsoft::WRL::ComPtr<ID3D11Device1> Device, Microsoft::WRL::ComPtr<ID3D11DeviceContext1> DeviceContext);
+	// Reorder the triangles for the vertex cache then for overdraw, and the vertices in their order of use
+	void OptimizeGeometry();
 
-	void InitTextures(Microsoft::WRL::ComPtr<ID3D11Device1>& Device, Microsoft::WRL::ComPtr<ID3D11DeviceContext1> DeviceContext);
+	// Simplify the mesh to a few levels of detail, at half, a quarter and an eighth of its triangles
+	void BuildLods();
 
-	void InitVertexBuffer(Microsoft::WRL::ComPtr<ID3D11Device1> Device, Microsoft::WRL::ComPtr<ID3D11DeviceContext1> DeviceContext);
+	// Full precision geometry for the CPU side : the vectors above, or the pages of the mesh cache file the mesh was loaded from
+	struct GeometryView
+	{
+		const VertexType* Vertices = nullptr;
+		size_t VertexCount = 0;
+		const DWORD* Indices = nullptr;
+		size_t IndexCount = 0;
+		// Indices of the levels of detail, right after Indices in a cache file
+		const DWORD* LodIndices = nullptr;
+		size_t LodIndexCount = 0;
+	};
+	GeometryView GetGeometry() const;
+
+	// Read the geometry from a mapped cache file instead of the vectors, which stay empty. The mesh keeps the file mapped
+	void SetMappedGeometry(std::shared_ptr<const MappedFile> File, const GeometryView& View);
+
+	// Level 0 is the full resolution mesh, then one level per entry of Lods
+	unsigned int GetLodCount() const { return static_cast<unsigned int>(Lods.size()) + 1; }
+	uint32_t GetLodIndexCount(unsigned int Lod) const;
+
+	// Coarsest level whose error stays under MaxPixelError once projected, PixelsPerUnit is the size on screen of a local unit
+	unsigned int SelectLod(float PixelsPerUnit, float MaxPixelError) const;
+
+	// Initialise the material and buffers for this mesh
+	void InitMesh(Microsoft::WRL::ComPtr<ID3D11DeviceContext1> DeviceContext, MaterialRegistry& SharedMaterials, GeometryArena& SharedGeometry);
+
+	void InitMaterial(MaterialRegistry& SharedMaterials);
 
-	// Render the mesh
-	void Draw(Microsoft::WRL::ComPtr<ID3D11DeviceContext1> DeviceContext);
+	void InitVertexBuffer(Microsoft::WRL::ComPtr<ID3D11DeviceContext1> DeviceContext, GeometryArena& SharedGeometry);
+
+	DirectX::BoundingBox GetWorldBounds() const;
+	DirectX::BoundingSphere GetWorldSphere() const;
+
+	// Buffers and textures to bind to render a level of the mesh, the shader and constants are left to the caller
+	DrawBindings GetDrawBindings(unsigned int Lod = 0) const;
+
+	// Memory of the mesh and its vertices and indices on the CPU side
+	size_t GetCpuBytes() const;
+
+	// Vertex and index ingestion of the Assimp constructor on a synthetic grid of Side x Side vertices with every attribute,
+	// against the push_back per vertex and per index it replaced
+	struct IngestionBenchmark
+	{
+		size_t Vertices = 0;
+		size_t Indices = 0;
+		unsigned int Runs = 0;
+		// Per run
+		double OneByOneMs = 0.0;
+		double BulkMs = 0.0;
+		uint64_t OneByOneAllocations = 0;
+		uint64_t BulkAllocations = 0;
+	};
+	static IngestionBenchmark RunIngestionBenchmark(unsigned int Side, unsigned int Runs);
 };
 
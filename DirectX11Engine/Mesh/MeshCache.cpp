@@ -0,0 +1,451 @@
+#include "Core/pch.h"
+#include "MeshCache.h"
+#include "Mesh.h"
+#include "Core/Hash.h"
+#include "Core/MappedFile.h"
+#include <fstream>
+
+using namespace DirectX;
+
+namespace
+{
+	const uint32_t CacheMagic = 0x434D5844; // "DXMC"
+	const uint32_t CacheVersion = 5;
+	const uint32_t StampMagic = 0x534D5844; // "DXMS"
+
+	struct CacheHeader
+	{
+		uint32_t Magic;
+		uint32_t Version;
+		uint64_t Key;
+		uint32_t MeshCount;
+		uint32_t LightCount;
+	};
+
+	struct CachedMeshHeader
+	{
+		XMFLOAT3 Position;
+		XMFLOAT3 Rotation;
+		XMFLOAT3 Scale;
+		MaterialData Material;
+		uint32_t VertexCount;
+		uint32_t IndexCount;
+		uint32_t LodCount;
+		uint32_t LodIndexCount;
+		// Albedo, normal map and specular map path lengths, in characters
+		uint32_t PathLengths[3];
+	};
+
+	// Files hashed into the key of a model, with their size and last write time when the key was computed
+	struct StampHeader
+	{
+		uint32_t Magic;
+		uint32_t Version;
+		uint64_t Key;
+		uint32_t FileCount;
+	};
+
+	// Zero size and time for a missing file
+	struct FileStamp
+	{
+		uint64_t Size = 0;
+		uint64_t WriteTime = 0;
+		uint32_t PathLength = 0;
+	};
+
+	// Every block of the file starts on a 4 bytes boundary so vertices and indices can be read straight from the mapping.
+	// The indices of the levels of detail follow the full resolution ones, the mesh uploads them in one piece
+	size_t AlignUp(size_t Value)
+	{
+		return (Value + 3) & ~size_t(3);
+	}
+
+	// Sequential reader over a mapped cache file, fails instead of reading past the end
+	class CacheReader
+	{
+	public:
+		CacheReader(const uint8_t* InData, size_t InSize)
+			: Data(InData), Size(InSize)
+		{ }
+
+		template <class T>
+		bool Read(T& Out)
+		{
+			const uint8_t* Bytes = Skip(sizeof(T));
+			if (!Bytes)
+			{
+				return false;
+			}
+			memcpy(&Out, Bytes, sizeof(T));
+			return true;
+		}
+
+		// Returns the address of the next Count bytes and moves past them
+		const uint8_t* Skip(size_t Count)
+		{
+			if (Count > Size - Offset)
+			{
+				return nullptr;
+			}
+			const uint8_t* Bytes = Data + Offset;
+			Offset = AlignUp(Offset + Count);
+			Offset = std::min(Offset, Size);
+			return Bytes;
+		}
+
+	private:
+		const uint8_t* Data;
+		size_t Size;
+		size_t Offset = 0;
+	};
+
+	void WriteBytes(std::ofstream& Stream, const void* Data, size_t Count)
+	{
+		static const char Padding[4] = {};
+
+		Stream.write(static_cast<const char*>(Data), Count);
+		Stream.write(Padding, AlignUp(Count) - Count);
+	}
+
+	// Combine the content of every material library an .obj references, its materials and texture paths end up in the cache too
+	uint64_t HashMaterialLibraries(const uint8_t* Data, size_t Size, const std::wstring& Folder, uint64_t Key, std::vector<std::wstring>& OutLibraries)
+	{
+		static const char Keyword[] = "mtllib";
+		const size_t KeywordLength = sizeof(Keyword) - 1;
+
+		const char* Text = reinterpret_cast<const char*>(Data);
+		size_t LineStart = 0;
+		while (LineStart < Size)
+		{
+			size_t LineEnd = LineStart;
+			while (LineEnd < Size && Text[LineEnd] != '\n' && Text[LineEnd] != '\r')
+			{
+				++LineEnd;
+			}
+
+			if (LineEnd - LineStart > KeywordLength && memcmp(Text + LineStart, Keyword, KeywordLength) == 0
+				&& (Text[LineStart + KeywordLength] == ' ' || Text[LineStart + KeywordLength] == '\t'))
+			{
+				// Like Assimp, the rest of the line is the file name
+				size_t NameStart = LineStart + KeywordLength;
+				size_t NameEnd = LineEnd;
+				while (NameStart < NameEnd && (Text[NameStart] == ' ' || Text[NameStart] == '\t'))
+				{
+					++NameStart;
+				}
+				while (NameEnd > NameStart && (Text[NameEnd - 1] == ' ' || Text[NameEnd - 1] == '\t'))
+				{
+					--NameEnd;
+				}
+
+				MappedFile Library;
+				const std::wstring LibraryPath = Folder + DX::StringToWString(std::string(Text + NameStart, NameEnd - NameStart));
+				Key = Hash::Combine(Key, Hash::HashString(LibraryPath));
+				// A missing library still changes the key once it shows up
+				Key = Hash::Combine(Key, Library.Open(LibraryPath) ? Hash::HashBytes(Library.GetData(), Library.GetSize()) : 0);
+				OutLibraries.push_back(LibraryPath);
+			}
+
+			LineStart = LineEnd + 1;
+		}
+		return Key;
+	}
+
+	FileStamp GetFileStamp(const std::wstring& Path)
+	{
+		FileStamp Stamp;
+		WIN32_FILE_ATTRIBUTE_DATA Attributes;
+		if (GetFileAttributesExW(Path.c_str(), GetFileExInfoStandard, &Attributes))
+		{
+			Stamp.Size = (uint64_t(Attributes.nFileSizeHigh) << 32) | Attributes.nFileSizeLow;
+			Stamp.WriteTime = (uint64_t(Attributes.ftLastWriteTime.dwHighDateTime) << 32) | Attributes.ftLastWriteTime.dwLowDateTime;
+		}
+		Stamp.PathLength = static_cast<uint32_t>(Path.size());
+		return Stamp;
+	}
+
+	std::wstring GetStampPath(const std::wstring& SourcePath, unsigned int ImportFlags)
+	{
+		CreateDirectoryW(L"Cache", nullptr);
+		CreateDirectoryW(L"Cache/Meshes", nullptr);
+
+		const uint64_t Name = Hash::Combine(Hash::Combine(Hash::HashString(SourcePath), ImportFlags), CacheVersion);
+		wchar_t FileName[64];
+		swprintf_s(FileName, L"Cache/Meshes/%016llx.meshstamp", static_cast<unsigned long long>(Name));
+		return FileName;
+	}
+
+	// The key of the stamp if none of its files changed size or write time since, otherwise 0
+	uint64_t ReadStamp(const std::wstring& StampPath)
+	{
+		MappedFile File;
+		if (!File.Open(StampPath))
+		{
+			return 0;
+		}
+
+		CacheReader Reader(File.GetData(), File.GetSize());
+		StampHeader Header;
+		if (!Reader.Read(Header) || Header.Magic != StampMagic || Header.Version != CacheVersion)
+		{
+			return 0;
+		}
+
+		for (uint32_t iFile = 0; iFile < Header.FileCount; ++iFile)
+		{
+			FileStamp Stored;
+			const uint8_t* PathData = Reader.Read(Stored) ? Reader.Skip(Stored.PathLength * sizeof(wchar_t)) : nullptr;
+			if (!PathData)
+			{
+				return 0;
+			}
+
+			const FileStamp Current = GetFileStamp(std::wstring(reinterpret_cast<const wchar_t*>(PathData), Stored.PathLength));
+			if (Current.Size != Stored.Size || Current.WriteTime != Stored.WriteTime)
+			{
+				return 0;
+			}
+		}
+		return Header.Key;
+	}
+
+	void WriteStamp(const std::wstring& StampPath, uint64_t Key, const std::vector<std::wstring>& Files)
+	{
+		// Same as the cache files, a crash never leaves a truncated stamp behind
+		const std::wstring TempPath = StampPath + L".tmp";
+		{
+			std::ofstream Stream(TempPath, std::ios::binary | std::ios::trunc);
+			if (!Stream)
+			{
+				return;
+			}
+
+			StampHeader Header;
+			Header.Magic = StampMagic;
+			Header.Version = CacheVersion;
+			Header.Key = Key;
+			Header.FileCount = static_cast<uint32_t>(Files.size());
+			WriteBytes(Stream, &Header, sizeof(Header));
+
+			for (const std::wstring& Path : Files)
+			{
+				const FileStamp Stamp = GetFileStamp(Path);
+				WriteBytes(Stream, &Stamp, sizeof(Stamp));
+				WriteBytes(Stream, Path.data(), Path.size() * sizeof(wchar_t));
+			}
+
+			if (!Stream)
+			{
+				return;
+			}
+		}
+		MoveFileExW(TempPath.c_str(), StampPath.c_str(), MOVEFILE_REPLACE_EXISTING);
+	}
+}
+
+uint64_t MeshCache::ComputeKey(const std::wstring& SourcePath, unsigned int ImportFlags)
+{
+	// The files are only hashed again once the model or one of its libraries changed size or write time
+	const std::wstring StampPath = GetStampPath(SourcePath, ImportFlags);
+	if (const uint64_t StampedKey = ReadStamp(StampPath))
+	{
+		return StampedKey;
+	}
+
+	MappedFile Source;
+	if (!Source.Open(SourcePath))
+	{
+		return 0;
+	}
+
+	// Texture paths are baked relative to the model's folder, so the folder is part of the key as well
+	wchar_t Drive[_MAX_DRIVE];
+	wchar_t Dir[_MAX_DIR];
+	wchar_t Extension[_MAX_EXT];
+	_wsplitpath_s(SourcePath.c_str(), Drive, _MAX_DRIVE, Dir, _MAX_DIR, nullptr, 0, Extension, _MAX_EXT);
+	const std::wstring Folder = std::wstring(Drive) + Dir;
+
+	std::vector<std::wstring> HashedFiles = { SourcePath };
+	uint64_t Key = Hash::HashBytes(Source.GetData(), Source.GetSize());
+	Key = Hash::Combine(Key, Hash::HashString(Folder));
+	if (_wcsicmp(Extension, L".obj") == 0)
+	{
+		Key = HashMaterialLibraries(Source.GetData(), Source.GetSize(), Folder, Key, HashedFiles);
+	}
+	Key = Hash::Combine(Key, ImportFlags);
+	Key = Hash::Combine(Key, CacheVersion);
+	Key = Key != 0 ? Key : 1;
+
+	WriteStamp(StampPath, Key, HashedFiles);
+	return Key;
+}
+
+std::wstring MeshCache::GetCachePath(uint64_t Key)
+{
+	CreateDirectoryW(L"Cache", nullptr);
+	CreateDirectoryW(L"Cache/Meshes", nullptr);
+
+	wchar_t FileName[64];
+	swprintf_s(FileName, L"Cache/Meshes/%016llx.meshcache", static_cast<unsigned long long>(Key));
+
+	return FileName;
+}
+
+bool MeshCache::Load(const std::wstring& CachePath, uint64_t Key, std::vector<Mesh*>& OutMeshes, std::vector<CookedLight>& OutLights)
+{
+	// Shared by the meshes, which read their geometry from it until they are released
+	std::shared_ptr<MappedFile> File = std::make_shared<MappedFile>();
+	if (!File->Open(CachePath))
+	{
+		return false;
+	}
+
+	CacheReader Reader(File->GetData(), File->GetSize());
+
+	CacheHeader Header;
+	if (!Reader.Read(Header) || Header.Magic != CacheMagic || Header.Version != CacheVersion || Header.Key != Key)
+	{
+		return false;
+	}
+
+	std::vector<Mesh*> LoadedMeshes;
+	LoadedMeshes.reserve(Header.MeshCount);
+
+	bool bValid = true;
+	for (uint32_t iMesh = 0; iMesh < Header.MeshCount && bValid; ++iMesh)
+	{
+		CachedMeshHeader MeshHeader;
+		if (!Reader.Read(MeshHeader))
+		{
+			bValid = false;
+			break;
+		}
+
+		std::wstring Paths[3];
+		for (int iPath = 0; iPath < 3 && bValid; ++iPath)
+		{
+			const uint8_t* PathData = Reader.Skip(MeshHeader.PathLengths[iPath] * sizeof(wchar_t));
+			bValid = PathData != nullptr;
+			if (bValid)
+			{
+				Paths[iPath].assign(reinterpret_cast<const wchar_t*>(PathData), MeshHeader.PathLengths[iPath]);
+			}
+		}
+
+		const uint8_t* VertexData = bValid ? Reader.Skip(size_t(MeshHeader.VertexCount) * sizeof(VertexType)) : nullptr;
+		const uint8_t* IndexData = VertexData ? Reader.Skip(size_t(MeshHeader.IndexCount) * sizeof(DWORD)) : nullptr;
+		const uint8_t* LodIndexData = IndexData ? Reader.Skip(size_t(MeshHeader.LodIndexCount) * sizeof(DWORD)) : nullptr;
+		const uint8_t* LodData = LodIndexData ? Reader.Skip(size_t(MeshHeader.LodCount) * sizeof(MeshLod)) : nullptr;
+		if (!VertexData || !IndexData || !LodData || !LodIndexData)
+		{
+			bValid = false;
+			break;
+		}
+
+		Mesh* NewMesh = new Mesh();
+		NewMesh->SetPosition(MeshHeader.Position);
+		NewMesh->SetRotation(MeshHeader.Rotation);
+		NewMesh->SetScale(MeshHeader.Scale);
+		NewMesh->SetMaterial(MeshHeader.Material);
+		NewMesh->TexturePath = Paths[0];
+		NewMesh->NormalMapPath = Paths[1];
+		NewMesh->SpecularMapPath = Paths[2];
+
+		// Vertices and indices stay in the mapping, the pages are only faulted in when the mesh uploads them
+		Mesh::GeometryView Geometry;
+		Geometry.Vertices = reinterpret_cast<const VertexType*>(VertexData);
+		Geometry.VertexCount = MeshHeader.VertexCount;
+		Geometry.Indices = reinterpret_cast<const DWORD*>(IndexData);
+		Geometry.IndexCount = MeshHeader.IndexCount;
+		Geometry.LodIndices = reinterpret_cast<const DWORD*>(LodIndexData);
+		Geometry.LodIndexCount = MeshHeader.LodIndexCount;
+		NewMesh->SetMappedGeometry(File, Geometry);
+
+		NewMesh->Lods.resize(MeshHeader.LodCount);
+		memcpy(NewMesh->Lods.data(), LodData, size_t(MeshHeader.LodCount) * sizeof(MeshLod));
+
+		LoadedMeshes.push_back(NewMesh);
+	}
+
+	std::vector<CookedLight> LoadedLights(bValid ? Header.LightCount : 0);
+	for (CookedLight& Light : LoadedLights)
+	{
+		if (!Reader.Read(Light))
+		{
+			bValid = false;
+			break;
+		}
+	}
+
+	if (!bValid)
+	{
+		for (Mesh* LoadedMesh : LoadedMeshes)
+		{
+			delete LoadedMesh;
+		}
+		return false;
+	}
+
+	OutMeshes.insert(OutMeshes.end(), LoadedMeshes.begin(), LoadedMeshes.end());
+	OutLights.insert(OutLights.end(), LoadedLights.begin(), LoadedLights.end());
+	return true;
+}
+
+bool MeshCache::Save(const std::wstring& CachePath, uint64_t Key, const std::vector<Mesh*>& Meshes, const std::vector<CookedLight>& Lights)
+{
+	// Write to a temporary file first so a crash never leaves a truncated cache behind
+	const std::wstring TempPath = CachePath + L".tmp";
+	{
+		std::ofstream Stream(TempPath, std::ios::binary | std::ios::trunc);
+		if (!Stream)
+		{
+			return false;
+		}
+
+		CacheHeader Header;
+		Header.Magic = CacheMagic;
+		Header.Version = CacheVersion;
+		Header.Key = Key;
+		Header.MeshCount = static_cast<uint32_t>(Meshes.size());
+		Header.LightCount = static_cast<uint32_t>(Lights.size());
+		WriteBytes(Stream, &Header, sizeof(Header));
+
+		for (const Mesh* CurrentMesh : Meshes)
+		{
+			CachedMeshHeader MeshHeader;
+			MeshHeader.Position = CurrentMesh->GetPosition();
+			MeshHeader.Rotation = CurrentMesh->GetRotation();
+			MeshHeader.Scale = CurrentMesh->GetScale();
+			MeshHeader.Material = CurrentMesh->Material;
+			const Mesh::GeometryView Geometry = CurrentMesh->GetGeometry();
+			MeshHeader.VertexCount = static_cast<uint32_t>(Geometry.VertexCount);
+			MeshHeader.IndexCount = static_cast<uint32_t>(Geometry.IndexCount);
+			MeshHeader.LodCount = static_cast<uint32_t>(CurrentMesh->Lods.size());
+			MeshHeader.LodIndexCount = static_cast<uint32_t>(Geometry.LodIndexCount);
+			MeshHeader.PathLengths[0] = static_cast<uint32_t>(CurrentMesh->TexturePath.size());
+			MeshHeader.PathLengths[1] = static_cast<uint32_t>(CurrentMesh->NormalMapPath.size());
+			MeshHeader.PathLengths[2] = static_cast<uint32_t>(CurrentMesh->SpecularMapPath.size());
+			WriteBytes(Stream, &MeshHeader, sizeof(MeshHeader));
+
+			WriteBytes(Stream, CurrentMesh->TexturePath.data(), CurrentMesh->TexturePath.size() * sizeof(wchar_t));
+			WriteBytes(Stream, CurrentMesh->NormalMapPath.data(), CurrentMesh->NormalMapPath.size() * sizeof(wchar_t));
+			WriteBytes(Stream, CurrentMesh->SpecularMapPath.data(), CurrentMesh->SpecularMapPath.size() * sizeof(wchar_t));
+			WriteBytes(Stream, Geometry.Vertices, Geometry.VertexCount * sizeof(VertexType));
+			WriteBytes(Stream, Geometry.Indices, Geometry.IndexCount * sizeof(DWORD));
+			WriteBytes(Stream, Geometry.LodIndices, Geometry.LodIndexCount * sizeof(DWORD));
+			WriteBytes(Stream, CurrentMesh->Lods.data(), CurrentMesh->Lods.size() * sizeof(MeshLod));
+		}
+
+		for (const CookedLight& Light : Lights)
+		{
+			WriteBytes(Stream, &Light, sizeof(Light));
+		}
+
+		if (!Stream)
+		{
+			return false;
+		}
+	}
+
+	return MoveFileExW(TempPath.c_str(), CachePath.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+}
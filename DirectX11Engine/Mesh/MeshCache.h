@@ -0,0 +1,32 @@
+#pragma once
+#include <vector>
+#include "Core/pch.h"
+
+class Mesh;
+
+// Cooked, memory-mapped copy of an imported model.
+// A cache file holds the final vertex/index arrays, levels of detail, materials, texture paths and node transforms of every mesh,
+// plus the directional light of the scene, so that a model can be reopened without going through Assimp.
+namespace MeshCache
+{
+	struct CookedLight
+	{
+		DirectX::XMFLOAT3 Position;
+		DirectX::XMFLOAT4 AmbientColor;
+		DirectX::XMFLOAT4 DiffuseColor;
+		DirectX::XMFLOAT4 SpecularColor;
+		DirectX::XMFLOAT3 Direction;
+	};
+
+	// Key of a model : hash of the source file content, of the material libraries of an .obj and of the Assimp import flags. Returns 0 if the source can't be read.
+	// A stamp of the size and write time of those files saves hashing them again while they don't change
+	uint64_t ComputeKey(const std::wstring& SourcePath, unsigned int ImportFlags);
+
+	std::wstring GetCachePath(uint64_t Key);
+
+	// Create the meshes stored in a cache file, returns false if the file is missing, stale or corrupted
+	bool Load(const std::wstring& CachePath, uint64_t Key, std::vector<Mesh*>& OutMeshes, std::vector<CookedLight>& OutLights);
+
+	// Write the meshes to a cache file, must be called before the meshes are initialized
+	bool Save(const std::wstring& CachePath, uint64_t Key, const std::vector<Mesh*>& Meshes, const std::vector<CookedLight>& Lights);
+}
@@ -0,0 +1,429 @@
+#include "Core/pch.h"
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <numeric>
+
+using namespace DirectX;
+
+namespace
+{
+	// Tom Forsyth, "Linear-Speed Vertex Cache Optimisation", with the constants of the article
+	constexpr int MaxCacheSize = 32;
+	constexpr float CacheDecayPower = 1.5f;
+	constexpr float LastTriangleScore = 0.75f;
+	constexpr float ValenceBoostScale = 2.0f;
+	constexpr float ValenceBoostPower = 0.5f;
+
+	constexpr uint32_t InvalidIndex = ~0u;
+
+	float GetVertexScore(int CachePosition, uint32_t RemainingTriangles)
+	{
+		if (RemainingTriangles == 0)
+		{
+			return -1.0f;
+		}
+
+		float Score = 0.0f;
+		if (CachePosition >= 0)
+		{
+			// The vertices of the last triangle get a fixed score, so the next one doesn't just reuse the same edge
+			Score = CachePosition < 3 ? LastTriangleScore : powf(1.0f - float(CachePosition - 3) / (MaxCacheSize - 3), CacheDecayPower);
+		}
+
+		// Vertices with few triangles left are finished first, so they don't end up alone
+		return Score + ValenceBoostScale * powf(float(RemainingTriangles), -ValenceBoostPower);
+	}
+
+	XMFLOAT3 GetPosition(const XMFLOAT3* Positions, size_t PositionStride, uint32_t Index)
+	{
+		return *reinterpret_cast<const XMFLOAT3*>(reinterpret_cast<const uint8_t*>(Positions) + Index * PositionStride);
+	}
+
+	// FIFO cache of the vertex indices, a vertex is in the cache until CacheSize other vertices missed after it
+	class FifoCache
+	{
+	public:
+		FifoCache(size_t VertexCount, unsigned int InCacheSize)
+			: Stamps(VertexCount, 0), CacheSize(InCacheSize)
+		{ }
+
+		// Returns true on a miss
+		bool Access(uint32_t Vertex)
+		{
+			if (Stamps[Vertex] != 0 && Time - Stamps[Vertex] < CacheSize)
+			{
+				return false;
+			}
+			Stamps[Vertex] = ++Time;
+			return true;
+		}
+
+	private:
+		std::vector<uint32_t> Stamps;
+		uint32_t Time = 0;
+		unsigned int CacheSize;
+	};
+}
+
+void MeshOptimizer::OptimizeVertexCache(uint32_t* Indices, size_t IndexCount, size_t VertexCount)
+{
+	const size_t TriangleCount = IndexCount / 3;
+	if (TriangleCount < 2)
+	{
+		return;
+	}
+
+	// Triangles of each vertex, the ones not emitted yet are kept first
+	std::vector<uint32_t> Offsets(VertexCount + 1, 0);
+	for (size_t i = 0; i < TriangleCount * 3; ++i)
+	{
+		++Offsets[Indices[i] + 1];
+	}
+	std::partial_sum(Offsets.begin(), Offsets.end(), Offsets.begin());
+
+	std::vector<uint32_t> Remaining(VertexCount);
+	std::vector<uint32_t> VertexTriangles(TriangleCount * 3);
+	for (size_t i = 0; i < TriangleCount * 3; ++i)
+	{
+		const uint32_t Vertex = Indices[i];
+		VertexTriangles[Offsets[Vertex] + Remaining[Vertex]++] = static_cast<uint32_t>(i / 3);
+	}
+
+	std::vector<int> CachePositions(VertexCount, -1);
+	std::vector<float> VertexScores(VertexCount);
+	for (size_t Vertex = 0; Vertex < VertexCount; ++Vertex)
+	{
+		VertexScores[Vertex] = GetVertexScore(-1, Remaining[Vertex]);
+	}
+
+	std::vector<float> TriangleScores(TriangleCount);
+	uint32_t Best = 0;
+	for (uint32_t Triangle = 0; Triangle < TriangleCount; ++Triangle)
+	{
+		TriangleScores[Triangle] = VertexScores[Indices[Triangle * 3]] + VertexScores[Indices[Triangle * 3 + 1]] + VertexScores[Indices[Triangle * 3 + 2]];
+		Best = TriangleScores[Triangle] > TriangleScores[Best] ? Triangle : Best;
+	}
+
+	std::vector<uint8_t> Emitted(TriangleCount, 0);
+	std::vector<uint32_t> Output;
+	Output.reserve(TriangleCount * 3);
+
+	uint32_t Cache[MaxCacheSize + 3];
+	uint32_t NewCache[MaxCacheSize + 3];
+	int CacheCount = 0;
+	size_t NextUnemitted = 0;
+
+	while (Output.size() < TriangleCount * 3)
+	{
+		// When nothing in the cache has triangles left, carry on in the source order
+		if (Best == InvalidIndex)
+		{
+			while (Emitted[NextUnemitted])
+			{
+				++NextUnemitted;
+			}
+			Best = static_cast<uint32_t>(NextUnemitted);
+		}
+
+		const uint32_t* Triangle = &Indices[Best * 3];
+		Emitted[Best] = 1;
+		Output.insert(Output.end(), Triangle, Triangle + 3);
+
+		for (int Corner = 0; Corner < 3; ++Corner)
+		{
+			const uint32_t Vertex = Triangle[Corner];
+			uint32_t* Live = &VertexTriangles[Offsets[Vertex]];
+			uint32_t* Found = std::find(Live, Live + Remaining[Vertex], Best);
+			if (Found != Live + Remaining[Vertex])
+			{
+				std::swap(*Found, Live[--Remaining[Vertex]]);
+			}
+		}
+
+		// The vertices of the triangle move to the front of the cache, the others are pushed back
+		int NewCount = 0;
+		for (int Corner = 0; Corner < 3; ++Corner)
+		{
+			if (std::find(NewCache, NewCache + NewCount, Triangle[Corner]) == NewCache + NewCount)
+			{
+				NewCache[NewCount++] = Triangle[Corner];
+			}
+		}
+		for (int i = 0; i < CacheCount; ++i)
+		{
+			if (Cache[i] != Triangle[0] && Cache[i] != Triangle[1] && Cache[i] != Triangle[2])
+			{
+				NewCache[NewCount++] = Cache[i];
+			}
+		}
+
+		// Vertices pushed out of the cache are rescored as well
+		for (int i = 0; i < NewCount; ++i)
+		{
+			const uint32_t Vertex = NewCache[i];
+			CachePositions[Vertex] = i < MaxCacheSize ? i : -1;
+
+			const float NewScore = GetVertexScore(CachePositions[Vertex], Remaining[Vertex]);
+			const float Delta = NewScore - VertexScores[Vertex];
+			VertexScores[Vertex] = NewScore;
+
+			const uint32_t* Live = &VertexTriangles[Offsets[Vertex]];
+			for (uint32_t j = 0; j < Remaining[Vertex]; ++j)
+			{
+				TriangleScores[Live[j]] += Delta;
+			}
+		}
+
+		Best = InvalidIndex;
+		float BestScore = -FLT_MAX;
+		for (int i = 0; i < NewCount; ++i)
+		{
+			const uint32_t Vertex = NewCache[i];
+			const uint32_t* Live = &VertexTriangles[Offsets[Vertex]];
+			for (uint32_t j = 0; j < Remaining[Vertex]; ++j)
+			{
+				if (TriangleScores[Live[j]] > BestScore)
+				{
+					BestScore = TriangleScores[Live[j]];
+					Best = Live[j];
+				}
+			}
+		}
+
+		CacheCount = std::min(NewCount, MaxCacheSize);
+		std::copy(NewCache, NewCache + CacheCount, Cache);
+	}
+
+	std::copy(Output.begin(), Output.end(), Indices);
+}
+
+void MeshOptimizer::OptimizeOverdraw(uint32_t* Indices, size_t IndexCount, const XMFLOAT3* Positions, size_t PositionStride, size_t VertexCount, float Threshold)
+{
+	const size_t TriangleCount = IndexCount / 3;
+	if (TriangleCount < 2)
+	{
+		return;
+	}
+
+	// A cluster starts where the three vertices of a triangle miss the cache, it can move without costing extra misses
+	std::vector<uint32_t> ClusterStarts;
+	FifoCache Cache(VertexCount, AnalysisCacheSize);
+	for (uint32_t Triangle = 0; Triangle < TriangleCount; ++Triangle)
+	{
+		int Misses = 0;
+		for (int Corner = 0; Corner < 3; ++Corner)
+		{
+			Misses += Cache.Access(Indices[Triangle * 3 + Corner]) ? 1 : 0;
+		}
+		if (Triangle == 0 || Misses == 3)
+		{
+			ClusterStarts.push_back(Triangle);
+		}
+	}
+	const size_t ClusterCount = ClusterStarts.size();
+	ClusterStarts.push_back(static_cast<uint32_t>(TriangleCount));
+	if (ClusterCount < 3)
+	{
+		return;
+	}
+
+	// Area weighted center and normal of each cluster
+	std::vector<XMFLOAT3> Centers(ClusterCount);
+	std::vector<XMFLOAT3> Normals(ClusterCount);
+	XMVECTOR MeshCenter = XMVectorZero();
+	float MeshArea = 0.0f;
+	for (size_t Cluster = 0; Cluster < ClusterCount; ++Cluster)
+	{
+		XMVECTOR Center = XMVectorZero();
+		XMVECTOR Normal = XMVectorZero();
+		float Area = 0.0f;
+		for (uint32_t Triangle = ClusterStarts[Cluster]; Triangle < ClusterStarts[Cluster + 1]; ++Triangle)
+		{
+			const XMFLOAT3 P0 = GetPosition(Positions, PositionStride, Indices[Triangle * 3]);
+			const XMFLOAT3 P1 = GetPosition(Positions, PositionStride, Indices[Triangle * 3 + 1]);
+			const XMFLOAT3 P2 = GetPosition(Positions, PositionStride, Indices[Triangle * 3 + 2]);
+			const XMVECTOR V0 = XMLoadFloat3(&P0), V1 = XMLoadFloat3(&P1), V2 = XMLoadFloat3(&P2);
+
+			const XMVECTOR Cross = XMVector3Cross(V1 - V0, V2 - V0);
+			const float TriangleArea = XMVectorGetX(XMVector3Length(Cross));
+			Center += (V0 + V1 + V2) * (TriangleArea / 3.0f);
+			Normal += Cross;
+			Area += TriangleArea;
+		}
+
+		MeshCenter += Center;
+		MeshArea += Area;
+		XMStoreFloat3(&Centers[Cluster], Area > 0.0f ? Center / Area : Center);
+		XMStoreFloat3(&Normals[Cluster], XMVector3Normalize(Normal));
+	}
+	MeshCenter = MeshArea > 0.0f ? MeshCenter / MeshArea : MeshCenter;
+
+	// Clusters far out along their normal hide the others, Sander et al. "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw"
+	std::vector<float> Sortedness(ClusterCount);
+	for (size_t Cluster = 0; Cluster < ClusterCount; ++Cluster)
+	{
+		Sortedness[Cluster] = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&Centers[Cluster]) - MeshCenter, XMLoadFloat3(&Normals[Cluster])));
+	}
+
+	std::vector<uint32_t> Order(ClusterCount);
+	std::iota(Order.begin(), Order.end(), 0);
+	std::stable_sort(Order.begin(), Order.end(), [&Sortedness](uint32_t A, uint32_t B) { return Sortedness[A] > Sortedness[B]; });
+
+	std::vector<uint32_t> Reordered;
+	Reordered.reserve(TriangleCount * 3);
+	for (uint32_t Cluster : Order)
+	{
+		Reordered.insert(Reordered.end(), Indices + ClusterStarts[Cluster] * 3, Indices + ClusterStarts[Cluster + 1] * 3);
+	}
+
+	const VertexCacheStats Before = AnalyzeVertexCache(Indices, TriangleCount * 3, VertexCount);
+	const VertexCacheStats After = AnalyzeVertexCache(Reordered.data(), Reordered.size(), VertexCount);
+	if (After.Misses <= Before.Misses * Threshold)
+	{
+		std::copy(Reordered.begin(), Reordered.end(), Indices);
+	}
+}
+
+size_t MeshOptimizer::OptimizeVertexFetch(void* Vertices, size_t VertexSize, size_t VertexCount, uint32_t* Indices, size_t IndexCount)
+{
+	std::vector<uint32_t> Remap(VertexCount, InvalidIndex);
+	uint32_t NextVertex = 0;
+	for (size_t i = 0; i < IndexCount; ++i)
+	{
+		uint32_t& NewIndex = Remap[Indices[i]];
+		if (NewIndex == InvalidIndex)
+		{
+			NewIndex = NextVertex++;
+		}
+		Indices[i] = NewIndex;
+	}
+
+	uint8_t* Bytes = static_cast<uint8_t*>(Vertices);
+	std::vector<uint8_t> Reordered(size_t(NextVertex) * VertexSize);
+	for (size_t Vertex = 0; Vertex < VertexCount; ++Vertex)
+	{
+		if (Remap[Vertex] != InvalidIndex)
+		{
+			memcpy(&Reordered[Remap[Vertex] * VertexSize], Bytes + Vertex * VertexSize, VertexSize);
+		}
+	}
+	std::copy(Reordered.begin(), Reordered.end(), Bytes);
+
+	return NextVertex;
+}
+
+MeshOptimizer::VertexCacheStats MeshOptimizer::AnalyzeVertexCache(const uint32_t* Indices, size_t IndexCount, size_t VertexCount)
+{
+	VertexCacheStats Result;
+	Result.Triangles = IndexCount / 3;
+
+	FifoCache Cache(VertexCount, AnalysisCacheSize);
+	std::vector<uint8_t> Referenced(VertexCount, 0);
+	for (size_t i = 0; i < Result.Triangles * 3; ++i)
+	{
+		Result.Misses += Cache.Access(Indices[i]) ? 1 : 0;
+		Result.Vertices += Referenced[Indices[i]] ? 0 : 1;
+		Referenced[Indices[i]] = 1;
+	}
+	return Result;
+}
+
+MeshOptimizer::OverdrawStats MeshOptimizer::AnalyzeOverdraw(const uint32_t* Indices, size_t IndexCount, const XMFLOAT3* Positions, size_t PositionStride, size_t VertexCount)
+{
+	constexpr int GridSize = 256;
+
+	OverdrawStats Result;
+	const size_t TriangleCount = IndexCount / 3;
+	if (TriangleCount == 0)
+	{
+		return Result;
+	}
+
+	float Min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float Max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (size_t i = 0; i < TriangleCount * 3; ++i)
+	{
+		const XMFLOAT3 Position = GetPosition(Positions, PositionStride, Indices[i]);
+		for (int Axis = 0; Axis < 3; ++Axis)
+		{
+			Min[Axis] = std::min(Min[Axis], (&Position.x)[Axis]);
+			Max[Axis] = std::max(Max[Axis], (&Position.x)[Axis]);
+		}
+	}
+
+	std::vector<float> Depth(GridSize * GridSize);
+	std::vector<uint8_t> Written(GridSize * GridSize);
+
+	for (int Axis = 0; Axis < 3; ++Axis)
+	{
+		// The two other axes are the screen, scaled uniformly so the mesh fits in the grid
+		const int U = (Axis + 1) % 3;
+		const int V = (Axis + 2) % 3;
+		const float Extent = std::max(Max[U] - Min[U], Max[V] - Min[V]);
+		if (Extent <= 0.0f)
+		{
+			continue;
+		}
+		const float Scale = (GridSize - 1) / Extent;
+
+		for (float Direction : { 1.0f, -1.0f })
+		{
+			std::fill(Depth.begin(), Depth.end(), FLT_MAX);
+			std::fill(Written.begin(), Written.end(), uint8_t(0));
+
+			for (size_t Triangle = 0; Triangle < TriangleCount; ++Triangle)
+			{
+				float X[3], Y[3], Z[3];
+				for (int Corner = 0; Corner < 3; ++Corner)
+				{
+					const XMFLOAT3 Position = GetPosition(Positions, PositionStride, Indices[Triangle * 3 + Corner]);
+					X[Corner] = ((&Position.x)[U] - Min[U]) * Scale;
+					Y[Corner] = ((&Position.x)[V] - Min[V]) * Scale;
+					Z[Corner] = ((&Position.x)[Axis] - Min[Axis]) * Direction;
+				}
+
+				// Each face is front facing for one of the two directions of the axis
+				const float Area = (X[1] - X[0]) * (Y[2] - Y[0]) - (X[2] - X[0]) * (Y[1] - Y[0]);
+				if (Area * Direction <= 0.0f)
+				{
+					continue;
+				}
+
+				const int MinX = std::max(0, static_cast<int>(ceilf(std::min({ X[0], X[1], X[2] }) - 0.5f)));
+				const int MaxX = std::min(GridSize - 1, static_cast<int>(floorf(std::max({ X[0], X[1], X[2] }) - 0.5f)));
+				const int MinY = std::max(0, static_cast<int>(ceilf(std::min({ Y[0], Y[1], Y[2] }) - 0.5f)));
+				const int MaxY = std::min(GridSize - 1, static_cast<int>(floorf(std::max({ Y[0], Y[1], Y[2] }) - 0.5f)));
+
+				for (int PixelY = MinY; PixelY <= MaxY; ++PixelY)
+				{
+					for (int PixelX = MinX; PixelX <= MaxX; ++PixelX)
+					{
+						const float PointX = PixelX + 0.5f;
+						const float PointY = PixelY + 0.5f;
+						const float W0 = ((X[1] - PointX) * (Y[2] - PointY) - (X[2] - PointX) * (Y[1] - PointY)) / Area;
+						const float W1 = ((X[2] - PointX) * (Y[0] - PointY) - (X[0] - PointX) * (Y[2] - PointY)) / Area;
+						const float W2 = 1.0f - W0 - W1;
+						if (W0 < 0.0f || W1 < 0.0f || W2 < 0.0f)
+						{
+							continue;
+						}
+
+						// Early depth test, only the pixels passing it are shaded
+						const float PixelDepth = W0 * Z[0] + W1 * Z[1] + W2 * Z[2];
+						const int Pixel = PixelY * GridSize + PixelX;
+						if (PixelDepth < Depth[Pixel])
+						{
+							Depth[Pixel] = PixelDepth;
+							Written[Pixel] = 1;
+							++Result.Shaded;
+						}
+					}
+				}
+			}
+
+			Result.Covered += static_cast<size_t>(std::count(Written.begin(), Written.end(), uint8_t(1)));
+		}
+	}
+
+	return Result;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "Core/pch.h"
+#include <vector>
+
+// Import time reordering of indexed triangle lists for the GPU : triangles for the post transform vertex cache,
+// then clusters of triangles for overdraw, then vertices for fetch locality.
+// The analysis functions measure the same things on the CPU, so the gains can be checked without a GPU.
+namespace MeshOptimizer
+{
+	// Size of the FIFO cache simulated by the analysis, about what a GPU keeps of the transformed vertices
+	constexpr unsigned int AnalysisCacheSize = 16;
+
+	struct VertexCacheStats
+	{
+		size_t Triangles = 0;
+		size_t Vertices = 0;
+		size_t Misses = 0;
+
+		// Average cache miss ratio, vertices transformed per triangle : 3 at worst, 0.5 at best on a regular grid
+		float GetACMR() const { return Triangles > 0 ? float(Misses) / Triangles : 0.0f; }
+		// Average transform to vertex ratio, vertices transformed per vertex : 1 is perfect
+		float GetATVR() const { return Vertices > 0 ? float(Misses) / Vertices : 0.0f; }
+
+		void Add(const VertexCacheStats& Other) { Triangles += Other.Triangles; Vertices += Other.Vertices; Misses += Other.Misses; }
+	};
+
+	struct OverdrawStats
+	{
+		size_t Covered = 0;
+		size_t Shaded = 0;
+
+		// Pixels shaded per covered pixel, 1 is perfect
+		float GetOverdraw() const { return Covered > 0 ? float(Shaded) / Covered : 0.0f; }
+
+		void Add(const OverdrawStats& Other) { Covered += Other.Covered; Shaded += Other.Shaded; }
+	};
+
+	// Reorder triangles so they reuse recently transformed vertices, with Tom Forsyth's linear speed heuristic
+	void OptimizeVertexCache(uint32_t* Indices, size_t IndexCount, size_t VertexCount);
+
+	// Split a vertex cache ordered list where the cache restarts, then draw the clusters facing out of the mesh first.
+	// The order is kept if the ACMR grows by more than Threshold
+	void OptimizeOverdraw(uint32_t* Indices, size_t IndexCount, const DirectX::XMFLOAT3* Positions, size_t PositionStride, size_t VertexCount, float Threshold = 1.05f);
+
+	// Renumber the vertices in their order of first use and move them to match, unreferenced vertices are dropped.
+	// Returns the new vertex count
+	size_t OptimizeVertexFetch(void* Vertices, size_t VertexSize, size_t VertexCount, uint32_t* Indices, size_t IndexCount);
+
+	VertexCacheStats AnalyzeVertexCache(const uint32_t* Indices, size_t IndexCount, size_t VertexCount);
+
+	// Rasterize the mesh along the six axis directions with back face culling and an early depth test,
+	// in index order, and count the pixels shaded against the pixels covered
+	OverdrawStats AnalyzeOverdraw(const uint32_t* Indices, size_t IndexCount, const DirectX::XMFLOAT3* Positions, size_t PositionStride, size_t VertexCount);
+}
@@ -0,0 +1,347 @@
+#include "Core/pch.h"
+#include "MeshSimplifier.h"
+#include "Core/Hash.h"
+#include <algorithm>
+#include <unordered_map>
+
+using namespace DirectX;
+
+namespace
+{
+	// Sum of the squared distances to a set of planes, as the upper triangle of a symmetric 4x4 matrix
+	struct Quadric
+	{
+		double A00 = 0.0, A01 = 0.0, A02 = 0.0, A03 = 0.0;
+		double A11 = 0.0, A12 = 0.0, A13 = 0.0;
+		double A22 = 0.0, A23 = 0.0;
+		double A33 = 0.0;
+
+		void AddPlane(double A, double B, double C, double D)
+		{
+			A00 += A * A; A01 += A * B; A02 += A * C; A03 += A * D;
+			A11 += B * B; A12 += B * C; A13 += B * D;
+			A22 += C * C; A23 += C * D;
+			A33 += D * D;
+		}
+
+		void Add(const Quadric& Other)
+		{
+			A00 += Other.A00; A01 += Other.A01; A02 += Other.A02; A03 += Other.A03;
+			A11 += Other.A11; A12 += Other.A12; A13 += Other.A13;
+			A22 += Other.A22; A23 += Other.A23;
+			A33 += Other.A33;
+		}
+
+		double Evaluate(const XMFLOAT3& Point) const
+		{
+			const double X = Point.x, Y = Point.y, Z = Point.z;
+			const double Result = A00 * X * X + 2.0 * A01 * X * Y + 2.0 * A02 * X * Z + 2.0 * A03 * X
+				+ A11 * Y * Y + 2.0 * A12 * Y * Z + 2.0 * A13 * Y
+				+ A22 * Z * Z + 2.0 * A23 * Z
+				+ A33;
+			return std::max(Result, 0.0);
+		}
+	};
+
+	struct Collapse
+	{
+		uint32_t From;
+		uint32_t To;
+		double Cost;
+	};
+
+	XMVECTOR FaceNormal(const XMFLOAT3& P0, const XMFLOAT3& P1, const XMFLOAT3& P2)
+	{
+		const XMVECTOR Origin = XMLoadFloat3(&P0);
+		return XMVector3Cross(XMVectorSubtract(XMLoadFloat3(&P1), Origin), XMVectorSubtract(XMLoadFloat3(&P2), Origin));
+	}
+
+	uint64_t EdgeKey(uint32_t A, uint32_t B)
+	{
+		return A < B ? (uint64_t(A) << 32) | B : (uint64_t(B) << 32) | A;
+	}
+
+	// Collapses have to keep the faces around them within 60 degrees of their normal, which also rejects flips
+	constexpr float MinNormalCosine = 0.5f;
+
+	class Simplifier
+	{
+	public:
+		Simplifier(const std::vector<XMFLOAT3>& InPoints, std::vector<uint32_t>& InIndices)
+			: Points(InPoints), Indices(InIndices), Quadrics(InPoints.size()), Locked(InPoints.size(), 0)
+		{
+			LockSeamsAndBorders();
+
+			for (size_t Triangle = 0; Triangle < Indices.size(); Triangle += 3)
+			{
+				const XMFLOAT3& P0 = Points[Indices[Triangle]];
+				XMFLOAT3 Normal;
+				XMStoreFloat3(&Normal, XMVector3Normalize(FaceNormal(P0, Points[Indices[Triangle + 1]], Points[Indices[Triangle + 2]])));
+				const double D = -(double(Normal.x) * P0.x + double(Normal.y) * P0.y + double(Normal.z) * P0.z);
+				for (int Corner = 0; Corner < 3; ++Corner)
+				{
+					Quadrics[Indices[Triangle + Corner]].AddPlane(Normal.x, Normal.y, Normal.z, D);
+				}
+			}
+		}
+
+		// Collapse independent edges, cheapest first, until the target or until no edge is left. Returns false if nothing collapsed
+		bool RunPass(size_t TargetIndexCount)
+		{
+			BuildAdjacency();
+
+			Candidates.clear();
+			for (size_t Triangle = 0; Triangle < Indices.size(); Triangle += 3)
+			{
+				for (int Corner = 0; Corner < 3; ++Corner)
+				{
+					const uint32_t A = Indices[Triangle + Corner];
+					const uint32_t B = Indices[Triangle + (Corner + 1) % 3];
+					if (!Locked[A])
+					{
+						Candidates.push_back({ A, B, GetCost(A, B) });
+					}
+					if (!Locked[B])
+					{
+						Candidates.push_back({ B, A, GetCost(B, A) });
+					}
+				}
+			}
+			std::sort(Candidates.begin(), Candidates.end(), [](const Collapse& L, const Collapse& R) { return L.Cost < R.Cost; });
+
+			// A vertex next to a collapse waits for the next pass, the faces checked here are never stale
+			Remap.resize(Points.size());
+			for (uint32_t i = 0; i < Remap.size(); ++i)
+			{
+				Remap[i] = i;
+			}
+			Touched.assign(Points.size(), 0);
+
+			size_t TriangleCount = Indices.size() / 3;
+			const size_t TargetTriangles = TargetIndexCount / 3;
+			bool bCollapsed = false;
+
+			for (const Collapse& Candidate : Candidates)
+			{
+				if (TriangleCount <= TargetTriangles)
+				{
+					break;
+				}
+				if (Touched[Candidate.From] || Touched[Candidate.To])
+				{
+					continue;
+				}
+
+				size_t Removed = 0;
+				if (!CanCollapse(Candidate.From, Candidate.To, Removed))
+				{
+					continue;
+				}
+
+				Remap[Candidate.From] = Candidate.To;
+				Quadrics[Candidate.To].Add(Quadrics[Candidate.From]);
+				MaxCost = std::max(MaxCost, Candidate.Cost);
+				TriangleCount -= Removed;
+				bCollapsed = true;
+
+				for (uint32_t Vertex : { Candidate.From, Candidate.To })
+				{
+					for (uint32_t i = TriangleOffsets[Vertex]; i < TriangleOffsets[Vertex + 1]; ++i)
+					{
+						const uint32_t Triangle = VertexTriangles[i];
+						Touched[Indices[Triangle * 3]] = Touched[Indices[Triangle * 3 + 1]] = Touched[Indices[Triangle * 3 + 2]] = 1;
+					}
+				}
+			}
+
+			if (bCollapsed)
+			{
+				ApplyRemap();
+			}
+			return bCollapsed;
+		}
+
+		double GetMaxCost() const { return MaxCost; }
+
+	private:
+
+		void LockSeamsAndBorders()
+		{
+			// Attribute seams : several vertices at the same position
+			std::unordered_map<uint64_t, uint32_t> FirstAtPosition;
+			FirstAtPosition.reserve(Points.size());
+			for (uint32_t i = 0; i < Points.size(); ++i)
+			{
+				auto Inserted = FirstAtPosition.emplace(Hash::HashBytes(&Points[i], sizeof(XMFLOAT3)), i);
+				if (!Inserted.second)
+				{
+					Locked[i] = 1;
+					Locked[Inserted.first->second] = 1;
+				}
+			}
+
+			// Open borders and non manifold edges : edges not shared by exactly two faces
+			std::unordered_map<uint64_t, uint32_t> EdgeFaces;
+			EdgeFaces.reserve(Indices.size());
+			for (size_t Triangle = 0; Triangle < Indices.size(); Triangle += 3)
+			{
+				for (int Corner = 0; Corner < 3; ++Corner)
+				{
+					++EdgeFaces[EdgeKey(Indices[Triangle + Corner], Indices[Triangle + (Corner + 1) % 3])];
+				}
+			}
+			for (const auto& Edge : EdgeFaces)
+			{
+				if (Edge.second != 2)
+				{
+					Locked[uint32_t(Edge.first >> 32)] = 1;
+					Locked[uint32_t(Edge.first)] = 1;
+				}
+			}
+		}
+
+		double GetCost(uint32_t From, uint32_t To) const
+		{
+			Quadric Merged = Quadrics[From];
+			Merged.Add(Quadrics[To]);
+			return Merged.Evaluate(Points[To]);
+		}
+
+		void BuildAdjacency()
+		{
+			TriangleOffsets.assign(Points.size() + 1, 0);
+			for (uint32_t Index : Indices)
+			{
+				++TriangleOffsets[Index + 1];
+			}
+			for (size_t i = 1; i < TriangleOffsets.size(); ++i)
+			{
+				TriangleOffsets[i] += TriangleOffsets[i - 1];
+			}
+
+			VertexTriangles.resize(Indices.size());
+			std::vector<uint32_t> Fill(TriangleOffsets.begin(), TriangleOffsets.end() - 1);
+			for (uint32_t i = 0; i < Indices.size(); ++i)
+			{
+				VertexTriangles[Fill[Indices[i]]++] = i / 3;
+			}
+		}
+
+		bool CanCollapse(uint32_t From, uint32_t To, size_t& OutRemoved) const
+		{
+			OutRemoved = 0;
+			for (uint32_t i = TriangleOffsets[From]; i < TriangleOffsets[From + 1]; ++i)
+			{
+				const uint32_t* Triangle = &Indices[VertexTriangles[i] * 3];
+				if (Triangle[0] == To || Triangle[1] == To || Triangle[2] == To)
+				{
+					++OutRemoved;
+					continue;
+				}
+
+				XMFLOAT3 Corners[3] = { Points[Triangle[0]], Points[Triangle[1]], Points[Triangle[2]] };
+				const XMVECTOR Before = FaceNormal(Corners[0], Corners[1], Corners[2]);
+				for (int Corner = 0; Corner < 3; ++Corner)
+				{
+					if (Triangle[Corner] == From)
+					{
+						Corners[Corner] = Points[To];
+					}
+				}
+				const XMVECTOR After = FaceNormal(Corners[0], Corners[1], Corners[2]);
+
+				const float LengthProduct = XMVectorGetX(XMVector3Length(Before)) * XMVectorGetX(XMVector3Length(After));
+				if (LengthProduct <= 1e-20f || XMVectorGetX(XMVector3Dot(Before, After)) < MinNormalCosine * LengthProduct)
+				{
+					return false;
+				}
+			}
+			return OutRemoved > 0;
+		}
+
+		void ApplyRemap()
+		{
+			size_t Written = 0;
+			for (size_t Triangle = 0; Triangle < Indices.size(); Triangle += 3)
+			{
+				const uint32_t A = Remap[Indices[Triangle]];
+				const uint32_t B = Remap[Indices[Triangle + 1]];
+				const uint32_t C = Remap[Indices[Triangle + 2]];
+				if (A != B && B != C && C != A)
+				{
+					Indices[Written++] = A;
+					Indices[Written++] = B;
+					Indices[Written++] = C;
+				}
+			}
+			Indices.resize(Written);
+		}
+
+		const std::vector<XMFLOAT3>& Points;
+		std::vector<uint32_t>& Indices;
+		std::vector<Quadric> Quadrics;
+		std::vector<uint8_t> Locked;
+
+		std::vector<uint32_t> TriangleOffsets;
+		std::vector<uint32_t> VertexTriangles;
+		std::vector<Collapse> Candidates;
+		std::vector<uint32_t> Remap;
+		std::vector<uint8_t> Touched;
+		double MaxCost = 0.0;
+	};
+}
+
+std::vector<MeshSimplifier::Level> MeshSimplifier::BuildLevels(const XMFLOAT3* Positions, size_t PositionStride, size_t VertexCount,
+	const uint32_t* Indices, size_t IndexCount, const std::vector<float>& Ratios)
+{
+	std::vector<Level> Levels;
+
+	std::vector<XMFLOAT3> Points(VertexCount);
+	const uint8_t* PositionBytes = reinterpret_cast<const uint8_t*>(Positions);
+	for (size_t i = 0; i < VertexCount; ++i)
+	{
+		Points[i] = *reinterpret_cast<const XMFLOAT3*>(PositionBytes + i * PositionStride);
+	}
+
+	// Degenerate faces would give zero planes and false borders
+	std::vector<uint32_t> Current;
+	Current.reserve(IndexCount);
+	for (size_t Triangle = 0; Triangle + 2 < IndexCount; Triangle += 3)
+	{
+		const uint32_t A = Indices[Triangle], B = Indices[Triangle + 1], C = Indices[Triangle + 2];
+		if (A != B && B != C && C != A && A < VertexCount && B < VertexCount && C < VertexCount
+			&& XMVectorGetX(XMVector3LengthSq(FaceNormal(Points[A], Points[B], Points[C]))) > 0.0f)
+		{
+			Current.insert(Current.end(), { A, B, C });
+		}
+	}
+	if (Current.empty())
+	{
+		return Levels;
+	}
+
+	Simplifier Collapser(Points, Current);
+	const size_t SourceIndexCount = Current.size();
+	size_t PreviousIndexCount = SourceIndexCount;
+
+	for (float Ratio : Ratios)
+	{
+		const size_t TargetIndexCount = std::max<size_t>(size_t(SourceIndexCount / 3 * Ratio), 1) * 3;
+		while (Current.size() > TargetIndexCount && Collapser.RunPass(TargetIndexCount))
+		{
+		}
+
+		if (Current.size() * 10 > PreviousIndexCount * 9)
+		{
+			break;
+		}
+
+		Level NewLevel;
+		NewLevel.Indices = Current;
+		NewLevel.Error = static_cast<float>(sqrt(Collapser.GetMaxCost()));
+		Levels.push_back(std::move(NewLevel));
+		PreviousIndexCount = Current.size();
+	}
+
+	return Levels;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "Core/pch.h"
+#include <vector>
+
+// Quadric error edge collapse simplification of indexed triangle lists.
+// Vertices are only ever merged into other existing vertices, so every level indexes the original vertex buffer.
+// Vertices on open borders and on attribute seams (same position, another normal or UV) never move, which keeps UV seams and hard edges.
+namespace MeshSimplifier
+{
+	struct Level
+	{
+		std::vector<uint32_t> Indices;
+		// Largest distance from a collapsed vertex to the planes of the faces it was merged from, in mesh units
+		float Error = 0.0f;
+	};
+
+	// One level per ratio of the source triangle count, ratios going down. The simplification stops early
+	// when no collapse is left, a level that didn't remove at least a tenth of the previous one is not returned
+	std::vector<Level> BuildLevels(const DirectX::XMFLOAT3* Positions, size_t PositionStride, size_t VertexCount,
+		const uint32_t* Indices, size_t IndexCount, const std::vector<float>& Ratios);
+}
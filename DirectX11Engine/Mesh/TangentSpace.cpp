@@ -0,0 +1,232 @@
+#include "Core/pch.h"
+#include "TangentSpace.h"
+#include "Mesh.h"
+#include "Core/ThreadPool.h"
+#include <numeric>
+
+using namespace DirectX;
+
+namespace
+{
+	const size_t TriangleGrain = 4096;
+	const size_t VertexGrain = 4096;
+
+	// Lists of items per key, stored back to back : the items of Key are Items[Offsets[Key], Offsets[Key + 1])
+	struct Adjacency
+	{
+		std::vector<uint32_t> Offsets;
+		std::vector<uint32_t> Items;
+
+		// Items are added in increasing order, so the lists don't depend on the thread count of whoever reads them
+		void Build(size_t KeyCount, size_t ItemCount, const std::function<uint32_t(size_t)>& GetKey)
+		{
+			Offsets.assign(KeyCount + 1, 0);
+			for (size_t iItem = 0; iItem < ItemCount; ++iItem)
+			{
+				++Offsets[GetKey(iItem) + 1];
+			}
+			std::partial_sum(Offsets.begin(), Offsets.end(), Offsets.begin());
+
+			std::vector<uint32_t> Cursors(Offsets.begin(), Offsets.end() - 1);
+			Items.resize(ItemCount);
+			for (size_t iItem = 0; iItem < ItemCount; ++iItem)
+			{
+				Items[Cursors[GetKey(iItem)]++] = static_cast<uint32_t>(iItem);
+			}
+		}
+	};
+
+	// Angle of a corner once its edges are projected on the plane of Normal
+	float GetCornerAngle(FXMVECTOR Normal, FXMVECTOR Corner, FXMVECTOR Next, GXMVECTOR Previous)
+	{
+		auto Project = [Normal](FXMVECTOR Edge)
+		{
+			return XMVector3Normalize(XMVectorSubtract(Edge, XMVectorScale(Normal, XMVectorGetX(XMVector3Dot(Normal, Edge)))));
+		};
+
+		const float Cosine = XMVectorGetX(XMVector3Dot(Project(XMVectorSubtract(Next, Corner)), Project(XMVectorSubtract(Previous, Corner))));
+		return acosf(std::min(std::max(Cosine, -1.0f), 1.0f));
+	}
+}
+
+XMVECTOR TangentSpace::GetAnyTangent(FXMVECTOR Normal)
+{
+	// Branchless orthonormal basis of Duff et al.
+	XMFLOAT3 N;
+	XMStoreFloat3(&N, XMVector3Normalize(Normal));
+	const float Sign = N.z >= 0.0f ? 1.0f : -1.0f;
+	const float A = -1.0f / (Sign + N.z);
+	const float B = N.x * N.y * A;
+	return XMVectorSet(1.0f + Sign * N.x * N.x * A, Sign * B, -Sign * N.x, 0.0f);
+}
+
+void TangentSpace::GenerateNormals(std::vector<VertexType>& Vertices, const std::vector<DWORD>& Indices)
+{
+	const size_t VertexCount = Vertices.size();
+	const size_t TriangleCount = Indices.size() / 3;
+	if (VertexCount == 0)
+	{
+		return;
+	}
+
+	// The cross product of two edges is twice the area, unnormalized it gives the area weighting for free
+	std::vector<XMFLOAT3> FaceNormals(TriangleCount);
+	ThreadPool::Get().ParallelFor(TriangleCount, TriangleGrain, [&](size_t Begin, size_t End)
+	{
+		for (size_t iTri = Begin; iTri < End; ++iTri)
+		{
+			const XMVECTOR P0 = XMLoadFloat3(&Vertices[Indices[iTri * 3]].Position);
+			const XMVECTOR P1 = XMLoadFloat3(&Vertices[Indices[iTri * 3 + 1]].Position);
+			const XMVECTOR P2 = XMLoadFloat3(&Vertices[Indices[iTri * 3 + 2]].Position);
+			XMStoreFloat3(&FaceNormals[iTri], XMVector3Cross(XMVectorSubtract(P1, P0), XMVectorSubtract(P2, P0)));
+		}
+	});
+
+	// Vertices split by UV seams share their position and get the same normal : each one is welded to the first vertex at its position
+	std::vector<uint32_t> ByPosition(VertexCount);
+	std::iota(ByPosition.begin(), ByPosition.end(), 0u);
+	std::sort(ByPosition.begin(), ByPosition.end(), [&Vertices](uint32_t A, uint32_t B)
+	{
+		const XMFLOAT3& PA = Vertices[A].Position;
+		const XMFLOAT3& PB = Vertices[B].Position;
+		return PA.x != PB.x ? PA.x < PB.x : PA.y != PB.y ? PA.y < PB.y : PA.z != PB.z ? PA.z < PB.z : A < B;
+	});
+
+	std::vector<uint32_t> Weld(VertexCount);
+	for (size_t iSorted = 0; iSorted < VertexCount; ++iSorted)
+	{
+		const uint32_t Vertex = ByPosition[iSorted];
+		const XMFLOAT3& Position = Vertices[Vertex].Position;
+		const XMFLOAT3* Previous = iSorted > 0 ? &Vertices[ByPosition[iSorted - 1]].Position : nullptr;
+		const bool bSameAsPrevious = Previous && Previous->x == Position.x && Previous->y == Position.y && Previous->z == Position.z;
+		Weld[Vertex] = bSameAsPrevious ? Weld[ByPosition[iSorted - 1]] : Vertex;
+	}
+
+	Adjacency WeldCorners;
+	WeldCorners.Build(VertexCount, TriangleCount * 3, [&](size_t Corner) { return Weld[Indices[Corner]]; });
+
+	std::vector<XMFLOAT3> WeldNormals(VertexCount);
+	ThreadPool::Get().ParallelFor(VertexCount, VertexGrain, [&](size_t Begin, size_t End)
+	{
+		for (size_t iVert = Begin; iVert < End; ++iVert)
+		{
+			XMVECTOR Sum = XMVectorZero();
+			for (uint32_t iItem = WeldCorners.Offsets[iVert]; iItem < WeldCorners.Offsets[iVert + 1]; ++iItem)
+			{
+				Sum = XMVectorAdd(Sum, XMLoadFloat3(&FaceNormals[WeldCorners.Items[iItem] / 3]));
+			}
+
+			// Vertices of degenerate triangles only point up
+			XMStoreFloat3(&WeldNormals[iVert], XMVectorGetX(XMVector3LengthSq(Sum)) > 0.0f ? XMVector3Normalize(Sum) : XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+		}
+	});
+
+	for (size_t iVert = 0; iVert < VertexCount; ++iVert)
+	{
+		Vertices[iVert].Normal = WeldNormals[Weld[iVert]];
+	}
+}
+
+size_t TangentSpace::GenerateTangents(std::vector<VertexType>& Vertices, std::vector<DWORD>& Indices)
+{
+	const size_t OriginalVertexCount = Vertices.size();
+	const size_t TriangleCount = Indices.size() / 3;
+	if (OriginalVertexCount == 0)
+	{
+		return 0;
+	}
+
+	// Tangent of every corner, already weighted, and the side of the binormal of every triangle : 0 when its UVs have no area
+	std::vector<XMFLOAT3> CornerTangents(TriangleCount * 3);
+	std::vector<int8_t> TriangleSides(TriangleCount);
+	ThreadPool::Get().ParallelFor(TriangleCount, TriangleGrain, [&](size_t Begin, size_t End)
+	{
+		for (size_t iTri = Begin; iTri < End; ++iTri)
+		{
+			const VertexType* Corners[3] = { &Vertices[Indices[iTri * 3]], &Vertices[Indices[iTri * 3 + 1]], &Vertices[Indices[iTri * 3 + 2]] };
+			const XMVECTOR Positions[3] = { XMLoadFloat3(&Corners[0]->Position), XMLoadFloat3(&Corners[1]->Position), XMLoadFloat3(&Corners[2]->Position) };
+
+			const XMFLOAT2& UV0 = Corners[0]->TextureCoordinate;
+			const XMFLOAT2 T1(Corners[1]->TextureCoordinate.x - UV0.x, Corners[1]->TextureCoordinate.y - UV0.y);
+			const XMFLOAT2 T2(Corners[2]->TextureCoordinate.x - UV0.x, Corners[2]->TextureCoordinate.y - UV0.y);
+			const float SignedArea = T1.x * T2.y - T1.y * T2.x;
+			TriangleSides[iTri] = SignedArea > 0.0f ? 1 : SignedArea < 0.0f ? -1 : 0;
+
+			// Direction of increasing u on the triangle, the area only scales it
+			const XMVECTOR D1 = XMVectorSubtract(Positions[1], Positions[0]);
+			const XMVECTOR D2 = XMVectorSubtract(Positions[2], Positions[0]);
+			const XMVECTOR FaceTangent = XMVectorScale(XMVectorSubtract(XMVectorScale(D1, T2.y), XMVectorScale(D2, T1.y)), SignedArea >= 0.0f ? 1.0f : -1.0f);
+
+			for (int iCorner = 0; iCorner < 3; ++iCorner)
+			{
+				XMVECTOR Weighted = XMVectorZero();
+				if (TriangleSides[iTri] != 0)
+				{
+					const XMVECTOR Normal = XMVector3Normalize(XMLoadFloat3(&Corners[iCorner]->Normal));
+					const XMVECTOR Projected = XMVectorSubtract(FaceTangent, XMVectorScale(Normal, XMVectorGetX(XMVector3Dot(Normal, FaceTangent))));
+					if (XMVectorGetX(XMVector3LengthSq(Projected)) > 0.0f)
+					{
+						const float Angle = GetCornerAngle(Normal, Positions[iCorner], Positions[(iCorner + 1) % 3], Positions[(iCorner + 2) % 3]);
+						Weighted = XMVectorScale(XMVector3Normalize(Projected), Angle);
+					}
+				}
+				XMStoreFloat3(&CornerTangents[iTri * 3 + iCorner], Weighted);
+			}
+		}
+	});
+
+	// A vertex used by triangles of both sides can't have one binormal : the corners of the negative side get a copy of it
+	std::vector<uint8_t> SidesSeen(OriginalVertexCount, 0);
+	for (size_t iCorner = 0; iCorner < TriangleCount * 3; ++iCorner)
+	{
+		const int8_t Side = TriangleSides[iCorner / 3];
+		SidesSeen[Indices[iCorner]] |= Side > 0 ? 1 : Side < 0 ? 2 : 0;
+	}
+
+	std::vector<uint32_t> Mirrors(OriginalVertexCount, ~0u);
+	for (size_t iVert = 0; iVert < OriginalVertexCount; ++iVert)
+	{
+		if (SidesSeen[iVert] == 3)
+		{
+			Mirrors[iVert] = static_cast<uint32_t>(Vertices.size());
+			Vertices.push_back(Vertices[iVert]);
+		}
+	}
+	for (size_t iCorner = 0; iCorner < TriangleCount * 3; ++iCorner)
+	{
+		if (TriangleSides[iCorner / 3] < 0 && Mirrors[Indices[iCorner]] != ~0u)
+		{
+			Indices[iCorner] = Mirrors[Indices[iCorner]];
+		}
+	}
+
+	const size_t VertexCount = Vertices.size();
+	Adjacency VertexCorners;
+	VertexCorners.Build(VertexCount, TriangleCount * 3, [&](size_t Corner) { return static_cast<uint32_t>(Indices[Corner]); });
+
+	ThreadPool::Get().ParallelFor(VertexCount, VertexGrain, [&](size_t Begin, size_t End)
+	{
+		for (size_t iVert = Begin; iVert < End; ++iVert)
+		{
+			XMVECTOR Sum = XMVectorZero();
+			float Side = 1.0f;
+			for (uint32_t iItem = VertexCorners.Offsets[iVert]; iItem < VertexCorners.Offsets[iVert + 1]; ++iItem)
+			{
+				const uint32_t Corner = VertexCorners.Items[iItem];
+				Sum = XMVectorAdd(Sum, XMLoadFloat3(&CornerTangents[Corner]));
+				Side = TriangleSides[Corner / 3] < 0 ? -1.0f : Side;
+			}
+
+			// The frame is made orthonormal, vertices without a UV direction get any tangent
+			VertexType& Vertex = Vertices[iVert];
+			const XMVECTOR Normal = XMVector3Normalize(XMLoadFloat3(&Vertex.Normal));
+			XMVECTOR Tangent = XMVectorSubtract(Sum, XMVectorScale(Normal, XMVectorGetX(XMVector3Dot(Normal, Sum))));
+			Tangent = XMVectorGetX(XMVector3LengthSq(Tangent)) > 1e-12f ? XMVector3Normalize(Tangent) : GetAnyTangent(Normal);
+
+			XMStoreFloat3(&Vertex.Tangent, Tangent);
+			XMStoreFloat3(&Vertex.Binormal, XMVectorScale(XMVector3Cross(Normal, Tangent), Side));
+		}
+	});
+
+	return VertexCount - OriginalVertexCount;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "Core/pch.h"
+#include <vector>
+
+struct VertexType;
+
+// Import time normals and tangent frames of indexed triangle lists, in place of Assimp's.
+// Both run on the thread pool and give the same result whatever the thread count.
+namespace TangentSpace
+{
+	// Area weighted normals, smoothed across the vertices sharing a position
+	void GenerateNormals(std::vector<VertexType>& Vertices, const std::vector<DWORD>& Indices);
+
+	// MikkTSpace style tangents : per corner tangents projected on the vertex normal, weighted by the corner angle,
+	// and a binormal side per triangle. Vertices shared by triangles of both sides are split, so the vertex count can grow.
+	// Returns the number of vertices added
+	size_t GenerateTangents(std::vector<VertexType>& Vertices, std::vector<DWORD>& Indices);
+
+	// Any unit vector orthogonal to Normal, for the vertices that have no UV direction
+	DirectX::XMVECTOR GetAnyTangent(DirectX::FXMVECTOR Normal);
+}
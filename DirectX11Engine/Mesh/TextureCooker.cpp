@@ -0,0 +1,419 @@
+#include "Core/pch.h"
+#include "TextureCooker.h"
+#include "BlockCompression.h"
+#include "TextureStreamer.h"
+#include "Core/Hash.h"
+#include "Core/MappedFile.h"
+#include "Core/ThreadPool.h"
+#include <chrono>
+#include <cmath>
+#include <fstream>
+
+namespace
+{
+	// Bump when the encoders or the mip generation change, so that stale cooked files are not loaded
+	const uint32_t CookerVersion = 1;
+
+	// DDS file layout
+	const uint32_t DDSMagic = 0x20534444; // "DDS "
+
+	struct DDSPixelFormat
+	{
+		uint32_t Size;
+		uint32_t Flags;
+		uint32_t FourCC;
+		uint32_t RGBBitCount;
+		uint32_t RBitMask;
+		uint32_t GBitMask;
+		uint32_t BBitMask;
+		uint32_t ABitMask;
+	};
+
+	struct DDSHeader
+	{
+		uint32_t Size;
+		uint32_t Flags;
+		uint32_t Height;
+		uint32_t Width;
+		uint32_t PitchOrLinearSize;
+		uint32_t Depth;
+		uint32_t MipMapCount;
+		uint32_t Reserved1[11];
+		DDSPixelFormat PixelFormat;
+		uint32_t Caps;
+		uint32_t Caps2;
+		uint32_t Caps3;
+		uint32_t Caps4;
+		uint32_t Reserved2;
+	};
+
+	struct DDSHeaderDX10
+	{
+		uint32_t DXGIFormat;
+		uint32_t ResourceDimension;
+		uint32_t MiscFlag;
+		uint32_t ArraySize;
+		uint32_t MiscFlags2;
+	};
+
+	static_assert(sizeof(DDSHeader) == 124 && sizeof(DDSPixelFormat) == 32, "DDS headers must match the file format");
+
+	const uint32_t DDSD_CAPS = 0x1;
+	const uint32_t DDSD_HEIGHT = 0x2;
+	const uint32_t DDSD_WIDTH = 0x4;
+	const uint32_t DDSD_PIXELFORMAT = 0x1000;
+	const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+	const uint32_t DDSD_LINEARSIZE = 0x80000;
+	const uint32_t DDPF_FOURCC = 0x4;
+	const uint32_t DDSCAPS_COMPLEX = 0x8;
+	const uint32_t DDSCAPS_TEXTURE = 0x1000;
+	const uint32_t DDSCAPS_MIPMAP = 0x400000;
+	const uint32_t DDS_DIMENSION_TEXTURE2D = 3;
+
+	constexpr uint32_t MakeFourCC(char A, char B, char C, char D)
+	{
+		return uint32_t(uint8_t(A)) | (uint32_t(uint8_t(B)) << 8) | (uint32_t(uint8_t(C)) << 16) | (uint32_t(uint8_t(D)) << 24);
+	}
+
+	// RGBA8 pixels of one mip
+	struct Image
+	{
+		UINT Width = 0;
+		UINT Height = 0;
+		std::vector<uint8_t> Pixels;
+	};
+
+	// Next mip with a 2x2 box filter, normal maps are renormalized
+	Image Downsample(const Image& Source, bool bNormalMap)
+	{
+		Image Result;
+		Result.Width = std::max<UINT>(1, Source.Width / 2);
+		Result.Height = std::max<UINT>(1, Source.Height / 2);
+		Result.Pixels.resize(size_t(Result.Width) * Result.Height * 4);
+
+		for (UINT y = 0; y < Result.Height; ++y)
+		{
+			const UINT SourceY[2] = { std::min(y * 2, Source.Height - 1), std::min(y * 2 + 1, Source.Height - 1) };
+			for (UINT x = 0; x < Result.Width; ++x)
+			{
+				const UINT SourceX[2] = { std::min(x * 2, Source.Width - 1), std::min(x * 2 + 1, Source.Width - 1) };
+
+				float Sum[4] = {};
+				for (int iSample = 0; iSample < 4; ++iSample)
+				{
+					const uint8_t* Pixel = &Source.Pixels[(size_t(SourceY[iSample / 2]) * Source.Width + SourceX[iSample % 2]) * 4];
+					for (int i = 0; i < 4; ++i)
+					{
+						Sum[i] += Pixel[i] * 0.25f;
+					}
+				}
+
+				if (bNormalMap)
+				{
+					float Normal[3] = { Sum[0] / 127.5f - 1.0f, Sum[1] / 127.5f - 1.0f, Sum[2] / 127.5f - 1.0f };
+					const float Length = std::sqrt(Normal[0] * Normal[0] + Normal[1] * Normal[1] + Normal[2] * Normal[2]);
+					for (int i = 0; i < 3; ++i)
+					{
+						Sum[i] = Length > 1e-4f ? (Normal[i] / Length + 1.0f) * 127.5f : Sum[i];
+					}
+				}
+
+				uint8_t* Destination = &Result.Pixels[(size_t(y) * Result.Width + x) * 4];
+				for (int i = 0; i < 4; ++i)
+				{
+					Destination[i] = static_cast<uint8_t>(std::min(255.0f, Sum[i] + 0.5f));
+				}
+			}
+		}
+		return Result;
+	}
+
+	size_t GetBlockBytes(TextureCooker::EBlockFormat Format)
+	{
+		return Format == TextureCooker::EBlockFormat::BC1 || Format == TextureCooker::EBlockFormat::BC4 ? 8 : 16;
+	}
+
+	// Channels kept by a format, as a mask of RGBA
+	int GetChannelMask(TextureCooker::EBlockFormat Format)
+	{
+		switch (Format)
+		{
+		case TextureCooker::EBlockFormat::BC1: return 0x7;
+		case TextureCooker::EBlockFormat::BC4: return 0x1;
+		case TextureCooker::EBlockFormat::BC5: return 0x3;
+		default: return 0xf;
+		}
+	}
+
+	DXGI_FORMAT GetDXGIFormat(TextureCooker::EBlockFormat Format)
+	{
+		switch (Format)
+		{
+		case TextureCooker::EBlockFormat::BC1: return DXGI_FORMAT_BC1_UNORM;
+		case TextureCooker::EBlockFormat::BC3: return DXGI_FORMAT_BC3_UNORM;
+		case TextureCooker::EBlockFormat::BC4: return DXGI_FORMAT_BC4_UNORM;
+		case TextureCooker::EBlockFormat::BC5: return DXGI_FORMAT_BC5_UNORM;
+		default: return DXGI_FORMAT_BC7_UNORM;
+		}
+	}
+
+	void EncodeBlock(TextureCooker::EBlockFormat Format, const uint8_t* Pixels, uint8_t* OutBlock)
+	{
+		switch (Format)
+		{
+		case TextureCooker::EBlockFormat::BC1: BlockCompression::EncodeBC1(Pixels, OutBlock); break;
+		case TextureCooker::EBlockFormat::BC3: BlockCompression::EncodeBC3(Pixels, OutBlock); break;
+		case TextureCooker::EBlockFormat::BC4: BlockCompression::EncodeBC4(Pixels, 0, OutBlock); break;
+		case TextureCooker::EBlockFormat::BC5: BlockCompression::EncodeBC5(Pixels, OutBlock); break;
+		case TextureCooker::EBlockFormat::BC7: BlockCompression::EncodeBC7(Pixels, OutBlock); break;
+		}
+	}
+
+	void DecodeBlock(TextureCooker::EBlockFormat Format, const uint8_t* Block, uint8_t* OutPixels)
+	{
+		switch (Format)
+		{
+		case TextureCooker::EBlockFormat::BC1: BlockCompression::DecodeBC1(Block, OutPixels); break;
+		case TextureCooker::EBlockFormat::BC3: BlockCompression::DecodeBC3(Block, OutPixels); break;
+		case TextureCooker::EBlockFormat::BC4: BlockCompression::DecodeBC4(Block, 0, OutPixels); break;
+		case TextureCooker::EBlockFormat::BC5: BlockCompression::DecodeBC5(Block, OutPixels); break;
+		case TextureCooker::EBlockFormat::BC7: BlockCompression::DecodeBC7(Block, OutPixels); break;
+		}
+	}
+
+	// The 4x4 pixels of a block, clamped to the image for the mips smaller than a block
+	void FetchBlock(const Image& Source, UINT BlockX, UINT BlockY, uint8_t* OutPixels)
+	{
+		for (UINT y = 0; y < 4; ++y)
+		{
+			const UINT SourceY = std::min(BlockY * 4 + y, Source.Height - 1);
+			for (UINT x = 0; x < 4; ++x)
+			{
+				const UINT SourceX = std::min(BlockX * 4 + x, Source.Width - 1);
+				memcpy(OutPixels + (y * 4 + x) * 4, &Source.Pixels[(size_t(SourceY) * Source.Width + SourceX) * 4], 4);
+			}
+		}
+	}
+
+	// Encode a whole mip, block rows are spread over the thread pool
+	std::vector<uint8_t> EncodeImage(const Image& Source, TextureCooker::EBlockFormat Format)
+	{
+		const UINT BlocksWide = (Source.Width + 3) / 4;
+		const UINT BlocksHigh = (Source.Height + 3) / 4;
+		const size_t BlockBytes = GetBlockBytes(Format);
+
+		std::vector<uint8_t> Blocks(size_t(BlocksWide) * BlocksHigh * BlockBytes);
+		ThreadPool::Get().ParallelFor(BlocksHigh, 4, [&](size_t Begin, size_t End)
+		{
+			uint8_t Pixels[64];
+			for (size_t BlockY = Begin; BlockY < End; ++BlockY)
+			{
+				for (UINT BlockX = 0; BlockX < BlocksWide; ++BlockX)
+				{
+					FetchBlock(Source, BlockX, UINT(BlockY), Pixels);
+					EncodeBlock(Format, Pixels, &Blocks[(BlockY * BlocksWide + BlockX) * BlockBytes]);
+				}
+			}
+		});
+		return Blocks;
+	}
+
+	// Peak signal to noise ratio of the encoded mip against its source
+	double ComputePSNR(const Image& Source, const std::vector<uint8_t>& Blocks, TextureCooker::EBlockFormat Format)
+	{
+		const UINT BlocksWide = (Source.Width + 3) / 4;
+		const UINT BlocksHigh = (Source.Height + 3) / 4;
+		const size_t BlockBytes = GetBlockBytes(Format);
+		const int ChannelMask = GetChannelMask(Format);
+
+		double SquaredError = 0.0;
+		size_t SampleCount = 0;
+		uint8_t Decoded[64];
+		for (UINT BlockY = 0; BlockY < BlocksHigh; ++BlockY)
+		{
+			for (UINT BlockX = 0; BlockX < BlocksWide; ++BlockX)
+			{
+				DecodeBlock(Format, &Blocks[(size_t(BlockY) * BlocksWide + BlockX) * BlockBytes], Decoded);
+
+				for (UINT y = 0; y < 4 && BlockY * 4 + y < Source.Height; ++y)
+				{
+					for (UINT x = 0; x < 4 && BlockX * 4 + x < Source.Width; ++x)
+					{
+						const uint8_t* Original = &Source.Pixels[(size_t(BlockY * 4 + y) * Source.Width + BlockX * 4 + x) * 4];
+						for (int i = 0; i < 4; ++i)
+						{
+							if (ChannelMask & (1 << i))
+							{
+								const double Delta = double(Original[i]) - Decoded[(y * 4 + x) * 4 + i];
+								SquaredError += Delta * Delta;
+								++SampleCount;
+							}
+						}
+					}
+				}
+			}
+		}
+
+		const double MeanSquaredError = SampleCount ? SquaredError / SampleCount : 0.0;
+		return MeanSquaredError > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / MeanSquaredError) : 99.0;
+	}
+
+	bool WriteDDS(const std::wstring& Path, TextureCooker::EBlockFormat Format, UINT Width, UINT Height, const std::vector<std::vector<uint8_t>>& Levels)
+	{
+		DDSHeader Header = {};
+		Header.Size = sizeof(DDSHeader);
+		Header.Flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+		Header.Height = Height;
+		Header.Width = Width;
+		Header.PitchOrLinearSize = static_cast<uint32_t>(Levels[0].size());
+		Header.MipMapCount = static_cast<uint32_t>(Levels.size());
+		Header.PixelFormat.Size = sizeof(DDSPixelFormat);
+		Header.PixelFormat.Flags = DDPF_FOURCC;
+		Header.Caps = DDSCAPS_TEXTURE | DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+
+		// BC7 has no legacy FourCC
+		switch (Format)
+		{
+		case TextureCooker::EBlockFormat::BC1: Header.PixelFormat.FourCC = MakeFourCC('D', 'X', 'T', '1'); break;
+		case TextureCooker::EBlockFormat::BC3: Header.PixelFormat.FourCC = MakeFourCC('D', 'X', 'T', '5'); break;
+		case TextureCooker::EBlockFormat::BC4: Header.PixelFormat.FourCC = MakeFourCC('A', 'T', 'I', '1'); break;
+		case TextureCooker::EBlockFormat::BC5: Header.PixelFormat.FourCC = MakeFourCC('A', 'T', 'I', '2'); break;
+		case TextureCooker::EBlockFormat::BC7: Header.PixelFormat.FourCC = MakeFourCC('D', 'X', '1', '0'); break;
+		}
+
+		// Write to a temporary file first so a crash never leaves a truncated texture behind
+		const std::wstring TempPath = Path + L".tmp";
+		{
+			std::ofstream Stream(TempPath, std::ios::binary | std::ios::trunc);
+			if (!Stream)
+			{
+				return false;
+			}
+
+			Stream.write(reinterpret_cast<const char*>(&DDSMagic), sizeof(DDSMagic));
+			Stream.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+			if (Format == TextureCooker::EBlockFormat::BC7)
+			{
+				DDSHeaderDX10 HeaderDX10 = {};
+				HeaderDX10.DXGIFormat = GetDXGIFormat(Format);
+				HeaderDX10.ResourceDimension = DDS_DIMENSION_TEXTURE2D;
+				HeaderDX10.ArraySize = 1;
+				Stream.write(reinterpret_cast<const char*>(&HeaderDX10), sizeof(HeaderDX10));
+			}
+
+			for (const std::vector<uint8_t>& Level : Levels)
+			{
+				Stream.write(reinterpret_cast<const char*>(Level.data()), Level.size());
+			}
+
+			if (!Stream)
+			{
+				return false;
+			}
+		}
+
+		return MoveFileExW(TempPath.c_str(), Path.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+	}
+}
+
+const char* TextureCooker::GetFormatName(EBlockFormat Format)
+{
+	switch (Format)
+	{
+	case EBlockFormat::BC1: return "BC1";
+	case EBlockFormat::BC3: return "BC3";
+	case EBlockFormat::BC4: return "BC4";
+	case EBlockFormat::BC5: return "BC5";
+	default: return "BC7";
+	}
+}
+
+std::wstring TextureCooker::GetCookedPath(uint64_t ContentHash, ETextureKind Kind)
+{
+	CreateDirectoryW(L"Cache", nullptr);
+	CreateDirectoryW(L"Cache/Textures", nullptr);
+
+	const uint64_t Key = Hash::Combine(Hash::Combine(ContentHash, uint64_t(Kind)), CookerVersion);
+
+	wchar_t FileName[64];
+	swprintf_s(FileName, L"Cache/Textures/%016llx.dds", static_cast<unsigned long long>(Key));
+
+	return FileName;
+}
+
+TextureCooker::Report TextureCooker::Cook(const std::wstring& SourcePath, ETextureKind Kind, const Settings& CookSettings)
+{
+	auto CookStart = std::chrono::steady_clock::now();
+
+	Report Result;
+	Result.SourcePath = SourcePath;
+	Result.Kind = Kind;
+
+	// Decode the source the same way the streamer does
+	uint64_t ContentHash = 0;
+	Image TopMip;
+	{
+		MappedFile Source;
+		if (!Source.Open(SourcePath))
+		{
+			return Result;
+		}
+
+		DecodedImage Decoded;
+		if (!TextureStreamer::DecodeImage(Source.GetData(), Source.GetSize(), Decoded))
+		{
+			return Result;
+		}
+
+		ContentHash = Hash::HashBytes(Source.GetData(), Source.GetSize());
+		TopMip.Width = Decoded.Width;
+		TopMip.Height = Decoded.Height;
+		TopMip.Pixels = std::move(Decoded.Pixels);
+	}
+
+	bool bHasAlpha = false;
+	for (size_t iPixel = 3; iPixel < TopMip.Pixels.size() && !bHasAlpha; iPixel += 4)
+	{
+		bHasAlpha = TopMip.Pixels[iPixel] != 255;
+	}
+
+	switch (Kind)
+	{
+	case ETextureKind::NormalMap:
+		Result.Format = EBlockFormat::BC5;
+		break;
+	case ETextureKind::SpecularMap:
+		Result.Format = EBlockFormat::BC4;
+		break;
+	default:
+		Result.Format = CookSettings.bAlbedoBC7 ? EBlockFormat::BC7 : (bHasAlpha ? EBlockFormat::BC3 : EBlockFormat::BC1);
+		break;
+	}
+
+	// Full mip chain down to 1x1
+	std::vector<Image> Mips;
+	Mips.push_back(std::move(TopMip));
+	while (Mips.back().Width > 1 || Mips.back().Height > 1)
+	{
+		Mips.push_back(Downsample(Mips.back(), Kind == ETextureKind::NormalMap));
+	}
+
+	std::vector<std::vector<uint8_t>> Levels(Mips.size());
+	for (size_t iMip = 0; iMip < Mips.size(); ++iMip)
+	{
+		Levels[iMip] = EncodeImage(Mips[iMip], Result.Format);
+		Result.UncompressedBytes += Mips[iMip].Pixels.size();
+		Result.CookedBytes += Levels[iMip].size();
+	}
+
+	Result.Width = Mips[0].Width;
+	Result.Height = Mips[0].Height;
+	Result.MipCount = static_cast<UINT>(Mips.size());
+	Result.PSNR = ComputePSNR(Mips[0], Levels[0], Result.Format);
+
+	Result.CookedPath = GetCookedPath(ContentHash, Kind);
+	Result.bSuccess = WriteDDS(Result.CookedPath, Result.Format, Result.Width, Result.Height, Levels);
+	Result.Milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - CookStart).count();
+
+	return Result;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include "Core/pch.h"
+#include "TextureRegistry.h"
+
+// Offline conversion of source images to block compressed DDS files with their full mip chain.
+// Cooked files live in Cache/Textures, keyed by the content of the source image and by its use,
+// and the TextureRegistry loads them instead of decoding the source when they exist.
+namespace TextureCooker
+{
+	enum class EBlockFormat
+	{
+		BC1,
+		BC3,
+		BC4,
+		BC5,
+		BC7
+	};
+
+	struct Settings
+	{
+		// Albedo maps go to BC7, or to BC1 (BC3 with alpha) when false
+		bool bAlbedoBC7 = true;
+	};
+
+	// Result of the cook of one texture
+	struct Report
+	{
+		std::wstring SourcePath;
+		std::wstring CookedPath;
+		ETextureKind Kind = ETextureKind::Albedo;
+		EBlockFormat Format = EBlockFormat::BC1;
+		UINT Width = 0;
+		UINT Height = 0;
+		UINT MipCount = 0;
+		// RGBA8 mip chain, as uploaded without cooking
+		size_t UncompressedBytes = 0;
+		size_t CookedBytes = 0;
+		// Of the top mip, over the channels stored by the format
+		double PSNR = 0.0;
+		double Milliseconds = 0.0;
+		bool bSuccess = false;
+	};
+
+	const char* GetFormatName(EBlockFormat Format);
+
+	// Where the cooked version of an image lives, the source content hash comes from Hash::HashBytes
+	std::wstring GetCookedPath(uint64_t ContentHash, ETextureKind Kind);
+
+	// Cook one image, its blocks are encoded on the thread pool
+	Report Cook(const std::wstring& SourcePath, ETextureKind Kind, const Settings& CookSettings);
+}
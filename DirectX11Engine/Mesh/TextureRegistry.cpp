@@ -0,0 +1,464 @@
+#include "Core/pch.h"
+#include "TextureRegistry.h"
+#include "TextureStreamer.h"
+#include "TextureCooker.h"
+#include "Core/Hash.h"
+#include "Core/MappedFile.h"
+#include "Core/StateCache.h"
+#include <cwctype>
+
+using namespace DirectX;
+using Microsoft::WRL::ComPtr;
+
+namespace
+{
+	// Size of a 4x4 block for block compressed formats, 0 otherwise
+	size_t GetBlockBytes(DXGI_FORMAT Format)
+	{
+		switch (Format)
+		{
+		case DXGI_FORMAT_BC1_UNORM:
+		case DXGI_FORMAT_BC1_UNORM_SRGB:
+		case DXGI_FORMAT_BC4_UNORM:
+		case DXGI_FORMAT_BC4_SNORM:
+			return 8;
+		case DXGI_FORMAT_BC2_UNORM:
+		case DXGI_FORMAT_BC2_UNORM_SRGB:
+		case DXGI_FORMAT_BC3_UNORM:
+		case DXGI_FORMAT_BC3_UNORM_SRGB:
+		case DXGI_FORMAT_BC5_UNORM:
+		case DXGI_FORMAT_BC5_SNORM:
+		case DXGI_FORMAT_BC6H_UF16:
+		case DXGI_FORMAT_BC6H_SF16:
+		case DXGI_FORMAT_BC7_UNORM:
+		case DXGI_FORMAT_BC7_UNORM_SRGB:
+			return 16;
+		default:
+			return 0;
+		}
+	}
+
+	// Bytes per pixel of the formats the WIC loader produces
+	size_t GetPixelBytes(DXGI_FORMAT Format)
+	{
+		switch (Format)
+		{
+		case DXGI_FORMAT_R32G32B32A32_FLOAT:
+			return 16;
+		case DXGI_FORMAT_R16G16B16A16_FLOAT:
+		case DXGI_FORMAT_R16G16B16A16_UNORM:
+			return 8;
+		case DXGI_FORMAT_R16_FLOAT:
+		case DXGI_FORMAT_R16_UNORM:
+		case DXGI_FORMAT_B5G5R5A1_UNORM:
+		case DXGI_FORMAT_B5G6R5_UNORM:
+			return 2;
+		case DXGI_FORMAT_R8_UNORM:
+		case DXGI_FORMAT_A8_UNORM:
+			return 1;
+		default:
+			return 4;
+		}
+	}
+}
+
+TextureRegistry::TextureRegistry(ComPtr<ID3D11Device1> Device, ComPtr<ID3D11DeviceContext1> DeviceContext, StateCache& States)
+	: Device(Device), DeviceContext(DeviceContext)
+{
+	D3D11_SAMPLER_DESC SamplerDesc;
+	ZeroMemory(&SamplerDesc, sizeof(SamplerDesc));
+	SamplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+	SamplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
+	SamplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
+	SamplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
+	SamplerDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+	SamplerDesc.MinLOD = 0;
+	SamplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
+
+	Sampler = States.GetSamplerState(SamplerDesc);
+
+	// 1x1 textures shown while streaming : grey albedo, flat normal and full specular
+	const uint32_t PlaceholderColors[size_t(ETextureKind::Count)] = { 0xff808080, 0xffff8080, 0xffffffff };
+	for (size_t iKind = 0; iKind < size_t(ETextureKind::Count); ++iKind)
+	{
+		CD3D11_TEXTURE2D_DESC PlaceholderDesc(DXGI_FORMAT_R8G8B8A8_UNORM, 1, 1, 1, 1, D3D11_BIND_SHADER_RESOURCE, D3D11_USAGE_IMMUTABLE);
+		D3D11_SUBRESOURCE_DATA PlaceholderData = { &PlaceholderColors[iKind], sizeof(uint32_t), 0 };
+
+		ComPtr<ID3D11Texture2D> PlaceholderTexture;
+		DX::ThrowIfFailed(Device->CreateTexture2D(&PlaceholderDesc, &PlaceholderData, PlaceholderTexture.GetAddressOf()));
+		DX::ThrowIfFailed(Device->CreateShaderResourceView(PlaceholderTexture.Get(), nullptr, Placeholders[iKind].GetAddressOf()));
+	}
+
+	Streamer = new TextureStreamer();
+	StatsResetTime = std::chrono::steady_clock::now();
+}
+
+TextureRegistry::~TextureRegistry()
+{
+	delete Streamer;
+}
+
+void TextureRegistry::ResetStats()
+{
+	Counters = Stats();
+	StatsResetTime = std::chrono::steady_clock::now();
+}
+
+size_t TextureRegistry::GetStreamingCount() const
+{
+	return Streamer->GetWaitingCount() + Streamer->GetInFlightCount() + Streamer->GetDecodedCount();
+}
+
+TextureHandle TextureRegistry::Load(const std::wstring& Path, ETextureKind Kind, EResourceLifetime Lifetime)
+{
+	if (Path.empty())
+	{
+		return TextureHandle();
+	}
+
+	const std::wstring CanonicalPath = CanonicalizePath(Path);
+	const std::wstring PathKey = MakePathKey(CanonicalPath, Kind);
+
+	// Same file
+	auto PathEntry = TexturesByPath.find(PathKey);
+	if (PathEntry != TexturesByPath.end())
+	{
+		if (Texture* Existing = Pool.Get(PathEntry->second))
+		{
+			++Counters.Hits;
+			if (Existing->bResident)
+			{
+				Counters.BytesSaved += Existing->GpuBytes;
+			}
+			else
+			{
+				++Existing->PendingShares;
+			}
+			Pool.ExtendLifetime(PathEntry->second, Lifetime);
+			return PathEntry->second;
+		}
+	}
+
+	if (FailedPaths.count(CanonicalPath))
+	{
+		++Counters.Failures;
+		return TextureHandle();
+	}
+
+	if (!bStreamTextures)
+	{
+		return LoadNow(CanonicalPath, Kind, Lifetime);
+	}
+
+	// Placeholder until the decoded image is uploaded by Update
+	Texture* NewTexture = new Texture();
+	NewTexture->View = Placeholders[size_t(Kind)];
+	NewTexture->Path = CanonicalPath;
+
+	++Counters.Misses;
+	const TextureHandle NewHandle = Pool.Add(NewTexture, Lifetime);
+	TexturesByPath[PathKey] = NewHandle;
+	Streamer->Request(CanonicalPath, Kind);
+
+	return NewHandle;
+}
+
+TextureHandle TextureRegistry::LoadNow(const std::wstring& CanonicalPath, ETextureKind Kind, EResourceLifetime Lifetime)
+{
+	const std::wstring PathKey = MakePathKey(CanonicalPath, Kind);
+
+	MappedFile File;
+	if (!File.Open(CanonicalPath))
+	{
+		FailedPaths.insert(CanonicalPath);
+		++Counters.Failures;
+		return TextureHandle();
+	}
+
+	// Same image under another name, the sizes must match too so that a hash collision doesn't share the wrong image
+	const uint64_t ContentHash = Hash::HashBytes(File.GetData(), File.GetSize());
+	const uint64_t ContentKey = MakeContentKey(ContentHash, Kind);
+	auto ContentEntry = TexturesByContent.find(ContentKey);
+	if (ContentEntry != TexturesByContent.end())
+	{
+		const Texture* Existing = Pool.Get(ContentEntry->second);
+		if (Existing && Existing->FileSize == File.GetSize())
+		{
+			++Counters.ContentHits;
+			Counters.BytesSaved += Existing->GpuBytes;
+			Pool.ExtendLifetime(ContentEntry->second, Lifetime);
+			TexturesByPath[PathKey] = ContentEntry->second;
+			return ContentEntry->second;
+		}
+	}
+
+	// Cooked version with its mips if there is one, otherwise decode and upload straight from the mapped file
+	Texture* NewTexture = new Texture();
+	HRESULT Hr = E_FAIL;
+	MappedFile CookedFile;
+	if (CookedFile.Open(TextureCooker::GetCookedPath(ContentHash, Kind)))
+	{
+		Hr = CreateDDSTextureFromMemory(Device.Get(), CookedFile.GetData(), CookedFile.GetSize(), nullptr, NewTexture->View.GetAddressOf());
+		Counters.CookedLoads += SUCCEEDED(Hr) ? 1 : 0;
+	}
+	if (FAILED(Hr))
+	{
+		Hr = CreateWICTextureFromMemory(Device.Get(), DeviceContext.Get(), File.GetData(), File.GetSize(), nullptr, NewTexture->View.GetAddressOf());
+	}
+	if (FAILED(Hr))
+	{
+		delete NewTexture;
+		FailedPaths.insert(CanonicalPath);
+		++Counters.Failures;
+		return TextureHandle();
+	}
+
+	NewTexture->Path = CanonicalPath;
+	NewTexture->ContentHash = ContentHash;
+	NewTexture->FileSize = File.GetSize();
+	NewTexture->GpuBytes = ComputeGpuBytes(NewTexture->View.Get());
+	NewTexture->bResident = true;
+
+	++Counters.Misses;
+	Counters.BytesUploaded += NewTexture->GpuBytes;
+
+	const TextureHandle NewHandle = Pool.Add(NewTexture, Lifetime, NewTexture->GpuBytes);
+	TexturesByPath[PathKey] = NewHandle;
+	TexturesByContent[ContentKey] = NewHandle;
+
+	return NewHandle;
+}
+
+void TextureRegistry::Update()
+{
+	auto UploadStart = std::chrono::steady_clock::now();
+
+	// At least one image per frame is uploaded, even if it is bigger than the budget
+	size_t UploadedBytes = 0;
+	DecodedImage Image;
+	while (UploadedBytes < UploadBudgetBytes && Streamer->PopDecoded(Image))
+	{
+		UploadedBytes += Image.GetUploadBytes();
+		FinishStreaming(Image);
+	}
+
+	// Refill the decoded queue
+	Streamer->Dispatch();
+
+	if (UploadedBytes > 0)
+	{
+		auto UploadEnd = std::chrono::steady_clock::now();
+		Counters.LastFrameUploadBytes = UploadedBytes;
+		Counters.LastFrameUploadMs = std::chrono::duration<double, std::milli>(UploadEnd - UploadStart).count();
+		Counters.MaxFrameUploadMs = std::max(Counters.MaxFrameUploadMs, Counters.LastFrameUploadMs);
+		Counters.StreamingDoneMs = std::chrono::duration<double, std::milli>(UploadEnd - StatsResetTime).count();
+	}
+}
+
+void TextureRegistry::FinishStreaming(DecodedImage& Image)
+{
+	// Dropped if the texture was released meanwhile
+	auto PathEntry = TexturesByPath.find(MakePathKey(Image.Path, Image.Kind));
+	Texture* Target = PathEntry != TexturesByPath.end() ? Pool.Get(PathEntry->second) : nullptr;
+	if (!Target)
+	{
+		return;
+	}
+
+	if (!Image.bDecoded)
+	{
+		// The meshes already using it keep the placeholder
+		Target->bFailed = true;
+		TexturesByPath.erase(PathEntry);
+		FailedPaths.insert(Image.Path);
+		++Counters.Failures;
+		return;
+	}
+
+	Target->ContentHash = Image.ContentHash;
+	Target->FileSize = Image.FileSize;
+	const uint64_t ContentKey = MakeContentKey(Image.ContentHash, Image.Kind);
+
+	// Same image already uploaded under another name
+	auto ContentEntry = TexturesByContent.find(ContentKey);
+	if (ContentEntry != TexturesByContent.end())
+	{
+		const Texture* Existing = Pool.Get(ContentEntry->second);
+		if (Existing && Existing->bResident && Existing->FileSize == Image.FileSize)
+		{
+			// The view is shared, its memory is counted once with the texture that uploaded it
+			Target->View = Existing->View;
+			Target->GpuBytes = Existing->GpuBytes;
+			Target->bResident = true;
+			Target->bShared = true;
+
+			++Counters.ContentHits;
+			Counters.BytesSaved += Target->GpuBytes * (1 + Target->PendingShares);
+			return;
+		}
+	}
+
+	ComPtr<ID3D11ShaderResourceView> NewView;
+	if (Image.bCooked)
+	{
+		// Mips come with the file
+		if (FAILED(CreateDDSTextureFromMemory(Device.Get(), Image.CookedData.data(), Image.CookedData.size(), nullptr, NewView.GetAddressOf())))
+		{
+			Target->bFailed = true;
+			TexturesByPath.erase(PathEntry);
+			FailedPaths.insert(Image.Path);
+			++Counters.Failures;
+			return;
+		}
+		++Counters.CookedLoads;
+	}
+	else
+	{
+		NewView = UploadDecoded(Image);
+		if (!NewView)
+		{
+			Target->bFailed = true;
+			TexturesByPath.erase(PathEntry);
+			FailedPaths.insert(Image.Path);
+			++Counters.Failures;
+			return;
+		}
+	}
+
+	Target->View = NewView;
+	Target->GpuBytes = ComputeGpuBytes(NewView.Get());
+	Target->bResident = true;
+	Pool.SetBytes(PathEntry->second, Target->GpuBytes);
+
+	Counters.BytesUploaded += Target->GpuBytes;
+	Counters.BytesSaved += Target->GpuBytes * Target->PendingShares;
+	TexturesByContent[ContentKey] = PathEntry->second;
+}
+
+ComPtr<ID3D11ShaderResourceView> TextureRegistry::UploadDecoded(const DecodedImage& Image)
+{
+	// Full mip chain, generated on the GPU
+	CD3D11_TEXTURE2D_DESC TextureDesc(DXGI_FORMAT_R8G8B8A8_UNORM, Image.Width, Image.Height, 1, 0,
+		D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET, D3D11_USAGE_DEFAULT, 0, 1, 0, D3D11_RESOURCE_MISC_GENERATE_MIPS);
+
+	ComPtr<ID3D11Texture2D> NewTexture;
+	ComPtr<ID3D11ShaderResourceView> NewView;
+	if (FAILED(Device->CreateTexture2D(&TextureDesc, nullptr, NewTexture.GetAddressOf()))
+		|| FAILED(Device->CreateShaderResourceView(NewTexture.Get(), nullptr, NewView.GetAddressOf())))
+	{
+		return nullptr;
+	}
+
+	DeviceContext->UpdateSubresource(NewTexture.Get(), 0, nullptr, Image.Pixels.data(), Image.Width * 4, 0);
+	DeviceContext->GenerateMips(NewView.Get());
+	return NewView;
+}
+
+void TextureRegistry::Invalidate()
+{
+	TexturesByPath.clear();
+	TexturesByContent.clear();
+	FailedPaths.clear();
+}
+
+size_t TextureRegistry::ReleaseLifetime(EResourceLifetime Lifetime)
+{
+	const size_t Released = Pool.ReleaseLifetime(Lifetime);
+
+	// Forget the released textures, their images are loaded again when asked for
+	for (auto Entry = TexturesByPath.begin(); Entry != TexturesByPath.end();)
+	{
+		Entry = Pool.Get(Entry->second) ? std::next(Entry) : TexturesByPath.erase(Entry);
+	}
+	for (auto Entry = TexturesByContent.begin(); Entry != TexturesByContent.end();)
+	{
+		Entry = Pool.Get(Entry->second) ? std::next(Entry) : TexturesByContent.erase(Entry);
+	}
+
+	// A new scene retries the paths that failed, their files may have been fixed since
+	if (Lifetime == EResourceLifetime::Scene)
+	{
+		FailedPaths.clear();
+	}
+	return Released;
+}
+
+TextureRegistry::Residency TextureRegistry::GetResidency() const
+{
+	// Every texture of the pool, the ones the maps forgot after a failure or an Invalidate too
+	Residency Counts;
+	Pool.ForEach([&Counts](TextureHandle, const Texture& Current)
+	{
+		if (Current.bFailed)
+		{
+			++Counts.Failed;
+		}
+		else if (!Current.bResident)
+		{
+			++Counts.Pending;
+		}
+		else
+		{
+			++(Current.bShared ? Counts.Shared : Counts.Resident);
+		}
+	});
+	return Counts;
+}
+
+size_t TextureRegistry::GetResidentBytes() const
+{
+	return Pool.GetStats().ResidentBytes;
+}
+
+std::wstring TextureRegistry::CanonicalizePath(const std::wstring& Path)
+{
+	wchar_t FullPath[MAX_PATH];
+	const DWORD Length = GetFullPathNameW(Path.c_str(), MAX_PATH, FullPath, nullptr);
+	std::wstring Canonical = (Length > 0 && Length < MAX_PATH) ? std::wstring(FullPath, Length) : Path;
+
+	// Paths are case insensitive on Windows and models mix both separators
+	for (wchar_t& Character : Canonical)
+	{
+		Character = Character == L'/' ? L'\\' : static_cast<wchar_t>(towlower(Character));
+	}
+	return Canonical;
+}
+
+std::wstring TextureRegistry::MakePathKey(const std::wstring& CanonicalPath, ETextureKind Kind)
+{
+	// '|' can't appear in a path
+	return CanonicalPath + L'|' + static_cast<wchar_t>(L'0' + int(Kind));
+}
+
+uint64_t TextureRegistry::MakeContentKey(uint64_t ContentHash, ETextureKind Kind)
+{
+	return Hash::Combine(ContentHash, uint64_t(Kind));
+}
+
+size_t TextureRegistry::ComputeGpuBytes(ID3D11ShaderResourceView* View)
+{
+	ComPtr<ID3D11Resource> Resource;
+	View->GetResource(Resource.GetAddressOf());
+
+	ComPtr<ID3D11Texture2D> Texture2D;
+	if (FAILED(Resource.As(&Texture2D)))
+	{
+		return 0;
+	}
+
+	D3D11_TEXTURE2D_DESC Desc;
+	Texture2D->GetDesc(&Desc);
+
+	const size_t BlockBytes = GetBlockBytes(Desc.Format);
+	const size_t PixelBytes = GetPixelBytes(Desc.Format);
+
+	size_t Bytes = 0;
+	for (UINT iMip = 0; iMip < Desc.MipLevels; ++iMip)
+	{
+		const size_t Width = std::max<UINT>(1, Desc.Width >> iMip);
+		const size_t Height = std::max<UINT>(1, Desc.Height >> iMip);
+
+		Bytes += BlockBytes ? ((Width + 3) / 4) * ((Height + 3) / 4) * BlockBytes : Width * Height * PixelBytes;
+	}
+	return Bytes * Desc.ArraySize;
+}
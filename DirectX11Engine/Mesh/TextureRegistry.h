@@ -0,0 +1,154 @@
+#pragma once
+#include <unordered_map>
+#include <unordered_set>
+#include <chrono>
+#include "Core/pch.h"
+#include "Core/ResourcePool.h"
+
+class TextureStreamer;
+class StateCache;
+struct DecodedImage;
+
+// What a texture is used for, picks the placeholder shown while it streams in
+enum class ETextureKind
+{
+	Albedo,
+	NormalMap,
+	SpecularMap,
+	Count
+};
+
+// A decoded image living on the GPU, shared by every material using it
+struct Texture
+{
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> View;
+	std::wstring Path;
+	uint64_t ContentHash = 0;
+	// Size of the image file, checked with the hash before sharing the texture
+	size_t FileSize = 0;
+	// Size of the texture and its mips in video memory
+	size_t GpuBytes = 0;
+	// False while View is still the placeholder
+	bool bResident = false;
+	// The image didn't decode or upload, View stays the placeholder until the texture is released
+	bool bFailed = false;
+	// View is the one of another texture with the same image, its memory is counted there
+	bool bShared = false;
+	// Requests served before the texture was resident, accounted for once its size is known
+	unsigned int PendingShares = 0;
+};
+
+// Hands out shared textures so that each image is decoded and uploaded once.
+// Textures are found by canonical path first, then by the hash of the file content so that
+// copies of the same image under different names are shared too.
+// Both are keyed by use as well, since the cooked version of an image depends on it.
+// Images cooked by the TextureCooker are loaded from their DDS file instead of being decoded.
+// The registry owns the textures and hands out handles to them, they are released with their lifetime.
+// When streaming, Load returns right away with a placeholder view. The images are decoded on the thread pool
+// and Update uploads them on the render thread, within a per-frame byte budget.
+class TextureRegistry
+{
+public:
+
+	struct Stats
+	{
+		// Requests served by an already loaded texture, by path or by content
+		unsigned int Hits = 0;
+		unsigned int ContentHits = 0;
+		// Requests that decoded and uploaded an image, and those of them served by a cooked DDS file
+		unsigned int Misses = 0;
+		unsigned int CookedLoads = 0;
+		unsigned int Failures = 0;
+		// Video memory that would have been used without sharing
+		size_t BytesSaved = 0;
+		size_t BytesUploaded = 0;
+
+		// Streaming uploads of the last frame and worst frame since the reset
+		size_t LastFrameUploadBytes = 0;
+		double LastFrameUploadMs = 0.0;
+		double MaxFrameUploadMs = 0.0;
+		// Time between the reset and the last streamed upload
+		double StreamingDoneMs = 0.0;
+	};
+
+	TextureRegistry(Microsoft::WRL::ComPtr<ID3D11Device1> Device, Microsoft::WRL::ComPtr<ID3D11DeviceContext1> DeviceContext, StateCache& States);
+	~TextureRegistry();
+
+	TextureRegistry(const TextureRegistry&) = delete;
+	TextureRegistry& operator=(const TextureRegistry&) = delete;
+
+	// Get the texture of an image file, returns an invalid handle if it is known not to load.
+	// A texture already loaded for the scene and asked for by the engine becomes an engine texture
+	TextureHandle Load(const std::wstring& Path, ETextureKind Kind = ETextureKind::Albedo, EResourceLifetime Lifetime = EResourceLifetime::Scene);
+
+	// The texture, or nullptr once it was released
+	const Texture* Get(TextureHandle Handle) const { return Pool.Get(Handle); }
+
+	// Release every texture of a lifetime in one pass, returns how many were released.
+	// Releasing the scene textures also forgets the failures, so the next scene tries those paths again
+	size_t ReleaseLifetime(EResourceLifetime Lifetime);
+
+	// Upload the images decoded since the last frame, once per frame from the render thread
+	void Update();
+
+	// Linear wrap sampler shared by every mesh
+	ID3D11SamplerState* GetSampler() const { return Sampler; }
+
+	const Stats& GetStats() const { return Counters; }
+	void ResetStats();
+
+	// Textures waiting for a decode, being decoded and waiting for their upload
+	size_t GetStreamingCount() const;
+
+	// Live textures by state : resident with an image of their own, sharing the image of another one,
+	// still showing their placeholder while streaming, or failed and keeping it
+	struct Residency
+	{
+		size_t Resident = 0;
+		size_t Shared = 0;
+		size_t Pending = 0;
+		size_t Failed = 0;
+	};
+	Residency GetResidency() const;
+
+	// Video memory of the live textures, the ones sharing the image of another one don't count
+	size_t GetResidentBytes() const;
+	ResourceStats GetResourceStats() const { return Pool.GetStats(); }
+
+	// Forget the known textures and failures so that the next loads pick up newly cooked files.
+	// Textures in use stay alive until their lifetime ends.
+	void Invalidate();
+
+	// Decode on worker threads and show placeholders meanwhile, otherwise Load blocks until the texture is uploaded
+	bool bStreamTextures = true;
+	size_t UploadBudgetBytes = 8 * 1024 * 1024;
+
+private:
+
+	TextureHandle LoadNow(const std::wstring& CanonicalPath, ETextureKind Kind, EResourceLifetime Lifetime);
+	void FinishStreaming(DecodedImage& Image);
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> UploadDecoded(const DecodedImage& Image);
+
+	static std::wstring CanonicalizePath(const std::wstring& Path);
+	static std::wstring MakePathKey(const std::wstring& CanonicalPath, ETextureKind Kind);
+	static uint64_t MakeContentKey(uint64_t ContentHash, ETextureKind Kind);
+	static size_t ComputeGpuBytes(ID3D11ShaderResourceView* View);
+
+	Microsoft::WRL::ComPtr<ID3D11Device1> Device;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext1> DeviceContext;
+	// Owned by the StateCache
+	ID3D11SamplerState* Sampler = nullptr;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> Placeholders[size_t(ETextureKind::Count)];
+
+	TextureStreamer* Streamer = nullptr;
+
+	ResourcePool<Texture> Pool{ "Textures" };
+	// Entries of released textures are erased by ReleaseLifetime
+	std::unordered_map<std::wstring, TextureHandle> TexturesByPath;
+	std::unordered_map<uint64_t, TextureHandle> TexturesByContent;
+	// Paths that failed to load, not retried for every mesh until the scene is released or the registry invalidated
+	std::unordered_set<std::wstring> FailedPaths;
+
+	Stats Counters;
+	std::chrono::steady_clock::time_point StatsResetTime;
+};
@@ -0,0 +1,176 @@
+#include "Core/pch.h"
+#include "TextureStreamer.h"
+#include "TextureCooker.h"
+#include "Core/Hash.h"
+#include "Core/MappedFile.h"
+#include "Core/ThreadPool.h"
+#include <wincodec.h>
+
+using Microsoft::WRL::ComPtr;
+
+namespace
+{
+	IWICImagingFactory* GetWICFactory()
+	{
+		static ComPtr<IWICImagingFactory> Factory;
+		static std::once_flag FactoryFlag;
+		std::call_once(FactoryFlag, []()
+		{
+			CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(Factory.GetAddressOf()));
+		});
+		return Factory.Get();
+	}
+
+	// WIC is used from the worker threads, which need to join the multithreaded apartment once
+	void EnsureComInitialized()
+	{
+		thread_local bool bComInitialized = false;
+		if (!bComInitialized)
+		{
+			CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+			bComInitialized = true;
+		}
+	}
+}
+
+TextureStreamer::TextureStreamer(size_t MaxQueuedImages)
+	: State(std::make_shared<SharedState>()), MaxQueuedImages(std::max<size_t>(1, MaxQueuedImages))
+{
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	Waiting.clear();
+
+	std::unique_lock<std::mutex> Lock(State->Mutex);
+	State->Idle.wait(Lock, [this]() { return State->InFlight == 0; });
+}
+
+void TextureStreamer::Request(const std::wstring& Path, ETextureKind Kind)
+{
+	Waiting.push_back({ Path, Kind });
+	Dispatch();
+}
+
+void TextureStreamer::Dispatch()
+{
+	std::lock_guard<std::mutex> Lock(State->Mutex);
+	while (!Waiting.empty() && State->InFlight + State->Decoded.size() < MaxQueuedImages)
+	{
+		++State->InFlight;
+
+		std::shared_ptr<SharedState> JobState = State;
+		ThreadPool::Get().Enqueue([JobState, Request = std::move(Waiting.front())]()
+		{
+			DecodedImage Image;
+			DecodeFile(Request, Image);
+
+			std::lock_guard<std::mutex> JobLock(JobState->Mutex);
+			JobState->Decoded.push_back(std::move(Image));
+			--JobState->InFlight;
+			JobState->Idle.notify_all();
+		});
+		Waiting.pop_front();
+	}
+}
+
+bool TextureStreamer::PopDecoded(DecodedImage& OutImage)
+{
+	std::lock_guard<std::mutex> Lock(State->Mutex);
+	if (State->Decoded.empty())
+	{
+		return false;
+	}
+
+	OutImage = std::move(State->Decoded.front());
+	State->Decoded.pop_front();
+	return true;
+}
+
+size_t TextureStreamer::GetInFlightCount() const
+{
+	std::lock_guard<std::mutex> Lock(State->Mutex);
+	return State->InFlight;
+}
+
+size_t TextureStreamer::GetDecodedCount() const
+{
+	std::lock_guard<std::mutex> Lock(State->Mutex);
+	return State->Decoded.size();
+}
+
+void TextureStreamer::DecodeFile(const WaitingRequest& Request, DecodedImage& OutImage)
+{
+	OutImage.Path = Request.Path;
+	OutImage.Kind = Request.Kind;
+
+	MappedFile File;
+	if (!File.Open(Request.Path))
+	{
+		return;
+	}
+
+	OutImage.ContentHash = Hash::HashBytes(File.GetData(), File.GetSize());
+	OutImage.FileSize = File.GetSize();
+
+	// The cooked version is uploaded as is
+	MappedFile CookedFile;
+	if (CookedFile.Open(TextureCooker::GetCookedPath(OutImage.ContentHash, Request.Kind)))
+	{
+		OutImage.CookedData.assign(CookedFile.GetData(), CookedFile.GetData() + CookedFile.GetSize());
+		OutImage.bCooked = true;
+		OutImage.bDecoded = true;
+		return;
+	}
+
+	DecodeImage(File.GetData(), File.GetSize(), OutImage);
+}
+
+bool TextureStreamer::DecodeImage(const uint8_t* Data, size_t Size, DecodedImage& OutImage)
+{
+	EnsureComInitialized();
+
+	IWICImagingFactory* Factory = GetWICFactory();
+	if (!Factory)
+	{
+		return false;
+	}
+
+	ComPtr<IWICStream> Stream;
+	ComPtr<IWICBitmapDecoder> Decoder;
+	ComPtr<IWICBitmapFrameDecode> Frame;
+	ComPtr<IWICFormatConverter> Converter;
+
+	if (FAILED(Factory->CreateStream(Stream.GetAddressOf()))
+		|| FAILED(Stream->InitializeFromMemory(const_cast<BYTE*>(Data), static_cast<DWORD>(Size)))
+		|| FAILED(Factory->CreateDecoderFromStream(Stream.Get(), nullptr, WICDecodeMetadataCacheOnDemand, Decoder.GetAddressOf()))
+		|| FAILED(Decoder->GetFrame(0, Frame.GetAddressOf()))
+		|| FAILED(Frame->GetSize(&OutImage.Width, &OutImage.Height)))
+	{
+		return false;
+	}
+
+	if (OutImage.Width == 0 || OutImage.Height == 0
+		|| OutImage.Width > D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION || OutImage.Height > D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION)
+	{
+		return false;
+	}
+
+	// Every image is converted to RGBA8, like the WIC texture loader does for the common formats
+	if (FAILED(Factory->CreateFormatConverter(Converter.GetAddressOf()))
+		|| FAILED(Converter->Initialize(Frame.Get(), GUID_WICPixelFormat32bppRGBA, WICBitmapDitherTypeNone, nullptr, 0.0, WICBitmapPaletteTypeMedianCut)))
+	{
+		return false;
+	}
+
+	const UINT RowPitch = OutImage.Width * 4;
+	OutImage.Pixels.resize(size_t(RowPitch) * OutImage.Height);
+	if (FAILED(Converter->CopyPixels(nullptr, RowPitch, static_cast<UINT>(OutImage.Pixels.size()), OutImage.Pixels.data())))
+	{
+		OutImage.Pixels.clear();
+		return false;
+	}
+
+	OutImage.bDecoded = true;
+	return true;
+}
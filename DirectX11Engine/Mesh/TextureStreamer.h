@@ -0,0 +1,79 @@
+#pragma once
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include "Core/pch.h"
+#include "TextureRegistry.h"
+
+// An image decoded to RGBA8 on a worker thread, or its cooked DDS file, waiting for its upload
+struct DecodedImage
+{
+	std::wstring Path;
+	ETextureKind Kind = ETextureKind::Albedo;
+	uint64_t ContentHash = 0;
+	size_t FileSize = 0;
+	UINT Width = 0;
+	UINT Height = 0;
+	std::vector<uint8_t> Pixels;
+	// Whole DDS file when a cooked version of the image exists, Pixels is empty then
+	std::vector<uint8_t> CookedData;
+	bool bCooked = false;
+	bool bDecoded = false;
+
+	size_t GetUploadBytes() const { return bCooked ? CookedData.size() : Pixels.size(); }
+};
+
+// Decodes image files on the thread pool.
+// Requests wait in a FIFO and are only dispatched while the decoded queue has room,
+// so that the memory held by images waiting for their upload stays bounded.
+class TextureStreamer
+{
+public:
+
+	explicit TextureStreamer(size_t MaxQueuedImages = 8);
+	// Waits for the decodes in flight
+	~TextureStreamer();
+
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	// Queue the decode of a file, from the render thread
+	void Request(const std::wstring& Path, ETextureKind Kind);
+
+	// Start decodes while there is room in the decoded queue
+	void Dispatch();
+
+	// Take the oldest decoded image, returns false if none is ready
+	bool PopDecoded(DecodedImage& OutImage);
+
+	size_t GetWaitingCount() const { return Waiting.size(); }
+	size_t GetInFlightCount() const;
+	size_t GetDecodedCount() const;
+
+	// Decode an image file from memory, usable from any thread
+	static bool DecodeImage(const uint8_t* Data, size_t Size, DecodedImage& OutImage);
+
+private:
+
+	// Shared with the decode jobs, which may outlive the streamer
+	struct SharedState
+	{
+		mutable std::mutex Mutex;
+		std::condition_variable Idle;
+		std::deque<DecodedImage> Decoded;
+		size_t InFlight = 0;
+	};
+
+	struct WaitingRequest
+	{
+		std::wstring Path;
+		ETextureKind Kind;
+	};
+
+	static void DecodeFile(const WaitingRequest& Request, DecodedImage& OutImage);
+
+	std::shared_ptr<SharedState> State;
+	std::deque<WaitingRequest> Waiting;
+	size_t MaxQueuedImages;
+};
@@ -0,0 +1,155 @@
+#include "Core/pch.h"
+#include "VertexPacking.h"
+#include "Mesh.h"
+#include "TangentSpace.h"
+
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+
+const D3D11_INPUT_ELEMENT_DESC PackedVertex::InputElements[PackedVertex::InputElementCount] =
+{
+	{ "POSITION",	0, DXGI_FORMAT_R16G16B16A16_UNORM,	0, 0,	D3D11_INPUT_PER_VERTEX_DATA, 0 },
+	{ "QTANGENT",	0, DXGI_FORMAT_R16G16B16A16_SNORM,	0, 8,	D3D11_INPUT_PER_VERTEX_DATA, 0 },
+	{ "TEXCOORD",	0, DXGI_FORMAT_R16G16_FLOAT,		0, 16,	D3D11_INPUT_PER_VERTEX_DATA, 0 },
+};
+
+namespace
+{
+	// Decoded vertex, as the vertex shader sees it before the world transform
+	struct UnpackedVertex
+	{
+		XMVECTOR Position;
+		XMVECTOR Normal;
+		XMVECTOR Tangent;
+		XMVECTOR Binormal;
+		XMVECTOR TextureCoordinate;
+	};
+
+	UnpackedVertex Unpack(const PackedVertex& Packed, const VertexPacking::Quantization& Quantize)
+	{
+		UnpackedVertex Vertex;
+		Vertex.Position = XMVectorMultiplyAdd(XMLoadUShortN4(&Packed.Position), XMLoadFloat4(&Quantize.Scale), XMLoadFloat4(&Quantize.Offset));
+
+		// The rows of the rotation are the frame, a quaternion and its opposite give the same rotation
+		const XMVECTOR QTangent = XMLoadShortN4(&Packed.QTangent);
+		const XMMATRIX Frame = XMMatrixRotationQuaternion(XMQuaternionNormalize(QTangent));
+		Vertex.Tangent = Frame.r[0];
+		Vertex.Normal = Frame.r[2];
+		Vertex.Binormal = XMVectorScale(Frame.r[1], XMVectorGetW(QTangent) < 0.0f ? -1.0f : 1.0f);
+
+		Vertex.TextureCoordinate = XMLoadHalf2(&Packed.TextureCoordinate);
+		return Vertex;
+	}
+
+	// Smallest |w| of a stored QTangent, a 16 bits w of 0 would have no sign
+	const float QTangentBias = 1.0f / 32767.0f;
+
+	XMSHORTN4 PackQTangent(const VertexType& Vertex)
+	{
+		// Orthonormal frame, the binormal only gives its side
+		XMVECTOR Normal = XMLoadFloat3(&Vertex.Normal);
+		Normal = XMVectorGetX(XMVector3LengthSq(Normal)) > 1e-12f ? XMVector3Normalize(Normal) : XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+		XMVECTOR Tangent = XMVectorSubtract(XMLoadFloat3(&Vertex.Tangent), XMVectorScale(Normal, XMVectorGetX(XMVector3Dot(Normal, XMLoadFloat3(&Vertex.Tangent)))));
+		Tangent = XMVectorGetX(XMVector3LengthSq(Tangent)) > 1e-12f ? XMVector3Normalize(Tangent) : TangentSpace::GetAnyTangent(Normal);
+		const XMVECTOR Binormal = XMVector3Cross(Normal, Tangent);
+		const bool bFlipped = XMVectorGetX(XMVector3Dot(Binormal, XMLoadFloat3(&Vertex.Binormal))) < 0.0f;
+
+		XMMATRIX Frame = XMMatrixIdentity();
+		Frame.r[0] = Tangent;
+		Frame.r[1] = Binormal;
+		Frame.r[2] = Normal;
+		XMVECTOR QTangent = XMQuaternionNormalize(XMQuaternionRotationMatrix(Frame));
+
+		// Positive w, at least the bias, then its sign is the side of the binormal
+		QTangent = XMVectorGetW(QTangent) < 0.0f ? XMVectorNegate(QTangent) : QTangent;
+		if (XMVectorGetW(QTangent) < QTangentBias)
+		{
+			QTangent = XMVectorSetW(XMVectorScale(QTangent, sqrtf(1.0f - QTangentBias * QTangentBias)), QTangentBias);
+		}
+		QTangent = bFlipped ? XMVectorNegate(QTangent) : QTangent;
+
+		XMSHORTN4 Packed;
+		XMStoreShortN4(&Packed, QTangent);
+		return Packed;
+	}
+
+	// Angle between a source direction and its decoded version, 0 for the degenerate source vectors that have no direction
+	float AngleDegrees(FXMVECTOR Source, FXMVECTOR Decoded)
+	{
+		if (XMVectorGetX(XMVector3LengthSq(Source)) < 1e-12f)
+		{
+			return 0.0f;
+		}
+		const float Cosine = XMVectorGetX(XMVector3Dot(XMVector3Normalize(Source), XMVector3Normalize(Decoded)));
+		return XMConvertToDegrees(acosf(std::min(std::max(Cosine, -1.0f), 1.0f)));
+	}
+}
+
+XMMATRIX VertexPacking::Quantization::GetMatrix() const
+{
+	return XMMatrixScaling(Scale.x, Scale.y, Scale.z) * XMMatrixTranslation(Offset.x, Offset.y, Offset.z);
+}
+
+void VertexPacking::ErrorStats::Add(const ErrorStats& Other)
+{
+	Vertices += Other.Vertices;
+	MaxPosition = std::max(MaxPosition, Other.MaxPosition);
+	MaxNormalDegrees = std::max(MaxNormalDegrees, Other.MaxNormalDegrees);
+	MaxTangentDegrees = std::max(MaxTangentDegrees, Other.MaxTangentDegrees);
+	MaxBinormalDegrees = std::max(MaxBinormalDegrees, Other.MaxBinormalDegrees);
+	MaxTextureCoordinate = std::max(MaxTextureCoordinate, Other.MaxTextureCoordinate);
+}
+
+VertexPacking::Quantization VertexPacking::ComputeQuantization(const BoundingBox& Bounds)
+{
+	// A flat axis keeps a scale of 1, every vertex is quantized to 0 on it
+	auto AxisScale = [](float Extent) { return Extent > 0.0f ? 2.0f * Extent : 1.0f; };
+
+	Quantization Quantize;
+	Quantize.Scale = XMFLOAT4(AxisScale(Bounds.Extents.x), AxisScale(Bounds.Extents.y), AxisScale(Bounds.Extents.z), 0.0f);
+	Quantize.Offset = XMFLOAT4(Bounds.Center.x - Bounds.Extents.x, Bounds.Center.y - Bounds.Extents.y, Bounds.Center.z - Bounds.Extents.z, 0.0f);
+	return Quantize;
+}
+
+void VertexPacking::Pack(const VertexType* Vertices, size_t VertexCount, const Quantization& Quantize, PackedVertex* OutVertices)
+{
+	const XMVECTOR Offset = XMLoadFloat4(&Quantize.Offset);
+	const XMVECTOR InvScale = XMVectorReciprocal(XMVectorSetW(XMLoadFloat4(&Quantize.Scale), 1.0f));
+
+	for (size_t iVert = 0; iVert < VertexCount; ++iVert)
+	{
+		const VertexType& Source = Vertices[iVert];
+		PackedVertex& Packed = OutVertices[iVert];
+
+		const XMVECTOR Position = XMVectorSaturate(XMVectorMultiply(XMVectorSubtract(XMLoadFloat3(&Source.Position), Offset), InvScale));
+		XMStoreUShortN4(&Packed.Position, XMVectorSetW(Position, 1.0f));
+
+		Packed.QTangent = PackQTangent(Source);
+
+		XMStoreHalf2(&Packed.TextureCoordinate, XMLoadFloat2(&Source.TextureCoordinate));
+	}
+}
+
+VertexPacking::ErrorStats VertexPacking::MeasureError(const VertexType* Vertices, const PackedVertex* Packed, size_t VertexCount, const Quantization& Quantize)
+{
+	ErrorStats Error;
+	Error.Vertices = VertexCount;
+
+	const float Diagonal = XMVectorGetX(XMVector3Length(XMLoadFloat4(&Quantize.Scale)));
+	for (size_t iVert = 0; iVert < VertexCount; ++iVert)
+	{
+		const VertexType& Source = Vertices[iVert];
+		const UnpackedVertex Decoded = Unpack(Packed[iVert], Quantize);
+
+		const float PositionError = XMVectorGetX(XMVector3Length(XMVectorSubtract(Decoded.Position, XMLoadFloat3(&Source.Position))));
+		Error.MaxPosition = std::max(Error.MaxPosition, PositionError / Diagonal);
+
+		Error.MaxNormalDegrees = std::max(Error.MaxNormalDegrees, AngleDegrees(XMLoadFloat3(&Source.Normal), Decoded.Normal));
+		Error.MaxTangentDegrees = std::max(Error.MaxTangentDegrees, AngleDegrees(XMLoadFloat3(&Source.Tangent), Decoded.Tangent));
+		Error.MaxBinormalDegrees = std::max(Error.MaxBinormalDegrees, AngleDegrees(XMLoadFloat3(&Source.Binormal), Decoded.Binormal));
+
+		const XMVECTOR TextureError = XMVectorAbs(XMVectorSubtract(Decoded.TextureCoordinate, XMLoadFloat2(&Source.TextureCoordinate)));
+		Error.MaxTextureCoordinate = std::max({ Error.MaxTextureCoordinate, XMVectorGetX(TextureError), XMVectorGetY(TextureError) });
+	}
+	return Error;
+}
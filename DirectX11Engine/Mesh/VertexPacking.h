@@ -0,0 +1,56 @@
+#pragma once
+#include "Core/pch.h"
+#include <DirectXPackedVector.h>
+#include <DirectXCollision.h>
+
+struct VertexType;
+
+// Vertex layout of the geometry arena, 20 bytes against the 56 of VertexType.
+// The position is quantized to 16 bits inside the bounds of its mesh and the tangent frame is one quaternion (QTangent),
+// unpacked to the normal, tangent and binormal in the vertex shader.
+struct PackedVertex
+{
+	// Position in the mesh bounds, w is 1
+	DirectX::PackedVector::XMUSHORTN4 Position;
+	// Rotation from (X, Y, Z) to (Tangent, cross(Normal, Tangent), Normal), with w kept away from 0.
+	// A negative w means the binormal is -cross(Normal, Tangent)
+	DirectX::PackedVector::XMSHORTN4 QTangent;
+	DirectX::PackedVector::XMHALF2 TextureCoordinate;
+
+	static const int InputElementCount = 3;
+	static const D3D11_INPUT_ELEMENT_DESC InputElements[InputElementCount];
+};
+static_assert(sizeof(PackedVertex) == 20, "PackedVertex is read by SimpleVertexShader.hlsl");
+
+namespace VertexPacking
+{
+	// Local position = quantized position * Scale + Offset, laid out like the vertex shader constants
+	struct Quantization
+	{
+		DirectX::XMFLOAT4 Scale = DirectX::XMFLOAT4(1.0f, 1.0f, 1.0f, 0.0f);
+		DirectX::XMFLOAT4 Offset = DirectX::XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+
+		// The same transform as a matrix, for the shaders that take the position through a world matrix
+		DirectX::XMMATRIX GetMatrix() const;
+	};
+
+	// Largest differences between the source vertices and their packed version, decoded the way the vertex shader does
+	struct ErrorStats
+	{
+		size_t Vertices = 0;
+		// Position error in fractions of the bounds diagonal
+		float MaxPosition = 0.0f;
+		float MaxNormalDegrees = 0.0f;
+		float MaxTangentDegrees = 0.0f;
+		float MaxBinormalDegrees = 0.0f;
+		float MaxTextureCoordinate = 0.0f;
+
+		void Add(const ErrorStats& Other);
+	};
+
+	Quantization ComputeQuantization(const DirectX::BoundingBox& Bounds);
+
+	void Pack(const VertexType* Vertices, size_t VertexCount, const Quantization& Quantize, PackedVertex* OutVertices);
+
+	ErrorStats MeasureError(const VertexType* Vertices, const PackedVertex* Packed, size_t VertexCount, const Quantization& Quantize);
+}
@@ -0,0 +1,846 @@
+#include "Core/pch.h"
+#include "ObjLoader.h"
+#include "Core/MappedFile.h"
+#include "Core/ThreadPool.h"
+#include <charconv>
+#include <chrono>
+#include <cstring>
+
+using namespace DirectX;
+
+namespace
+{
+	// Files smaller than this are parsed in a single chunk
+	const size_t MinChunkSize = 1 << 20;
+
+	// A range of characters of the mapped file, tokens are never copied
+	struct TextView
+	{
+		const char* Begin = nullptr;
+		const char* End = nullptr;
+
+		bool IsEmpty() const { return Begin == End; }
+		bool operator==(const char* Other) const
+		{
+			const size_t Length = strlen(Other);
+			return size_t(End - Begin) == Length && memcmp(Begin, Other, Length) == 0;
+		}
+		std::string ToString() const { return std::string(Begin, End); }
+	};
+
+	bool IsBlank(char C)
+	{
+		return C == ' ' || C == '\t';
+	}
+
+	// Next blank separated token from Cursor, returns false once the view is exhausted
+	bool NextToken(TextView& Cursor, TextView& OutToken)
+	{
+		while (Cursor.Begin < Cursor.End && IsBlank(*Cursor.Begin))
+		{
+			++Cursor.Begin;
+		}
+		if (Cursor.Begin == Cursor.End)
+		{
+			return false;
+		}
+
+		OutToken.Begin = Cursor.Begin;
+		while (Cursor.Begin < Cursor.End && !IsBlank(*Cursor.Begin))
+		{
+			++Cursor.Begin;
+		}
+		OutToken.End = Cursor.Begin;
+		return true;
+	}
+
+	TextView FirstToken(TextView Line)
+	{
+		TextView Token;
+		NextToken(Line, Token);
+		return Token;
+	}
+
+	// Everything after the first token, without the surrounding blanks
+	TextView Tail(TextView Line)
+	{
+		TextView Token;
+		if (!NextToken(Line, Token))
+		{
+			return TextView();
+		}
+		while (Line.Begin < Line.End && IsBlank(*Line.Begin))
+		{
+			++Line.Begin;
+		}
+		while (Line.End > Line.Begin && IsBlank(*(Line.End - 1)))
+		{
+			--Line.End;
+		}
+		return Line;
+	}
+
+	bool ParseFloat(TextView Token, float& Out)
+	{
+		if (Token.Begin < Token.End && *Token.Begin == '+')
+		{
+			++Token.Begin;
+		}
+		return std::from_chars(Token.Begin, Token.End, Out).ec == std::errc();
+	}
+
+	bool ParseInt(TextView Token, int& Out)
+	{
+		if (Token.Begin < Token.End && *Token.Begin == '+')
+		{
+			++Token.Begin;
+		}
+		return std::from_chars(Token.Begin, Token.End, Out).ec == std::errc();
+	}
+
+	// Parse up to Count floats from the tail of a line, missing values are left untouched
+	int ParseFloats(TextView Line, float* Out, int Count)
+	{
+		TextView Cursor = Tail(Line);
+		TextView Token;
+		int Parsed = 0;
+		while (Parsed < Count && NextToken(Cursor, Token))
+		{
+			ParseFloat(Token, Out[Parsed++]);
+		}
+		return Parsed;
+	}
+
+	// Calls Function(Line) for every line of [Begin, End), without the line break
+	template <class FunctionType>
+	size_t ForEachLine(const char* Begin, const char* End, FunctionType Function)
+	{
+		size_t LineCount = 0;
+		const char* Cursor = Begin;
+		while (Cursor < End)
+		{
+			const char* LineEnd = static_cast<const char*>(memchr(Cursor, '\n', End - Cursor));
+			if (!LineEnd)
+			{
+				LineEnd = End;
+			}
+
+			TextView Line{ Cursor, LineEnd };
+			if (Line.End > Line.Begin && *(Line.End - 1) == '\r')
+			{
+				--Line.End;
+			}
+
+			Function(Line);
+			++LineCount;
+
+			Cursor = LineEnd < End ? LineEnd + 1 : End;
+		}
+		return LineCount;
+	}
+
+	enum ECornerFlags : uint8_t
+	{
+		CornerHasTexCoord = 1 << 0,
+		CornerHasNormal = 1 << 1,
+		// Negative OBJ indices are stored relative to the start of the chunk and fixed up when merging
+		PositionRelative = 1 << 2,
+		TexCoordRelative = 1 << 3,
+		NormalRelative = 1 << 4
+	};
+
+	// One v/vt/vn reference of a face, with 0 based indices
+	struct FaceCorner
+	{
+		int32_t Position = 0;
+		int32_t TexCoord = 0;
+		int32_t Normal = 0;
+		uint8_t Flags = 0;
+	};
+
+	enum class EStatement : uint8_t
+	{
+		Group,
+		Face,
+		UseMaterial,
+		MaterialLibrary
+	};
+
+	// The lines that drive the mesh generation, in file order
+	struct Statement
+	{
+		EStatement Type;
+		// Group : the line is an "o" or "g" statement, otherwise it only starts with a g
+		bool bNamed = false;
+		// Name of the group, material or library
+		TextView Text;
+		// Face corners
+		uint32_t FirstCorner = 0;
+		uint32_t CornerCount = 0;
+	};
+
+	// Output of the parallel pass for one chunk of the file
+	struct ParsedChunk
+	{
+		const char* Begin = nullptr;
+		const char* End = nullptr;
+
+		std::vector<XMFLOAT3> Positions;
+		std::vector<XMFLOAT2> TexCoords;
+		std::vector<XMFLOAT3> Normals;
+		std::vector<FaceCorner> Corners;
+		std::vector<Statement> Statements;
+		size_t Lines = 0;
+	};
+
+	// Resolve an OBJ index against the number of elements read so far in the chunk
+	int32_t ResolveIndex(int Index, size_t LocalCount, uint8_t RelativeFlag, uint8_t& Flags)
+	{
+		if (Index < 0)
+		{
+			Flags |= RelativeFlag;
+			return static_cast<int32_t>(LocalCount) + Index;
+		}
+		return Index - 1;
+	}
+
+	void ParseFace(TextView Line, ParsedChunk& Chunk)
+	{
+		Statement Face;
+		Face.Type = EStatement::Face;
+		Face.FirstCorner = static_cast<uint32_t>(Chunk.Corners.size());
+
+		TextView Cursor = Tail(Line);
+		TextView Token;
+		while (NextToken(Cursor, Token))
+		{
+			// Split v/vt/vn
+			TextView Parts[3];
+			int PartCount = 0;
+			const char* PartBegin = Token.Begin;
+			for (const char* C = Token.Begin; C <= Token.End && PartCount < 3; ++C)
+			{
+				if (C == Token.End || *C == '/')
+				{
+					Parts[PartCount++] = TextView{ PartBegin, C };
+					PartBegin = C + 1;
+				}
+			}
+
+			FaceCorner Corner;
+			int Index = 0;
+			ParseInt(Parts[0], Index);
+			Corner.Position = ResolveIndex(Index, Chunk.Positions.size(), PositionRelative, Corner.Flags);
+
+			if (PartCount >= 2 && !Parts[1].IsEmpty() && ParseInt(Parts[1], Index))
+			{
+				Corner.TexCoord = ResolveIndex(Index, Chunk.TexCoords.size(), TexCoordRelative, Corner.Flags);
+				Corner.Flags |= CornerHasTexCoord;
+			}
+			if (PartCount == 3 && ParseInt(Parts[2], Index))
+			{
+				Corner.Normal = ResolveIndex(Index, Chunk.Normals.size(), NormalRelative, Corner.Flags);
+				Corner.Flags |= CornerHasNormal;
+			}
+
+			Chunk.Corners.push_back(Corner);
+		}
+
+		Face.CornerCount = static_cast<uint32_t>(Chunk.Corners.size()) - Face.FirstCorner;
+		Chunk.Statements.push_back(Face);
+	}
+
+	void ParseChunk(ParsedChunk& Chunk)
+	{
+		Chunk.Lines = ForEachLine(Chunk.Begin, Chunk.End, [&Chunk](TextView Line)
+		{
+			const TextView Token = FirstToken(Line);
+
+			if (Token == "v")
+			{
+				XMFLOAT3 Position(0.0f, 0.0f, 0.0f);
+				ParseFloats(Line, &Position.x, 3);
+				Chunk.Positions.push_back(Position);
+			}
+			else if (Token == "vt")
+			{
+				XMFLOAT2 TexCoord(0.0f, 0.0f);
+				ParseFloats(Line, &TexCoord.x, 2);
+				Chunk.TexCoords.push_back(TexCoord);
+			}
+			else if (Token == "vn")
+			{
+				XMFLOAT3 Normal(0.0f, 0.0f, 0.0f);
+				ParseFloats(Line, &Normal.x, 3);
+				Chunk.Normals.push_back(Normal);
+			}
+			else if (Token == "f")
+			{
+				ParseFace(Line, Chunk);
+			}
+			else if (Token == "o" || Token == "g" || (!Line.IsEmpty() && *Line.Begin == 'g'))
+			{
+				Statement Group;
+				Group.Type = EStatement::Group;
+				Group.bNamed = Token == "o" || Token == "g";
+				Group.Text = Tail(Line);
+				Chunk.Statements.push_back(Group);
+			}
+			else if (Token == "usemtl")
+			{
+				Statement UseMaterial;
+				UseMaterial.Type = EStatement::UseMaterial;
+				UseMaterial.Text = Tail(Line);
+				Chunk.Statements.push_back(UseMaterial);
+			}
+			else if (Token == "mtllib")
+			{
+				Statement Library;
+				Library.Type = EStatement::MaterialLibrary;
+				Library.Text = Tail(Line);
+				Chunk.Statements.push_back(Library);
+			}
+		});
+	}
+
+	// Split the file in chunks that start at the beginning of a line
+	std::vector<ParsedChunk> SplitInChunks(const char* Begin, const char* End)
+	{
+		const size_t Size = End - Begin;
+		const size_t MaxChunks = std::max<size_t>(1, (ThreadPool::Get().GetThreadCount() + 1) * 4);
+		const size_t ChunkCount = std::min(MaxChunks, std::max<size_t>(1, Size / MinChunkSize));
+
+		std::vector<ParsedChunk> Chunks(ChunkCount);
+		const char* ChunkBegin = Begin;
+		for (size_t iChunk = 0; iChunk < ChunkCount; ++iChunk)
+		{
+			const char* ChunkEnd = End;
+			if (iChunk + 1 < ChunkCount)
+			{
+				ChunkEnd = std::max(ChunkBegin, Begin + Size * (iChunk + 1) / ChunkCount);
+				const char* LineBreak = static_cast<const char*>(memchr(ChunkEnd, '\n', End - ChunkEnd));
+				ChunkEnd = LineBreak ? LineBreak + 1 : End;
+			}
+
+			Chunks[iChunk].Begin = ChunkBegin;
+			Chunks[iChunk].End = ChunkEnd;
+			ChunkBegin = ChunkEnd;
+		}
+
+		return Chunks;
+	}
+
+	bool operator==(const XMFLOAT3& A, const XMFLOAT3& B)
+	{
+		return A.x == B.x && A.y == B.y && A.z == B.z;
+	}
+
+	bool operator!=(const XMFLOAT3& A, const XMFLOAT3& B)
+	{
+		return !(A == B);
+	}
+
+	XMFLOAT3 Subtract(const XMFLOAT3& A, const XMFLOAT3& B)
+	{
+		return XMFLOAT3(A.x - B.x, A.y - B.y, A.z - B.z);
+	}
+
+	XMFLOAT3 Cross(const XMFLOAT3& A, const XMFLOAT3& B)
+	{
+		return XMFLOAT3(A.y * B.z - A.z * B.y, A.z * B.x - A.x * B.z, A.x * B.y - A.y * B.x);
+	}
+
+	float Dot(const XMFLOAT3& A, const XMFLOAT3& B)
+	{
+		return A.x * B.x + A.y * B.y + A.z * B.z;
+	}
+
+	// Is P1 on the same side as P2 of the segment AB
+	bool SameSide(const XMFLOAT3& P1, const XMFLOAT3& P2, const XMFLOAT3& A, const XMFLOAT3& B)
+	{
+		const XMFLOAT3 Edge = Subtract(B, A);
+		return Dot(Cross(Edge, Subtract(P1, A)), Cross(Edge, Subtract(P2, A))) >= 0.0f;
+	}
+
+	// Same test as the previous loader, which projects the point itself (not its offset to the triangle) on the normal
+	bool InTriangle(const XMFLOAT3& Point, const XMFLOAT3& Tri1, const XMFLOAT3& Tri2, const XMFLOAT3& Tri3)
+	{
+		if (!SameSide(Point, Tri1, Tri2, Tri3) || !SameSide(Point, Tri2, Tri1, Tri3) || !SameSide(Point, Tri3, Tri1, Tri2))
+		{
+			return false;
+		}
+
+		const XMFLOAT3 Normal = Cross(Subtract(Tri2, Tri1), Subtract(Tri3, Tri1));
+		const float NormalLength = sqrtf(Dot(Normal, Normal));
+		const XMFLOAT3 UnitNormal(Normal.x / NormalLength, Normal.y / NormalLength, Normal.z / NormalLength);
+		const float Distance = Dot(Point, UnitNormal);
+		const XMFLOAT3 Projection(UnitNormal.x * Distance, UnitNormal.y * Distance, UnitNormal.z * Distance);
+
+		return sqrtf(Dot(Projection, Projection)) == 0.0f;
+	}
+
+	// Triangulate a face into indices local to the face.
+	// Polygons go through the same ear clipping as the previous loader, which matches corners by position.
+	void TriangulateFace(const VertexPositionNormalTexture* Vertices, int VertexCount, std::vector<unsigned int>& OutIndices, std::vector<XMFLOAT3>& Remaining)
+	{
+		if (VertexCount < 3)
+		{
+			return;
+		}
+		if (VertexCount == 3)
+		{
+			OutIndices.push_back(0);
+			OutIndices.push_back(1);
+			OutIndices.push_back(2);
+			return;
+		}
+
+		// Push the face corners matching any of the three positions, in corner order
+		auto PushMatching = [&](int CornerCount, const XMFLOAT3& A, const XMFLOAT3& B, const XMFLOAT3& C)
+		{
+			for (int j = 0; j < CornerCount; ++j)
+			{
+				if (Vertices[j].position == A)
+					OutIndices.push_back(j);
+				if (Vertices[j].position == B)
+					OutIndices.push_back(j);
+				if (Vertices[j].position == C)
+					OutIndices.push_back(j);
+			}
+		};
+
+		const size_t FirstIndex = OutIndices.size();
+		Remaining.clear();
+		for (int i = 0; i < VertexCount; ++i)
+		{
+			Remaining.push_back(Vertices[i].position);
+		}
+
+		while (true)
+		{
+			const size_t RemainingBefore = Remaining.size();
+
+			for (int i = 0; i < int(Remaining.size()); ++i)
+			{
+				const XMFLOAT3 Prev = Remaining[i == 0 ? Remaining.size() - 1 : i - 1];
+				const XMFLOAT3 Cur = Remaining[i];
+				const XMFLOAT3 Next = Remaining[i == int(Remaining.size()) - 1 ? 0 : i + 1];
+
+				// Last triangle
+				if (Remaining.size() == 3)
+				{
+					PushMatching(3, Cur, Prev, Next);
+					Remaining.clear();
+					break;
+				}
+
+				// Last two triangles
+				if (Remaining.size() == 4)
+				{
+					PushMatching(VertexCount, Cur, Prev, Next);
+
+					XMFLOAT3 Other(0.0f, 0.0f, 0.0f);
+					for (const XMFLOAT3& Position : Remaining)
+					{
+						if (Position != Cur && Position != Prev && Position != Next)
+						{
+							Other = Position;
+							break;
+						}
+					}
+
+					PushMatching(VertexCount, Prev, Next, Other);
+					Remaining.clear();
+					break;
+				}
+
+				// Skip the ears containing another corner
+				bool bInTriangle = false;
+				for (int j = 0; j < VertexCount; ++j)
+				{
+					const XMFLOAT3& Position = Vertices[j].position;
+					if (InTriangle(Position, Prev, Cur, Next) && Position != Prev && Position != Cur && Position != Next)
+					{
+						bInTriangle = true;
+						break;
+					}
+				}
+				if (bInTriangle)
+				{
+					continue;
+				}
+
+				PushMatching(VertexCount, Cur, Prev, Next);
+
+				for (size_t j = 0; j < Remaining.size(); ++j)
+				{
+					if (Remaining[j] == Cur)
+					{
+						Remaining.erase(Remaining.begin() + j);
+						break;
+					}
+				}
+
+				// Start over from the first remaining corner
+				i = -1;
+			}
+
+			// Stop when done, when nothing could be clipped or when a pass made no progress
+			if (OutIndices.size() == FirstIndex || Remaining.empty() || Remaining.size() == RemainingBefore)
+			{
+				break;
+			}
+		}
+	}
+
+	// Directory of a path, with its trailing separator
+	std::wstring GetDirectory(const std::wstring& Path)
+	{
+		const size_t Separator = Path.find_last_of(L"/\\");
+		return Separator == std::wstring::npos ? std::wstring() : Path.substr(0, Separator + 1);
+	}
+
+	bool EndsWith(const std::wstring& String, const wchar_t* Suffix)
+	{
+		const size_t Length = wcslen(Suffix);
+		return String.size() >= Length && String.compare(String.size() - Length, Length, Suffix) == 0;
+	}
+}
+
+MaterialData objl::Material::ToMaterialData() const
+{
+	MaterialData Data;
+	Data.AmbientColor = Ka;
+	Data.DiffuseColor = Kd;
+	Data.SpecularColor = Ks;
+	Data.SpecExp = Ns <= 0.0f ? 64.0f : Ns;
+	return Data;
+}
+
+bool objl::Loader::LoadFile(const std::string& Path)
+{
+	return LoadFile(DX::StringToWString(Path));
+}
+
+bool objl::Loader::LoadFile(const std::wstring& Path)
+{
+	if (!EndsWith(Path, L".obj"))
+	{
+		return false;
+	}
+
+	auto LoadStart = std::chrono::steady_clock::now();
+
+	MappedFile File;
+	if (!File.Open(Path))
+	{
+		return false;
+	}
+
+	LoadedMeshes.clear();
+	LoadedVertices.clear();
+	LoadedIndices.clear();
+	LoadedMaterials.clear();
+	Stats = LoadStats();
+
+	// Parse every chunk in parallel
+	const char* FileBegin = reinterpret_cast<const char*>(File.GetData());
+	std::vector<ParsedChunk> Chunks = SplitInChunks(FileBegin, FileBegin + File.GetSize());
+
+	ThreadPool::Get().ParallelFor(Chunks.size(), 1, [&Chunks](size_t Begin, size_t End)
+	{
+		for (size_t iChunk = Begin; iChunk < End; ++iChunk)
+		{
+			ParseChunk(Chunks[iChunk]);
+		}
+	});
+
+	auto ParseEnd = std::chrono::steady_clock::now();
+
+	// Merge the vertex attributes, remembering where each chunk starts
+	struct ChunkOffsets
+	{
+		size_t Position;
+		size_t TexCoord;
+		size_t Normal;
+	};
+	std::vector<ChunkOffsets> Offsets(Chunks.size());
+
+	std::vector<XMFLOAT3> Positions;
+	std::vector<XMFLOAT2> TexCoords;
+	std::vector<XMFLOAT3> Normals;
+	{
+		size_t PositionCount = 0, TexCoordCount = 0, NormalCount = 0;
+		for (size_t iChunk = 0; iChunk < Chunks.size(); ++iChunk)
+		{
+			Offsets[iChunk] = { PositionCount, TexCoordCount, NormalCount };
+			PositionCount += Chunks[iChunk].Positions.size();
+			TexCoordCount += Chunks[iChunk].TexCoords.size();
+			NormalCount += Chunks[iChunk].Normals.size();
+			Stats.Lines += Chunks[iChunk].Lines;
+		}
+
+		Positions.reserve(PositionCount);
+		TexCoords.reserve(TexCoordCount);
+		Normals.reserve(NormalCount);
+		for (ParsedChunk& Chunk : Chunks)
+		{
+			Positions.insert(Positions.end(), Chunk.Positions.begin(), Chunk.Positions.end());
+			TexCoords.insert(TexCoords.end(), Chunk.TexCoords.begin(), Chunk.TexCoords.end());
+			Normals.insert(Normals.end(), Chunk.Normals.begin(), Chunk.Normals.end());
+			std::vector<XMFLOAT3>().swap(Chunk.Positions);
+			std::vector<XMFLOAT2>().swap(Chunk.TexCoords);
+			std::vector<XMFLOAT3>().swap(Chunk.Normals);
+		}
+	}
+
+	auto FetchPosition = [&Positions](int64_t Index) { return Index >= 0 && Index < int64_t(Positions.size()) ? Positions[Index] : XMFLOAT3(0.0f, 0.0f, 0.0f); };
+	auto FetchTexCoord = [&TexCoords](int64_t Index) { return Index >= 0 && Index < int64_t(TexCoords.size()) ? TexCoords[Index] : XMFLOAT2(0.0f, 0.0f); };
+	auto FetchNormal = [&Normals](int64_t Index) { return Index >= 0 && Index < int64_t(Normals.size()) ? Normals[Index] : XMFLOAT3(0.0f, 0.0f, 0.0f); };
+
+	// Build the meshes, walking the statements in file order
+	std::vector<VertexPositionNormalTexture> Vertices;
+	std::vector<DWORD> Indices;
+	std::vector<std::string> MeshMaterialNames;
+	std::vector<VertexPositionNormalTexture> FaceVertices;
+	std::vector<unsigned int> FaceIndices;
+	std::vector<XMFLOAT3> TriangulationScratch;
+
+	bool bListening = false;
+	std::string MeshName;
+
+	auto PushMesh = [&](const std::string& Name)
+	{
+		Mesh NewMesh;
+		NewMesh.MeshName = Name;
+		NewMesh.Vertices = Vertices;
+		NewMesh.Indices = Indices;
+		LoadedMeshes.push_back(std::move(NewMesh));
+
+		Vertices.clear();
+		Indices.clear();
+	};
+
+	for (size_t iChunk = 0; iChunk < Chunks.size(); ++iChunk)
+	{
+		const ParsedChunk& Chunk = Chunks[iChunk];
+		const ChunkOffsets& Offset = Offsets[iChunk];
+
+		for (const Statement& CurrentStatement : Chunk.Statements)
+		{
+			switch (CurrentStatement.Type)
+			{
+			case EStatement::Group:
+			{
+				const std::string Name = CurrentStatement.bNamed ? CurrentStatement.Text.ToString() : "unnamed";
+				if (!bListening)
+				{
+					bListening = true;
+					MeshName = Name;
+				}
+				else if (!Indices.empty() && !Vertices.empty())
+				{
+					PushMesh(MeshName);
+					MeshName = CurrentStatement.Text.ToString();
+				}
+				else
+				{
+					MeshName = Name;
+				}
+				break;
+			}
+			case EStatement::Face:
+			{
+				FaceVertices.clear();
+				bool bNoNormal = false;
+
+				for (uint32_t iCorner = 0; iCorner < CurrentStatement.CornerCount; ++iCorner)
+				{
+					const FaceCorner& Corner = Chunk.Corners[CurrentStatement.FirstCorner + iCorner];
+
+					VertexPositionNormalTexture Vertex;
+					Vertex.position = FetchPosition(Corner.Position + int64_t((Corner.Flags & PositionRelative) ? Offset.Position : 0));
+					Vertex.textureCoordinate = (Corner.Flags & CornerHasTexCoord)
+						? FetchTexCoord(Corner.TexCoord + int64_t((Corner.Flags & TexCoordRelative) ? Offset.TexCoord : 0))
+						: XMFLOAT2(0.0f, 0.0f);
+					Vertex.normal = XMFLOAT3(0.0f, 0.0f, 0.0f);
+
+					if (Corner.Flags & CornerHasNormal)
+					{
+						Vertex.normal = FetchNormal(Corner.Normal + int64_t((Corner.Flags & NormalRelative) ? Offset.Normal : 0));
+					}
+					else
+					{
+						bNoNormal = true;
+					}
+
+					FaceVertices.push_back(Vertex);
+				}
+
+				// Faces without normals get the (unnormalized) face normal on every corner
+				if (bNoNormal && FaceVertices.size() >= 3)
+				{
+					const XMFLOAT3 FaceNormal = Cross(Subtract(FaceVertices[0].position, FaceVertices[1].position), Subtract(FaceVertices[2].position, FaceVertices[1].position));
+					for (VertexPositionNormalTexture& Vertex : FaceVertices)
+					{
+						Vertex.normal = FaceNormal;
+					}
+				}
+
+				Vertices.insert(Vertices.end(), FaceVertices.begin(), FaceVertices.end());
+				LoadedVertices.insert(LoadedVertices.end(), FaceVertices.begin(), FaceVertices.end());
+
+				FaceIndices.clear();
+				TriangulateFace(FaceVertices.data(), int(FaceVertices.size()), FaceIndices, TriangulationScratch);
+
+				const unsigned int MeshBase = static_cast<unsigned int>(Vertices.size() - FaceVertices.size());
+				const unsigned int LoadedBase = static_cast<unsigned int>(LoadedVertices.size() - FaceVertices.size());
+				for (unsigned int FaceIndex : FaceIndices)
+				{
+					Indices.push_back(MeshBase + FaceIndex);
+					LoadedIndices.push_back(LoadedBase + FaceIndex);
+				}
+				break;
+			}
+			case EStatement::UseMaterial:
+			{
+				MeshMaterialNames.push_back(CurrentStatement.Text.ToString());
+
+				// A material change within a group starts a new mesh
+				if (!Indices.empty() && !Vertices.empty())
+				{
+					PushMesh(MeshName + "_2");
+				}
+				break;
+			}
+			case EStatement::MaterialLibrary:
+			{
+				LoadMaterials(GetDirectory(Path) + DX::StringToWString(CurrentStatement.Text.ToString()));
+				break;
+			}
+			}
+		}
+	}
+
+	// Deal with last mesh
+	if (!Indices.empty() && !Vertices.empty())
+	{
+		PushMesh(MeshName);
+	}
+
+	// Set Materials for each Mesh
+	for (size_t i = 0; i < MeshMaterialNames.size() && i < LoadedMeshes.size(); ++i)
+	{
+		for (const Material& LoadedMaterial : LoadedMaterials)
+		{
+			if (LoadedMaterial.Name == MeshMaterialNames[i])
+			{
+				LoadedMeshes[i].MeshMaterial = LoadedMaterial;
+				break;
+			}
+		}
+	}
+
+	auto LoadEnd = std::chrono::steady_clock::now();
+	Stats.Bytes = File.GetSize();
+	Stats.Chunks = static_cast<unsigned int>(Chunks.size());
+	Stats.ParseSeconds = std::chrono::duration<double>(ParseEnd - LoadStart).count();
+	Stats.TotalSeconds = std::chrono::duration<double>(LoadEnd - LoadStart).count();
+
+	return !LoadedMeshes.empty() || !LoadedVertices.empty() || !LoadedIndices.empty();
+}
+
+bool objl::Loader::LoadMaterials(const std::wstring& Path)
+{
+	if (!EndsWith(Path, L".mtl"))
+	{
+		return false;
+	}
+
+	MappedFile File;
+	if (!File.Open(Path))
+	{
+		return false;
+	}
+
+	Material CurrentMaterial;
+	bool bListening = false;
+
+	const char* FileBegin = reinterpret_cast<const char*>(File.GetData());
+	ForEachLine(FileBegin, FileBegin + File.GetSize(), [&](TextView Line)
+	{
+		const TextView Token = FirstToken(Line);
+
+		if (Token == "newmtl")
+		{
+			if (bListening)
+			{
+				LoadedMaterials.push_back(CurrentMaterial);
+				CurrentMaterial = Material();
+			}
+			bListening = true;
+
+			CurrentMaterial.Name = (Line.End - Line.Begin) > 7 ? Tail(Line).ToString() : "none";
+		}
+		else if (Token == "Ka" || Token == "Kd" || Token == "Ks")
+		{
+			// Colors need exactly three components
+			TextView Cursor = Tail(Line);
+			TextView Component;
+			int ComponentCount = 0;
+			while (NextToken(Cursor, Component))
+			{
+				++ComponentCount;
+			}
+
+			if (ComponentCount == 3)
+			{
+				XMFLOAT3& Color = Token == "Ka" ? CurrentMaterial.Ka : (Token == "Kd" ? CurrentMaterial.Kd : CurrentMaterial.Ks);
+				ParseFloats(Line, &Color.x, 3);
+			}
+		}
+		else if (Token == "Ns" || Token == "Ni" || Token == "d")
+		{
+			float& Value = Token == "Ns" ? CurrentMaterial.Ns : (Token == "Ni" ? CurrentMaterial.Ni : CurrentMaterial.D);
+			ParseFloats(Line, &Value, 1);
+		}
+		else if (Token == "illum")
+		{
+			TextView Cursor = Tail(Line);
+			TextView Value;
+			if (NextToken(Cursor, Value))
+			{
+				ParseInt(Value, CurrentMaterial.Illum);
+			}
+		}
+		else if (Token == "map_Ka")
+		{
+			CurrentMaterial.Map_Ka = Tail(Line).ToString();
+		}
+		else if (Token == "map_Kd")
+		{
+			CurrentMaterial.Map_Kd = Tail(Line).ToString();
+		}
+		else if (Token == "map_Ks")
+		{
+			CurrentMaterial.Map_Ks = Tail(Line).ToString();
+		}
+		else if (Token == "map_Ns")
+		{
+			CurrentMaterial.Map_Ns = Tail(Line).ToString();
+		}
+		else if (Token == "map_d")
+		{
+			CurrentMaterial.Map_d = Tail(Line).ToString();
+		}
+		else if (Token == "map_Bump" || Token == "map_bump" || Token == "bump")
+		{
+			CurrentMaterial.Map_bump = Tail(Line).ToString();
+		}
+	});
+
+	// Deal with last material
+	LoadedMaterials.push_back(CurrentMaterial);
+
+	return true;
+}
@@ -0,0 +1,83 @@
+// ObjLoader.h - OBJ/MTL model loader
+//
+// Replaces the old single header loader : the file is memory mapped, tokenized in place and
+// parsed with std::from_chars, in parallel chunks that are merged once every chunk is done.
+// The produced meshes are the same as the ones the previous loader generated.
+
+#pragma once
+#include "Core/pch.h"
+#include "Mesh/Material.h"
+#include <string>
+#include <vector>
+
+namespace objl
+{
+	// Material as described in a .mtl file
+	struct Material
+	{
+		std::string Name;
+
+		DirectX::XMFLOAT3 Ka = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+		DirectX::XMFLOAT3 Kd = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+		DirectX::XMFLOAT3 Ks = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+		float Ns = 0.0f;
+		float Ni = 0.0f;
+		float D = 0.0f;
+		int Illum = 0;
+
+		std::string Map_Ka;
+		std::string Map_Kd;
+		std::string Map_Ks;
+		std::string Map_Ns;
+		std::string Map_d;
+		std::string Map_bump;
+
+		// Convert to the data used by the shaders
+		MaterialData ToMaterialData() const;
+	};
+
+	// A named list of vertices and indices using one material
+	struct Mesh
+	{
+		std::string MeshName;
+		std::vector<DirectX::VertexPositionNormalTexture> Vertices;
+		std::vector<DWORD> Indices;
+
+		Material MeshMaterial;
+	};
+
+	// Throughput of the last LoadFile call
+	struct LoadStats
+	{
+		size_t Bytes = 0;
+		size_t Lines = 0;
+		unsigned int Chunks = 0;
+		double ParseSeconds = 0.0;
+		double TotalSeconds = 0.0;
+
+		double GetMegaBytesPerSecond() const { return TotalSeconds > 0.0 ? Bytes / (1024.0 * 1024.0) / TotalSeconds : 0.0; }
+		double GetLinesPerSecond() const { return TotalSeconds > 0.0 ? Lines / TotalSeconds : 0.0; }
+	};
+
+	class Loader
+	{
+	public:
+		// Load an .obj file and the .mtl files it references, returns false if nothing could be loaded
+		bool LoadFile(const std::wstring& Path);
+		bool LoadFile(const std::string& Path);
+
+		// Loaded Mesh Objects
+		std::vector<Mesh> LoadedMeshes;
+		// Every vertex of every mesh
+		std::vector<DirectX::VertexPositionNormalTexture> LoadedVertices;
+		// Indices into LoadedVertices
+		std::vector<unsigned int> LoadedIndices;
+		// Loaded Material Objects
+		std::vector<Material> LoadedMaterials;
+
+		LoadStats Stats;
+
+	private:
+		bool LoadMaterials(const std::wstring& Path);
+	};
+}
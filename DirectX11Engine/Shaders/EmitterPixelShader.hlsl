@@ -0,0 +1,11 @@
+struct PS_INPUT
+{
+    float4 Pos : SV_POSITION;
+    float4 Color : COLOR;
+};
+
+// Light proxies are drawn in the colour of their light
+float4 main(PS_INPUT input) : SV_TARGET
+{
+    return float4(saturate(input.Color.rgb), 1.0f);
+}
@@ -0,0 +1,22 @@
+cbuffer cbPerFrame
+{
+	// View projection matrix, the world matrix comes with each instance
+    float4x4 ViewProj;
+};
+
+struct VS_OUTPUT
+{
+	float4 Pos : SV_POSITION;
+    float4 Color : COLOR;
+};
+
+// The position is the packed one of the mesh, InstanceWorld starts with its dequantization
+VS_OUTPUT main(float4 pos : POSITION, float4x4 InstanceWorld : INSTANCEWORLD, float4 InstanceColor : INSTANCECOLOR)
+{
+    VS_OUTPUT Output;
+
+    Output.Pos = mul(mul(pos, InstanceWorld), ViewProj);
+    Output.Color = InstanceColor;
+
+	return Output;
+}
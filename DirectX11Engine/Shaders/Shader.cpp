@@ -1,35 +1,38 @@
 #include "Shader.h"
+#include "ShaderCache.h"
 #include <d3dcompiler.h>
 
-Shader::Shader(LPCWSTR Path, EShaderType InShaderType, Microsoft::WRL::ComPtr<ID3D11Device> Device)
+Shader::Shader(LPCWSTR Path, EShaderType InShaderType, Microsoft::WRL::ComPtr<ID3D11Device> Device, const D3D_SHADER_MACRO* Defines)
 {
-	LPCSTR ShaderTypeString;
 	ShaderType = InShaderType;
 
-	switch (InShaderType)
-	{
-	case PixelShader:
-		ShaderTypeString = "ps_5_0";
-		break;
-	case VertexShader:
-		ShaderTypeString = "vs_5_0";
-		break;
-	default:
-		break;
-	}
-
-	
-	ID3DBlob* ShaderErrorMessage = nullptr;
-	HRESULT hr = D3DCompileFromFile(Path, nullptr, nullptr, "main", ShaderTypeString, 0, 0, ShaderBuffer.ReleaseAndGetAddressOf(), nullptr);
+	Microsoft::WRL::ComPtr<ID3DBlob> ShaderErrorMessage;
+	HRESULT hr = Compile(Path, InShaderType, Defines, ShaderBuffer.ReleaseAndGetAddressOf(), ShaderErrorMessage.GetAddressOf());
 	if (FAILED(hr))
 	{
-		const char* errorMsg = (const char*)ShaderErrorMessage->GetBufferPointer();
-		MessageBox(nullptr, (LPCWSTR)errorMsg, L"Shader Compilation Error", MB_RETRYCANCEL);
-		ShaderErrorMessage->Release();
+		const char* errorMsg = ShaderErrorMessage ? (const char*)ShaderErrorMessage->GetBufferPointer() : "Shader file not found";
+		MessageBoxA(nullptr, errorMsg, "Shader Compilation Error", MB_RETRYCANCEL);
+		DX::ThrowIfFailed(hr);
 	}
 
+	CreateShader(Device);
+}
+
+Shader::Shader(Microsoft::WRL::ComPtr<ID3DBlob> Bytecode, EShaderType InShaderType, Microsoft::WRL::ComPtr<ID3D11Device> Device)
+	: ShaderBuffer(Bytecode), ShaderType(InShaderType)
+{
+	CreateShader(Device);
+}
 
-	switch (InShaderType)
+HRESULT Shader::Compile(LPCWSTR Path, EShaderType InShaderType, const D3D_SHADER_MACRO* Defines, ID3DBlob** OutBytecode, ID3DBlob** OutErrors)
+{
+	LPCSTR ShaderTypeString = InShaderType == PixelShader ? "ps_5_0" : "vs_5_0";
+	return ShaderCache::CompileFromFile(Path, Defines, "main", ShaderTypeString, 0, OutBytecode, OutErrors);
+}
+
+void Shader::CreateShader(Microsoft::WRL::ComPtr<ID3D11Device> Device)
+{
+	switch (ShaderType)
 	{
 	case PixelShader:
 	{
@@ -48,13 +51,10 @@ Shader::Shader(LPCWSTR Path, EShaderType InShaderType, Microsoft::WRL::ComPtr<ID
 	default:
 		break;
 	}
-	
 }
 
 Shader::~Shader()
 {
-	ShaderBuffer->Release();
-	ShaderRef->Release();
 }
 
 Microsoft::WRL::ComPtr<ID3D11VertexShader> Shader::GetVertexShaderRef()
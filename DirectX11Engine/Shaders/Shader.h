@@ -7,13 +7,18 @@ enum EShaderType
 	VertexShader
 };
 
-// A helper class to compiler or use shaders
+// A helper class to compiler or use shaders, the bytecode comes from the ShaderCache when the source did not change
 class Shader
 {
 public:
-	Shader(LPCWSTR Path, EShaderType ShaderType, Microsoft::WRL::ComPtr<ID3D11Device> Device);
+	Shader(LPCWSTR Path, EShaderType ShaderType, Microsoft::WRL::ComPtr<ID3D11Device> Device, const D3D_SHADER_MACRO* Defines = nullptr);
+	// From bytecode compiled beforehand, by Compile
+	Shader(Microsoft::WRL::ComPtr<ID3DBlob> Bytecode, EShaderType ShaderType, Microsoft::WRL::ComPtr<ID3D11Device> Device);
 	~Shader();
 
+	// Compile or fetch from the ShaderCache without creating the shader, usable from any thread
+	static HRESULT Compile(LPCWSTR Path, EShaderType ShaderType, const D3D_SHADER_MACRO* Defines, ID3DBlob** OutBytecode, ID3DBlob** OutErrors);
+
 	Microsoft::WRL::ComPtr<ID3D11VertexShader> GetVertexShaderRef();
 	Microsoft::WRL::ComPtr<ID3D11PixelShader> GetPixelShaderRef();
 
@@ -21,4 +26,8 @@ public:
 	Microsoft::WRL::ComPtr<ID3D10Blob> ShaderBuffer;
 
 	EShaderType ShaderType;
+
+private:
+
+	void CreateShader(Microsoft::WRL::ComPtr<ID3D11Device> Device);
 };
\ No newline at end of file
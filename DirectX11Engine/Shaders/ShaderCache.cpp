@@ -0,0 +1,257 @@
+#include "Core/pch.h"
+#include "ShaderCache.h"
+#include "Core/Hash.h"
+#include "Core/MappedFile.h"
+#include <d3dcompiler.h>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	const uint32_t CacheMagic = 0x43534844; // "DHSC"
+	const uint32_t CacheVersion = 1;
+
+	struct CacheHeader
+	{
+		uint32_t Magic;
+		uint32_t Version;
+		uint64_t Key;
+		double CompileMs;
+		uint32_t IncludeCount;
+		uint32_t BytecodeSize;
+	};
+
+	// Followed by the path, in characters
+	struct CachedInclude
+	{
+		uint64_t ContentHash;
+		uint32_t PathLength;
+		uint32_t Padding;
+	};
+
+	struct IncludedFile
+	{
+		std::wstring Path;
+		uint64_t ContentHash;
+	};
+
+	std::mutex StatsMutex;
+	ShaderCache::Stats Counters;
+
+	// Resolves includes relative to the source folder and records every file it opens
+	class RecordingInclude : public ID3DInclude
+	{
+	public:
+		explicit RecordingInclude(const std::wstring& InFolder)
+			: Folder(InFolder)
+		{ }
+
+		HRESULT __stdcall Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR FileName, LPCVOID ParentData, LPCVOID* OutData, UINT* OutBytes) override
+		{
+			const std::wstring Path = Folder + DX::StringToWString(FileName);
+
+			MappedFile File;
+			if (!File.Open(Path))
+			{
+				return E_FAIL;
+			}
+
+			uint8_t* Data = new uint8_t[File.GetSize()];
+			memcpy(Data, File.GetData(), File.GetSize());
+			Included.push_back({ Path, Hash::HashBytes(Data, File.GetSize()) });
+
+			*OutData = Data;
+			*OutBytes = static_cast<UINT>(File.GetSize());
+			return S_OK;
+		}
+
+		HRESULT __stdcall Close(LPCVOID Data) override
+		{
+			delete[] static_cast<const uint8_t*>(Data);
+			return S_OK;
+		}
+
+		std::wstring Folder;
+		std::vector<IncludedFile> Included;
+	};
+
+	uint64_t ComputeKey(const MappedFile& Source, const std::wstring& Path, const D3D_SHADER_MACRO* Defines, const char* EntryPoint, const char* Profile, UINT Flags)
+	{
+		uint64_t Key = Hash::HashBytes(Source.GetData(), Source.GetSize());
+		Key = Hash::Combine(Key, Hash::HashString(Path));
+		Key = Hash::Combine(Key, Hash::HashBytes(EntryPoint, strlen(EntryPoint)));
+		Key = Hash::Combine(Key, Hash::HashBytes(Profile, strlen(Profile)));
+		for (const D3D_SHADER_MACRO* Define = Defines; Define && Define->Name; ++Define)
+		{
+			Key = Hash::Combine(Key, Hash::HashBytes(Define->Name, strlen(Define->Name)));
+			Key = Hash::Combine(Key, Define->Definition ? Hash::HashBytes(Define->Definition, strlen(Define->Definition)) : 0);
+		}
+		Key = Hash::Combine(Key, Flags);
+		Key = Hash::Combine(Key, D3D_COMPILER_VERSION);
+		Key = Hash::Combine(Key, CacheVersion);
+		return Key;
+	}
+
+	std::wstring GetCachePath(uint64_t Key)
+	{
+		CreateDirectoryW(L"Cache", nullptr);
+		CreateDirectoryW(L"Cache/Shaders", nullptr);
+
+		wchar_t FileName[64];
+		swprintf_s(FileName, L"Cache/Shaders/%016llx.cso", static_cast<unsigned long long>(Key));
+		return FileName;
+	}
+
+	// Returns the cached bytecode if the file matches the key and none of its includes changed
+	bool Load(const std::wstring& CachePath, uint64_t Key, ID3DBlob** OutBytecode, double& OutCompileMs)
+	{
+		MappedFile File;
+		if (!File.Open(CachePath) || File.GetSize() < sizeof(CacheHeader))
+		{
+			return false;
+		}
+
+		CacheHeader Header;
+		memcpy(&Header, File.GetData(), sizeof(Header));
+		if (Header.Magic != CacheMagic || Header.Version != CacheVersion || Header.Key != Key)
+		{
+			return false;
+		}
+
+		size_t Offset = sizeof(Header);
+		for (uint32_t iInclude = 0; iInclude < Header.IncludeCount; ++iInclude)
+		{
+			CachedInclude Include;
+			if (File.GetSize() - Offset < sizeof(Include))
+			{
+				return false;
+			}
+			memcpy(&Include, File.GetData() + Offset, sizeof(Include));
+			Offset += sizeof(Include);
+
+			const size_t PathBytes = size_t(Include.PathLength) * sizeof(wchar_t);
+			if (File.GetSize() - Offset < PathBytes)
+			{
+				return false;
+			}
+			std::wstring IncludePath(Include.PathLength, L'\0');
+			memcpy(&IncludePath[0], File.GetData() + Offset, PathBytes);
+			Offset += PathBytes;
+
+			MappedFile IncludeFile;
+			if (!IncludeFile.Open(IncludePath) || Hash::HashBytes(IncludeFile.GetData(), IncludeFile.GetSize()) != Include.ContentHash)
+			{
+				return false;
+			}
+		}
+
+		if (File.GetSize() - Offset != Header.BytecodeSize || FAILED(D3DCreateBlob(Header.BytecodeSize, OutBytecode)))
+		{
+			return false;
+		}
+
+		memcpy((*OutBytecode)->GetBufferPointer(), File.GetData() + Offset, Header.BytecodeSize);
+		OutCompileMs = Header.CompileMs;
+		return true;
+	}
+
+	bool Save(const std::wstring& CachePath, uint64_t Key, double CompileMs, const std::vector<IncludedFile>& Included, ID3DBlob* Bytecode)
+	{
+		// Write to a temporary file first so a crash never leaves a truncated cache behind
+		const std::wstring TempPath = CachePath + L".tmp";
+		{
+			std::ofstream Stream(TempPath, std::ios::binary | std::ios::trunc);
+			if (!Stream)
+			{
+				return false;
+			}
+
+			CacheHeader Header;
+			Header.Magic = CacheMagic;
+			Header.Version = CacheVersion;
+			Header.Key = Key;
+			Header.CompileMs = CompileMs;
+			Header.IncludeCount = static_cast<uint32_t>(Included.size());
+			Header.BytecodeSize = static_cast<uint32_t>(Bytecode->GetBufferSize());
+			Stream.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+
+			for (const IncludedFile& Include : Included)
+			{
+				CachedInclude CachedEntry = { Include.ContentHash, static_cast<uint32_t>(Include.Path.size()), 0 };
+				Stream.write(reinterpret_cast<const char*>(&CachedEntry), sizeof(CachedEntry));
+				Stream.write(reinterpret_cast<const char*>(Include.Path.data()), Include.Path.size() * sizeof(wchar_t));
+			}
+
+			Stream.write(static_cast<const char*>(Bytecode->GetBufferPointer()), Bytecode->GetBufferSize());
+			if (!Stream)
+			{
+				return false;
+			}
+		}
+
+		return MoveFileExW(TempPath.c_str(), CachePath.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+	}
+}
+
+HRESULT ShaderCache::CompileFromFile(const std::wstring& Path, const D3D_SHADER_MACRO* Defines, const char* EntryPoint, const char* Profile, UINT Flags,
+	ID3DBlob** OutBytecode, ID3DBlob** OutErrors)
+{
+	auto StartTime = std::chrono::steady_clock::now();
+
+	MappedFile Source;
+	if (!Source.Open(Path))
+	{
+		return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+	}
+
+	const uint64_t Key = ComputeKey(Source, Path, Defines, EntryPoint, Profile, Flags);
+	const std::wstring CachePath = GetCachePath(Key);
+
+	double CachedCompileMs = 0.0;
+	if (Load(CachePath, Key, OutBytecode, CachedCompileMs))
+	{
+		const double LoadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - StartTime).count();
+
+		std::lock_guard<std::mutex> Lock(StatsMutex);
+		++Counters.Hits;
+		Counters.LoadMs += LoadMs;
+		Counters.SavedMs += std::max(0.0, CachedCompileMs - LoadMs);
+		return S_OK;
+	}
+
+	wchar_t Drive[_MAX_DRIVE];
+	wchar_t Dir[_MAX_DIR];
+	_wsplitpath_s(Path.c_str(), Drive, _MAX_DRIVE, Dir, _MAX_DIR, nullptr, 0, nullptr, 0);
+	RecordingInclude Include(std::wstring(Drive) + Dir);
+
+	const std::string SourceName = DX::WStringToString(Path);
+	HRESULT Hr = D3DCompile(Source.GetData(), Source.GetSize(), SourceName.c_str(), Defines, &Include, EntryPoint, Profile, Flags, 0, OutBytecode, OutErrors);
+
+	const double CompileMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - StartTime).count();
+	{
+		std::lock_guard<std::mutex> Lock(StatsMutex);
+		++Counters.Misses;
+		Counters.CompileMs += CompileMs;
+	}
+
+	// Failed compiles are not cached, the errors have to show up again
+	if (SUCCEEDED(Hr))
+	{
+		Save(CachePath, Key, CompileMs, Include.Included, *OutBytecode);
+	}
+	return Hr;
+}
+
+ShaderCache::Stats ShaderCache::GetStats()
+{
+	std::lock_guard<std::mutex> Lock(StatsMutex);
+	return Counters;
+}
+
+void ShaderCache::ResetStats()
+{
+	std::lock_guard<std::mutex> Lock(StatsMutex);
+	Counters = Stats();
+}
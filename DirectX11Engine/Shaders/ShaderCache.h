@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include "Core/pch.h"
+
+// Compiled shader bytecode kept in Cache/Shaders.
+// A cache file is named after the hash of the source, defines, entry point, profile and flags,
+// and records the content hash of every file the source included, so that editing an include invalidates it too.
+namespace ShaderCache
+{
+	struct Stats
+	{
+		unsigned int Hits = 0;
+		unsigned int Misses = 0;
+		// Time spent compiling, and loading from the cache
+		double CompileMs = 0.0;
+		double LoadMs = 0.0;
+		// Compile time the hits would have cost, minus their load time
+		double SavedMs = 0.0;
+	};
+
+	// Same as D3DCompileFromFile, but returns the cached bytecode when the source and its includes did not change.
+	// Includes are resolved relative to the folder of the source file.
+	HRESULT CompileFromFile(const std::wstring& Path, const D3D_SHADER_MACRO* Defines, const char* EntryPoint, const char* Profile, UINT Flags,
+		ID3DBlob** OutBytecode, ID3DBlob** OutErrors);
+
+	// Counters since the start or the last reset, safe to call from any thread
+	Stats GetStats();
+	void ResetStats();
+}
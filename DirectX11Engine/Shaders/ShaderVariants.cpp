@@ -0,0 +1,120 @@
+#include "Core/pch.h"
+#include "ShaderVariants.h"
+#include "Core/ThreadPool.h"
+#include <chrono>
+
+using Microsoft::WRL::ComPtr;
+
+ShaderVariantSet::ShaderVariantSet(const std::wstring& Path, ComPtr<ID3D11Device> Device)
+{
+	auto BuildStart = std::chrono::steady_clock::now();
+
+	ComPtr<ID3DBlob> Bytecodes[VariantCount];
+	ComPtr<ID3DBlob> Errors[VariantCount];
+	HRESULT Results[VariantCount] = {};
+
+	ThreadPool::Get().ParallelFor(VariantCount, 1, [&](size_t Begin, size_t End)
+	{
+		for (size_t iVariant = Begin; iVariant < End; ++iVariant)
+		{
+			const ShaderVariantKey Key = GetKey(static_cast<unsigned int>(iVariant));
+			const std::string LightCount = std::to_string(Key.PointLightCount);
+
+			const D3D_SHADER_MACRO Defines[] =
+			{
+				{ "NORMAL_MAP", Key.bNormalMap ? "1" : "0" },
+				{ "SPECULAR_MAP", Key.bSpecularMap ? "1" : "0" },
+				{ "POINT_LIGHT_COUNT", LightCount.c_str() },
+				{ nullptr, nullptr }
+			};
+
+			Results[iVariant] = Shader::Compile(Path.c_str(), PixelShader, Defines, Bytecodes[iVariant].GetAddressOf(), Errors[iVariant].GetAddressOf());
+		}
+	});
+
+	// Shaders are created and errors reported from the calling thread
+	for (unsigned int iVariant = 0; iVariant < VariantCount; ++iVariant)
+	{
+		if (FAILED(Results[iVariant]))
+		{
+			const char* ErrorMessage = Errors[iVariant] ? static_cast<const char*>(Errors[iVariant]->GetBufferPointer()) : "Shader file not found";
+			MessageBoxA(nullptr, ErrorMessage, "Shader Compilation Error", MB_RETRYCANCEL);
+			DX::ThrowIfFailed(Results[iVariant]);
+		}
+
+		Variants[iVariant] = new Shader(Bytecodes[iVariant], PixelShader, Device);
+	}
+
+	BuildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - BuildStart).count();
+}
+
+ShaderVariantSet::~ShaderVariantSet()
+{
+	for (Shader* Variant : Variants)
+	{
+		delete Variant;
+	}
+}
+
+ShaderVariantKey ShaderVariantSet::Select(bool bHasNormalMap, bool bHasSpecularMap, unsigned int AffectingLights)
+{
+	ShaderVariantKey Key;
+	Key.bNormalMap = bHasNormalMap;
+	Key.bSpecularMap = bHasSpecularMap;
+	Key.PointLightCount = std::min<unsigned int>(AffectingLights, MAX_LIGHTS);
+	return Key;
+}
+
+unsigned int ShaderVariantSet::GetIndex(const ShaderVariantKey& Key)
+{
+	const unsigned int Features = (Key.bNormalMap ? 1 : 0) | (Key.bSpecularMap ? 2 : 0);
+	return std::min<unsigned int>(Key.PointLightCount, MAX_LIGHTS) * 4 + Features;
+}
+
+ShaderVariantKey ShaderVariantSet::GetKey(unsigned int Index)
+{
+	ShaderVariantKey Key;
+	Key.bNormalMap = (Index & 1) != 0;
+	Key.bSpecularMap = (Index & 2) != 0;
+	Key.PointLightCount = Index / 4;
+	return Key;
+}
+
+bool ShaderVariantSet::RunSelfTest()
+{
+	// Every index maps to a key that maps back to it
+	for (unsigned int iVariant = 0; iVariant < VariantCount; ++iVariant)
+	{
+		const ShaderVariantKey Key = GetKey(iVariant);
+		if (Key.PointLightCount > MAX_LIGHTS || GetIndex(Key) != iVariant || !(GetKey(GetIndex(Key)) == Key))
+		{
+			return false;
+		}
+	}
+
+	for (unsigned int Lights : { 0u, 1u, unsigned(MAX_LIGHTS), unsigned(MAX_LIGHTS) + 1, 1000u })
+	{
+		// Each combination of textures gets its own variant for the same lights
+		bool bIndexUsed[VariantCount] = {};
+		for (unsigned int Features = 0; Features < 4; ++Features)
+		{
+			const bool bNormalMap = (Features & 1) != 0;
+			const bool bSpecularMap = (Features & 2) != 0;
+			const ShaderVariantKey Key = Select(bNormalMap, bSpecularMap, Lights);
+
+			// Lights past MAX_LIGHTS are clamped, no lights is a variant of its own
+			if (Key.bNormalMap != bNormalMap || Key.bSpecularMap != bSpecularMap || Key.PointLightCount != std::min<unsigned int>(Lights, MAX_LIGHTS))
+			{
+				return false;
+			}
+
+			const unsigned int Index = GetIndex(Key);
+			if (Index >= VariantCount || bIndexUsed[Index] || !(GetKey(Index) == Key))
+			{
+				return false;
+			}
+			bIndexUsed[Index] = true;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <string>
+#include "Shader.h"
+
+// Features compiled in or out of a variant, through the NORMAL_MAP, SPECULAR_MAP and POINT_LIGHT_COUNT defines
+struct ShaderVariantKey
+{
+	bool bNormalMap = false;
+	bool bSpecularMap = false;
+	// Point lights applied, the loop is unrolled for this count
+	unsigned int PointLightCount = 0;
+
+	bool operator==(const ShaderVariantKey& Other) const
+	{
+		return bNormalMap == Other.bNormalMap && bSpecularMap == Other.bSpecularMap && PointLightCount == Other.PointLightCount;
+	}
+};
+
+// Every variant of a pixel shader, compiled up front.
+// Variants are compiled on the thread pool, through the ShaderCache, then created on the calling thread.
+class ShaderVariantSet
+{
+public:
+
+	static constexpr unsigned int VariantCount = 2 * 2 * (MAX_LIGHTS + 1);
+
+	ShaderVariantSet(const std::wstring& Path, Microsoft::WRL::ComPtr<ID3D11Device> Device);
+	~ShaderVariantSet();
+
+	ShaderVariantSet(const ShaderVariantSet&) = delete;
+	ShaderVariantSet& operator=(const ShaderVariantSet&) = delete;
+
+	Shader* Get(const ShaderVariantKey& Key) const { return Variants[GetIndex(Key)]; }
+
+	// The cheapest variant rendering a mesh with these textures and lights
+	static ShaderVariantKey Select(bool bHasNormalMap, bool bHasSpecularMap, unsigned int AffectingLights);
+
+	// Variants are stored in [0, VariantCount)
+	static unsigned int GetIndex(const ShaderVariantKey& Key);
+	static ShaderVariantKey GetKey(unsigned int Index);
+
+	// Checks the selection and the mapping between keys and indices, a wrong mapping silently draws with another variant
+	static bool RunSelfTest();
+
+	double GetBuildMs() const { return BuildMs; }
+
+private:
+
+	Shader* Variants[VariantCount] = {};
+	double BuildMs = 0.0;
+};
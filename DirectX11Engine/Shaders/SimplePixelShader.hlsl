@@ -1,3 +1,14 @@
+// Variants, see ShaderVariants.h. Without defines the shader has every feature
+#ifndef NORMAL_MAP
+#define NORMAL_MAP 1
+#endif
+#ifndef SPECULAR_MAP
+#define SPECULAR_MAP 1
+#endif
+#ifndef POINT_LIGHT_COUNT
+#define POINT_LIGHT_COUNT 5
+#endif
+
 Texture2D Texture       : register(t0);
 Texture2D NormalMap     : register(t1);
 Texture2D SpecularMap   : register(t2);
@@ -43,6 +54,8 @@ cbuffer cbPerObject
 {
     // The directional light of our scene
     Material CurrentMaterial;
+    // Indices in Lights of the point lights reaching the object, 4 per element
+    uint4 LightIndices[2];
 };
 
 struct PS_INPUT
@@ -61,10 +74,10 @@ float3 AmbientLighting(float4 LightAmbient)
     return /*CurrentMaterial.AmbientColor **/ LightAmbient;
 }
 
-float3 DiffuseLighting(float3 N, float3 L, float4 LightDiffuse, float2 TexCoord)
+float3 DiffuseLighting(float3 N, float3 L, float4 LightDiffuse, float4 TextureColor)
 {
     float DiffuseTerm = saturate(dot(N, L));
-	return Texture.Sample(ObjectSamplerState, TexCoord) * LightDiffuse * DiffuseTerm;
+	return TextureColor * LightDiffuse * DiffuseTerm;
 }
 
 float3 SpecularLighting(float3 N, float3 L, float3 V, float4 LightSpecular, float SpecularMapValue)
@@ -79,29 +92,31 @@ float3 SpecularLighting(float3 N, float3 L, float3 V, float4 LightSpecular, floa
         SpecularTerm = pow(clamp(dot(N, H), 0, 1), CurrentMaterial.SpecExponent);
     }
     
-    return LightSpecular * SpecularTerm /** SpecularMapValue*/;
+    return LightSpecular * SpecularTerm * SpecularMapValue;
 }
 
-float3 CalculateDirectional(DirectionalLight Light, float3 Normal, float3 ViewDir, float2 TexCoord, float SpecularMapValue)
+float3 CalculateDirectional(DirectionalLight Light, float3 Normal, float3 ViewDir, float4 TextureColor, float SpecularMapValue)
 { 
     float3 LightDir = normalize(-Light.Dir);
     
     float3 Ambient = AmbientLighting(Light.Ambient);
-    float3 Diffuse = DiffuseLighting(Normal, LightDir, Light.Diffuse, TexCoord);
+    float3 Diffuse = DiffuseLighting(Normal, LightDir, Light.Diffuse, TextureColor);
     float3 Specular = SpecularLighting(Normal, LightDir, ViewDir, Light.Specular, SpecularMapValue);
     
     return Ambient + Diffuse + Specular;
 }
 
-float3 CalculatePointLight(PointLight Light, float3 WorldPosition, float3 Normal, float3 ViewDir, float2 TexCoord, float SpecularMapValue)
+float3 CalculatePointLight(PointLight Light, float3 WorldPosition, float3 Normal, float3 ViewDir, float4 TextureColor, float SpecularMapValue)
 {
     float3 LightDir = normalize(Light.Position - WorldPosition);
     float Distance = length(Light.Position - WorldPosition);
     float Attenuation = 1.0 / (Light.Attenuation.x + Light.Attenuation.y * Distance + Light.Attenuation.z * (Distance * Distance));
+    // Lights are only assigned to the objects within their range
+    Attenuation *= Distance < Light.Range ? 1.0f : 0.0f;
 
     
     float3 Ambient = AmbientLighting(Light.Ambient) * Attenuation;
-    float3 Diffuse = DiffuseLighting(Normal, LightDir, Light.Diffuse, TexCoord) * Attenuation;
+    float3 Diffuse = DiffuseLighting(Normal, LightDir, Light.Diffuse, TextureColor) * Attenuation;
     float3 Specular = SpecularLighting(Normal, LightDir, ViewDir, Light.Specular, SpecularMapValue) * Attenuation;
     
     return Ambient + Diffuse + Specular;
@@ -112,25 +127,33 @@ float4 main(PS_INPUT input) : SV_TARGET
     float3 V = normalize(CamPosition - input.WorldPos.xyz);
 
     float4 TextureColor = Texture.Sample(ObjectSamplerState, input.TexCoord);
-    float SpecularMapValue = SpecularMap.Sample(ObjectSamplerState, input.TexCoord).x;  
+
+#if SPECULAR_MAP
+    float SpecularMapValue = SpecularMap.Sample(ObjectSamplerState, input.TexCoord).x;
+#else
+    float SpecularMapValue = 1.0f;
+#endif
     
+#if NORMAL_MAP
     // Normal mapping
-    float4 BumpMap = NormalMap.Sample(ObjectSamplerState, input.TexCoord);
-    BumpMap = (BumpMap * 2.0f) - 1.0f;
-    float3 BumpNormal = (BumpMap.x * input.Tangent) + (BumpMap.y * input.Binormal) + (BumpMap.z * input.Normal);
+    // Only xy is stored by cooked BC5 normal maps, z is rebuilt
+    float2 BumpXY = NormalMap.Sample(ObjectSamplerState, input.TexCoord).xy * 2.0f - 1.0f;
+    float BumpZ = sqrt(saturate(1.0f - dot(BumpXY, BumpXY)));
+    float3 BumpNormal = (BumpXY.x * input.Tangent) + (BumpXY.y * input.Binormal) + (BumpZ * input.Normal);
     BumpNormal = normalize(BumpNormal);
-    
-    // Uncomment to see without bumpmapping
-    BumpNormal = normalize(input.Normal);
+#else
+    float3 BumpNormal = normalize(input.Normal);
+#endif
     
     //if (TextureColor.a < 0.01)
     //    discard;
     
-    float3 FinalColor = TextureColor * CalculateDirectional(Sun, BumpNormal, V, input.TexCoord, SpecularMapValue);
+    float3 FinalColor = TextureColor * CalculateDirectional(Sun, BumpNormal, V, TextureColor, SpecularMapValue);
     
-    for (int i = 0; i < LightsCount; i++)
+    [unroll]
+    for (uint i = 0; i < POINT_LIGHT_COUNT; i++)
     {
-        FinalColor += TextureColor * CalculatePointLight(Lights[i], input.WorldPos.xyz, BumpNormal, V, input.TexCoord, SpecularMapValue);
+        FinalColor += TextureColor * CalculatePointLight(Lights[LightIndices[i / 4][i % 4]], input.WorldPos.xyz, BumpNormal, V, TextureColor, SpecularMapValue);
     }
     
     return float4(saturate(FinalColor), 1.0f);
@@ -3,6 +3,9 @@ cbuffer cbPerObject
 	// pre multiplied world view projection matrix
     float4x4 WorldViewProj;
     float4x4 WorldMatrix;
+    // Positions are quantized in the mesh bounds : local position = position * PositionScale + PositionOffset
+    float4 PositionScale;
+    float4 PositionOffset;
 };
 
 struct VS_OUTPUT
@@ -16,9 +19,16 @@ struct VS_OUTPUT
     float2 ReturnTex : RETTEX;
 };
 
-VS_OUTPUT main( float4 pos : POSITION, float3 Normal : NORMAL, float3 Tangent : TANGENT, float3 Binormal : BINORMAL, float2 TexCoord : TEXCOORD )
+VS_OUTPUT main( float4 PackedPos : POSITION, float4 QTangent : QTANGENT, float2 TexCoord : TEXCOORD )
 {
     VS_OUTPUT Output;
+
+    // Unpack the vertex, the frame is the first and last rows of the QTangent rotation and the sign of w is the binormal side
+    float4 pos = float4(PackedPos.xyz * PositionScale.xyz + PositionOffset.xyz, 1.0f);
+    float4 Q = normalize(QTangent);
+    float3 Tangent = float3(1.0f - 2.0f * (Q.y * Q.y + Q.z * Q.z), 2.0f * (Q.x * Q.y + Q.z * Q.w), 2.0f * (Q.x * Q.z - Q.y * Q.w));
+    float3 Normal = float3(2.0f * (Q.x * Q.z + Q.y * Q.w), 2.0f * (Q.y * Q.z - Q.x * Q.w), 1.0f - 2.0f * (Q.x * Q.x + Q.y * Q.y));
+    float3 Binormal = cross(Normal, Tangent) * (QTangent.w < 0.0f ? -1.0f : 1.0f);
 	
     Output.Pos = mul(pos, WorldViewProj);
     